@@ -63,6 +63,10 @@ using HTTP_CLIENT = java_wrapper::HTTPClientPlatformWrapper;
 #error "No implementation for `net/api/api.h` is available for your system."
 #endif
 
+#ifdef CURRENT_POSIX
+#include "impl/async_client.h"
+#endif
+
 using HTTP_IMPL = current::http::HTTPImpl<HTTP_CLIENT, CHUNKED_HTTP_CLIENT, current::http::HTTPServerPOSIX>;
 
 namespace current {
@@ -73,10 +77,21 @@ inline typename current::weed::call_with_type<HTTP_IMPL, TS...> HTTP(TS&&... par
   return current::Singleton<HTTP_IMPL>()(std::forward<TS>(params)...);
 }
 
+#ifdef CURRENT_POSIX
+// `AsyncHTTP(GET(url))` returns the future of the response, `AsyncHTTP(GET(url), on_response, on_error)` calls back.
+template <typename... TS>
+inline auto AsyncHTTP(TS&&... params) -> decltype(std::declval<HTTPAsyncClient&>()(std::forward<TS>(params)...)) {
+  return current::Singleton<HTTPAsyncClient>()(std::forward<TS>(params)...);
+}
+#endif  // CURRENT_POSIX
+
 }  // namespace http
 }  // namespace current
 
 using current::http::HTTP;
+#ifdef CURRENT_POSIX
+using current::http::AsyncHTTP;
+#endif
 using current::http::Request;
 using current::http::Response;
 using current::http::ReRegisterRoute;
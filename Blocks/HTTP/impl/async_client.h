@@ -0,0 +1,692 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The asynchronous HTTP client behind `AsyncHTTP()`, see `api.h`.
+//
+// `AsyncHTTP(GET(url))`, as well as `AsyncHTTP(POST(url, body))` and the rest, returns an `std::future<>` of the
+// response, and `AsyncHTTP(GET(url), on_response, on_error)` calls back instead. `AsyncHTTP(ChunkedGET(...))` passes
+// the chunks to the callbacks of `ChunkedGET` as they arrive, and throwing from these callbacks aborts the request.
+//
+// All the requests in flight are driven by a single `epoll`-based thread, which connects, sends the requests and
+// receives the responses without blocking, so that a thousand outstanding requests cost a thousand sockets, not
+// a thousand threads. The callbacks are called from that thread: they should not block, and may issue more requests.
+// The host names are resolved on the calling thread. Each request uses a connection of its own.
+
+#ifndef BLOCKS_HTTP_IMPL_ASYNC_CLIENT_H
+#define BLOCKS_HTTP_IMPL_ASYNC_CLIENT_H
+
+#include "../../../port.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../types.h"
+
+#include "../../URL/url.h"
+
+#include "../../../Bricks/file/file.h"
+#include "../../../Bricks/net/exceptions.h"
+#include "../../../Bricks/net/http/http.h"
+#include "../../../Bricks/strings/join.h"
+#include "../../../Bricks/strings/split.h"
+#include "../../../Bricks/strings/util.h"
+
+#ifdef CURRENT_POSIX
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../../../Bricks/net/tcp/tcp.h"
+
+#endif  // CURRENT_POSIX
+
+namespace current {
+namespace http {
+
+struct HTTPMalformedResponseException : current::net::HTTPException {
+  using current::net::HTTPException::HTTPException;
+};
+
+struct AsyncHTTPClientStoppedException : current::net::HTTPException {
+  using current::net::HTTPException::HTTPException;
+};
+
+// The request to send, as composed from `GET`, `POST`, etc.
+struct AsyncHTTPRequest {
+  std::string method;
+  std::string url;
+  std::string body;
+  std::string content_type;
+  std::string user_agent;
+  current::net::http::Headers headers;
+  bool allow_redirects = false;
+
+  // The same bytes as `HTTPClientPOSIX` sends.
+  std::string Compose(const URL& parsed_url) const {
+    std::string result = method + ' ' + parsed_url.path + parsed_url.ComposeParameters() + " HTTP/1.1\r\n";
+    result += "Host: " + parsed_url.host + "\r\n";
+    if (!user_agent.empty()) {
+      result += "User-Agent: " + user_agent + "\r\n";
+    }
+    for (const auto& h : headers) {
+      result += h.header + ": " + h.value + "\r\n";
+    }
+    if (!headers.cookies.empty()) {
+      result += "Cookie: " + headers.CookiesAsString() + "\r\n";
+    }
+    if (!content_type.empty()) {
+      result += "Content-Type: " + content_type + "\r\n";
+    }
+    if (!body.empty()) {
+      result += "Content-Length: " + std::to_string(body.length()) + "\r\n";
+    }
+    result += "\r\n";
+    result += body;
+    return result;
+  }
+};
+
+namespace impl {
+
+template <typename T>
+AsyncHTTPRequest ComposeAsyncHTTPRequest(const char* method, const HTTPRequestBase<T>& request) {
+  AsyncHTTPRequest result;
+  result.method = method;
+  result.url = request.url;
+  result.user_agent = request.custom_user_agent;
+  result.headers = request.custom_headers;
+  result.allow_redirects = request.allow_redirects;
+  return result;
+}
+
+template <typename T>
+AsyncHTTPRequest ComposeAsyncHTTPRequestWithBody(const char* method, const T& request) {
+  AsyncHTTPRequest result = ComposeAsyncHTTPRequest(method, request);
+  result.body = request.body;
+  result.content_type = request.content_type;
+  return result;
+}
+
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const GET& request) { return ComposeAsyncHTTPRequest("GET", request); }
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const HEAD& request) {
+  return ComposeAsyncHTTPRequest("HEAD", request);
+}
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const DELETE& request) {
+  return ComposeAsyncHTTPRequest("DELETE", request);
+}
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const POST& request) {
+  return ComposeAsyncHTTPRequestWithBody("POST", request);
+}
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const PUT& request) {
+  return ComposeAsyncHTTPRequestWithBody("PUT", request);
+}
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const PATCH& request) {
+  return ComposeAsyncHTTPRequestWithBody("PATCH", request);
+}
+inline AsyncHTTPRequest ComposeAsyncHTTPRequest(const POSTFromFile& request) {
+  AsyncHTTPRequest result = ComposeAsyncHTTPRequest("POST", request);
+  result.body = current::FileSystem::ReadFileAsString(request.file_name);  // Can throw `FileException`.
+  result.content_type = request.content_type;
+  return result;
+}
+
+}  // namespace current::http::impl
+
+// Parses the HTTP response as its bytes arrive. The body is either kept, or passed on to `on_body` piece by piece:
+// chunk by chunk if it is chunk-encoded, or as it is received otherwise.
+class IncomingHTTPResponse final {
+ public:
+  enum : size_t { kMaxHeaderBytes = 64 * 1024 };
+
+  using header_callback_t = std::function<void(const std::string&, const std::string&)>;
+  using body_callback_t = std::function<void(const std::string&)>;
+
+  explicit IncomingHTTPResponse(bool no_body = false,
+                                header_callback_t on_header = nullptr,
+                                body_callback_t on_body = nullptr)
+      : no_body_(no_body), on_header_(on_header), on_body_(on_body) {}
+
+  // Returns `true` once the response has been received in full.
+  bool Append(const char* data, size_t size) {
+    buffer_.append(data, size);
+    const bool done = Parse();
+    if (offset_ == buffer_.length()) {
+      buffer_.clear();
+      offset_ = 0u;
+    } else if (state_ != State::Headers && offset_ >= kMaxHeaderBytes) {
+      buffer_.erase(0u, offset_);
+      offset_ = 0u;
+    }
+    return done;
+  }
+
+  // To be called once the server has closed the connection. Returns `true` if the response is complete.
+  bool Closed() {
+    if (state_ == State::UntilClosed) {
+      state_ = State::Done;
+    }
+    return state_ == State::Done;
+  }
+
+  int Code() const { return code_; }
+  const current::net::http::Headers& headers() const { return headers_; }
+  std::string& MutableBody() { return body_; }
+
+ private:
+  enum class State { Headers, Body, UntilClosed, ChunkSize, ChunkData, Trailers, Done };
+
+  bool Parse() {
+    while (true) {
+      const size_t available = buffer_.length() - offset_;
+      if (state_ == State::Headers) {
+        const size_t blank_line = buffer_.find("\r\n\r\n", scanned_ > 3u ? scanned_ - 3u : 0u);
+        scanned_ = buffer_.length();
+        if (blank_line == std::string::npos) {
+          if (buffer_.length() > kMaxHeaderBytes) {
+            CURRENT_THROW(HTTPMalformedResponseException("The HTTP response headers are too long."));
+          }
+          return false;
+        }
+        ParseHeaders(blank_line);
+        offset_ = blank_line + 4u;
+      } else if (state_ == State::Body) {
+        const size_t size = std::min(available, remaining_);
+        PassBody(size);
+        remaining_ -= size;
+        if (remaining_) {
+          return false;
+        }
+        state_ = State::Done;
+      } else if (state_ == State::UntilClosed) {
+        PassBody(available);
+        return false;
+      } else if (state_ == State::ChunkSize || state_ == State::Trailers) {
+        const size_t crlf = buffer_.find("\r\n", offset_);
+        if (crlf == std::string::npos) {
+          if (available > kMaxHeaderBytes) {
+            CURRENT_THROW(HTTPMalformedResponseException("The HTTP response chunk header is too long."));
+          }
+          return false;
+        }
+        const std::string line = buffer_.substr(offset_, crlf - offset_);
+        offset_ = crlf + 2u;
+        if (state_ == State::Trailers) {
+          if (line.empty()) {
+            state_ = State::Done;
+          }
+        } else {
+          char* end;
+          remaining_ = static_cast<size_t>(std::strtoull(line.c_str(), &end, 16));
+          if (end == line.c_str()) {
+            CURRENT_THROW(current::net::ChunkSizeNotAValidHEXValue());
+          }
+          state_ = remaining_ ? State::ChunkData : State::Trailers;
+        }
+      } else if (state_ == State::ChunkData) {
+        // The chunk is passed on as a whole, once it has been received along with its trailing CRLF.
+        if (available < remaining_ + 2u) {
+          return false;
+        }
+        PassBody(remaining_);
+        offset_ += 2u;
+        state_ = State::ChunkSize;
+      } else {
+        return true;
+      }
+    }
+  }
+
+  void ParseHeaders(size_t blank_line) {
+    size_t line_end = buffer_.find("\r\n");
+    const std::vector<std::string> status =
+        current::strings::Split<current::strings::ByWhitespace>(buffer_.substr(0u, line_end));
+    if (status.size() < 2u || status[0].compare(0u, 5u, "HTTP/") != 0) {
+      CURRENT_THROW(HTTPMalformedResponseException("Not an HTTP response: `" + buffer_.substr(0u, line_end) + "`."));
+    }
+    code_ = std::atoi(status[1].c_str());
+    bool chunked = false;
+    size_t content_length = static_cast<size_t>(-1);
+    while (line_end < blank_line) {
+      const size_t line_begin = line_end + 2u;
+      line_end = buffer_.find("\r\n", line_begin);
+      const size_t colon = buffer_.find(':', line_begin);
+      if (colon < line_end) {
+        const std::string key = current::strings::Trim(buffer_.substr(line_begin, colon - line_begin));
+        const std::string value = current::strings::Trim(buffer_.substr(colon + 1u, line_end - colon - 1u));
+        const std::string lowercase_key = current::strings::ToLower(key);
+        if (lowercase_key == "content-length") {
+          content_length = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        } else if (lowercase_key == "transfer-encoding" && current::strings::ToLower(value) == "chunked") {
+          chunked = true;
+        }
+        headers_.SetHeaderOrCookie(key, value);
+        if (on_header_) {
+          on_header_(key, value);
+        }
+      }
+    }
+    if (no_body_ || (code_ >= 100 && code_ < 200) || code_ == 204 || code_ == 304) {
+      state_ = State::Done;
+    } else if (chunked) {
+      state_ = State::ChunkSize;
+    } else if (content_length != static_cast<size_t>(-1)) {
+      remaining_ = content_length;
+      state_ = State::Body;
+    } else {
+      state_ = State::UntilClosed;
+    }
+  }
+
+  void PassBody(size_t size) {
+    if (size) {
+      if (on_body_) {
+        on_body_(buffer_.substr(offset_, size));
+      } else {
+        body_.append(buffer_, offset_, size);
+      }
+      offset_ += size;
+    }
+  }
+
+  const bool no_body_;
+  const header_callback_t on_header_;
+  const body_callback_t on_body_;
+
+  std::string buffer_;
+  size_t offset_ = 0u;   // The bytes of `buffer_` before `offset_` have been parsed.
+  size_t scanned_ = 0u;  // The bytes of `buffer_` searched for the end of the headers.
+  State state_ = State::Headers;
+  size_t remaining_ = 0u;  // The bytes of the body, or of the chunk, yet to receive.
+
+  int code_ = 0;
+  current::net::http::Headers headers_;
+  std::string body_;
+};
+
+#ifdef CURRENT_POSIX
+
+struct HTTPAsyncClientStats {
+  size_t outstanding = 0u;  // The number of requests in flight now.
+  uint64_t completed = 0u;  // The number of responses received.
+  uint64_t failed = 0u;     // The number of requests failed.
+};
+
+class HTTPAsyncClient final {
+ public:
+  using response_callback_t = std::function<void(HTTPResponseWithBuffer&&)>;
+  using chunked_response_callback_t = std::function<void(current::net::HTTPResponseCodeValue)>;
+  using error_callback_t = std::function<void(std::exception_ptr)>;
+
+  HTTPAsyncClient()
+      : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
+        wakeup_fd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+        terminating_(false),
+        completed_(0u),
+        failed_(0u) {
+    if (epoll_fd_ < 0 || wakeup_fd_ < 0) {
+      CURRENT_THROW(current::net::SocketCreateException());  // LCOV_EXCL_LINE
+    }
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wakeup_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event)) {
+      CURRENT_THROW(current::net::SocketCreateException());  // LCOV_EXCL_LINE
+    }
+    thread_ = std::thread(&HTTPAsyncClient::Thread, this);
+  }
+
+  // The requests still in flight fail with `AsyncHTTPClientStoppedException`.
+  ~HTTPAsyncClient() {
+    terminating_ = true;
+    const uint64_t one = 1u;
+    if (::write(wakeup_fd_, &one, sizeof(one)) != sizeof(one)) {
+      std::cerr << "HTTP async client: could not wake up the thread.\n";  // LCOV_EXCL_LINE
+    }
+    thread_.join();
+    std::map<int, std::unique_ptr<Transfer>> transfers;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      transfers.swap(transfers_);
+    }
+    for (auto& transfer : transfers) {
+      Fail(*transfer.second, std::make_exception_ptr(AsyncHTTPClientStoppedException()));
+    }
+    ::close(wakeup_fd_);
+    ::close(epoll_fd_);
+  }
+
+  template <typename REQUEST>
+  void operator()(const REQUEST& request, response_callback_t on_response, error_callback_t on_error) {
+    std::unique_ptr<Transfer> transfer = std::make_unique<Transfer>(on_error);
+    transfer->request = impl::ComposeAsyncHTTPRequest(request);
+    transfer->response_url = request.url;
+    transfer->on_success = [on_response](Transfer& done) {
+      HTTPResponseWithBuffer response;
+      response.url = done.response_url;
+      response.code = HTTPResponseCode(done.response->Code());
+      response.headers = done.response->headers();
+      response.body = std::move(done.response->MutableBody());
+      CallResponseCallback([&]() { on_response(std::move(response)); });
+    };
+    Start(std::move(transfer));
+  }
+
+  template <typename REQUEST>
+  std::future<HTTPResponseWithBuffer> operator()(const REQUEST& request) {
+    auto promise = std::make_shared<std::promise<HTTPResponseWithBuffer>>();
+    std::future<HTTPResponseWithBuffer> future = promise->get_future();
+    operator()(request,
+               [promise](HTTPResponseWithBuffer&& response) { promise->set_value(std::move(response)); },
+               [promise](std::exception_ptr e) { promise->set_exception(e); });
+    return future;
+  }
+
+  // Calls the `done_callback` of the `ChunkedGET` and then `on_response` once the last chunk has been received.
+  void operator()(const ChunkedGET& request, chunked_response_callback_t on_response, error_callback_t on_error) {
+    std::unique_ptr<Transfer> transfer = std::make_unique<Transfer>(on_error);
+    transfer->request.method = "GET";
+    transfer->request.url = request.url;
+    transfer->response_url = request.url;
+    transfer->on_header = request.header_callback;
+    transfer->on_body = request.chunk_callback;
+    const std::function<void()> done_callback = request.done_callback;
+    transfer->on_success = [done_callback, on_response](Transfer& done) {
+      done_callback();
+      CallResponseCallback([&]() { on_response(HTTPResponseCode(done.response->Code())); });
+    };
+    Start(std::move(transfer));
+  }
+
+  std::future<current::net::HTTPResponseCodeValue> operator()(const ChunkedGET& request) {
+    auto promise = std::make_shared<std::promise<current::net::HTTPResponseCodeValue>>();
+    std::future<current::net::HTTPResponseCodeValue> future = promise->get_future();
+    operator()(request,
+               [promise](current::net::HTTPResponseCodeValue code) { promise->set_value(code); },
+               [promise](std::exception_ptr e) { promise->set_exception(e); });
+    return future;
+  }
+
+  HTTPAsyncClientStats Stats() const {
+    HTTPAsyncClientStats stats;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stats.outstanding = transfers_.size();
+    }
+    stats.completed = completed_;
+    stats.failed = failed_;
+    return stats;
+  }
+
+ private:
+  struct Transfer final {
+    AsyncHTTPRequest request;
+    std::string response_url;
+    std::set<std::string> visited_urls;
+    IncomingHTTPResponse::header_callback_t on_header;
+    IncomingHTTPResponse::body_callback_t on_body;
+    std::function<void(Transfer&)> on_success;
+    const error_callback_t on_error;
+
+    // The state of the current connection, reset on redirect.
+    std::unique_ptr<current::net::SocketHandle> socket;
+    std::unique_ptr<IncomingHTTPResponse> response;
+    std::string outgoing;
+    size_t sent = 0u;
+    bool connected = false;
+
+    explicit Transfer(error_callback_t on_error) : on_error(on_error) {}
+  };
+
+  // Connects to the host of `transfer->response_url` and has the thread of the client take it from there.
+  void Start(std::unique_ptr<Transfer> transfer) {
+    int fd;
+    try {
+      const URL parsed_url(transfer->response_url);
+      const std::string composed_url = parsed_url.ComposeURL();
+      if (transfer->visited_urls.count(composed_url)) {
+        CURRENT_THROW(current::net::HTTPRedirectLoopException(
+            current::strings::Join(transfer->visited_urls, ' ') + " " + composed_url));
+      }
+      transfer->visited_urls.insert(composed_url);
+      transfer->outgoing = transfer->request.Compose(parsed_url);
+      transfer->sent = 0u;
+      transfer->connected = false;
+      transfer->response = std::make_unique<IncomingHTTPResponse>(
+          transfer->request.method == "HEAD", transfer->on_header, transfer->on_body);
+      const auto addr_info = current::net::GetAddrInfo(parsed_url.host, std::to_string(parsed_url.port));
+      transfer->socket = std::make_unique<current::net::SocketHandle>(current::net::SocketHandle::NewHandle());
+      fd = transfer->socket->socket;
+      const int flags = ::fcntl(fd, F_GETFL, 0);
+      if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        CURRENT_THROW(current::net::SocketFcntlException());  // LCOV_EXCL_LINE
+      }
+      if (::connect(fd, addr_info->ai_addr, addr_info->ai_addrlen) && errno != EINPROGRESS) {
+        CURRENT_THROW(current::net::SocketConnectException());
+      }
+    } catch (...) {
+      Fail(*transfer, std::current_exception());
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!terminating_) {
+        transfers_[fd] = std::move(transfer);
+        struct epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+        event.data.fd = fd;
+        if (!::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+          return;
+        }
+        // LCOV_EXCL_START
+        transfer = std::move(transfers_[fd]);
+        transfers_.erase(fd);
+        // LCOV_EXCL_STOP
+      }
+    }
+    Fail(*transfer, std::make_exception_ptr(AsyncHTTPClientStoppedException()));
+  }
+
+  void Thread() {
+    enum { kMaxEvents = 256 };
+    struct epoll_event events[kMaxEvents];
+    std::vector<char> buffer(64 * 1024);
+    while (!terminating_) {
+      const int count = ::epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+      for (int i = 0; i < count && !terminating_; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd != wakeup_fd_) {
+          OnEvents(fd, events[i].events, buffer);
+        }
+      }
+    }
+  }
+
+  void OnEvents(int fd, uint32_t events, std::vector<char>& buffer) {
+    Transfer* transfer;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto it = transfers_.find(fd);
+      if (it == transfers_.end()) {
+        return;  // LCOV_EXCL_LINE
+      }
+      transfer = it->second.get();
+    }
+    try {
+      if (!transfer->connected) {
+        int error = 0;
+        socklen_t error_length = sizeof(error);
+        if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) || error) {
+          CURRENT_THROW(current::net::SocketConnectException());
+        }
+        transfer->connected = true;
+      }
+      if (transfer->sent < transfer->outgoing.length()) {
+        Send(fd, *transfer);
+      }
+      if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        while (true) {
+          const ssize_t retval = ::recv(fd, &buffer[0], buffer.size(), MSG_DONTWAIT);
+          if (retval > 0) {
+            if (transfer->response->Append(&buffer[0], static_cast<size_t>(retval))) {
+              Complete(fd);
+              return;
+            }
+          } else if (retval == 0) {
+            if (!transfer->response->Closed()) {
+              CURRENT_THROW(current::net::ConnectionResetByPeer());
+            }
+            Complete(fd);
+            return;
+          } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+          } else if (errno == ECONNRESET) {
+            CURRENT_THROW(current::net::ConnectionResetByPeer());
+          } else if (errno != EINTR) {
+            CURRENT_THROW(current::net::SocketReadException());  // LCOV_EXCL_LINE
+          }
+        }
+      }
+    } catch (...) {
+      std::unique_ptr<Transfer> failed = Remove(fd);
+      Fail(*failed, std::current_exception());
+    }
+  }
+
+  void Send(int fd, Transfer& transfer) {
+    while (transfer.sent < transfer.outgoing.length()) {
+      const ssize_t retval = ::send(fd,
+                                    transfer.outgoing.data() + transfer.sent,
+                                    transfer.outgoing.length() - transfer.sent,
+                                    MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (retval > 0) {
+        transfer.sent += static_cast<size_t>(retval);
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      } else if (errno != EINTR) {
+        CURRENT_THROW(current::net::SocketWriteException());
+      }
+    }
+    // The request is sent, only wait for the response from now on.
+    transfer.outgoing.clear();
+    transfer.sent = 0u;
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+  }
+
+  std::unique_ptr<Transfer> Remove(int fd) {
+    std::unique_ptr<Transfer> transfer;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      transfer = std::move(transfers_[fd]);
+      transfers_.erase(fd);
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    transfer->socket = nullptr;
+    return transfer;
+  }
+
+  // Follows the redirect, or reports the response.
+  void Complete(int fd) {
+    std::unique_ptr<Transfer> transfer = Remove(fd);
+    const int code = transfer->response->Code();
+    const std::string location = transfer->response->headers().GetOrDefault("Location", "");
+    if (code >= 300 && code <= 399 && !location.empty()) {
+      if (!transfer->request.allow_redirects) {
+        Fail(*transfer, std::make_exception_ptr(current::net::HTTPRedirectNotAllowedException()));
+      } else {
+        transfer->response_url = URL::MakeRedirectedURL(URL(transfer->response_url), location).ComposeURL();
+        Start(std::move(transfer));
+      }
+      return;
+    }
+    ++completed_;
+    try {
+      transfer->on_success(*transfer);
+    } catch (...) {
+      // Only the `done_callback` of a `ChunkedGET` can throw here, and it fails the request.
+      --completed_;
+      Fail(*transfer, std::current_exception());
+    }
+  }
+
+  // The response has been delivered by the time `on_response` is called, so its exceptions are only logged.
+  template <typename F>
+  static void CallResponseCallback(F&& f) {
+    try {
+      f();
+    } catch (const std::exception& e) {
+      std::cerr << "HTTP async client: the response callback has thrown: " << e.what() << '\n';
+    } catch (...) {
+      std::cerr << "HTTP async client: the response callback has thrown.\n";
+    }
+  }
+
+  void Fail(Transfer& transfer, std::exception_ptr e) {
+    ++failed_;
+    try {
+      transfer.on_error(e);
+    } catch (const std::exception& inner) {
+      std::cerr << "HTTP async client: the error callback has thrown: " << inner.what() << '\n';
+    }
+  }
+
+  const int epoll_fd_;
+  const int wakeup_fd_;
+  std::atomic_bool terminating_;
+  std::atomic<uint64_t> completed_;
+  std::atomic<uint64_t> failed_;
+  mutable std::mutex mutex_;
+  std::map<int, std::unique_ptr<Transfer>> transfers_;
+  std::thread thread_;
+};
+
+#endif  // CURRENT_POSIX
+
+}  // namespace http
+}  // namespace current
+
+#endif  // BLOCKS_HTTP_IMPL_ASYNC_CLIENT_H
@@ -0,0 +1,457 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The `epoll`-based event loop of `HTTPServerPOSIX`, see `HTTP(port).ConfigureEventLoops()`.
+//
+// The accepted connections are watched by the event loops until their requests have been received in full.
+// The bytes are read without blocking as they arrive, and the moment the request is complete the connection,
+// along with the bytes received, is handed over to be parsed and served, so that neither parsing it nor running
+// its handler ever waits for the client. Until then, a connection costs no thread.
+//
+// Only the end of the request is looked for here: the blank line after the headers, and then the body as per
+// `Content-Length` or `Transfer-Encoding: chunked`. The request itself is parsed by `HTTPServerConnection` as before.
+// The requests whose bodies are read by the handlers themselves, see `StreamedRequestBody`, are handed over as soon
+// as their headers are received.
+//
+// With keep-alive, see `HTTP(port).EnableKeepAlive()`, the connection comes back to an event loop once the response
+// is sent, along with the bytes of the next request the client may have already sent. If these make a complete
+// request, it is served right away, otherwise the loop waits for the rest of it, for up to the idle timeout.
+// The new connections are given the request timeout, see `HTTP(port).SetRequestTimeout()`, to send their headers.
+
+#ifndef BLOCKS_HTTP_IMPL_EVENT_LOOP_H
+#define BLOCKS_HTTP_IMPL_EVENT_LOOP_H
+
+#include "../../../port.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "../../../Bricks/net/http/constants.h"
+
+#ifdef CURRENT_POSIX
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../../../Bricks/net/exceptions.h"
+#include "../../../Bricks/net/tcp/tcp.h"
+
+#endif  // CURRENT_POSIX
+
+namespace current {
+namespace http {
+
+// Accumulates the bytes of an incoming HTTP request, and tells when the request has been received in full.
+// Errs on the side of reporting the request as complete: the malformed, oversized or otherwise unusual ones
+// are handed over to the regular parser, which would reply with an error or read the rest in a blocking way.
+class IncomingHTTPRequest final {
+ public:
+  enum : size_t { kMaxHeaderBytes = 64 * 1024, kMaxChunkSizeLineLength = 1024 };
+
+  void Append(const char* data, size_t size) { data_.append(data, size); }
+
+  std::string& MutableData() { return data_; }
+
+  bool HeadersReceived() const { return headers_end_ != std::string::npos; }
+
+  // Whether the body of the request to this target, the path with the query, is not to be waited for.
+  using streamed_body_function_t = std::function<bool(const std::string& request_target)>;
+
+  bool Complete(const streamed_body_function_t& streamed_body = nullptr) {
+    if (headers_end_ == std::string::npos) {
+      const size_t from = scanned_ > 3u ? scanned_ - 3u : 0u;
+      const size_t blank_line = data_.find("\r\n\r\n", from);
+      scanned_ = data_.length();
+      if (blank_line == std::string::npos) {
+        return data_.length() > kMaxHeaderBytes;
+      }
+      headers_end_ = blank_line + 4u;
+      next_chunk_ = headers_end_;
+      if (!ParseHeaders() || (streamed_body && streamed_body(RequestTarget()))) {
+        return true;
+      }
+    }
+    if (chunked_) {
+      return ChunkedBodyComplete();
+    } else {
+      return data_.length() >= headers_end_ + body_length_;
+    }
+  }
+
+ private:
+  static bool HeaderNameEquals(const char* lhs, size_t lhs_length, const char* rhs) {
+    const size_t rhs_length = std::strlen(rhs);
+    if (lhs_length != rhs_length) {
+      return false;
+    }
+    for (size_t i = 0u; i < lhs_length; ++i) {
+      if (std::tolower(lhs[i]) != std::tolower(rhs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Skips over the chunks received in full. The last chunk, of size zero, is followed by the optional trailers and
+  // the blank line. The malformed chunk size lines are left for the parser to reject.
+  bool ChunkedBodyComplete() {
+    while (true) {
+      const size_t line_end = data_.find("\r\n", next_chunk_);
+      if (line_end == std::string::npos) {
+        return data_.length() - next_chunk_ > kMaxChunkSizeLineLength;
+      }
+      const char* begin = data_.c_str() + next_chunk_;
+      char* end = nullptr;
+      const uint64_t size = static_cast<uint64_t>(std::strtoull(begin, &end, 16));
+      if (end == begin || size > net::constants::kMaxHTTPPayloadSizeInBytes) {
+        return true;
+      }
+      if (!size) {
+        // The blank line ends the trailers, and right after the last chunk it is its own CRLF followed by one more.
+        return data_.find("\r\n\r\n", line_end) != std::string::npos ||
+               data_.length() - line_end > kMaxHeaderBytes;
+      }
+      const size_t next_chunk = line_end + 2u + static_cast<size_t>(size) + 2u;
+      if (data_.length() < next_chunk) {
+        return false;
+      }
+      next_chunk_ = next_chunk;
+    }
+  }
+
+  // The second word of the first non-blank line, "/path?query" of "GET /path?query HTTP/1.1".
+  std::string RequestTarget() const {
+    const size_t begin = data_.find_first_not_of("\r\n");
+    const size_t target_begin = data_.find(' ', begin);
+    if (begin == std::string::npos || target_begin == std::string::npos) {
+      return "";  // LCOV_EXCL_LINE
+    }
+    const size_t target_end = data_.find_first_of(" \r\n", target_begin + 1u);
+    return data_.substr(target_begin + 1u, std::min(target_end, data_.length()) - target_begin - 1u);
+  }
+
+  // Returns `false` if the request should be handed over to the parser right away.
+  bool ParseHeaders() {
+    size_t line_begin = data_.find("\r\n") + 2u;
+    while (line_begin < headers_end_ - 2u) {
+      const size_t line_end = data_.find("\r\n", line_begin);
+      const size_t colon = data_.find(':', line_begin);
+      if (colon < line_end) {
+        size_t value_begin = colon + 1u;
+        while (value_begin < line_end && (data_[value_begin] == ' ' || data_[value_begin] == '\t')) {
+          ++value_begin;
+        }
+        size_t value_end = line_end;
+        while (value_end > value_begin && (data_[value_end - 1u] == ' ' || data_[value_end - 1u] == '\t')) {
+          --value_end;
+        }
+        const char* key = &data_[line_begin];
+        const size_t key_length = colon - line_begin;
+        if (HeaderNameEquals(key, key_length, net::constants::kContentLengthHeaderKey)) {
+          body_length_ = static_cast<size_t>(std::strtoull(data_.c_str() + value_begin, nullptr, 10));
+          if (body_length_ > net::constants::kMaxHTTPPayloadSizeInBytes) {
+            return false;
+          }
+        } else if (HeaderNameEquals(key, key_length, net::constants::kTransferEncodingHeaderKey) &&
+                   HeaderNameEquals(&data_[value_begin],
+                                    value_end - value_begin,
+                                    net::constants::kTransferEncodingChunkedValue)) {
+          chunked_ = true;
+        }
+      }
+      line_begin = line_end + 2u;
+    }
+    return true;
+  }
+
+  std::string data_;
+  size_t scanned_ = 0u;
+  size_t headers_end_ = std::string::npos;
+  size_t body_length_ = 0u;
+  bool chunked_ = false;
+  size_t next_chunk_ = 0u;  // Where the size line of the next chunk begins, for the chunked body.
+};
+
+#ifdef CURRENT_POSIX
+
+// One thread watching its share of the accepted connections via `epoll`.
+class HTTPServerEventLoop final {
+ public:
+  // Called from the thread of the event loop, with the request already received into the connection,
+  // and with the number of requests served on this connection before.
+  using dispatch_function_t = std::function<void(current::net::Connection&&, size_t)>;
+
+  // The requests `streamed_body` returns `true` for are dispatched as soon as their headers are received.
+  explicit HTTPServerEventLoop(dispatch_function_t dispatch,
+                               IncomingHTTPRequest::streamed_body_function_t streamed_body = nullptr)
+      : dispatch_(dispatch),
+        streamed_body_(streamed_body),
+        epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
+        wakeup_fd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+        terminating_(false),
+        idle_timeout_ms_(0),
+        request_timeout_ms_(0) {
+    if (epoll_fd_ < 0 || wakeup_fd_ < 0) {
+      CURRENT_THROW(current::net::SocketCreateException());  // LCOV_EXCL_LINE
+    }
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wakeup_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event)) {
+      CURRENT_THROW(current::net::SocketCreateException());  // LCOV_EXCL_LINE
+    }
+    thread_ = std::thread(&HTTPServerEventLoop::Thread, this);
+  }
+
+  // The connections whose requests have not been received in full by now are closed.
+  ~HTTPServerEventLoop() {
+    terminating_ = true;
+    WakeUp();
+    thread_.join();
+    ::close(wakeup_fd_);
+    ::close(epoll_fd_);
+  }
+
+  // Watches the connection until its next request is received. The bytes of that request the connection has already
+  // been read from are passed as `received`.
+  void Add(current::net::Connection&& connection, size_t requests_served = 0u, std::string received = "") {
+    const int fd = connection.socket;
+    std::unique_ptr<PendingConnection> pending =
+        std::make_unique<PendingConnection>(std::move(connection), requests_served);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!received.empty()) {
+      pending->request.MutableData() = std::move(received);
+      if (pending->request.Complete(streamed_body_)) {
+        // A pipelined request, received along with the previous one. Have the thread of the loop serve it.
+        ready_.push_back(std::move(pending));
+        lock.unlock();
+        WakeUp();
+        return;
+      }
+    }
+    pending_[fd] = std::move(pending);
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+      // LCOV_EXCL_START
+      // Can not watch this connection, serve it as if there were no event loop.
+      std::unique_ptr<PendingConnection> unwatched = std::move(pending_[fd]);
+      pending_.erase(fd);
+      lock.unlock();
+      Dispatch(*unwatched);
+      // LCOV_EXCL_STOP
+    }
+  }
+
+  size_t PendingConnectionsCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_.size();
+  }
+
+  // The kept alive connections not sending the next request for this long are closed. Zero means no timeout.
+  void SetIdleTimeout(std::chrono::milliseconds idle_timeout) {
+    idle_timeout_ms_ = static_cast<int64_t>(idle_timeout.count());
+    WakeUp();
+  }
+
+  // The new connections not sending the headers of their first request within this long since accepted, or sending
+  // nothing for this long while at it, are closed. Zero means no timeout.
+  void SetRequestTimeout(std::chrono::milliseconds request_timeout) {
+    request_timeout_ms_ = static_cast<int64_t>(request_timeout.count());
+    WakeUp();
+  }
+
+ private:
+  struct PendingConnection final {
+    current::net::Connection connection;
+    IncomingHTTPRequest request;
+    const size_t requests_served;
+    const std::chrono::steady_clock::time_point added;
+    std::chrono::steady_clock::time_point last_activity;
+    PendingConnection(current::net::Connection&& connection, size_t requests_served)
+        : connection(std::move(connection)),
+          requests_served(requests_served),
+          added(std::chrono::steady_clock::now()),
+          last_activity(added) {}
+  };
+
+  void WakeUp() {
+    const uint64_t one = 1u;
+    if (::write(wakeup_fd_, &one, sizeof(one)) != sizeof(one)) {
+      std::cerr << "HTTP event loop: could not wake up the thread.\n";  // LCOV_EXCL_LINE
+    }
+  }
+
+  void Dispatch(PendingConnection& ready) {
+    ready.connection.SetPrefetchedData(std::move(ready.request.MutableData()));
+    dispatch_(std::move(ready.connection), ready.requests_served);
+  }
+
+  void Thread() {
+    enum { kMaxEvents = 64 };
+    enum { kMaxIdleTimeoutCheckIntervalMS = 100 };
+    struct epoll_event events[kMaxEvents];
+    std::vector<char> buffer(16 * 1024);
+    std::chrono::steady_clock::time_point next_idle_timeout_check = std::chrono::steady_clock::now();
+    while (!terminating_) {
+      const int64_t idle_timeout_ms = idle_timeout_ms_;
+      const int64_t request_timeout_ms = request_timeout_ms_;
+      int64_t check_interval_ms = kMaxIdleTimeoutCheckIntervalMS;
+      for (const int64_t timeout_ms : {idle_timeout_ms, request_timeout_ms}) {
+        if (timeout_ms) {
+          check_interval_ms = std::min(check_interval_ms, timeout_ms);
+        }
+      }
+      const int wait_ms = (idle_timeout_ms || request_timeout_ms) ? static_cast<int>(check_interval_ms) : -1;
+      const int count = ::epoll_wait(epoll_fd_, events, kMaxEvents, wait_ms);
+      for (int i = 0; i < count && !terminating_; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd != wakeup_fd_) {
+          std::unique_ptr<PendingConnection> ready = ReceiveAvailableData(fd, buffer);
+          if (ready) {
+            Dispatch(*ready);
+          }
+        } else {
+          uint64_t value;
+          if (::read(wakeup_fd_, &value, sizeof(value)) != sizeof(value)) {
+            // Nothing to do, the wakeups are only counted to not have `epoll_wait()` return right away again.
+          }
+        }
+      }
+      std::vector<std::unique_ptr<PendingConnection>> ready;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready.swap(ready_);
+      }
+      for (auto& pipelined : ready) {
+        if (!terminating_) {
+          Dispatch(*pipelined);
+        }
+      }
+      if (wait_ms >= 0) {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now >= next_idle_timeout_check) {
+          CloseIdleConnections(now, idle_timeout_ms, request_timeout_ms);
+          next_idle_timeout_check = now + std::chrono::milliseconds(wait_ms);
+        }
+      }
+    }
+  }
+
+  // Closes the kept alive connections that have received nothing for `idle_timeout_ms`, and the new ones that
+  // are past `request_timeout_ms` with their first request, see `SetRequestTimeout()`. Zero timeouts are not applied.
+  void CloseIdleConnections(std::chrono::steady_clock::time_point now,
+                            int64_t idle_timeout_ms,
+                            int64_t request_timeout_ms) {
+    const auto timed_out = [now](std::chrono::steady_clock::time_point since, int64_t timeout_ms) {
+      return timeout_ms && since < now - std::chrono::milliseconds(timeout_ms);
+    };
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      const PendingConnection& pending = *it->second;
+      const bool close =
+          pending.requests_served
+              ? timed_out(pending.last_activity, idle_timeout_ms)
+              : (timed_out(pending.last_activity, request_timeout_ms) ||
+                 (!pending.request.HeadersReceived() && timed_out(pending.added, request_timeout_ms)));
+      if (close) {
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->first, nullptr);
+        it = pending_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Returns the connection if its request is complete. Closes it if the client has gone away.
+  std::unique_ptr<PendingConnection> ReceiveAvailableData(int fd, std::vector<char>& buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = pending_.find(fd);
+    if (it == pending_.end()) {
+      return nullptr;  // LCOV_EXCL_LINE
+    }
+    bool closed = false;
+    it->second->last_activity = std::chrono::steady_clock::now();
+    while (true) {
+      const ssize_t retval = ::recv(fd, &buffer[0], buffer.size(), MSG_DONTWAIT);
+      if (retval > 0) {
+        it->second->request.Append(&buffer[0], static_cast<size_t>(retval));
+      } else {
+        closed = (retval == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+        if (retval == 0 || errno != EINTR) {
+          break;
+        }
+      }
+    }
+    const bool complete = it->second->request.Complete(streamed_body_);
+    if (!complete && !closed) {
+      return nullptr;
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    std::unique_ptr<PendingConnection> result = std::move(it->second);
+    pending_.erase(it);
+    if (!complete) {
+      // The client has closed the connection before sending the complete request, nothing to serve.
+      return nullptr;
+    }
+    return result;
+  }
+
+  const dispatch_function_t dispatch_;
+  const IncomingHTTPRequest::streamed_body_function_t streamed_body_;
+  const int epoll_fd_;
+  const int wakeup_fd_;
+  std::atomic_bool terminating_;
+  std::atomic<int64_t> idle_timeout_ms_;
+  std::atomic<int64_t> request_timeout_ms_;
+  mutable std::mutex mutex_;
+  std::map<int, std::unique_ptr<PendingConnection>> pending_;
+  std::vector<std::unique_ptr<PendingConnection>> ready_;
+  std::thread thread_;
+};
+
+#endif  // CURRENT_POSIX
+
+}  // namespace http
+}  // namespace current
+
+#endif  // BLOCKS_HTTP_IMPL_EVENT_LOOP_H
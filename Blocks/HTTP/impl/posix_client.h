@@ -34,10 +34,14 @@ SOFTWARE.
 #include <string>
 #include <set>
 
+#include "posix_client_pool.h"
+
 #include "../../URL/url.h"
 
 #include "../../../Bricks/net/http/http.h"
 #include "../../../Bricks/file/file.h"
+#include "../../../Bricks/strings/util.h"
+#include "../../../Bricks/util/singleton.h"
 
 namespace current {
 namespace http {
@@ -84,47 +88,22 @@ class GenericHTTPClientPOSIX final {
         CURRENT_THROW(current::net::HTTPRedirectLoopException(loop));
       }
       all_urls.insert(composed_url);
-      current::net::Connection connection(
-          current::net::Connection(current::net::ClientSocket(parsed_url.host, parsed_url.port)));
-      connection.BlockingWrite(
-          request_method_ + ' ' + parsed_url.path + parsed_url.ComposeParameters() + " HTTP/1.1\r\n", true);
-      connection.BlockingWrite("Host: " + parsed_url.host + "\r\n", true);
-      if (!request_user_agent_.empty()) {
-        connection.BlockingWrite("User-Agent: " + request_user_agent_ + "\r\n", true);
-      }
-      for (const auto& h : request_headers_) {
-        connection.BlockingWrite(h.header + ": " + h.value + "\r\n", true);
-      }
-      if (!request_headers_.cookies.empty()) {
-        connection.BlockingWrite("Cookie: " + request_headers_.CookiesAsString() + "\r\n", true);
-      }
-      if (!request_body_content_type_.empty()) {
-        connection.BlockingWrite("Content-Type: " + request_body_content_type_ + "\r\n", true);
-      }
-      if (!request_body_contents_.empty()) {
-        // NOTE(dkorolev): The `try/catch/throw` combo here is a hack for the unit test for HTTP 413 to pass.
-        // It swallows the `SocketWriteException` exception for huge payloads, as Current's HTTP server logic
-        // does intentionally close the HTTP connection prematurely if `Content-Length` exceeds a reasonable limit.
-        try {
-#ifndef CURRENT_WINDOWS
-          connection.BlockingWrite("Content-Length: " + std::to_string(request_body_contents_.length()) + "\r\n", true);
-          connection.BlockingWrite("\r\n", true);
-          connection.BlockingWrite(request_body_contents_, false);
-#else
-          // TODO(grixa): this fix for the PayloadTooLarge test on Windows is temporary, need to revisit it.
-          connection.BlockingWrite("Content-Length: " + std::to_string(request_body_contents_.length()) + "\r\n\r\n" +
-                                       request_body_contents_,
-                                   false);
-#endif
-        } catch (const net::SocketWriteException&) {
-          if (request_body_contents_.length() <= net::constants::kMaxHTTPPayloadSizeInBytes) {
-            throw;
-          }
+      auto& pool = current::Singleton<HTTPClientConnectionPool>();
+      bool reused = false;
+      std::unique_ptr<current::net::Connection> connection = pool.Acquire(parsed_url.host, parsed_url.port, reused);
+      try {
+        SendRequestAndReceiveResponse(*connection, parsed_url);
+      } catch (const current::net::SocketException&) {
+        if (!reused || request_method_ == "POST" || request_method_ == "PATCH") {
+          throw;
         }
-      } else {
-        connection.BlockingWrite("\r\n", false);
+        // The server has closed the kept connection before responding, most likely as it was idle for too long.
+        connection = pool.Reopen(parsed_url.host, parsed_url.port);
+        SendRequestAndReceiveResponse(*connection, parsed_url);
+      }
+      if (CanKeepConnectionAlive()) {
+        pool.Release(parsed_url.host, parsed_url.port, std::move(*connection));
       }
-      http_request_.reset(new CustomHTTPRequestData(connection, request_data_construction_params_));
       // TODO(dkorolev): Rename `Path()`, it's only called so now because of HTTP request/response format.
       // Elaboration:
       // HTTP request  message is: `GET /path HTTP/1.1`, "/path" is the second component of it.
@@ -149,6 +128,63 @@ class GenericHTTPClientPOSIX final {
 
   const CustomHTTPRequestData& HTTPRequest() const { return *http_request_.get(); }
 
+ private:
+  void SendRequestAndReceiveResponse(current::net::Connection& connection, const URL& parsed_url) {
+    connection.BlockingWrite(
+        request_method_ + ' ' + parsed_url.path + parsed_url.ComposeParameters() + " HTTP/1.1\r\n", true);
+    connection.BlockingWrite("Host: " + parsed_url.host + "\r\n", true);
+    if (!request_user_agent_.empty()) {
+      connection.BlockingWrite("User-Agent: " + request_user_agent_ + "\r\n", true);
+    }
+    for (const auto& h : request_headers_) {
+      connection.BlockingWrite(h.header + ": " + h.value + "\r\n", true);
+    }
+    if (!request_headers_.cookies.empty()) {
+      connection.BlockingWrite("Cookie: " + request_headers_.CookiesAsString() + "\r\n", true);
+    }
+    if (!request_body_content_type_.empty()) {
+      connection.BlockingWrite("Content-Type: " + request_body_content_type_ + "\r\n", true);
+    }
+    if (!request_body_contents_.empty()) {
+      // NOTE(dkorolev): The `try/catch/throw` combo here is a hack for the unit test for HTTP 413 to pass.
+      // It swallows the `SocketWriteException` exception for huge payloads, as Current's HTTP server logic
+      // does intentionally close the HTTP connection prematurely if `Content-Length` exceeds a reasonable limit.
+      try {
+#ifndef CURRENT_WINDOWS
+        connection.BlockingWrite("Content-Length: " + std::to_string(request_body_contents_.length()) + "\r\n", true);
+        connection.BlockingWrite("\r\n", true);
+        connection.BlockingWrite(request_body_contents_, false);
+#else
+        // TODO(grixa): this fix for the PayloadTooLarge test on Windows is temporary, need to revisit it.
+        connection.BlockingWrite("Content-Length: " + std::to_string(request_body_contents_.length()) + "\r\n\r\n" +
+                                     request_body_contents_,
+                                 false);
+#endif
+      } catch (const net::SocketWriteException&) {
+        if (request_body_contents_.length() <= net::constants::kMaxHTTPPayloadSizeInBytes) {
+          throw;
+        }
+      }
+    } else {
+      connection.BlockingWrite("\r\n", false);
+    }
+    http_request_.reset(new CustomHTTPRequestData(connection, request_data_construction_params_));
+  }
+
+  // Whether the connection can be used for the next request to the same host and port: the server has said so,
+  // and the response body has been received in full, exactly as per its `Content-Length`. The chunked responses
+  // are not kept alive, since the servers, this one included, tend to close the connection after them regardless.
+  bool CanKeepConnectionAlive() const {
+    if (request_method_ == "HEAD") {
+      return false;
+    }
+    const auto& headers = http_request_->headers();
+    return current::strings::ToLower(headers.GetOrDefault("Connection", "")).find("keep-alive") != std::string::npos &&
+           headers.Has(current::net::constants::kContentLengthHeaderKey) &&
+           !headers.Has(current::net::constants::kTransferEncodingHeaderKey) &&
+           http_request_->ReceivedBeyondRequest().empty();
+  }
+
  public:
   // Request parameters.
   std::string request_method_ = "";
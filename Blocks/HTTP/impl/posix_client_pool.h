@@ -0,0 +1,197 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The pool of the kept alive connections of the POSIX HTTP client, see `HTTPClientPOSIX`.
+//
+// When the server responds with `Connection: keep-alive`, and the response has been received in full, the connection
+// is kept in the pool of its host and port, and the next request to the same host and port is sent over it instead
+// of over a new one. Up to `max_idle_connections_per_host` connections are kept per host and port, each for up to
+// `max_idle_time`. The kept connections the server has closed meanwhile are detected and dropped before being used,
+// and the requests other than `POST` and `PATCH` that fail on a kept connection are retried once on a new one.
+//
+// `current::Singleton<current::http::HTTPClientConnectionPool>().Configure(0u)` turns the pooling off.
+
+#ifndef BLOCKS_HTTP_IMPL_POSIX_CLIENT_POOL_H
+#define BLOCKS_HTTP_IMPL_POSIX_CLIENT_POOL_H
+
+#include "../../../port.h"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#ifndef CURRENT_WINDOWS
+#include <cerrno>
+#include <sys/socket.h>
+#endif
+
+#include "../../../Bricks/net/tcp/tcp.h"
+
+namespace current {
+namespace http {
+
+struct HTTPClientConnectionPoolStats {
+  size_t idle = 0u;       // The number of connections kept in the pool now.
+  uint64_t opened = 0u;   // The number of connections opened.
+  uint64_t reused = 0u;   // The number of requests sent over the kept connections.
+  uint64_t stale = 0u;    // The number of kept connections dropped as closed by the server or idle for too long.
+  uint64_t retried = 0u;  // The number of requests retried on a new connection after failing on a kept one.
+};
+
+constexpr static size_t kDefaultHTTPClientMaxIdleConnectionsPerHost = 8u;
+constexpr static std::chrono::milliseconds kDefaultHTTPClientMaxIdleTime = std::chrono::milliseconds(30000);
+
+class HTTPClientConnectionPool final {
+ public:
+  HTTPClientConnectionPool()
+      : max_idle_connections_per_host_(kDefaultHTTPClientMaxIdleConnectionsPerHost),
+        max_idle_time_(kDefaultHTTPClientMaxIdleTime) {}
+
+  // The connections kept so far are closed.
+  void Configure(size_t max_idle_connections_per_host,
+                 std::chrono::milliseconds max_idle_time = kDefaultHTTPClientMaxIdleTime) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_idle_connections_per_host_ = max_idle_connections_per_host;
+    max_idle_time_ = max_idle_time;
+    idle_.clear();
+  }
+
+  // Returns a kept connection to `host:port`, setting `reused`, or a new one.
+  std::unique_ptr<current::net::Connection> Acquire(const std::string& host, int port, bool& reused) {
+    const std::string key = Key(host, port);
+    while (true) {
+      std::unique_ptr<current::net::Connection> kept;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto it = idle_.find(key);
+        if (it == idle_.end() || it->second.empty()) {
+          break;
+        }
+        // The most recently used connection is the most likely to still be open.
+        IdleConnection& idle = it->second.back();
+        const bool expired = std::chrono::steady_clock::now() - idle.since > max_idle_time_;
+        kept = std::make_unique<current::net::Connection>(std::move(idle.connection));
+        it->second.pop_back();
+        if (expired) {
+          ++stale_;
+          continue;
+        }
+      }
+      if (IsOpen(*kept)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++reused_;
+        reused = true;
+        return kept;
+      } else {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stale_;
+      }
+    }
+    reused = false;
+    return Open(host, port);
+  }
+
+  // Returns a new connection to `host:port`, to retry the request that has failed on a kept one.
+  std::unique_ptr<current::net::Connection> Reopen(const std::string& host, int port) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++retried_;
+    }
+    return Open(host, port);
+  }
+
+  // Keeps the connection the response has been received from in full for the next request to `host:port`.
+  void Release(const std::string& host, int port, current::net::Connection&& connection) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_idle_connections_per_host_) {
+      std::deque<IdleConnection>& idle = idle_[Key(host, port)];
+      if (idle.size() >= max_idle_connections_per_host_) {
+        idle.pop_front();
+      }
+      idle.emplace_back(std::move(connection));
+    }
+  }
+
+  HTTPClientConnectionPoolStats Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    HTTPClientConnectionPoolStats stats;
+    for (const auto& host : idle_) {
+      stats.idle += host.second.size();
+    }
+    stats.opened = opened_;
+    stats.reused = reused_;
+    stats.stale = stale_;
+    stats.retried = retried_;
+    return stats;
+  }
+
+ private:
+  struct IdleConnection final {
+    current::net::Connection connection;
+    const std::chrono::steady_clock::time_point since;
+    explicit IdleConnection(current::net::Connection&& connection)
+        : connection(std::move(connection)), since(std::chrono::steady_clock::now()) {}
+    IdleConnection(IdleConnection&&) = default;
+  };
+
+  static std::string Key(const std::string& host, int port) { return host + ':' + std::to_string(port); }
+
+  std::unique_ptr<current::net::Connection> Open(const std::string& host, int port) {
+    std::unique_ptr<current::net::Connection> connection =
+        std::make_unique<current::net::Connection>(current::net::ClientSocket(host, port));
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++opened_;
+    return connection;
+  }
+
+  // Whether the kept connection has not been closed by the server. Nothing is expected to have arrived on it.
+  static bool IsOpen(current::net::Connection& connection) {
+#ifndef CURRENT_WINDOWS
+    char c;
+    const ssize_t retval = ::recv(connection.socket, &c, 1u, MSG_PEEK | MSG_DONTWAIT);
+    return retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+#else
+    // The closed connections are not detected on Windows yet, so the kept connections are not reused there.
+    static_cast<void>(connection);
+    return false;
+#endif
+  }
+
+  mutable std::mutex mutex_;
+  size_t max_idle_connections_per_host_;
+  std::chrono::milliseconds max_idle_time_;
+  std::map<std::string, std::deque<IdleConnection>> idle_;
+  uint64_t opened_ = 0u;
+  uint64_t reused_ = 0u;
+  uint64_t stale_ = 0u;
+  uint64_t retried_ = 0u;
+};
+
+}  // namespace http
+}  // namespace current
+
+#endif  // BLOCKS_HTTP_IMPL_POSIX_CLIENT_POOL_H
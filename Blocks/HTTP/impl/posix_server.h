@@ -29,12 +29,19 @@ SOFTWARE.
 #define BLOCKS_HTTP_IMPL_POSIX_SERVER_H
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <string>
 #include <map>
 #include <memory>
 #include <thread>
 #include <iostream>  // TODO(dkorolev): More robust logging here.
 
+#include "event_loop.h"
+#include "routes.h"
+#include "static_files.h"
+
 #include "../types.h"
 #include "../request.h"
 
@@ -45,6 +52,7 @@ SOFTWARE.
 #include "../../../Bricks/time/chrono.h"
 #include "../../../Bricks/strings/printf.h"
 #include "../../../Bricks/util/accumulative_scoped_deleter.h"
+#include "../../../Bricks/util/make_scope_guard.h"
 
 namespace current {
 namespace http {
@@ -75,6 +83,10 @@ struct HandlerDoesNotExistException : InvalidHandlerPathException {
   using InvalidHandlerPathException::InvalidHandlerPathException;
 };
 
+struct EventLoopsNotSupportedException : Exception {
+  using Exception::Exception;
+};
+
 struct ServeStaticFilesException : Exception {
   using Exception::Exception;
 };
@@ -87,6 +99,14 @@ struct ServeStaticFilesFromCannotServeMoreThanOneIndexFile : ServeStaticFilesExc
   using ServeStaticFilesException::ServeStaticFilesException;
 };
 
+// Passed to `Register()` for the handler to read the body of the request itself, as it is being received, via
+// `r.BodyReader()`, instead of it being read into `r.body` in full before the handler is called. Accepts the bodies
+// of up to `max_length` bytes, regardless of `kMaxHTTPPayloadSizeInBytes`. The connection is not kept alive.
+struct StreamedRequestBody final {
+  uint64_t max_length;
+  explicit StreamedRequestBody(uint64_t max_length) : max_length(max_length) {}
+};
+
 struct ServeStaticFilesFromOptions {
   // HTTP server route prefix.
   std::string route_prefix;
@@ -97,6 +117,9 @@ struct ServeStaticFilesFromOptions {
   // Names of files to serve if a directory URL is requested, in the priority order (first found will be served).
   std::vector<std::string> index_filenames;
 
+  // Keep the files open and serve them from disk rather than from memory, see `static_files.h`. Not on Windows.
+  bool serve_from_open_files = false;
+
   explicit ServeStaticFilesFromOptions(std::string route_prefix_in = "/",
                                        std::string public_url_prefix_in = "",
                                        std::vector<std::string> index_filenames_in = {"index.html", "index.htm"})
@@ -112,6 +135,12 @@ struct StaticFileServer {
   std::string content_type;
   bool serves_directory;
   std::string trailing_slash_redirect_url;
+#ifndef CURRENT_WINDOWS
+  // With `ServeStaticFilesFromOptions::serve_from_open_files`, the file to serve instead of `content`,
+  // and its gzip-compressed sibling, if any.
+  std::shared_ptr<OpenStaticFile> file;
+  std::shared_ptr<OpenStaticFile> gzipped_file;
+#endif
 
   StaticFileServer(std::string content,
                    std::string content_type,
@@ -129,6 +158,12 @@ struct StaticFileServer {
         // (`static` is a directory, not a file).
         // 2) Respond with the content if we're serving a file and don't have a trailing slash. Example:
         // `/static/index.html`, `/static/file.png`.
+#ifndef CURRENT_WINDOWS
+        if (file) {
+          ServeOpenStaticFile(r, content_type, *file, gzipped_file.get());
+          return;
+        }
+#endif
         r.connection.SendHTTPResponse(content, HTTPResponseCode.OK, content_type);
       } else if (!serves_directory && r.url_path_had_trailing_slash) {
         // Respond with HTTP 404 Not Found if we're serving a file and have a trailing slash. Example:
@@ -154,14 +189,55 @@ struct StaticFileServer {
   }
 };
 
+// The state of the worker pool of `HTTPServerPOSIX`, see `HTTP(port).ConfigureWorkerPool()`,
+// and of its event loops, see `HTTP(port).ConfigureEventLoops()`.
+struct HTTPServerWorkerPoolStats {
+  size_t workers = 0u;             // Zero if the requests are served on the listening thread.
+  size_t max_queue_depth = 0u;     // The number of accepted connections allowed to wait for a worker.
+  size_t queue_depth = 0u;         // The number of accepted connections waiting for a worker now.
+  uint64_t dispatched = 0u;        // The number of connections handed over to the workers.
+  uint64_t rejected = 0u;          // The number of connections answered "503" as the queue was full.
+  size_t event_loops = 0u;         // Zero if the requests are read by whoever serves them.
+  size_t awaiting_requests = 0u;   // The number of connections the event loops are receiving the requests from.
+  uint64_t kept_alive = 0u;        // The number of times a connection was handed back for one more request.
+};
+
+constexpr static size_t kDefaultHTTPServerWorkerPoolMaxQueueDepth = 1024u;
+constexpr static size_t kDefaultHTTPServerKeepAliveMaxRequests = 100u;
+constexpr static std::chrono::milliseconds kDefaultHTTPServerKeepAliveIdleTimeout = std::chrono::milliseconds(5000);
+constexpr static std::chrono::milliseconds kDefaultHTTPServerRequestTimeout = std::chrono::milliseconds(30000);
+
 // HTTP server bound to a specific port.
+//
+// By default, the listening thread accepts the connection, parses the request and runs its handler, one connection
+// at a time. With `ConfigureWorkerPool(workers)`, the listening thread only accepts the connections, and the workers
+// parse the requests and run the handlers. When the queue of accepted connections is full, the new ones are
+// answered with "503 SERVICE UNAVAILABLE" right away, without reading the request.
+//
+// On Linux, with `ConfigureEventLoops(loops)`, the accepted connections are first watched by the `epoll`-based
+// event loops, see `event_loop.h`, until their requests are received in full, so that the idle and the slow clients
+// hold no threads. The complete requests are then served by the workers, if any, or on the event loop threads.
+// The connections not sending the headers of their first request within `SetRequestTimeout()` are closed.
+//
+// With the event loops running, `EnableKeepAlive()` makes the server respond with `Connection: keep-alive` to the
+// HTTP/1.1 requests, unless they ask for `Connection: close`, and to the HTTP/1.0 ones asking for keep-alive. Once
+// such a response is sent, the connection goes back to an event loop to receive the next request. The requests
+// the client has pipelined are served in order. The connection is closed after `max_requests_per_connection`
+// requests, or if it stays idle for longer than `idle_timeout`. The chunked responses still close the connection.
 class HTTPServerPOSIX final {
  public:
   // The constructor starts listening on the specified port.
   // Since instances of `HTTPServerPOSIX` are created via a singleton,
   // a listening thread will only be created once per port, on the first access to that port.
   explicit HTTPServerPOSIX(int port)
-      : terminating_(false), port_(port), thread_(&HTTPServerPOSIX::Thread, this, current::net::Socket(port)) {}
+      : terminating_(false),
+        port_(port),
+        keep_alive_max_requests_(0u),
+        keep_alive_idle_timeout_ms_(static_cast<int64_t>(kDefaultHTTPServerKeepAliveIdleTimeout.count())),
+        kept_alive_(0u),
+        request_timeout_ms_(static_cast<int64_t>(kDefaultHTTPServerRequestTimeout.count())),
+        routes_(std::make_shared<HTTPRoutesTrie>()),
+        thread_(&HTTPServerPOSIX::Thread, this, current::net::Socket(port)) {}
 
   // The destructor closes the socket.
   // Note that the destructor will only be run on the shutdown of the binary,
@@ -186,6 +262,9 @@ class HTTPServerPOSIX final {
     if (thread_.joinable()) {
       thread_.join();
     }
+    // The connections still sending their requests are closed, the ones already queued are still served.
+    StopEventLoops();
+    StopWorkers();
   }
 
   // The bare `Join()` method is only used by small scripts to run the server indefinitely,
@@ -239,9 +318,26 @@ class HTTPServerPOSIX final {
     return DoRegisterHandler(path, handler, URLPathArgs::CountMask::None, POLICY);
   }
 
+  // The handlers reading the body of the request themselves, see `StreamedRequestBody`.
+  template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt, typename F>
+  HTTPRoutesScopeEntry Register(const std::string& path, StreamedRequestBody body, F& handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return DoRegisterHandler(
+        path, [&handler](Request r) { handler(std::move(r)); }, URLPathArgs::CountMask::None, POLICY, body.max_length);
+  }
+  template <ReRegisterRoute POLICY = ReRegisterRoute::ThrowOnAttempt>
+  HTTPRoutesScopeEntry Register(const std::string& path,
+                                StreamedRequestBody body,
+                                std::function<void(Request)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return DoRegisterHandler(path, handler, URLPathArgs::CountMask::None, POLICY, body.max_length);
+  }
+
   void UnRegister(const std::string& path,
                   const URLPathArgs::CountMask path_args_count_mask = URLPathArgs::CountMask::None) {
     std::lock_guard<std::mutex> lock(mutex_);
+    // The handlers unregistered before a `HandlerDoesNotExistException`, if any, are unregistered from the routes too.
+    const auto compile_routes = current::MakeScopeGuard([this]() { CompileRoutes(); });
     URLPathArgs::CountMask mask = URLPathArgs::CountMask::None;  // `None` == 1 == (1 << 0).
     for (size_t i = 0; i <= URLPathArgs::MaxArgsCount; ++i, mask <<= 1) {
       if ((path_args_count_mask & mask) == mask) {
@@ -276,6 +372,18 @@ class HTTPServerPOSIX final {
             return;
           }
 
+#ifndef CURRENT_WINDOWS
+          // Ignore the gzip-compressed siblings of the files to serve, they are served along with those files.
+          const std::string& pathname = item_info.pathname;
+          if (options.serve_from_open_files && pathname.length() > 3u &&
+              pathname.compare(pathname.length() - 3u, 3u, ".gz") == 0 &&
+              !current::net::GetFileMimeType(item_info.basename.substr(0u, item_info.basename.length() - 3u), "")
+                   .empty() &&
+              OpenStaticFile::Exists(pathname.substr(0u, pathname.length() - 3u))) {
+            return;
+          }
+#endif
+
           const std::string content_type(current::net::GetFileMimeType(item_info.basename, ""));
           if (!content_type.empty()) {
             const bool path_components_empty = item_info.path_components_cref.empty();
@@ -304,7 +412,21 @@ class HTTPServerPOSIX final {
 
             // TODO(dkorolev): Wrap keeping file contents into a singleton
             // that keeps a map from a (SHA256) hash to the contents.
-            std::string content = current::FileSystem::ReadFileAsString(item_info.pathname);
+            std::string content;
+#ifndef CURRENT_WINDOWS
+            std::shared_ptr<OpenStaticFile> file;
+            std::shared_ptr<OpenStaticFile> gzipped_file;
+            if (options.serve_from_open_files) {
+              file = std::make_shared<OpenStaticFile>(item_info.pathname);
+              if (OpenStaticFile::Exists(item_info.pathname + ".gz")) {
+                gzipped_file = std::make_shared<OpenStaticFile>(item_info.pathname + ".gz");
+              }
+            } else {
+              content = current::FileSystem::ReadFileAsString(item_info.pathname);
+            }
+#else
+            content = current::FileSystem::ReadFileAsString(item_info.pathname);
+#endif
 
             // If it's an index file, serve it additionally at the route without the filename (i.e. the directory
             // route).
@@ -322,11 +444,19 @@ class HTTPServerPOSIX final {
 
               auto static_file_server =
                   std::make_unique<StaticFileServer>(content, content_type, true, trailing_slash_redirect_url);
+#ifndef CURRENT_WINDOWS
+              static_file_server->file = file;
+              static_file_server->gzipped_file = gzipped_file;
+#endif
               scope += Register(route_for_directory, *static_file_server);
               static_file_servers_.push_back(std::move(static_file_server));
             }
 
             auto static_file_server = std::make_unique<StaticFileServer>(std::move(content), content_type, false);
+#ifndef CURRENT_WINDOWS
+            static_file_server->file = file;
+            static_file_server->gzipped_file = gzipped_file;
+#endif
             scope += Register(route_for_file, *static_file_server);
             static_file_servers_.push_back(std::move(static_file_server));
           } else {
@@ -338,117 +468,142 @@ class HTTPServerPOSIX final {
     return scope;
   }
 
-  size_t PathHandlersCount() const {
-    // NOTE: The total number of handlers is no longer an interesting measure.
-    //       Just return the number of distinct paths, which may be path prefixes.
-    std::lock_guard<std::mutex> lock(mutex_);
-    return handlers_.size();
+  // Starts serving the requests on `workers` threads, with up to `max_queue_depth` accepted connections waiting for
+  // a worker. `ConfigureWorkerPool(0)` goes back to serving them on the listening thread. The workers being replaced
+  // serve all the already queued connections first.
+  void ConfigureWorkerPool(size_t workers, size_t max_queue_depth = kDefaultHTTPServerWorkerPoolMaxQueueDepth) {
+    std::lock_guard<std::mutex> configuration_lock(worker_pool_configuration_mutex_);
+    StopWorkers();
+    std::lock_guard<std::mutex> lock(worker_pool_mutex_);
+    stopping_workers_ = false;
+    max_queue_depth_ = max_queue_depth;
+    for (size_t i = 0; i < workers; ++i) {
+      workers_.emplace_back(&HTTPServerPOSIX::WorkerThread, this);
+    }
   }
 
- private:
-  void FindHandler(const std::string& path,
-                   std::function<void(Request)>& output_handler,
-                   URLPathArgs& output_url_args) {
-    // Just `return` is safe. Uninitialized `output_handler` would be interpreted as "no handler found".
-    // LCOV_EXCL_START
-    if (path.empty()) {
-      std::cerr << "HTTP: path is empty.\n";
-      return;
+  // Starts receiving the requests on `loops` `epoll`-based event loops. `ConfigureEventLoops(0)` stops them.
+  // Meant to be called before the server gets busy: the connections the stopped loops were still receiving
+  // the requests from are closed.
+  void ConfigureEventLoops(size_t loops = std::max(std::thread::hardware_concurrency(), 1u)) {
+#ifdef CURRENT_POSIX
+    std::lock_guard<std::mutex> configuration_lock(worker_pool_configuration_mutex_);
+    StopEventLoops();
+    std::vector<std::unique_ptr<HTTPServerEventLoop>> event_loops;
+    for (size_t i = 0; i < loops; ++i) {
+      event_loops.push_back(std::make_unique<HTTPServerEventLoop>(
+          [this](current::net::Connection&& connection, size_t requests_served) {
+            DispatchConnection(std::move(connection), requests_served);
+          },
+          [this](const std::string& request_target) {
+            // The requests to the routes with streamed bodies are dispatched without waiting for the body.
+            const std::shared_ptr<const HTTPRoutesTrie> routes = std::atomic_load(&routes_);
+            if (!routes->HasStreamedBodies()) {
+              return false;
+            }
+            URLPathArgs url_path_args;
+            const HTTPRoute* route = routes->Match(URL(request_target).path, url_path_args);
+            return route && route->max_streamed_body_length;
+          }));
+      if (keep_alive_max_requests_) {
+        event_loops.back()->SetIdleTimeout(std::chrono::milliseconds(keep_alive_idle_timeout_ms_));
+      }
+      event_loops.back()->SetRequestTimeout(std::chrono::milliseconds(request_timeout_ms_));
     }
-    if (path[0] != '/') {
-      std::cerr << "HTTP: path does not start with a slash.\n";
-      return;
+    std::lock_guard<std::mutex> lock(event_loops_mutex_);
+    event_loops_.swap(event_loops);
+#else
+    if (loops) {
+      CURRENT_THROW(EventLoopsNotSupportedException("The HTTP server event loops require `epoll`."));
     }
-    // LCOV_EXCL_STOP
-
-    // Work with the path by trying to match the full one, then the one with the last component removed,
-    // then the one with two last components removed, etc.
-    // As a component is removed, it's removed from `base_path` and is added to `url_args`.
-    std::string& remaining_path = output_url_args.base_path;
-    remaining_path = path;
+#endif
+  }
 
-    // Friendly reminder: `remaining_path[0]` is guaranteed to be '/'.
-    while (true) {
-      while (remaining_path.length() > 1 && remaining_path.back() == '/') {
-        remaining_path.resize(remaining_path.length() - 1);
-      }
+  // Keeps the connections open for up to `max_requests_per_connection` requests, as long as the next request
+  // arrives within `idle_timeout`. Only has effect with the event loops running, see `ConfigureEventLoops()`.
+  void EnableKeepAlive(std::chrono::milliseconds idle_timeout = kDefaultHTTPServerKeepAliveIdleTimeout,
+                       size_t max_requests_per_connection = kDefaultHTTPServerKeepAliveMaxRequests) {
+    keep_alive_idle_timeout_ms_ = static_cast<int64_t>(idle_timeout.count());
+    keep_alive_max_requests_ = max_requests_per_connection;
+    SetEventLoopsIdleTimeout(idle_timeout);
+  }
 
-      const auto cit = handlers_.find(remaining_path);
-      if (cit != handlers_.end()) {
-        const auto cit2 = cit->second.find(output_url_args.size());
-        if (cit2 != cit->second.end()) {
-          output_handler = cit2->second;
-          return;
-        }
-      }
+  // Goes back to closing every connection once its response is sent. The kept alive connections close after
+  // their next request, or once idle for the keep-alive idle timeout, the default one if it was set to zero.
+  void DisableKeepAlive() {
+    keep_alive_max_requests_ = 0u;
+    if (!keep_alive_idle_timeout_ms_) {
+      keep_alive_idle_timeout_ms_ = static_cast<int64_t>(kDefaultHTTPServerKeepAliveIdleTimeout.count());
+    }
+    SetEventLoopsIdleTimeout(std::chrono::milliseconds(keep_alive_idle_timeout_ms_));
+  }
 
-      if (remaining_path == "/") {
-        break;
-      }
+  // The new connections are closed unless the headers of their first request arrive within `request_timeout`
+  // and the rest of it keeps coming. Zero means no timeout. Only has effect with the event loops running.
+  void SetRequestTimeout(std::chrono::milliseconds request_timeout = kDefaultHTTPServerRequestTimeout) {
+    request_timeout_ms_ = static_cast<int64_t>(request_timeout.count());
+#ifdef CURRENT_POSIX
+    std::lock_guard<std::mutex> lock(event_loops_mutex_);
+    for (auto& event_loop : event_loops_) {
+      event_loop->SetRequestTimeout(request_timeout);
+    }
+#endif
+  }
 
-      const size_t arg_begin_index = remaining_path.rfind('/') + 1;
-      output_url_args.add(remaining_path.substr(arg_begin_index));
-      remaining_path.resize(arg_begin_index);
+  HTTPServerWorkerPoolStats WorkerPoolStats() const {
+    HTTPServerWorkerPoolStats stats;
+    {
+      std::lock_guard<std::mutex> lock(worker_pool_mutex_);
+      stats.workers = workers_.size();
+      stats.max_queue_depth = workers_.empty() ? 0u : max_queue_depth_;
+      stats.queue_depth = queue_.size();
+      stats.dispatched = dispatched_;
+      stats.rejected = rejected_;
+    }
+    stats.kept_alive = kept_alive_;
+#ifdef CURRENT_POSIX
+    std::lock_guard<std::mutex> lock(event_loops_mutex_);
+    stats.event_loops = event_loops_.size();
+    for (const auto& event_loop : event_loops_) {
+      stats.awaiting_requests += event_loop->PendingConnectionsCount();
     }
+#endif
+    return stats;
+  }
+
+  size_t PathHandlersCount() const {
+    // NOTE: The total number of handlers is no longer an interesting measure.
+    //       Just return the number of distinct paths, which may be path prefixes.
+    std::lock_guard<std::mutex> lock(mutex_);
+    return handlers_.size();
+  }
+
+ private:
+  // Compiles the routes from `handlers_` for `ServeConnection()` to match the requests against, see `routes.h`.
+  // Called with `mutex_` locked.
+  void CompileRoutes() {
+    std::atomic_store(&routes_, std::shared_ptr<const HTTPRoutesTrie>(std::make_shared<HTTPRoutesTrie>(handlers_)));
   }
 
   void Thread(current::net::Socket socket) {
     // TODO(dkorolev): Benchmark QPS.
     while (!terminating_) {
       try {
-        std::unique_ptr<current::net::HTTPServerConnection> connection(
-            new current::net::HTTPServerConnection(socket.Accept()));
+        current::net::Connection connection(socket.Accept());
         if (terminating_) {
-          // Already terminating. Will not send the response, and this
-          // lack of response should not result in an exception.
-          connection->DoNotSendAnyResponse();
+          // Already terminating. The connection is closed without a response.
           break;
         }
-        std::function<void(Request)> handler;
-        URLPathArgs url_path_args;
+#ifdef CURRENT_POSIX
         {
-          // TODO(dkorolev): Read-write lock for performance?
-          std::lock_guard<std::mutex> lock(mutex_);
-          FindHandler(connection->HTTPRequest().URL().path, handler, url_path_args);
-        }
-        if (handler) {
-          // OK, here's the tricky part with error handling and exceptions in this multithreaded world.
-          // * On the one hand, the connection should be std::move-d into the request,
-          //   since it might end up being served in another thread, via a message queue, etc.
-          //   Thus, the user code is responsible for closing the connection.
-          //   Not to mention that the std::move-d away connection can easily outlive this scope.
-          // * On the other hand, if an exception occurs in user code, we need to return a 500,
-          //   which should obviously happen before the connection object is destructed.
-          //   This seems like a good reason to not std::move it away, or move it away with some flag,
-          //   but I thought hard of it, and don't think it's a good choice -- D.K.
-          //
-          // Solution: Do nothing here. No matter how tempting it is, it won't work across threads. Period.
-          //
-          // The implementation of HTTP connection will return an "INTERNAL SERVER ERROR"
-          // if no response was sent. That's what the user gets. In debugger, they can put a breakpoint there
-          // and see what caused the error.
-          //
-          // It is the job of the user of this library to ensure no exceptions leave their code.
-          // In practice, a top-level try-catch for `const current::Exception& e` is good enough.
-          try {
-            handler(Request(std::move(connection), url_path_args));
-          } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
-            // WARNING: This `catch` is really not sufficient, it just logs a message
-            // if a user exception occurred in the same thread that ran the handler.
-            // DO NOT COUNT ON IT.
-            std::cerr << "HTTP route failed in user code: " << e.what() << '\n';  // LCOV_EXCL_LINE
+          std::lock_guard<std::mutex> lock(event_loops_mutex_);
+          if (!event_loops_.empty()) {
+            event_loops_[next_event_loop_++ % event_loops_.size()]->Add(std::move(connection));
+            continue;
           }
-        } else {
-          connection->SendHTTPResponse(current::net::DefaultNotFoundMessage(),
-                                       HTTPResponseCode.NotFound,
-                                       current::net::constants::kDefaultHTMLContentType);
         }
-      } catch (const current::net::ChunkSizeNotAValidHEXValue&) {
-        // The `ChunkSizeNotAValidHEXValue` situation, if emerged, is already handled with a "400 BAD REQUEST" response.
-      } catch (const current::net::HTTPPayloadTooLarge&) {
-        // The `HTTPPayloadTooLarge` situation, if emerged, is already handled with a "413 ENTITY TOO LARGE" response.
-      } catch (const current::net::EmptySocketException&) {  // LCOV_EXCL_LINE
-        // Silently discard errors if no data was sent in.
+#endif
+        DispatchConnection(std::move(connection));
       } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
         // TODO(dkorolev): More reliable logging.
         std::cerr << "HTTP route failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
@@ -456,6 +611,222 @@ class HTTPServerPOSIX final {
     }
   }
 
+  // Hands the connection over to the worker pool, if there is one, or serves it right away.
+  void DispatchConnection(current::net::Connection&& connection, size_t requests_served = 0u) {
+    bool serve_now = false;
+    {
+      std::lock_guard<std::mutex> lock(worker_pool_mutex_);
+      if (workers_.empty()) {
+        serve_now = true;
+      } else if (queue_.size() < max_queue_depth_) {
+        queue_.emplace_back(std::move(connection), requests_served);
+        ++dispatched_;
+        worker_pool_condition_variable_.notify_one();
+        return;
+      } else {
+        ++rejected_;
+      }
+    }
+    if (serve_now) {
+      ServeConnection(std::move(connection), requests_served);
+    } else {
+      try {
+        current::net::HTTPResponder::SendHTTPResponse(connection,
+                                                      current::net::DefaultServiceUnavailableMessage(),
+                                                      HTTPResponseCode.ServiceUnavailable,
+                                                      current::net::constants::kDefaultHTMLContentType);
+      } catch (const current::Exception& e) {                                         // LCOV_EXCL_LINE
+        std::cerr << "HTTP could not reject the connection: " << e.what() << '\n';  // LCOV_EXCL_LINE
+      }
+    }
+  }
+
+  void WorkerThread() {
+    while (true) {
+      std::unique_ptr<current::net::Connection> connection;
+      size_t requests_served;
+      {
+        std::unique_lock<std::mutex> lock(worker_pool_mutex_);
+        worker_pool_condition_variable_.wait(lock, [this]() { return stopping_workers_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          // Only exit once the queue is drained, so that every accepted connection is served.
+          return;
+        }
+        connection = std::make_unique<current::net::Connection>(std::move(queue_.front().first));
+        requests_served = queue_.front().second;
+        queue_.pop_front();
+      }
+      ServeConnection(std::move(*connection), requests_served);
+    }
+  }
+
+  void StopWorkers() {
+    std::vector<std::thread> workers;
+    {
+      std::lock_guard<std::mutex> lock(worker_pool_mutex_);
+      stopping_workers_ = true;
+      workers.swap(workers_);
+      worker_pool_condition_variable_.notify_all();
+    }
+    // With `workers_` empty, the listening thread no longer queues the connections, and serves them itself.
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  void StopEventLoops() {
+#ifdef CURRENT_POSIX
+    std::vector<std::unique_ptr<HTTPServerEventLoop>> event_loops;
+    {
+      std::lock_guard<std::mutex> lock(event_loops_mutex_);
+      event_loops.swap(event_loops_);
+    }
+    // The event loops are destroyed, and their threads joined, here, outside the lock.
+#endif
+  }
+
+  void SetEventLoopsIdleTimeout(std::chrono::milliseconds idle_timeout) {
+#ifdef CURRENT_POSIX
+    std::lock_guard<std::mutex> lock(event_loops_mutex_);
+    for (auto& event_loop : event_loops_) {
+      event_loop->SetIdleTimeout(idle_timeout);
+    }
+#else
+    static_cast<void>(idle_timeout);
+#endif
+  }
+
+  // Whether the connection should stay open after responding to this request, its `requests_served + 1`-th.
+  bool ShouldKeepAlive(const current::net::HTTPServerConnection& connection, size_t requests_served) const {
+    if (requests_served + 1u >= keep_alive_max_requests_ || connection.HTTPRequest().BodyIsStreamed()) {
+      return false;
+    }
+#ifdef CURRENT_POSIX
+    {
+      std::lock_guard<std::mutex> lock(event_loops_mutex_);
+      if (event_loops_.empty()) {
+        return false;
+      }
+    }
+    const auto& request = connection.HTTPRequest();
+    const std::string value = current::strings::ToLower(request.headers().GetOrDefault("Connection", ""));
+    if (request.HTTPVersion() == "HTTP/1.1") {
+      return value.find("close") == std::string::npos;
+    } else if (request.HTTPVersion() == "HTTP/1.0") {
+      return value.find("keep-alive") != std::string::npos;
+    } else {
+      return false;
+    }
+#else
+    static_cast<void>(connection);
+    return false;
+#endif
+  }
+
+  // Hands the connection, once the response to its `requests_served`-th request is sent, back to an event loop.
+  void RecycleConnection(current::net::Connection&& connection, size_t requests_served, std::string&& received) {
+#ifdef CURRENT_POSIX
+    if (!terminating_) {
+      std::lock_guard<std::mutex> lock(event_loops_mutex_);
+      if (!event_loops_.empty()) {
+        ++kept_alive_;
+        event_loops_[next_event_loop_++ % event_loops_.size()]->Add(
+            std::move(connection), requests_served, std::move(received));
+      }
+    }
+#else
+    static_cast<void>(connection);
+    static_cast<void>(requests_served);
+    static_cast<void>(received);
+#endif
+    // Otherwise the connection is closed here.
+  }
+
+  // Parses the request from the accepted connection and runs its handler, on the listening thread or on a worker.
+  // `requests_served` is the number of requests served on this connection before, if it has been kept alive.
+  void ServeConnection(current::net::Connection&& accepted_connection, size_t requests_served = 0u) {
+    try {
+      // The route is matched as soon as the URL is parsed, to tell whether the handler reads the body itself.
+      // The routes are kept alive, along with the handler, for as long as the handler runs.
+      std::shared_ptr<const HTTPRoutesTrie> routes;
+      URLPathArgs url_path_args;
+      const HTTPRoute* route = nullptr;
+      const auto match = [this, &routes, &url_path_args, &route](const std::string& path) {
+        routes = std::atomic_load(&routes_);
+        route = routes->Match(path, url_path_args);
+      };
+      std::unique_ptr<current::net::HTTPServerConnection> connection(new current::net::HTTPServerConnection(
+          std::move(accepted_connection),
+          current::net::HTTPDefaultHelper::ConstructionParams(),
+          16 * 1024 + 1,
+          1.95,
+          [&match, &route](const current::net::HTTPRequestData& request) -> uint64_t {
+            match(request.URL().path);
+            return route ? route->max_streamed_body_length : 0u;
+          }));
+      if (!routes) {
+        match(connection->HTTPRequest().URL().path);  // LCOV_EXCL_LINE -- No first line in the request.
+      }
+      if (terminating_) {
+        // Already terminating. Will not send the response, and this
+        // lack of response should not result in an exception.
+        connection->DoNotSendAnyResponse();
+        return;
+      }
+      if (ShouldKeepAlive(*connection, requests_served)) {
+        connection->KeepAlive([this, requests_served](current::net::Connection&& kept_alive_connection,
+                                                      std::string&& received) {
+          RecycleConnection(std::move(kept_alive_connection), requests_served + 1u, std::move(received));
+        });
+      }
+      if (route) {
+        // OK, here's the tricky part with error handling and exceptions in this multithreaded world.
+        // * On the one hand, the connection should be std::move-d into the request,
+        //   since it might end up being served in another thread, via a message queue, etc.
+        //   Thus, the user code is responsible for closing the connection.
+        //   Not to mention that the std::move-d away connection can easily outlive this scope.
+        // * On the other hand, if an exception occurs in user code, we need to return a 500,
+        //   which should obviously happen before the connection object is destructed.
+        //   This seems like a good reason to not std::move it away, or move it away with some flag,
+        //   but I thought hard of it, and don't think it's a good choice -- D.K.
+        //
+        // Solution: Do nothing here. No matter how tempting it is, it won't work across threads. Period.
+        //
+        // The implementation of HTTP connection will return an "INTERNAL SERVER ERROR"
+        // if no response was sent. That's what the user gets. In debugger, they can put a breakpoint there
+        // and see what caused the error.
+        //
+        // It is the job of the user of this library to ensure no exceptions leave their code.
+        // In practice, a top-level try-catch for `const current::Exception& e` is good enough.
+        try {
+          route->handler(Request(std::move(connection), url_path_args));
+        } catch (const current::net::ChunkSizeNotAValidHEXValue&) {
+          // Thrown by `r.BodyReader()`, and already handled with a "400 BAD REQUEST" response.
+        } catch (const current::net::HTTPPayloadTooLarge&) {
+          // Thrown by `r.BodyReader()`, and already handled with a "413 ENTITY TOO LARGE" response.
+        } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
+          // WARNING: This `catch` is really not sufficient, it just logs a message
+          // if a user exception occurred in the same thread that ran the handler.
+          // DO NOT COUNT ON IT.
+          std::cerr << "HTTP route failed in user code: " << e.what() << '\n';  // LCOV_EXCL_LINE
+        }
+      } else {
+        connection->SendHTTPResponse(current::net::DefaultNotFoundMessage(),
+                                     HTTPResponseCode.NotFound,
+                                     current::net::constants::kDefaultHTMLContentType);
+      }
+    } catch (const current::net::ChunkSizeNotAValidHEXValue&) {
+      // The `ChunkSizeNotAValidHEXValue` situation, if emerged, is already handled with a "400 BAD REQUEST" response.
+    } catch (const current::net::HTTPPayloadTooLarge&) {
+      // The `HTTPPayloadTooLarge` situation, if emerged, is already handled with a "413 ENTITY TOO LARGE" response.
+    } catch (const current::net::EmptySocketException&) {  // LCOV_EXCL_LINE
+      // Silently discard errors if no data was sent in.
+    } catch (const current::Exception& e) {  // LCOV_EXCL_LINE
+      // TODO(dkorolev): More reliable logging.
+      std::cerr << "HTTP route failed: " << e.what() << '\n';  // LCOV_EXCL_LINE
+    }
+  }
+
   void ValidateRoute(const std::string& path) {
     if (path.empty() || path[0] != '/') {
       CURRENT_THROW(PathDoesNotStartWithSlash("HTTP URL path does not start with a slash: `" + path + "`."));
@@ -471,7 +842,8 @@ class HTTPServerPOSIX final {
   HTTPRoutesScopeEntry DoRegisterHandler(const std::string& path,
                                          std::function<void(Request)> handler,
                                          const URLPathArgs::CountMask path_args_count_mask,
-                                         const ReRegisterRoute policy) {
+                                         const ReRegisterRoute policy,
+                                         uint64_t max_streamed_body_length = 0u) {
     // LCOV_EXCL_START
     if (static_cast<uint16_t>(path_args_count_mask) == 0) {
       return HTTPRoutesScopeEntry();
@@ -508,9 +880,10 @@ class HTTPServerPOSIX final {
       URLPathArgs::CountMask mask = URLPathArgs::CountMask::None;  // `None` == 1 == (1 << 0).
       for (size_t i = 0; i <= URLPathArgs::MaxArgsCount; ++i, mask = mask << 1) {
         if ((path_args_count_mask & mask) == mask) {
-          handlers_per_path[i] = handler;
+          handlers_per_path[i] = HTTPRoute(handler, max_streamed_body_length);
         }
       }
+      CompileRoutes();
     }
 
     if (policy == ReRegisterRoute::SilentlyUpdateExisting) {
@@ -524,12 +897,44 @@ class HTTPServerPOSIX final {
 
   std::atomic_bool terminating_;
   const int port_;
+
+  // The worker pool. Empty `workers_` means the requests are served on the listening thread.
+  std::mutex worker_pool_configuration_mutex_;
+  mutable std::mutex worker_pool_mutex_;
+  std::condition_variable worker_pool_condition_variable_;
+  std::vector<std::thread> workers_;
+  std::deque<std::pair<current::net::Connection, size_t>> queue_;  // With the number of requests served before.
+  size_t max_queue_depth_ = kDefaultHTTPServerWorkerPoolMaxQueueDepth;
+  bool stopping_workers_ = false;
+  uint64_t dispatched_ = 0u;
+  uint64_t rejected_ = 0u;
+
+  // Keep-alive. Zero `keep_alive_max_requests_` means the connections are closed after the first response.
+  std::atomic<size_t> keep_alive_max_requests_;
+  std::atomic<int64_t> keep_alive_idle_timeout_ms_;
+  std::atomic<uint64_t> kept_alive_;
+
+  // For the event loops to close the connections that do not send their first request, see `SetRequestTimeout()`.
+  std::atomic<int64_t> request_timeout_ms_;
+
+#ifdef CURRENT_POSIX
+  // The event loops, if any, with the connections distributed among them round-robin.
+  mutable std::mutex event_loops_mutex_;
+  std::vector<std::unique_ptr<HTTPServerEventLoop>> event_loops_;
+  size_t next_event_loop_ = 0u;
+#endif
+
+  // The routes the requests are matched against, recompiled from `handlers_` on every change, see `CompileRoutes()`.
+  // Only accessed via `std::atomic_load()` and `std::atomic_store()`.
+  std::shared_ptr<const HTTPRoutesTrie> routes_;
+
+  // Declared after the worker pool and the routes, which the listening thread uses from the very start.
   std::thread thread_;
 
-  // TODO(dkorolev): Look into read-write mutexes here.
+  // Guards `handlers_`, the routes as registered, and `static_file_servers_`.
   mutable std::mutex mutex_;
 
-  std::map<std::string, std::map<size_t, std::function<void(Request)>>> handlers_;
+  std::map<std::string, HTTPRoutesTrie::handlers_per_path_t> handlers_;
   std::vector<std::unique_ptr<StaticFileServer>> static_file_servers_;
 };
 
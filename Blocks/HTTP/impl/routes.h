@@ -0,0 +1,206 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The routes of `HTTPServerPOSIX`, compiled into a trie of the components of their paths.
+//
+// The trie is immutable: the server compiles a new one on every `Register()` and `UnRegister()`, and swaps it in
+// atomically, so that `Match()` routes the requests without taking the lock of the server. `Match()` itself does
+// not allocate memory, except for the URL path args and the base path it returns.
+
+#ifndef BLOCKS_HTTP_IMPL_ROUTES_H
+#define BLOCKS_HTTP_IMPL_ROUTES_H
+
+#include "../../../port.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../request.h"
+
+#include "../../URL/url.h"
+
+namespace current {
+namespace http {
+
+// The handler of the route, along with the maximum length of the body it reads itself, see `StreamedRequestBody`.
+struct HTTPRoute final {
+  std::function<void(Request)> handler;
+  uint64_t max_streamed_body_length = 0u;  // Zero for the body to be read in full before the handler is called.
+
+  HTTPRoute() = default;
+  HTTPRoute(std::function<void(Request)> handler, uint64_t max_streamed_body_length)
+      : handler(handler), max_streamed_body_length(max_streamed_body_length) {}
+};
+
+class HTTPRoutesTrie final {
+ public:
+  using handlers_per_path_t = std::map<size_t, HTTPRoute>;  // Keyed by the number of the URL path args.
+
+  HTTPRoutesTrie() = default;
+
+  // The paths of `routes` are as validated by `Register()`: starting with a slash, and not ending with one.
+  explicit HTTPRoutesTrie(const std::map<std::string, handlers_per_path_t>& routes) {
+    for (const auto& route : routes) {
+      Node* node = &root_;
+      const std::string& path = route.first;
+      size_t begin = 1u;
+      while (begin < path.length()) {
+        size_t end = path.find('/', begin);
+        if (end == std::string::npos) {
+          end = path.length();
+        }
+        node = node->MutableChild(path.substr(begin, end - begin));
+        begin = end + 1u;
+      }
+      node->handlers = route.second;
+      for (const auto& handler : route.second) {
+        if (handler.second.max_streamed_body_length) {
+          has_streamed_bodies_ = true;
+        }
+      }
+    }
+  }
+
+  // Whether any of the routes reads the body of the request itself, for the server to not look for them otherwise.
+  bool HasStreamedBodies() const { return has_streamed_bodies_; }
+
+  // Returns the route for `path`, filling in `output_url_args`, or `nullptr` if there is none.
+  // Matches what the longest registered prefix of `path` accepts as the URL path args, then the next longest, etc.
+  const HTTPRoute* Match(const std::string& path, URLPathArgs& output_url_args) const {
+    if (path.empty() || path[0] != '/') {
+      return nullptr;  // LCOV_EXCL_LINE
+    }
+
+    // The trailing slashes are ignored, as are the empty components within the URL path args.
+    size_t length = path.length();
+    while (length > 1u && path[length - 1u] == '/') {
+      --length;
+    }
+
+    // Walk down the trie along the components of the path, as long as they match.
+    // `prefix_end` is where the path of `node` ends within `path`, zero for the root.
+    const Node* node = &root_;
+    size_t prefix_end = 0u;
+    while (prefix_end + 1u < length) {
+      const size_t begin = prefix_end + 1u;
+      const size_t end = std::min(path.find('/', begin), length);
+      const Node* child = node->Child(path.data() + begin, end - begin);
+      if (!child) {
+        break;
+      }
+      node = child;
+      prefix_end = end;
+    }
+
+    // Then walk up the trie, every level up adding one more URL path arg.
+    size_t args_count = CountComponents(path, prefix_end, length);
+    while (true) {
+      const auto cit = node->handlers.find(args_count);
+      if (cit != node->handlers.end()) {
+        output_url_args.base_path.assign(path, 0u, node == &root_ ? 1u : prefix_end);
+        AddComponents(path, prefix_end, length, output_url_args);
+        return &cit->second;
+      }
+      if (node == &root_) {
+        return nullptr;
+      }
+      prefix_end -= node->key_length + 1u;
+      if (node->key_length) {
+        ++args_count;  // The empty components, of the paths registered with double slashes, are not URL path args.
+      }
+      node = node->parent;
+    }
+  }
+
+ private:
+  struct Node final {
+    const Node* parent = nullptr;
+    size_t key_length = 0u;
+    handlers_per_path_t handlers;
+    std::vector<std::pair<std::string, std::unique_ptr<Node>>> children;  // Sorted by the path component.
+
+    const Node* Child(const char* key, size_t key_length) const {
+      const auto less = [key_length](const std::pair<std::string, std::unique_ptr<Node>>& lhs, const char* rhs) {
+        return lhs.first.compare(0u, std::string::npos, rhs, key_length) < 0;
+      };
+      const auto cit = std::lower_bound(children.begin(), children.end(), key, less);
+      if (cit != children.end() && !cit->first.compare(0u, std::string::npos, key, key_length)) {
+        return cit->second.get();
+      } else {
+        return nullptr;
+      }
+    }
+
+    Node* MutableChild(const std::string& key) {
+      auto it = std::lower_bound(children.begin(),
+                                 children.end(),
+                                 key,
+                                 [](const std::pair<std::string, std::unique_ptr<Node>>& lhs, const std::string& rhs) {
+                                   return lhs.first < rhs;
+                                 });
+      if (it == children.end() || it->first != key) {
+        std::unique_ptr<Node> child = std::make_unique<Node>();
+        child->parent = this;
+        child->key_length = key.length();
+        it = children.insert(it, std::make_pair(key, std::move(child)));
+      }
+      return it->second.get();
+    }
+  };
+
+  // The number of the non-empty components of `path` between `begin`, which is zero or points to a slash, and `end`.
+  static size_t CountComponents(const std::string& path, size_t begin, size_t end) {
+    size_t count = 0u;
+    for (size_t i = begin; i + 1u < end; ++i) {
+      if (path[i] == '/' && path[i + 1u] != '/') {
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  // Adds these components as the URL path args, the last one first.
+  static void AddComponents(const std::string& path, size_t begin, size_t end, URLPathArgs& output_url_args) {
+    while (end > begin) {
+      const size_t slash = path.rfind('/', end - 1u);
+      if (slash + 1u < end) {
+        output_url_args.add(path.substr(slash + 1u, end - slash - 1u));
+      }
+      end = slash;
+    }
+  }
+
+  Node root_;
+  bool has_streamed_bodies_ = false;
+};
+
+}  // namespace http
+}  // namespace current
+
+#endif  // BLOCKS_HTTP_IMPL_ROUTES_H
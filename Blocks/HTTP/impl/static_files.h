@@ -0,0 +1,249 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The static files served from their open file descriptors, see `ServeStaticFilesFromOptions::serve_from_open_files`.
+//
+// The body of the response is sent via `sendfile(2)` on Linux, and is never kept in memory. The responses carry
+// `ETag` and `Last-Modified`, and the conditional requests, `If-None-Match` and `If-Modified-Since`, are answered
+// "304 NOT MODIFIED" as appropriate. A single byte range can be requested with `Range`, and `If-Range`.
+// If the file `name.gz` exists next to `name`, it is served instead, with `Content-Encoding: gzip`, to the clients
+// whose `Accept-Encoding` allows it. The files are expected to not change while they are being served.
+
+#ifndef BLOCKS_HTTP_IMPL_STATIC_FILES_H
+#define BLOCKS_HTTP_IMPL_STATIC_FILES_H
+
+#include "../../../port.h"
+
+#ifndef CURRENT_WINDOWS
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../request.h"
+
+#include "../../../Bricks/file/exceptions.h"
+#include "../../../Bricks/net/http/http.h"
+#include "../../../Bricks/strings/printf.h"
+#include "../../../Bricks/strings/split.h"
+#include "../../../Bricks/strings/util.h"
+#include "../../../Bricks/time/chrono.h"
+
+namespace current {
+namespace http {
+
+class OpenStaticFile final {
+ public:
+  explicit OpenStaticFile(const std::string& file_name) : fd_(::open(file_name.c_str(), O_RDONLY | O_CLOEXEC)) {
+    struct stat info;
+    if (fd_ < 0 || ::fstat(fd_, &info)) {
+      if (fd_ >= 0) {
+        ::close(fd_);  // LCOV_EXCL_LINE
+      }
+      CURRENT_THROW(current::CannotReadFileException(file_name));
+    }
+    size_ = static_cast<uint64_t>(info.st_size);
+    modified_ = std::chrono::seconds(info.st_mtime);
+    last_modified_ = FormatDateTimeAsIMFFix(modified_);
+    // The inode, for the gzip-compressed sibling to have a different `ETag` even if of the same size and age.
+    etag_ = current::strings::Printf("\"%llx-%llx-%llx\"",
+                                     static_cast<unsigned long long>(info.st_ino),
+                                     static_cast<unsigned long long>(size_),
+                                     static_cast<unsigned long long>(info.st_mtime));
+  }
+  ~OpenStaticFile() { ::close(fd_); }
+
+  // Whether `file_name` is a regular file, as `name.gz` should be to be picked up as the sibling of `name`.
+  static bool Exists(const std::string& file_name) {
+    struct stat info;
+    return !::stat(file_name.c_str(), &info) && S_ISREG(info.st_mode);
+  }
+
+  int FD() const { return fd_; }
+  uint64_t Size() const { return size_; }
+  const std::string& ETag() const { return etag_; }
+  const std::string& LastModified() const { return last_modified_; }
+
+  // Whether the copy the client already has, as told by the conditional request headers, is this one.
+  bool NotModified(const current::net::http::Headers& request_headers) const {
+    if (request_headers.Has("If-None-Match")) {
+      // `If-Modified-Since` is to be ignored when `If-None-Match` is present.
+      for (const std::string& tag : current::strings::Split(request_headers.Get("If-None-Match"), ',')) {
+        std::string trimmed = current::strings::Trim(tag);
+        if (trimmed.compare(0u, 2u, "W/") == 0) {
+          trimmed = trimmed.substr(2u);
+        }
+        if (trimmed == "*" || trimmed == etag_) {
+          return true;
+        }
+      }
+      return false;
+    } else if (request_headers.Has("If-Modified-Since")) {
+      const std::chrono::microseconds since = IMFFixDateTimeStringToTimestamp(request_headers.Get("If-Modified-Since"));
+      return since.count() && since >= modified_;
+    } else {
+      return false;
+    }
+  }
+
+ private:
+  const int fd_;
+  uint64_t size_;
+  std::chrono::microseconds modified_;
+  std::string last_modified_;
+  std::string etag_;
+
+  OpenStaticFile(const OpenStaticFile&) = delete;
+  void operator=(const OpenStaticFile&) = delete;
+};
+
+namespace impl {
+
+// Whether the `Accept-Encoding` header of the request allows the gzip-compressed response.
+inline bool AcceptsGzip(const std::string& accept_encoding) {
+  bool any = false;
+  for (const std::string& encoding : current::strings::Split(accept_encoding, ',')) {
+    const std::vector<std::string> params = current::strings::Split(encoding, ';');
+    if (params.empty()) {
+      continue;  // LCOV_EXCL_LINE
+    }
+    double q = 1.0;
+    for (size_t i = 1u; i < params.size(); ++i) {
+      const std::string param = current::strings::Trim(params[i]);
+      if (param.compare(0u, 2u, "q=") == 0) {
+        q = std::atof(param.c_str() + 2u);
+      }
+    }
+    const std::string name = current::strings::ToLower(current::strings::Trim(params[0]));
+    if (name == "gzip") {
+      return q > 0;
+    } else if (name == "*") {
+      any = q > 0;
+    }
+  }
+  return any;
+}
+
+enum class ByteRange { Absent, Satisfiable, Unsatisfiable };
+
+// Parses the single byte range of the `Range` header into `[begin, end)`. The multiple ranges and the malformed
+// headers are ignored, as if there was no `Range` header, and the whole file is served.
+inline ByteRange ParseByteRange(const std::string& range, uint64_t size, uint64_t& begin, uint64_t& end) {
+  if (range.compare(0u, 6u, "bytes=") != 0 || range.find(',') != std::string::npos) {
+    return ByteRange::Absent;
+  }
+  const std::string spec = current::strings::Trim(range.substr(6u));
+  const size_t dash = spec.find('-');
+  if (dash == std::string::npos ||
+      spec.find_first_not_of("0123456789", 0u) != dash ||
+      spec.find_first_not_of("0123456789", dash + 1u) != std::string::npos ||
+      (dash == 0u && dash + 1u == spec.length())) {
+    return ByteRange::Absent;
+  }
+  if (dash == 0u) {
+    // The suffix range, `bytes=-N`, is the last N bytes.
+    const uint64_t suffix = std::strtoull(spec.c_str() + 1u, nullptr, 10);
+    if (!suffix || !size) {
+      return ByteRange::Unsatisfiable;
+    }
+    begin = size - std::min(suffix, size);
+    end = size;
+  } else {
+    // The range is `bytes=first-last`, with both ends included, or `bytes=first-`, up to the end of the file.
+    const bool up_to_end = dash + 1u == spec.length();
+    const uint64_t first = std::strtoull(spec.c_str(), nullptr, 10);
+    const uint64_t last = up_to_end ? size : std::strtoull(spec.c_str() + dash + 1u, nullptr, 10);
+    if (!up_to_end && last < first) {
+      return ByteRange::Absent;
+    }
+    if (first >= size) {
+      return ByteRange::Unsatisfiable;
+    }
+    begin = first;
+    end = up_to_end ? size : std::min(last + 1u, size);
+  }
+  return ByteRange::Satisfiable;
+}
+
+}  // namespace current::http::impl
+
+// Responds to the `GET` request with the file, or with its `gzipped` sibling, if there is one and it is acceptable.
+inline void ServeOpenStaticFile(Request& r,
+                                const std::string& content_type,
+                                const OpenStaticFile& file,
+                                const OpenStaticFile* gzipped) {
+  const bool gzip = gzipped && impl::AcceptsGzip(r.headers.GetOrDefault("Accept-Encoding", ""));
+  const OpenStaticFile& served = gzip ? *gzipped : file;
+
+  current::net::http::Headers headers;
+  headers.Set("ETag", served.ETag());
+  headers.Set("Last-Modified", served.LastModified());
+  if (gzipped) {
+    headers.Set("Vary", "Accept-Encoding");
+  }
+  if (gzip) {
+    headers.Set("Content-Encoding", "gzip");
+  }
+  if (served.NotModified(r.headers)) {
+    r.connection.SendHTTPResponse("", HTTPResponseCode.NotModified, content_type, headers);
+    return;
+  }
+
+  headers.Set("Accept-Ranges", "bytes");
+  uint64_t begin = 0u;
+  uint64_t end = served.Size();
+  const impl::ByteRange range =
+      r.headers.Has("Range") && r.headers.GetOrDefault("If-Range", served.ETag()) == served.ETag()
+          ? impl::ParseByteRange(r.headers.Get("Range"), served.Size(), begin, end)
+          : impl::ByteRange::Absent;
+  if (range == impl::ByteRange::Unsatisfiable) {
+    headers.Set("Content-Range",
+                current::strings::Printf("bytes */%llu", static_cast<unsigned long long>(served.Size())));
+    r.connection.SendHTTPResponse("", HTTPResponseCode.RequestedRangeNotSatisfiable, content_type, headers);
+  } else if (range == impl::ByteRange::Satisfiable) {
+    headers.Set("Content-Range",
+                current::strings::Printf("bytes %llu-%llu/%llu",
+                                         static_cast<unsigned long long>(begin),
+                                         static_cast<unsigned long long>(end - 1u),
+                                         static_cast<unsigned long long>(served.Size())));
+    r.connection.SendHTTPResponseFromFile(
+        served.FD(), begin, end - begin, HTTPResponseCode.PartialContent, content_type, headers);
+  } else {
+    r.connection.SendHTTPResponseFromFile(
+        served.FD(), 0u, served.Size(), HTTPResponseCode.OK, content_type, headers);
+  }
+}
+
+}  // namespace http
+}  // namespace current
+
+#endif  // CURRENT_WINDOWS
+
+#endif  // BLOCKS_HTTP_IMPL_STATIC_FILES_H
@@ -112,6 +112,10 @@ struct Request final {
     connection.SendHTTPResponse(std::forward<TS>(params)...);
   }
 
+  // The reader of the body as it is being received, for the handlers registered with `StreamedRequestBody`.
+  // For the other handlers, it reads `body`.
+  current::net::HTTPRequestBodyReader& BodyReader() { return connection.BodyReader(); }
+
   current::net::HTTPServerConnection::ChunkedResponseSender SendChunkedResponse(
       net::HTTPResponseCodeValue code = HTTPResponseCode.OK,
       const std::string& content_type = net::constants::kDefaultJSONContentType,
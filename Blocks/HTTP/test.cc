@@ -33,7 +33,11 @@ SOFTWARE.
 #include "docu/server/docu_03httpserver_04_test.cc"
 #include "docu/server/docu_03httpserver_05_test.cc"
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <string>
+#include <thread>
 
 #include "api.h"
 
@@ -64,6 +68,7 @@ using current::net::http::Headers;
 using current::net::DefaultInternalServerErrorMessage;
 using current::net::DefaultNotFoundMessage;
 using current::net::DefaultMethodNotAllowedMessage;
+using current::net::DefaultServiceUnavailableMessage;
 
 using current::net::HTTPRedirectNotAllowedException;
 using current::net::HTTPRedirectLoopException;
@@ -171,6 +176,31 @@ TEST(HTTPAPI, RegisterWithURLPathParams) {
   EXPECT_EQ("/ (user, a, 1, blah) url_path_had_trailing_slash", run("/user/a/1/blah/"));
 }
 
+TEST(HTTPAPI, ManyRoutes) {
+  const auto handler =
+      [](Request r) { r(r.url_path_args.base_path + " (" + current::strings::Join(r.url_path_args, ", ") + ")"); };
+  const auto run = [](const std::string& path) -> std::string {
+    return HTTP(GET(Printf("http://localhost:%d", FLAGS_net_api_test_port) + path)).body;
+  };
+
+  auto& server = HTTP(FLAGS_net_api_test_port);
+  HTTPRoutesScope even;
+  HTTPRoutesScope odd;
+  for (int i = 0; i < 1000; ++i) {
+    (i % 2 ? odd : even) += server.Register("/route/" + std::to_string(i), URLPathArgs::CountMask::Any, handler);
+  }
+  EXPECT_EQ(1000u, server.PathHandlersCount());
+
+  EXPECT_EQ("/route/42 ()", run("/route/42"));
+  EXPECT_EQ("/route/43 (x, y)", run("/route/43/x/y/"));
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(Printf("http://localhost:%d/route/1000", FLAGS_net_api_test_port))).code));
+
+  even = nullptr;
+  EXPECT_EQ(500u, server.PathHandlersCount());
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(Printf("http://localhost:%d/route/42", FLAGS_net_api_test_port))).code));
+  EXPECT_EQ("/route/43 (x)", run("/route/43/x"));
+}
+
 TEST(HTTPAPI, ScopeLeftHangingThrowsAnException) {
   const string url = Printf("http://localhost:%d/foo", FLAGS_net_api_test_port);
 
@@ -605,6 +635,51 @@ TEST(HTTPAPI, ChunkedResponseWithHeaders) {
   EXPECT_EQ("yeah", response.headers.Get("header"));
 }
 
+TEST(HTTPAPI, ChunkedResponseCoalesced) {
+  std::atomic_size_t chunks_received(0u);
+  const auto wait_for_chunks = [&chunks_received](size_t n) {
+    while (chunks_received < n) {
+      std::this_thread::yield();
+    }
+  };
+  const auto scope =
+      HTTP(FLAGS_net_api_test_port)
+          .Register("/coalesced",
+                    [&chunks_received, &wait_for_chunks](Request r) {
+                      auto response = r.connection.SendChunkedHTTPResponse(HTTPResponseCode.OK, "text/plain");
+                      response.Coalesce(16u, std::chrono::hours(1));
+                      response.Send("a");
+                      response.Send("b");
+                      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                      EXPECT_EQ(0u, static_cast<size_t>(chunks_received));  // Kept until `Flush()`.
+                      response.Flush();
+                      wait_for_chunks(2u);
+                      response.Send("c");
+                      response.Send("dddddddd");  // Sixteen bytes of chunks, with their sizes, are written right away.
+                      wait_for_chunks(4u);
+                      response.Send("e");
+                      response.Coalesce(0u, std::chrono::microseconds(0));  // Turning coalescing off flushes.
+                      wait_for_chunks(5u);
+                      response.Send("f");
+                      wait_for_chunks(6u);
+                      response.Coalesce(1000u, std::chrono::microseconds(0));  // No delay, so written right away.
+                      response.Send("g");
+                      wait_for_chunks(7u);
+                      response.Coalesce(1000u, std::chrono::hours(1));
+                      response.Send("h");  // Written as the response is done.
+                    });
+  std::vector<std::string> chunks;
+  const auto response = HTTP(ChunkedGET(Printf("http://localhost:%d/coalesced", FLAGS_net_api_test_port),
+                                        [](const std::string&, const std::string&) {},
+                                        [&chunks, &chunks_received](const std::string& s) {
+                                          chunks.push_back(s);
+                                          ++chunks_received;
+                                        },
+                                        []() {}));
+  EXPECT_EQ(200, static_cast<int>(response));
+  EXPECT_EQ("a|b|c|dddddddd|e|f|g|h", current::strings::Join(chunks, '|'));
+}
+
 // A hacky way to get back the response chunk by chunk. TODO(dkorolev): `ChunkedGET`.
 TEST(HTTPAPI, GetByChunksPrototype) {
   // Handler returning the result chunk by chunk.
@@ -1100,6 +1175,97 @@ TEST(HTTPAPI, ServeStaticFilesFrom) {
   EXPECT_EQ(405, static_cast<int>(HTTP(DELETE(Printf("http://localhost:%d/file.html", FLAGS_net_api_test_port))).code));
 }
 
+#ifndef CURRENT_WINDOWS
+TEST(HTTPAPI, ServeStaticFilesFromOpenFiles) {
+  FileSystem::MkDir(FLAGS_net_api_test_tmpdir, FileSystem::MkDirParameters::Silent);
+  const std::string dir = FileSystem::JoinPath(FLAGS_net_api_test_tmpdir, "static_open");
+  const auto dir_remover = current::FileSystem::ScopedRmDir(dir);
+  FileSystem::MkDir(dir, FileSystem::MkDirParameters::Silent);
+  std::string large;
+  for (int i = 0; i < 100000; ++i) {
+    large += std::to_string(i) + '\n';
+  }
+  FileSystem::WriteStringToFile("<h1>HTML index</h1>", FileSystem::JoinPath(dir, "index.html").c_str());
+  FileSystem::WriteStringToFile(large, FileSystem::JoinPath(dir, "large.txt").c_str());
+  FileSystem::WriteStringToFile("alert('JavaScript')", FileSystem::JoinPath(dir, "file.js").c_str());
+  FileSystem::WriteStringToFile("gzipped JavaScript", FileSystem::JoinPath(dir, "file.js.gz").c_str());
+
+  ServeStaticFilesFromOptions options;
+  options.serve_from_open_files = true;
+  const auto scope = HTTP(FLAGS_net_api_test_port).ServeStaticFilesFrom(dir, options);
+  const std::string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port);
+
+  // The files are served from disk, with the validators and without the gzip-compressed sibling by default.
+  const auto index = HTTP(GET(base_url + "/"));
+  EXPECT_EQ(200, static_cast<int>(index.code));
+  EXPECT_EQ("<h1>HTML index</h1>", index.body);
+  EXPECT_EQ("text/html", index.headers.Get("Content-Type"));
+  EXPECT_EQ("bytes", index.headers.Get("Accept-Ranges"));
+  ASSERT_TRUE(index.headers.Has("ETag"));
+  ASSERT_TRUE(index.headers.Has("Last-Modified"));
+  EXPECT_FALSE(index.headers.Has("Vary"));
+  EXPECT_EQ("<h1>HTML index</h1>", HTTP(GET(base_url + "/index.html")).body);
+  EXPECT_EQ(large, HTTP(GET(base_url + "/large.txt")).body);
+
+  // The conditional requests.
+  {
+    const auto response = HTTP(GET(base_url + "/").SetHeader("If-None-Match", index.headers.Get("ETag")));
+    EXPECT_EQ(304, static_cast<int>(response.code));
+    EXPECT_EQ("", response.body);
+    EXPECT_EQ(304,
+              static_cast<int>(
+                  HTTP(GET(base_url + "/").SetHeader("If-None-Match", "\"x\", " + index.headers.Get("ETag"))).code));
+    EXPECT_EQ(200, static_cast<int>(HTTP(GET(base_url + "/").SetHeader("If-None-Match", "\"x\"")).code));
+    EXPECT_EQ(304,
+              static_cast<int>(
+                  HTTP(GET(base_url + "/").SetHeader("If-Modified-Since", index.headers.Get("Last-Modified"))).code));
+    EXPECT_EQ(200,
+              static_cast<int>(
+                  HTTP(GET(base_url + "/").SetHeader("If-Modified-Since", "Thu, 01 Jan 1998 00:00:00 GMT")).code));
+  }
+
+  // The range requests.
+  {
+    const auto response = HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=10-19"));
+    EXPECT_EQ(206, static_cast<int>(response.code));
+    EXPECT_EQ(large.substr(10u, 10u), response.body);
+    EXPECT_EQ(Printf("bytes 10-19/%d", static_cast<int>(large.length())), response.headers.Get("Content-Range"));
+    EXPECT_EQ(large.substr(large.length() - 7u),
+              HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=-7")).body);
+    EXPECT_EQ(large.substr(100u), HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=100-")).body);
+    EXPECT_EQ(large.substr(large.length() - 5u),
+              HTTP(GET(base_url + "/large.txt")
+                       .SetHeader("Range", Printf("bytes=%d-100000000", static_cast<int>(large.length() - 5u))))
+                  .body);
+    const auto unsatisfiable = HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=100000000-"));
+    EXPECT_EQ(416, static_cast<int>(unsatisfiable.code));
+    EXPECT_EQ(Printf("bytes */%d", static_cast<int>(large.length())), unsatisfiable.headers.Get("Content-Range"));
+    // The multiple ranges, the malformed ones, and the ones for the other version of the file are ignored.
+    EXPECT_EQ(large, HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=0-1,5-6")).body);
+    EXPECT_EQ(large, HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=5-1")).body);
+    EXPECT_EQ(large,
+              HTTP(GET(base_url + "/large.txt").SetHeader("Range", "bytes=0-1").SetHeader("If-Range", "\"x\"")).body);
+  }
+
+  // The gzip-compressed sibling.
+  {
+    const auto plain = HTTP(GET(base_url + "/file.js"));
+    EXPECT_EQ("alert('JavaScript')", plain.body);
+    EXPECT_EQ("Accept-Encoding", plain.headers.Get("Vary"));
+    EXPECT_FALSE(plain.headers.Has("Content-Encoding"));
+    const auto gzipped = HTTP(GET(base_url + "/file.js").SetHeader("Accept-Encoding", "deflate, gzip"));
+    EXPECT_EQ("gzipped JavaScript", gzipped.body);
+    EXPECT_EQ("gzip", gzipped.headers.Get("Content-Encoding"));
+    EXPECT_EQ("application/javascript", gzipped.headers.Get("Content-Type"));
+    EXPECT_NE(plain.headers.Get("ETag"), gzipped.headers.Get("ETag"));
+    EXPECT_EQ("alert('JavaScript')",
+              HTTP(GET(base_url + "/file.js").SetHeader("Accept-Encoding", "gzip;q=0, identity")).body);
+    EXPECT_EQ("gzipped JavaScript", HTTP(GET(base_url + "/file.js").SetHeader("Accept-Encoding", "*")).body);
+    EXPECT_EQ(404, static_cast<int>(HTTP(GET(base_url + "/file.js.gz")).code));
+  }
+}
+#endif  // CURRENT_WINDOWS
+
 TEST(HTTPAPI, ServeStaticFilesFromOptionsCustomRoutePrefix) {
   FileSystem::MkDir(FLAGS_net_api_test_tmpdir, FileSystem::MkDirParameters::Silent);
   const std::string dir = FileSystem::JoinPath(FLAGS_net_api_test_tmpdir, "static");
@@ -1477,6 +1643,105 @@ TEST(HTTPAPI, PayloadTooLarge) {
   }
 }
 
+TEST(HTTPAPI, StreamedRequestBody) {
+  std::atomic_size_t bytes_streamed(0u);
+  const auto streamed = [&bytes_streamed](Request r) {
+    EXPECT_TRUE(r.body.empty());
+    std::string head;
+    size_t total = 0u;
+    bytes_streamed = 0u;
+    while (true) {
+      const std::string piece = r.BodyReader().Read();
+      if (piece.empty()) {
+        break;
+      }
+      if (head.length() < 20u) {
+        head += piece.substr(0u, 20u - head.length());
+      }
+      total += piece.length();
+      bytes_streamed = total;
+    }
+    EXPECT_TRUE(r.BodyReader().Done());
+    EXPECT_EQ(total, r.BodyReader().TotalRead());
+    r(Printf("%d:", static_cast<int>(total)) + head + '\n');
+  };
+  HTTPRoutesScope scope;
+  scope += HTTP(FLAGS_net_api_test_port).Register("/streamed", StreamedRequestBody(32 * 1024 * 1024), streamed);
+  scope += HTTP(FLAGS_net_api_test_port).Register("/buffered", [](Request r) { r(r.BodyReader().Read()); });
+  const string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port);
+
+  // The body of up to the length of the route, which is beyond `kMaxHTTPPayloadSizeInBytes`, read piece by piece.
+  {
+    const auto response = HTTP(POST(base_url + "/streamed", std::string(32 * 1024 * 1024, '.')));
+    EXPECT_EQ(200, static_cast<int>(response.code));
+    EXPECT_EQ("33554432:....................\n", response.body);
+  }
+  EXPECT_EQ("0:\n", HTTP(POST(base_url + "/streamed", "")).body);
+  EXPECT_EQ("0:\n", HTTP(GET(base_url + "/streamed")).body);
+  EXPECT_EQ("buffered", HTTP(POST(base_url + "/buffered", "buffered")).body);
+
+  const auto read_response = [](Connection& connection, const std::string& expected) {
+    string response;
+    std::vector<char> buffer(1000);
+    while (response.find(expected) == string::npos) {
+      const size_t read_count = connection.BlockingRead(&buffer[0], buffer.size());
+      EXPECT_NE(0u, read_count);
+      if (!read_count) {
+        break;  // LCOV_EXCL_LINE
+      }
+      response.append(&buffer[0], read_count);
+    }
+    return response.substr(0u, response.find('\n') + 1u);
+  };
+
+  // The chunked body is read by the handler chunk by chunk, as it arrives.
+  const auto test_chunked_body = [&bytes_streamed, &read_response](int port) {
+    Connection connection(current::net::ClientSocket("localhost", port));
+    connection.BlockingWrite("POST /streamed HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nHello\r\n", false);
+    while (bytes_streamed != 5u) {
+      std::this_thread::yield();
+    }
+    connection.BlockingWrite("7;extension=ignored\r\n, world\r\n1\r\n!\r\n0\r\nTrailer: ignored\r\n\r\n", false);
+    EXPECT_EQ("HTTP/1.1 200 OK\r\n", read_response(connection, "13:Hello, world!\n"));
+  };
+  test_chunked_body(FLAGS_net_api_test_port);
+
+  // The bodies too long for the route.
+  {
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("POST /streamed HTTP/1.1\r\nContent-Length: 33554433\r\n\r\n", false);
+    EXPECT_EQ("HTTP/1.1 413 Request Entity Too Large\r\n",
+              read_response(connection, current::net::DefaultRequestEntityTooLargeMessage()));
+  }
+  {
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("POST /streamed HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2000001\r\n", false);
+    EXPECT_EQ("HTTP/1.1 413 Request Entity Too Large\r\n",
+              read_response(connection, current::net::DefaultRequestEntityTooLargeMessage()));
+  }
+
+  // The malformed chunked body.
+  {
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port));
+    connection.BlockingWrite("POST /streamed HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nnope\r\n", false);
+    EXPECT_EQ("HTTP/1.1 400 Bad Request\r\n",
+              read_response(connection, current::net::DefaultInvalidHEXChunkSizeBadRequestMessage()));
+  }
+
+#ifdef CURRENT_POSIX
+  // The event loops hand the requests with streamed bodies over as soon as their headers are received.
+  {
+    auto& server = HTTP(FLAGS_net_api_test_port_secondary);
+    scope += server.Register("/streamed", StreamedRequestBody(1000u), streamed);
+    server.ConfigureEventLoops(1u);
+    test_chunked_body(FLAGS_net_api_test_port_secondary);
+    EXPECT_EQ("4:body\n",
+              HTTP(POST(Printf("http://localhost:%d/streamed", FLAGS_net_api_test_port_secondary), "body")).body);
+    server.ConfigureEventLoops(0u);
+  }
+#endif
+}
+
 CURRENT_STRUCT_T(HTTPAPITemplatedTestObject) {
   CURRENT_FIELD(text, std::string, "OK");
   CURRENT_FIELD(data, T);
@@ -1534,3 +1799,471 @@ TEST(HTTPAPI, JSONHasOriginWhenSentViaResponse) {
   ASSERT_TRUE(response.headers.Has("Access-Control-Allow-Origin"));
   EXPECT_EQ("*", response.headers.Get("Access-Control-Allow-Origin"));
 }
+
+TEST(HTTPAPI, WorkerPool) {
+  auto& server = HTTP(FLAGS_net_api_test_port_secondary);
+  const string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port_secondary);
+
+  std::atomic_bool slow_request_entered(false);
+  std::atomic_bool slow_request_released(false);
+  HTTPRoutesScope scope;
+  scope += server.Register("/slow",
+                           [&slow_request_entered, &slow_request_released](Request r) {
+                             slow_request_entered = true;
+                             while (!slow_request_released) {
+                               std::this_thread::yield();
+                             }
+                             r("slow\n");
+                           });
+  scope += server.Register("/fast", [](Request r) { r("fast\n"); });
+
+  EXPECT_EQ(0u, server.WorkerPoolStats().workers);
+
+  // A slow handler no longer blocks the other requests.
+  {
+    server.ConfigureWorkerPool(2u, 1u);
+    EXPECT_EQ(2u, server.WorkerPoolStats().workers);
+    EXPECT_EQ(1u, server.WorkerPoolStats().max_queue_depth);
+
+    std::thread slow_client([&base_url]() { EXPECT_EQ("slow\n", HTTP(GET(base_url + "/slow")).body); });
+    while (!slow_request_entered) {
+      std::this_thread::yield();
+    }
+    EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+    slow_request_released = true;
+    slow_client.join();
+  }
+
+  // Once the queue is full, the new connections are answered "503" right away.
+  {
+    slow_request_entered = false;
+    slow_request_released = false;
+    server.ConfigureWorkerPool(1u, 1u);
+
+    std::thread slow_client([&base_url]() { EXPECT_EQ("slow\n", HTTP(GET(base_url + "/slow")).body); });
+    while (!slow_request_entered) {
+      std::this_thread::yield();
+    }
+    std::thread queued_client([&base_url]() { EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body); });
+    while (server.WorkerPoolStats().queue_depth != 1u) {
+      std::this_thread::yield();
+    }
+
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    std::vector<char> response(1000);
+    response.resize(connection.BlockingRead(&response[0], response.size()));
+    const string response_string(response.begin(), response.end());
+    EXPECT_EQ("HTTP/1.1 503 Service Unavailable\r\n", response_string.substr(0u, response_string.find('\n') + 1u));
+    EXPECT_NE(string::npos, response_string.find(DefaultServiceUnavailableMessage()));
+    EXPECT_EQ(1u, server.WorkerPoolStats().rejected);
+
+    slow_request_released = true;
+    slow_client.join();
+    queued_client.join();
+
+    const auto stats = server.WorkerPoolStats();
+    EXPECT_EQ(0u, stats.queue_depth);
+    EXPECT_EQ(4u, stats.dispatched);
+    EXPECT_EQ(1u, stats.rejected);
+  }
+
+  // Back to serving the requests on the listening thread.
+  server.ConfigureWorkerPool(0u);
+  EXPECT_EQ(0u, server.WorkerPoolStats().workers);
+  EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+  EXPECT_EQ(4u, server.WorkerPoolStats().dispatched);
+}
+
+#ifdef CURRENT_POSIX
+TEST(HTTPAPI, EventLoops) {
+  auto& server = HTTP(FLAGS_net_api_test_port_secondary);
+  const string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port_secondary);
+
+  HTTPRoutesScope scope;
+  scope += server.Register("/fast", [](Request r) { r("fast\n"); });
+  scope += server.Register("/echo", [](Request r) { r("echo:" + r.body); });
+
+  server.ConfigureEventLoops(2u);
+  server.ConfigureWorkerPool(1u);
+  EXPECT_EQ(2u, server.WorkerPoolStats().event_loops);
+
+  const auto wait_for_awaiting_requests = [&server](size_t count) {
+    while (server.WorkerPoolStats().awaiting_requests != count) {
+      std::this_thread::yield();
+    }
+  };
+
+  // The idle connections hold no threads: the only worker is still free to serve the other requests.
+  {
+    std::vector<std::unique_ptr<Connection>> idle_connections;
+    for (int i = 0; i < 20; ++i) {
+      idle_connections.push_back(std::make_unique<Connection>(
+          current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary)));
+    }
+    wait_for_awaiting_requests(20u);
+    EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+    EXPECT_EQ("echo:body", HTTP(POST(base_url + "/echo", "body")).body);
+
+    // The request sent piece by piece is served once it is complete.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("POST /echo HTTP/1.1\r\nContent-Length: 5\r\n", true);
+    wait_for_awaiting_requests(21u);
+    connection.BlockingWrite("\r\nhel", false);
+    wait_for_awaiting_requests(21u);
+    connection.BlockingWrite("lo", false);
+    string response;
+    std::vector<char> buffer(1000);
+    while (response.find("echo:hello") == string::npos) {
+      const size_t read_count = connection.BlockingRead(&buffer[0], buffer.size());
+      ASSERT_NE(0u, read_count);
+      response.append(&buffer[0], read_count);
+    }
+    EXPECT_EQ("HTTP/1.1 200 OK\r\n", response.substr(0u, response.find('\n') + 1u));
+
+    wait_for_awaiting_requests(20u);
+  }
+
+  // The connections closed by the clients are let go of.
+  wait_for_awaiting_requests(0u);
+
+  // The chunked body is complete with its last chunk, whether or not the trailers follow it.
+  {
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel\r\n\r\n", false);
+    wait_for_awaiting_requests(1u);
+    connection.BlockingWrite("2\r\nlo\r\n0\r\nX-Trailer: yes\r\n", false);
+    wait_for_awaiting_requests(1u);
+    connection.BlockingWrite("\r\n", false);
+    string response;
+    std::vector<char> buffer(1000);
+    while (response.find("echo:hel\r\nlo") == string::npos) {
+      const size_t read_count = connection.BlockingRead(&buffer[0], buffer.size());
+      ASSERT_NE(0u, read_count);
+      response.append(&buffer[0], read_count);
+    }
+    wait_for_awaiting_requests(0u);
+  }
+
+  // The connections not sending their first request in time are closed, and so are the ones sending it too slowly.
+  server.SetRequestTimeout(std::chrono::milliseconds(200));
+  {
+    Connection silent(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    Connection slow(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    wait_for_awaiting_requests(2u);
+    try {
+      for (int i = 0; i < 10; ++i) {
+        slow.BlockingWrite("X", false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+    } catch (const current::net::SocketException&) {
+      // The server may have closed the connection already.
+    }
+    wait_for_awaiting_requests(0u);
+    std::vector<char> buffer(1000);
+    EXPECT_THROW(silent.BlockingRead(&buffer[0], buffer.size()), current::net::EmptySocketException);
+  }
+  server.SetRequestTimeout();
+
+  server.ConfigureEventLoops(0u);
+  server.ConfigureWorkerPool(0u);
+  EXPECT_EQ(0u, server.WorkerPoolStats().event_loops);
+  EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+}
+
+TEST(HTTPAPI, KeepAlive) {
+  auto& server = HTTP(FLAGS_net_api_test_port_secondary);
+  const string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port_secondary);
+
+  HTTPRoutesScope scope;
+  scope += server.Register("/fast", [](Request r) { r("fast\n"); });
+  scope += server.Register("/echo", [](Request r) { r("echo:" + r.body); });
+
+  server.ConfigureEventLoops(2u);
+  server.EnableKeepAlive(std::chrono::milliseconds(200), 3u);
+  const uint64_t kept_alive = server.WorkerPoolStats().kept_alive;
+
+  // Reads until `what` is received, or until the connection is closed if `what` is empty.
+  const auto read = [](Connection& connection, const string& what) {
+    string response;
+    std::vector<char> buffer(1000);
+    while (what.empty() || response.find(what) == string::npos) {
+      size_t read_count = 0u;
+      try {
+        read_count = connection.BlockingRead(&buffer[0], buffer.size());
+      } catch (const current::net::SocketException&) {
+      }
+      if (!read_count) {
+        EXPECT_TRUE(what.empty()) << "Closed before receiving `" << what << "`.";
+        break;
+      }
+      response.append(&buffer[0], read_count);
+    }
+    return response;
+  };
+  const auto count = [](const string& s, const string& what) {
+    size_t result = 0u;
+    for (size_t i = s.find(what); i != string::npos; i = s.find(what, i + 1u)) {
+      ++result;
+    }
+    return result;
+  };
+
+  {
+    // The pipelined requests are served in order, with the connection kept alive.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("GET /fast HTTP/1.1\r\n\r\nPOST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello", false);
+    const string pipelined = read(connection, "echo:hello");
+    EXPECT_EQ(2u, count(pipelined, "HTTP/1.1 200 OK\r\n"));
+    EXPECT_EQ(2u, count(pipelined, "Connection: keep-alive\r\n"));
+    EXPECT_LT(pipelined.find("fast\n"), pipelined.find("echo:hello"));
+
+    // The third request on the connection is the last one.
+    connection.BlockingWrite("GET /fast HTTP/1.1\r\n\r\n", false);
+    const string last = read(connection, "");
+    EXPECT_EQ(1u, count(last, "Connection: close\r\n"));
+    EXPECT_EQ("fast\n", last.substr(last.length() - 5u));
+  }
+
+  {
+    // The idle connection is closed after the timeout.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("GET /fast HTTP/1.1\r\n\r\n", false);
+    const string response = read(connection, "");
+    EXPECT_EQ(1u, count(response, "Connection: keep-alive\r\n"));
+    EXPECT_EQ(0u, server.WorkerPoolStats().awaiting_requests);
+  }
+  EXPECT_EQ(kept_alive + 3u, server.WorkerPoolStats().kept_alive);
+
+  {
+    // HTTP/1.0 and `Connection: close` requests close the connection.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("GET /fast HTTP/1.0\r\n\r\n", false);
+    EXPECT_EQ(1u, count(read(connection, ""), "Connection: close\r\n"));
+  }
+  {
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("GET /fast HTTP/1.1\r\nConnection: close\r\n\r\n", false);
+    EXPECT_EQ(1u, count(read(connection, ""), "Connection: close\r\n"));
+  }
+  {
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("GET /fast HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", false);
+    EXPECT_EQ(1u, count(read(connection, "fast\n"), "Connection: keep-alive\r\n"));
+  }
+  {
+    // The trailers of a chunked body are not taken for the next request.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", true);
+    connection.BlockingWrite("2\r\nhi\r\n0\r\nX-Trailer: yes\r\n\r\n", false);
+    EXPECT_EQ(1u, count(read(connection, "echo:hi"), "Connection: keep-alive\r\n"));
+    connection.BlockingWrite("GET /fast HTTP/1.1\r\n\r\n", false);
+    const string next = read(connection, "fast\n");
+    EXPECT_EQ(1u, count(next, "HTTP/1.1 200 OK\r\n"));
+    EXPECT_EQ(1u, count(next, "Connection: keep-alive\r\n"));
+  }
+
+  EXPECT_EQ("echo:body", HTTP(POST(base_url + "/echo", "body")).body);
+
+  {
+    // With keep-alive disabled, the connections waiting for their next request are closed once idle.
+    Connection connection(current::net::ClientSocket("localhost", FLAGS_net_api_test_port_secondary));
+    connection.BlockingWrite("GET /fast HTTP/1.1\r\n\r\n", false);
+    EXPECT_EQ(1u, count(read(connection, "fast\n"), "Connection: keep-alive\r\n"));
+    server.DisableKeepAlive();
+    EXPECT_EQ("", read(connection, ""));
+    EXPECT_EQ(0u, server.WorkerPoolStats().awaiting_requests);
+  }
+
+  server.ConfigureEventLoops(0u);
+  EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+}
+
+TEST(HTTPAPI, ClientConnectionPool) {
+  auto& server = HTTP(FLAGS_net_api_test_port_secondary);
+  const string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port_secondary);
+  auto& pool = current::Singleton<current::http::HTTPClientConnectionPool>();
+  pool.Configure(current::http::kDefaultHTTPClientMaxIdleConnectionsPerHost);
+
+  HTTPRoutesScope scope;
+  scope += server.Register("/fast", [](Request r) { r("fast\n"); });
+  scope += server.Register("/echo", [](Request r) { r("echo:" + r.body); });
+
+  // The connections the server closes are not kept.
+  const auto initial = pool.Stats();
+  EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+  EXPECT_EQ(initial.opened + 1u, pool.Stats().opened);
+  EXPECT_EQ(0u, pool.Stats().idle);
+
+  server.ConfigureEventLoops(1u);
+  server.EnableKeepAlive(std::chrono::milliseconds(200));
+
+  // The requests are sent over the same connection.
+  const uint64_t kept_alive = server.WorkerPoolStats().kept_alive;
+  {
+    const auto before = pool.Stats();
+    for (int i = 0; i < 10; ++i) {
+      EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+      EXPECT_EQ("echo:" + std::to_string(i), HTTP(POST(base_url + "/echo", std::to_string(i))).body);
+    }
+    const auto after = pool.Stats();
+    EXPECT_EQ(before.opened + 1u, after.opened);
+    EXPECT_EQ(before.reused + 19u, after.reused);
+    EXPECT_EQ(1u, after.idle);
+  }
+
+  // The connection the server has closed as idle is not used, and a new one is opened instead.
+  {
+    while (server.WorkerPoolStats().kept_alive != kept_alive + 20u) {
+      std::this_thread::yield();
+    }
+    while (server.WorkerPoolStats().awaiting_requests) {
+      std::this_thread::yield();
+    }
+    const auto before = pool.Stats();
+    EXPECT_EQ("echo:stale", HTTP(POST(base_url + "/echo", "stale")).body);
+    const auto after = pool.Stats();
+    EXPECT_EQ(before.stale + 1u, after.stale);
+    EXPECT_EQ(before.opened + 1u, after.opened);
+    EXPECT_EQ(1u, after.idle);
+  }
+
+  // With the pooling turned off, every request opens a new connection.
+  {
+    pool.Configure(0u);
+    const auto before = pool.Stats();
+    EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+    EXPECT_EQ("fast\n", HTTP(GET(base_url + "/fast")).body);
+    const auto after = pool.Stats();
+    EXPECT_EQ(before.opened + 2u, after.opened);
+    EXPECT_EQ(before.reused, after.reused);
+    EXPECT_EQ(0u, after.idle);
+  }
+
+  pool.Configure(current::http::kDefaultHTTPClientMaxIdleConnectionsPerHost);
+  server.DisableKeepAlive();
+  server.ConfigureEventLoops(0u);
+}
+TEST(HTTPAPI, AsyncClient) {
+  auto& server = HTTP(FLAGS_net_api_test_port_secondary);
+  const string base_url = Printf("http://localhost:%d", FLAGS_net_api_test_port_secondary);
+
+  HTTPRoutesScope scope;
+  scope += server.Register("/square", [](Request r) {
+    const int x = current::FromString<int>(r.url.query["x"]);
+    r(std::to_string(x * x));
+  });
+  scope += server.Register("/echo", [](Request r) { r(r.method + ':' + r.body); });
+  scope += server.Register("/from", [](Request r) {
+    r("", HTTPResponseCode.Found, current::net::constants::kDefaultHTMLContentType, Headers({{"Location", "/echo"}}));
+  });
+  scope += server.Register("/chunks", [](Request r) {
+    auto response =
+        r.connection.SendChunkedHTTPResponse(HTTPResponseCode.OK, "text/plain", Headers({{"header", "oh-well"}}));
+    response.Send("1\n");
+    response.Send("23\n");
+    response.Send("456\n");
+  });
+
+  server.ConfigureEventLoops(2u);
+  auto& client = current::Singleton<current::http::HTTPAsyncClient>();
+  const auto initial = client.Stats();
+
+  // Many requests in flight at once.
+  {
+    std::vector<std::future<current::http::HTTPResponseWithBuffer>> responses;
+    for (int i = 0; i < 100; ++i) {
+      responses.push_back(AsyncHTTP(GET(base_url + "/square?x=" + std::to_string(i))));
+    }
+    for (int i = 0; i < 100; ++i) {
+      const auto response = responses[i].get();
+      EXPECT_EQ(200, static_cast<int>(response.code));
+      EXPECT_EQ(std::to_string(i * i), response.body);
+    }
+  }
+
+  // The requests with bodies, the errors, and the redirects.
+  EXPECT_EQ("POST:data", AsyncHTTP(POST(base_url + "/echo", "data")).get().body);
+  EXPECT_EQ("PUT:", AsyncHTTP(PUT(base_url + "/echo", "")).get().body);
+  EXPECT_EQ(404, static_cast<int>(AsyncHTTP(GET(base_url + "/nope")).get().code));
+  EXPECT_EQ("", AsyncHTTP(HEAD(base_url + "/echo")).get().body);
+  ASSERT_THROW(AsyncHTTP(GET(base_url + "/from")).get(), HTTPRedirectNotAllowedException);
+  {
+    const auto response = AsyncHTTP(GET(base_url + "/from").AllowRedirects()).get();
+    EXPECT_EQ("GET:", response.body);
+    EXPECT_EQ(base_url + "/echo", response.url);
+  }
+  ASSERT_THROW(AsyncHTTP(GET("http://999.999.999.999/")).get(), SocketResolveAddressException);
+  ASSERT_THROW(AsyncHTTP(GET("http://localhost:1/")).get(), current::net::SocketConnectException);
+
+  // The callbacks.
+  {
+    std::promise<std::string> result;
+    AsyncHTTP(POST(base_url + "/echo", "callback"),
+              [&result](current::http::HTTPResponseWithBuffer&& response) { result.set_value(response.body); },
+              [&result](std::exception_ptr e) { result.set_exception(e); });
+    EXPECT_EQ("POST:callback", result.get_future().get());
+  }
+
+  // The chunks of `ChunkedGET` are passed on one by one.
+  {
+    std::vector<std::string> headers;
+    std::vector<std::string> chunks;
+    const auto code =
+        AsyncHTTP(ChunkedGET(base_url + "/chunks",
+                             [&headers](const std::string& k, const std::string& v) { headers.push_back(k + '=' + v); },
+                             [&chunks](const std::string& s) { chunks.push_back(s); },
+                             [&chunks]() { chunks.push_back("DONE"); })).get();
+    EXPECT_EQ(200, static_cast<int>(code));
+    EXPECT_EQ("1\n|23\n|456\n|DONE", current::strings::Join(chunks, '|'));
+    EXPECT_EQ("Content-Type=text/plain Connection=keep-alive header=oh-well Transfer-Encoding=chunked",
+              current::strings::Join(headers, ' '));
+  }
+
+  // Throwing from a callback of `ChunkedGET` aborts the request.
+  {
+    struct StopHere {};
+    ASSERT_THROW(AsyncHTTP(ChunkedGET(base_url + "/chunks",
+                                      [](const std::string&, const std::string&) {},
+                                      [](const std::string&) { throw StopHere(); },
+                                      []() {})).get(),
+                 StopHere);
+  }
+
+  // Throwing from the `done_callback` of `ChunkedGET` fails the request, and it is counted as failed once.
+  {
+    struct StopHere {};
+    const auto before = client.Stats();
+    ASSERT_THROW(AsyncHTTP(ChunkedGET(base_url + "/chunks",
+                                      [](const std::string&, const std::string&) {},
+                                      [](const std::string&) {},
+                                      []() { throw StopHere(); })).get(),
+                 StopHere);
+    const auto after = client.Stats();
+    EXPECT_EQ(before.completed, after.completed);
+    EXPECT_EQ(before.failed + 1u, after.failed);
+  }
+
+  // Throwing from `on_response` does not make the delivered response an error.
+  {
+    std::promise<std::string> result;
+    std::atomic_bool error_reported(false);
+    AsyncHTTP(POST(base_url + "/echo", "throw"),
+              [&result](current::http::HTTPResponseWithBuffer&& response) {
+                result.set_value(response.body);
+                throw std::logic_error("Expected.");
+              },
+              [&error_reported](std::exception_ptr) { error_reported = true; });
+    EXPECT_EQ("POST:throw", result.get_future().get());
+    // Issue one more request through the same thread, so that the exception has been handled by when it completes.
+    EXPECT_EQ("GET:", AsyncHTTP(GET(base_url + "/echo")).get().body);
+    EXPECT_FALSE(error_reported);
+  }
+
+  const auto stats = client.Stats();
+  EXPECT_EQ(0u, stats.outstanding);
+  EXPECT_EQ(initial.completed + 109u, stats.completed);
+  EXPECT_EQ(initial.failed + 5u, stats.failed);
+
+  server.ConfigureEventLoops(0u);
+}
+#endif  // CURRENT_POSIX
@@ -41,6 +41,7 @@ inline std::string DefaultInternalServerErrorMessage() { return "<h1>INTERNAL SE
 inline std::string DefaultMethodNotAllowedMessage() { return "<h1>METHOD NOT ALLOWED</h1>\n"; }
 inline std::string DefaultRequestEntityTooLargeMessage() { return "<h1>ENTITY TOO LARGE</h1>\n"; }
 inline std::string DefaultInvalidHEXChunkSizeBadRequestMessage() { return "<h1>BAD CHUNK SIZE</h1>\n"; }
+inline std::string DefaultServiceUnavailableMessage() { return "<h1>SERVICE UNAVAILABLE</h1>\n"; }
 
 }  // namespace net
 }  // namespace current
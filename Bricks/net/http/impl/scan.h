@@ -0,0 +1,171 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The scanner of the lines of HTTP headers, looking for the CRLF and the ':' within the same pass over the bytes.
+//
+// Compares 32 bytes at a time with AVX2, if the code is compiled with it enabled, as with `-mavx2` or `-march=native`,
+// or 16 bytes at a time with SSE2, which every x86-64 CPU has. Otherwise, and with `CURRENT_BRICKS_HTTP_NO_SIMD`
+// defined, one byte at a time.
+
+#ifndef BRICKS_NET_HTTP_IMPL_SCAN_H
+#define BRICKS_NET_HTTP_IMPL_SCAN_H
+
+#include "../../../../port.h"
+
+#include <cstdint>
+#include <string>
+
+#include "../constants.h"
+
+#if !defined(CURRENT_BRICKS_HTTP_NO_SIMD) && defined(__AVX2__)
+#define CURRENT_BRICKS_HTTP_SCAN_AVX2
+#include <immintrin.h>
+#endif
+
+#if !defined(CURRENT_BRICKS_HTTP_NO_SIMD) && defined(__SSE2__)
+#define CURRENT_BRICKS_HTTP_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace current {
+namespace net {
+
+// The offsets, from the beginning of the line, of the CRLF ending it and of the first ':' before that CRLF.
+// `std::string::npos` if there is no such CRLF within the scanned bytes, or no such ':'.
+struct HTTPLineScan final {
+  size_t colon = std::string::npos;
+  size_t crlf = std::string::npos;
+};
+
+namespace impl {
+
+inline HTTPLineScan ScanHTTPLineScalar(const char* begin, const char* end) {
+  HTTPLineScan result;
+  for (const char* p = begin; p < end; ++p) {
+    if (*p == '\r') {
+      if (p + 1 < end && p[1] == '\n') {
+        result.crlf = static_cast<size_t>(p - begin);
+        return result;
+      }
+    } else if (*p == constants::kHeaderKeyValueSeparator && result.colon == std::string::npos) {
+      result.colon = static_cast<size_t>(p - begin);
+    }
+  }
+  return result;
+}
+
+#ifdef CURRENT_BRICKS_HTTP_SCAN_SSE2
+struct ScanHTTPLineWithSSE2 final {
+  enum : size_t { kBlockSize = 16 };
+  static void Masks(const char* p, uint32_t& cr, uint32_t& colon) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    cr = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+    colon = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(constants::kHeaderKeyValueSeparator))));
+  }
+};
+#endif  // CURRENT_BRICKS_HTTP_SCAN_SSE2
+
+#ifdef CURRENT_BRICKS_HTTP_SCAN_AVX2
+struct ScanHTTPLineWithAVX2 final {
+  enum : size_t { kBlockSize = 32 };
+  static void Masks(const char* p, uint32_t& cr, uint32_t& colon) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    cr = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r'))));
+    colon = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(constants::kHeaderKeyValueSeparator))));
+  }
+};
+#endif  // CURRENT_BRICKS_HTTP_SCAN_AVX2
+
+#if defined(CURRENT_BRICKS_HTTP_SCAN_SSE2) || defined(CURRENT_BRICKS_HTTP_SCAN_AVX2)
+// Looks at the bytes in blocks of `IMPL::kBlockSize`, with the bitmasks of '\r'-s and ':'-s within each block.
+// The remaining bytes, fewer than a block, are scanned one by one.
+template <class IMPL>
+inline HTTPLineScan ScanHTTPLineVectorized(const char* begin, const char* end) {
+  HTTPLineScan result;
+  const char* p = begin;
+  // Strictly more than a block left, for the byte after the last '\r' of the block to be there to check for the '\n'.
+  while (static_cast<size_t>(end - p) > IMPL::kBlockSize) {
+    uint32_t cr;
+    uint32_t colon;
+    IMPL::Masks(p, cr, colon);
+    if (result.colon != std::string::npos) {
+      colon = 0u;
+    }
+    for (; cr; cr &= cr - 1u) {
+      const uint32_t i = static_cast<uint32_t>(__builtin_ctz(cr));
+      if (p[i + 1u] == '\n') {
+        const uint32_t colon_before_crlf = colon & ((1u << i) - 1u);
+        if (colon_before_crlf) {
+          result.colon = static_cast<size_t>(p - begin) + __builtin_ctz(colon_before_crlf);
+        }
+        result.crlf = static_cast<size_t>(p - begin) + i;
+        return result;
+      }
+    }
+    if (colon) {
+      result.colon = static_cast<size_t>(p - begin) + __builtin_ctz(colon);
+    }
+    p += IMPL::kBlockSize;
+  }
+  const HTTPLineScan tail = ScanHTTPLineScalar(p, end);
+  if (tail.crlf != std::string::npos) {
+    result.crlf = static_cast<size_t>(p - begin) + tail.crlf;
+  }
+  if (result.colon == std::string::npos && tail.colon != std::string::npos) {
+    result.colon = static_cast<size_t>(p - begin) + tail.colon;
+  }
+  return result;
+}
+#endif
+
+// The instruction set `ScanHTTPLine()` uses.
+inline const char* ScanHTTPLineInstructionSet() {
+#if defined(CURRENT_BRICKS_HTTP_SCAN_AVX2)
+  return "AVX2";
+#elif defined(CURRENT_BRICKS_HTTP_SCAN_SSE2)
+  return "SSE2";
+#else
+  return "scalar";
+#endif
+}
+
+}  // namespace current::net::impl
+
+// Scans `[begin, end)` for the first CRLF, and for the first ':' before it.
+inline HTTPLineScan ScanHTTPLine(const char* begin, const char* end) {
+#if defined(CURRENT_BRICKS_HTTP_SCAN_AVX2)
+  return impl::ScanHTTPLineVectorized<impl::ScanHTTPLineWithAVX2>(begin, end);
+#elif defined(CURRENT_BRICKS_HTTP_SCAN_SSE2)
+  return impl::ScanHTTPLineVectorized<impl::ScanHTTPLineWithSSE2>(begin, end);
+#else
+  return impl::ScanHTTPLineScalar(begin, end);
+#endif
+}
+
+}  // namespace current::net
+}  // namespace current
+
+#endif  // BRICKS_NET_HTTP_IMPL_SCAN_H
@@ -25,6 +25,10 @@ SOFTWARE.
 #ifndef BRICKS_NET_HTTP_IMPL_SERVER_H
 #define BRICKS_NET_HTTP_IMPL_SERVER_H
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <map>
 #include <sstream>
 #include <string>
@@ -38,6 +42,8 @@ SOFTWARE.
 
 #include "../headers/headers.h"
 
+#include "scan.h"
+
 #include "../../exceptions.h"
 
 #include "../../tcp/tcp.h"
@@ -122,16 +128,21 @@ struct HTTPResponder {
   // The actual implementation of sending the HTTP response.
   template <typename T>
   static void SendHTTPResponseImpl(Connection& connection,
+                                   ConnectionType connection_type,
                                    const T& begin,
                                    const T& end,
                                    HTTPResponseCodeValue code,
                                    const std::string& content_type,
                                    const http::Headers& extra_headers) {
     std::ostringstream os;
-    PrepareHTTPResponseHeader(os, ConnectionClose, code, content_type, extra_headers);
+    PrepareHTTPResponseHeader(os, connection_type, code, content_type, extra_headers);
     os << "Content-Length: " << (end - begin) << constants::kCRLF << constants::kCRLF;
-    connection.BlockingWrite(os.str(), true);
-    connection.BlockingWrite(begin, end, false);
+    if (begin != end) {
+      connection.BlockingWriteV(
+          {os.str(), WriteBuffer(&(*begin), (end - begin) * sizeof(typename T::value_type))}, false);
+    } else {
+      connection.BlockingWrite(os.str(), false);
+    }
   }
 
   // Only support STL containers of chars and bytes, this does not yet cover std::string.
@@ -143,7 +154,7 @@ struct HTTPResponder {
       HTTPResponseCodeValue code = HTTPResponseCode.OK,
       const std::string& content_type = constants::kDefaultContentType,
       const http::Headers& extra_headers = http::Headers()) {
-    SendHTTPResponseImpl(connection, begin, end, code, content_type, extra_headers);
+    SendHTTPResponseImpl(connection, ConnectionClose, begin, end, code, content_type, extra_headers);
   }
   template <typename T>
   static ENABLE_IF<sizeof(typename T::value_type) == 1> SendHTTPResponse(
@@ -152,7 +163,8 @@ struct HTTPResponder {
       HTTPResponseCodeValue code = HTTPResponseCode.OK,
       const std::string& content_type = constants::kDefaultContentType,
       const http::Headers& extra_headers = http::Headers()) {
-    SendHTTPResponseImpl(connection, container.begin(), container.end(), code, content_type, extra_headers);
+    SendHTTPResponseImpl(
+        connection, ConnectionClose, container.begin(), container.end(), code, content_type, extra_headers);
   }
 
   // Special case to handle std::string.
@@ -161,7 +173,39 @@ struct HTTPResponder {
                                HTTPResponseCodeValue code = HTTPResponseCode.OK,
                                const std::string& content_type = constants::kDefaultContentType,
                                const http::Headers& extra_headers = http::Headers()) {
-    SendHTTPResponseImpl(connection, string.begin(), string.end(), code, content_type, extra_headers);
+    SendHTTPResponseImpl(connection, ConnectionClose, string.begin(), string.end(), code, content_type, extra_headers);
+  }
+
+  // Same as the above, with the `Connection:` header to send explicitly specified.
+  template <typename T>
+  static ENABLE_IF<sizeof(typename T::value_type) == 1> SendHTTPResponse(
+      Connection& connection,
+      ConnectionType connection_type,
+      const T& begin,
+      const T& end,
+      HTTPResponseCodeValue code = HTTPResponseCode.OK,
+      const std::string& content_type = constants::kDefaultContentType,
+      const http::Headers& extra_headers = http::Headers()) {
+    SendHTTPResponseImpl(connection, connection_type, begin, end, code, content_type, extra_headers);
+  }
+  template <typename T>
+  static ENABLE_IF<sizeof(typename T::value_type) == 1> SendHTTPResponse(
+      Connection& connection,
+      ConnectionType connection_type,
+      T&& container,
+      HTTPResponseCodeValue code = HTTPResponseCode.OK,
+      const std::string& content_type = constants::kDefaultContentType,
+      const http::Headers& extra_headers = http::Headers()) {
+    SendHTTPResponseImpl(
+        connection, connection_type, container.begin(), container.end(), code, content_type, extra_headers);
+  }
+  static void SendHTTPResponse(Connection& connection,
+                               ConnectionType connection_type,
+                               const std::string& string,
+                               HTTPResponseCodeValue code = HTTPResponseCode.OK,
+                               const std::string& content_type = constants::kDefaultContentType,
+                               const http::Headers& extra_headers = http::Headers()) {
+    SendHTTPResponseImpl(connection, connection_type, string.begin(), string.end(), code, content_type, extra_headers);
   }
 
   // Support `CURRENT_STRUCT`-s.
@@ -174,7 +218,7 @@ struct HTTPResponder {
       const http::Headers& extra_headers = http::Headers::DefaultJSONHeaders()) {
     // TODO(dkorolev): We should probably make this not only correct but also efficient.
     const std::string s = JSON(std::forward<T>(object)) + '\n';
-    SendHTTPResponseImpl(connection, s.begin(), s.end(), code, content_type, extra_headers);
+    SendHTTPResponseImpl(connection, ConnectionClose, s.begin(), s.end(), code, content_type, extra_headers);
   }
 
   // Support `CURRENT_STRUCT`-s wrapper under a user-defined name.
@@ -189,7 +233,32 @@ struct HTTPResponder {
       const http::Headers& extra_headers = http::Headers::DefaultJSONHeaders()) {
     // TODO(dkorolev): We should probably make this not only correct but also efficient.
     const std::string s = "{\"" + name + "\":" + JSON(std::forward<T>(object)) + "}\n";
-    SendHTTPResponseImpl(connection, s.begin(), s.end(), code, content_type, extra_headers);
+    SendHTTPResponseImpl(connection, ConnectionClose, s.begin(), s.end(), code, content_type, extra_headers);
+  }
+
+  // Same as the above two, with the `Connection:` header to send explicitly specified.
+  template <class T>
+  static ENABLE_IF<IS_CURRENT_STRUCT(current::decay<T>)> SendHTTPResponse(
+      Connection& connection,
+      ConnectionType connection_type,
+      T&& object,
+      HTTPResponseCodeValue code = HTTPResponseCode.OK,
+      const std::string& content_type = constants::kDefaultJSONContentType,
+      const http::Headers& extra_headers = http::Headers::DefaultJSONHeaders()) {
+    const std::string s = JSON(std::forward<T>(object)) + '\n';
+    SendHTTPResponseImpl(connection, connection_type, s.begin(), s.end(), code, content_type, extra_headers);
+  }
+  template <class T>
+  static ENABLE_IF<IS_CURRENT_STRUCT(current::decay<T>)> SendHTTPResponse(
+      Connection& connection,
+      ConnectionType connection_type,
+      T&& object,
+      const std::string& name,
+      HTTPResponseCodeValue code = HTTPResponseCode.OK,
+      const std::string& content_type = constants::kDefaultJSONContentType,
+      const http::Headers& extra_headers = http::Headers::DefaultJSONHeaders()) {
+    const std::string s = "{\"" + name + "\":" + JSON(std::forward<T>(object)) + "}\n";
+    SendHTTPResponseImpl(connection, connection_type, s.begin(), s.end(), code, content_type, extra_headers);
   }
 };
 
@@ -220,6 +289,156 @@ class HTTPDefaultHelper {
   std::string body_;
 };
 
+// The body of the request left for the handler to read, see `stream_body` of `GenericHTTPRequestData`.
+struct StreamedHTTPRequestBody final {
+  uint64_t max_length = 0u;  // Zero if the body has been read in full before the handler is called.
+  bool chunked = false;
+  uint64_t length = 0u;  // The `Content-Length`, unless `chunked`.
+  std::string received;  // The beginning of the body, received along with the headers.
+};
+
+// Reads the body of the request from the connection as the handler asks for it, so that the body is never kept in
+// memory in full. Nothing is read from the connection until asked for, so that the client sending the body faster
+// than it is read is slowed down by TCP itself. The chunked body growing longer than `max_length` is responded to
+// with "413 ENTITY TOO LARGE", the malformed one with "400 BAD REQUEST", and the respective exception is thrown.
+class HTTPRequestBodyReader final {
+ public:
+  enum : size_t { kDefaultReadLength = 64 * 1024, kMaxChunkSizeLineLength = 1024 };
+
+  // Called to respond to the request with an error, unless the response has already been sent.
+  using reject_function_t = std::function<void(const std::string& message, HTTPResponseCodeValue code)>;
+
+  HTTPRequestBodyReader(Connection& connection, StreamedHTTPRequestBody&& body, reject_function_t reject)
+      : connection_(connection),
+        max_length_(body.max_length),
+        chunked_(body.chunked),
+        received_(std::move(body.received)),
+        remaining_(body.chunked ? 0u : body.length),
+        done_(!body.chunked && !body.length),
+        reject_(reject) {}
+
+  // Reads up to `max_length` bytes of the body into `buffer`, waiting for at least one to arrive.
+  // Returns the number of bytes read, zero once the whole body has been read.
+  size_t Read(char* buffer, size_t max_length) {
+    if (!done_ && !remaining_) {
+      ReadChunkSize();  // Only in chunked mode, as the body of known length is done once it is read in full.
+    }
+    if (done_ || !max_length) {
+      return 0u;
+    }
+    const size_t length = static_cast<size_t>(std::min(static_cast<uint64_t>(max_length), remaining_));
+    size_t read_count;
+    if (received_offset_ < received_.length()) {
+      read_count = std::min(length, received_.length() - received_offset_);
+      std::memcpy(buffer, received_.data() + received_offset_, read_count);
+      received_offset_ += read_count;
+    } else {
+      read_count = connection_.BlockingRead(buffer, length);
+      if (!read_count) {
+        CURRENT_THROW(ConnectionResetByPeer());  // LCOV_EXCL_LINE
+      }
+    }
+    remaining_ -= read_count;
+    total_read_ += read_count;
+    if (!chunked_ && !remaining_) {
+      done_ = true;
+    }
+    return read_count;
+  }
+
+  // Returns the next up to `max_length` bytes of the body, or an empty string once the whole body has been read.
+  std::string Read(size_t max_length = kDefaultReadLength) {
+    std::string result(max_length, '\0');
+    result.resize(Read(&result[0], max_length));
+    return result;
+  }
+
+  // Whether the whole body has been read. Becomes `true` for the chunked body once `Read()` has returned zero.
+  bool Done() const { return done_; }
+
+  // The number of bytes of the body read so far.
+  uint64_t TotalRead() const { return total_read_; }
+
+ private:
+  void Reject(const std::string& message, HTTPResponseCodeValue code) {
+    done_ = true;
+    if (reject_) {
+      reject_(message, code);
+    }
+  }
+
+  void RejectBadChunk() {
+    Reject(net::DefaultInvalidHEXChunkSizeBadRequestMessage(), HTTPResponseCode.BadRequest);
+    CURRENT_THROW(ChunkSizeNotAValidHEXValue());
+  }
+
+  // Reads the next line of the chunked body, not including its CRLF.
+  std::string ReadLine() {
+    std::string line;
+    while (true) {
+      if (received_offset_ == received_.length()) {
+        received_.resize(kMaxChunkSizeLineLength);
+        received_.resize(connection_.BlockingRead(&received_[0], received_.length()));
+        received_offset_ = 0u;
+        if (received_.empty()) {
+          CURRENT_THROW(ConnectionResetByPeer());  // LCOV_EXCL_LINE
+        }
+      }
+      const size_t lf = received_.find('\n', received_offset_);
+      line.append(received_, received_offset_, lf == std::string::npos ? std::string::npos : lf - received_offset_);
+      received_offset_ = lf == std::string::npos ? received_.length() : lf + 1u;
+      if (lf != std::string::npos) {
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+        return line;
+      }
+      if (line.length() > kMaxChunkSizeLineLength) {
+        RejectBadChunk();
+      }
+    }
+  }
+
+  void ReadChunkSize() {
+    // The data of the previous chunk is followed by CRLF, the size of the next chunk goes on the next line.
+    if (chunks_read_++ && !ReadLine().empty()) {
+      RejectBadChunk();
+    }
+    const std::string line = ReadLine();
+    const size_t end = std::min(line.find(';'), line.length());  // Chunk extensions, if any, are ignored.
+    char* parsed_end = nullptr;
+    const uint64_t size = std::strtoull(line.c_str(), &parsed_end, 16);
+    if (!end || parsed_end != line.c_str() + end) {
+      RejectBadChunk();
+    }
+    if (!size) {
+      // The last chunk, followed by the optional trailers, which are ignored, and the blank line.
+      while (!ReadLine().empty()) {
+      }
+      done_ = true;
+    } else if (size > max_length_ - total_read_) {
+      Reject(net::DefaultRequestEntityTooLargeMessage(), HTTPResponseCode.RequestEntityTooLarge);
+      CURRENT_THROW(HTTPPayloadTooLarge());
+    } else {
+      remaining_ = size;
+    }
+  }
+
+  Connection& connection_;
+  const uint64_t max_length_;
+  const bool chunked_;
+  std::string received_;
+  size_t received_offset_ = 0u;
+  uint64_t remaining_;  // Of the body of known length, or of the current chunk.
+  uint64_t total_read_ = 0u;
+  size_t chunks_read_ = 0u;
+  bool done_;
+  const reject_function_t reject_;
+
+  HTTPRequestBodyReader(const HTTPRequestBodyReader&) = delete;
+  void operator=(const HTTPRequestBodyReader&) = delete;
+};
+
 // In constructor, GenericHTTPRequestData parses HTTP response from `Connection&` is was provided with.
 // Extracts method, path (URL + parameters), and, if provided, the body.
 //
@@ -228,6 +447,7 @@ class HTTPDefaultHelper {
 // * std::string RawPath() (the URL before parsing).
 // * std::string Method().
 // * std::string Body(), size_t BodyLength(), const char* Body{Begin,End}().
+// * bool BodyIsStreamed(), see `stream_body` below.
 //
 // Exceptions:
 // * ConnectionResetByPeer       : When the server is using chunked transfer and doesn't fully send one.
@@ -236,11 +456,17 @@ class HTTPDefaultHelper {
 template <class HELPER>
 class GenericHTTPRequestData : public HELPER {
  public:
+  // Called once the first line of the request, with the method and the URL, has been parsed. Returns the maximum
+  // length of the body for the handler to read via `HTTPRequestBodyReader`, or zero for the body to be read in full
+  // before the handler is called. If the body is streamed, the parsing stops at the blank line after the headers.
+  using stream_body_function_t = std::function<uint64_t(const GenericHTTPRequestData&)>;
+
   inline GenericHTTPRequestData(
       Connection& c,
       const typename HELPER::ConstructionParams& params = typename HELPER::ConstructionParams(),
       const int initial_buffer_size = 16 * 1024 + 1,
-      const double buffer_growth_k = 1.95)
+      const double buffer_growth_k = 1.95,
+      const stream_body_function_t& stream_body = nullptr)
       : HELPER(params), buffer_(initial_buffer_size) {
     // `offset` is the number of bytes read into `buffer_` so far.
     // `length_cap` is infinity first (size_t is unsigned), and it changes/ to the absolute offset
@@ -264,6 +490,9 @@ class GenericHTTPRequestData : public HELPER {
     // `receiving_body_in_chunks` is set to true when the parsing is already in the "receive body" mode.
     bool receiving_body_in_chunks = false;
 
+    // `receiving_trailers` is set once the last chunk has been received, until the blank line ending the request.
+    bool receiving_trailers = false;
+
     while (offset < length_cap) {
       size_t chunk;
       size_t read_count;
@@ -292,9 +521,11 @@ class GenericHTTPRequestData : public HELPER {
         CURRENT_THROW(ConnectionResetByPeer());  // LCOV_EXCL_LINE
       }
       buffer_[offset] = '\0';
-      char* next_crlf_ptr;
+      // The CRLF ending the line, and the ':' within it, are looked for within the same pass over the line.
+      HTTPLineScan scan;
       while ((body_offset == static_cast<size_t>(-1) || offset < body_offset) &&
-             (next_crlf_ptr = strstr(&buffer_[current_line_offset], constants::kCRLF))) {
+             (scan = ScanHTTPLine(&buffer_[current_line_offset], &buffer_[offset])).crlf != std::string::npos) {
+        char* next_crlf_ptr = &buffer_[current_line_offset + scan.crlf];
         const bool line_is_blank = (next_crlf_ptr == &buffer_[current_line_offset]);
         *next_crlf_ptr = '\0';
         // `next_line_offset` is mutable since reading chunked body will change it.
@@ -311,7 +542,19 @@ class GenericHTTPRequestData : public HELPER {
               raw_path_ = pieces[1];
               url_ = current::url::URL(raw_path_);
             }
+            if (pieces.size() >= 3 && pieces[2].compare(0, 5, "HTTP/") == 0) {
+              http_version_ = pieces[2];
+            }
             first_line_parsed = true;
+            if (stream_body) {
+              streamed_body_.max_length = stream_body(*this);
+            }
+          }
+        } else if (receiving_trailers) {
+          // The trailers are ignored, the blank line ends the request.
+          if (line_is_blank) {
+            KeepBytesReceivedBeyondRequest(next_line_offset, offset);
+            return;
           }
         } else if (receiving_body_in_chunks) {
           // Ignore blank lines.
@@ -331,7 +574,7 @@ class GenericHTTPRequestData : public HELPER {
             if (chunk_length == 0) {
               // Done with the body.
               HELPER::OnChunkedBodyDone(body_buffer_begin_, body_buffer_end_);
-              return;
+              receiving_trailers = true;
             } else {
               // A chunk of length `chunk_length` bytes starts right at next_line_offset.
               size_t chunk_offset = next_line_offset;
@@ -376,8 +619,8 @@ class GenericHTTPRequestData : public HELPER {
             }
           }
         } else if (!line_is_blank) {
-          char* p = strchr(&buffer_[current_line_offset], constants::kHeaderKeyValueSeparator);
-          if (p) {
+          if (scan.colon != std::string::npos) {
+            char* p = &buffer_[current_line_offset + scan.colon];
             *p++ = '\0';
             const char* const key = &buffer_[current_line_offset];
             const char* value = p;
@@ -394,8 +637,10 @@ class GenericHTTPRequestData : public HELPER {
 
             HELPER::OnHeader(key, value);
             if (HeaderNameEquals(key, constants::kContentLengthHeaderKey)) {
-              body_length = static_cast<size_t>(atoi(value));
-              if (body_length > constants::kMaxHTTPPayloadSizeInBytes) {
+              body_length = static_cast<size_t>(std::strtoull(value, nullptr, 10));
+              const uint64_t max_body_length =
+                  BodyIsStreamed() ? streamed_body_.max_length : constants::kMaxHTTPPayloadSizeInBytes;
+              if (body_length > max_body_length) {
                 HTTPResponder::SendHTTPResponse(c,
                                                 net::DefaultRequestEntityTooLargeMessage(),
                                                 HTTPResponseCode.RequestEntityTooLarge,
@@ -413,7 +658,15 @@ class GenericHTTPRequestData : public HELPER {
         } else {
           CURRENT_BRICKS_LOG_HTTP_EVENT("http header is parsed\n");
           // The blank line is what separates HTTP headers from HTTP body.
-          if (!chunked_transfer_encoding) {
+          if (BodyIsStreamed()) {
+            // The body is left for the handler to read, along with the part of it that has already been received.
+            streamed_body_.chunked = chunked_transfer_encoding;
+            if (!chunked_transfer_encoding && body_length != static_cast<size_t>(-1)) {
+              streamed_body_.length = body_length;
+            }
+            streamed_body_.received.assign(&buffer_[next_line_offset], offset - next_line_offset);
+            return;
+          } else if (!chunked_transfer_encoding) {
             // HTTP body starts right after this last CRLF.
             body_offset = next_line_offset;
             // Non-chunked encoding. Assume BODY follows as raw data.
@@ -433,9 +686,11 @@ class GenericHTTPRequestData : public HELPER {
               }
               body_buffer_begin_ = &buffer_[body_offset];
               body_buffer_end_ = body_buffer_begin_ + body_length;
+              KeepBytesReceivedBeyondRequest(length_cap, offset);
               return;
             } else {
               // HTTP body length has not been set, so we're done..
+              KeepBytesReceivedBeyondRequest(body_offset, offset);
               return;
             }
           } else {
@@ -444,6 +699,12 @@ class GenericHTTPRequestData : public HELPER {
         }
         current_line_offset = next_line_offset;
       }
+      if (receiving_trailers && !c.HasPrefetchedData()) {
+        // The event loop hands over keep-alive requests received in full, up to the blank line after the trailers.
+        // Otherwise the connection is closed after the response, and there is no need to wait for the rest of it.
+        KeepBytesReceivedBeyondRequest(current_line_offset, offset);
+        return;
+      }
       if (receiving_body_in_chunks && current_line_offset) {
         if (offset > current_line_offset) {
           CURRENT_BRICKS_LOG_HTTP_EVENT("memmove %lu bytes from offset %lu to the beginning\n",
@@ -464,6 +725,13 @@ class GenericHTTPRequestData : public HELPER {
   inline const current::url::URL& URL() const { return url_; }
   inline const std::string& RawPath() const { return raw_path_; }
 
+  // The protocol version from the first line, "HTTP/1.1" or "HTTP/1.0", or an empty string if there was none.
+  inline const std::string& HTTPVersion() const { return http_version_; }
+
+  // The bytes that have been read from the connection past the end of this request, if the client has sent them
+  // without waiting for the response. They are the beginning of the next request on the same connection.
+  inline const std::string& ReceivedBeyondRequest() const { return received_beyond_request_; }
+
   // Note that `Body*()` methods assume that the body was fully read into memory.
   // If other means of reading the body, for example, event-based chunk parsing, is used,
   // then `Body()` will return empty string and all other `Body*()` methods will return nullptr.
@@ -492,6 +760,10 @@ class GenericHTTPRequestData : public HELPER {
     }
   }
 
+  // Whether the body is left for the handler to read, see `stream_body`. If it is, `Body()` is empty.
+  inline bool BodyIsStreamed() const { return streamed_body_.max_length != 0u; }
+  inline StreamedHTTPRequestBody& MutableStreamedBody() { return streamed_body_; }
+
  private:
   static char NormalizeHeaderChar(char c) { return c != '_' ? std::tolower(c) : '-'; }
   static bool HeaderNameEquals(const char* lhs, const char* rhs) {
@@ -503,15 +775,24 @@ class GenericHTTPRequestData : public HELPER {
     return !*lhs && !*rhs;
   }
 
+  void KeepBytesReceivedBeyondRequest(size_t request_end, size_t offset) {
+    if (offset > request_end) {
+      received_beyond_request_.assign(&buffer_[request_end], offset - request_end);
+    }
+  }
+
   // Fields available to the user via getters.
   std::string method_;
   current::url::URL url_;
   std::string raw_path_;
+  std::string http_version_;
+  std::string received_beyond_request_;
 
   // HTTP parsing fields that have to be caried out of the parsing routine.
   std::vector<char> buffer_;                 // The buffer into which data has been read, except for chunked case.
   const char* body_buffer_begin_ = nullptr;  // If BODY has been provided, pointer pair to it.
   const char* body_buffer_end_ = nullptr;    // Will not be nullptr if body_buffer_begin_ is not nullptr.
+  StreamedHTTPRequestBody streamed_body_;    // If the body is left for the handler to read.
 
   // HTTP body gets converted to an std::string representation as it's first requested.
   // TODO(dkorolev): This pattern is worth revisiting. StringPiece?
@@ -537,10 +818,23 @@ class GenericHTTPServerConnection final : public HTTPResponder {
       Connection&& c,
       const typename HTTP_REQUEST_DATA::ConstructionParams& params = typename HTTP_REQUEST_DATA::ConstructionParams(),
       const int initial_buffer_size = 16 * 1024 + 1,
-      const double buffer_growth_k = 1.95)
-      : connection_(std::move(c)), message_(connection_, params, initial_buffer_size, buffer_growth_k) {}
+      const double buffer_growth_k = 1.95,
+      const typename GenericHTTPRequestData<HTTP_REQUEST_DATA>::stream_body_function_t& stream_body = nullptr)
+      : connection_(std::move(c)),
+        message_(connection_, params, initial_buffer_size, buffer_growth_k, stream_body) {}
   ~GenericHTTPServerConnection() {
-    if (!responded_) {
+    if (responded_with_keep_alive_) {
+      // The response has been sent with `Connection: keep-alive`, hand the connection back for the next request,
+      // along with the bytes of it that might have already been received.
+      // LCOV_EXCL_START
+      try {
+        std::string received = message_.ReceivedBeyondRequest() + connection_.TakePrefetchedData();
+        keep_alive_(std::move(connection_), std::move(received));
+      } catch (const Exception& e) {
+        std::cerr << "Could not keep the HTTP connection alive: " << e.what() << std::endl;
+      }
+      // LCOV_EXCL_STOP
+    } else if (!responded_) {
       // If a user code throws an exception in a different thread, it will not be caught.
       // But, at least, capitalized "INTERNAL SERVER ERROR" will be returned.
       // It's also a good place for a breakpoint to tell the source of that exception.
@@ -566,17 +860,53 @@ class GenericHTTPServerConnection final : public HTTPResponder {
     }
   }
 
+  // The function to pass the connection and the bytes received beyond this request to once the response is sent.
+  // With it set, the regular response is sent with `Connection: keep-alive` instead of `Connection: close`.
+  using keep_alive_function_t = std::function<void(Connection&&, std::string&&)>;
+  void KeepAlive(keep_alive_function_t keep_alive) { keep_alive_ = keep_alive; }
+
   template <typename... ARGS>
   void SendHTTPResponse(ARGS&&... args) {
     if (responded_) {
       CURRENT_THROW(AttemptedToSendHTTPResponseMoreThanOnce());
     } else {
-      HTTPResponder::SendHTTPResponse(connection_, std::forward<ARGS>(args)...);
+      HTTPResponder::SendHTTPResponse(
+          connection_, keep_alive_ ? ConnectionKeepAlive : ConnectionClose, std::forward<ARGS>(args)...);
+      responded_ = true;
+      responded_with_keep_alive_ = static_cast<bool>(keep_alive_);
+    }
+  }
+
+#ifndef CURRENT_WINDOWS
+  // Sends the response with `length` bytes of the open file `fd`, starting from `offset`, as its body.
+  // See `Connection::BlockingSendFile()`.
+  void SendHTTPResponseFromFile(int fd,
+                                uint64_t offset,
+                                uint64_t length,
+                                HTTPResponseCodeValue code = HTTPResponseCode.OK,
+                                const std::string& content_type = constants::kDefaultContentType,
+                                const http::Headers& extra_headers = http::Headers()) {
+    if (responded_) {
+      CURRENT_THROW(AttemptedToSendHTTPResponseMoreThanOnce());
+    } else {
+      std::ostringstream os;
+      PrepareHTTPResponseHeader(
+          os, keep_alive_ ? ConnectionKeepAlive : ConnectionClose, code, content_type, extra_headers);
+      os << "Content-Length: " << length << constants::kCRLF << constants::kCRLF;
+      connection_.BlockingWrite(os.str(), length > 0u);
+      if (length) {
+        connection_.BlockingSendFile(fd, offset, length);
+      }
       responded_ = true;
+      responded_with_keep_alive_ = static_cast<bool>(keep_alive_);
     }
   }
+#endif  // CURRENT_WINDOWS
 
   // The wrapper to send HTTP response in chunks.
+  // Each chunk is written with a single system call. With `Coalesce()`, the chunks are kept in memory instead,
+  // and written together once they are `max_bytes` in total, or once the first of them is `max_delay` old as the
+  // next one is sent, or on `Flush()`. The chunks themselves are kept as they are, only the writes are merged.
   struct ChunkedResponseSender final {
     // `struct Impl` is the logic wrapped into an `std::unique_ptr<>` to call the destructor only once.
     struct Impl final {
@@ -585,10 +915,8 @@ class GenericHTTPServerConnection final : public HTTPResponder {
       ~Impl() {
         if (!can_no_longer_write_) {
           try {
-            connection_.BlockingWrite("0", true);
-            // Should send CRLF twice.
-            connection_.BlockingWrite(constants::kCRLF, true);
-            connection_.BlockingWrite(constants::kCRLF, false);
+            // The final, zero-length, chunk, followed by CRLF twice.
+            connection_.BlockingWriteV({pending_, "0\r\n\r\n"}, false);
           } catch (const SocketException& e) {                                          // LCOV_EXCL_LINE
             std::cerr << "Chunked response closure failed: " << e.what() << std::endl;  // LCOV_EXCL_LINE
           }                                                                             // LCOV_EXCL_LINE
@@ -599,21 +927,53 @@ class GenericHTTPServerConnection final : public HTTPResponder {
       template <typename T>
       void SendImpl(T&& data) {
         if (!data.empty()) {
-          try {
-            connection_.BlockingWrite(strings::Printf("%lX", data.size()), true);
-            connection_.BlockingWrite(constants::kCRLF, true);
-            connection_.BlockingWrite(std::forward<T>(data), true);
-            // Force every chunk to be sent out by passing `false` as the second argument.
-            connection_.BlockingWrite(constants::kCRLF, false);
-          } catch (const SocketException&) {
-            // For chunked HTTP responses, if the receiving end has closed the connection,
-            // as detected during `Send`, suppress logging about the failure to send the final "zero" chunk.
-            can_no_longer_write_ = true;
-            throw;
+          const std::string size = strings::Printf("%lX", data.size()) + constants::kCRLF;
+          const WriteBuffer bytes(&(*data.begin()), data.size() * sizeof(typename current::decay<T>::value_type));
+          if (!coalesce_max_bytes_) {
+            Write([&]() { connection_.BlockingWriteV({size, bytes, constants::kCRLF}, false); });
+          } else {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (pending_.empty()) {
+              pending_since_ = now;
+            }
+            pending_.append(size);
+            pending_.append(static_cast<const char*>(bytes.data), bytes.length);
+            pending_.append(constants::kCRLF);
+            if (pending_.length() >= coalesce_max_bytes_ || now - pending_since_ >= coalesce_max_delay_) {
+              Flush();
+            }
           }
         }
       }
 
+      void Coalesce(size_t max_bytes, std::chrono::microseconds max_delay) {
+        coalesce_max_bytes_ = max_bytes;
+        coalesce_max_delay_ = max_delay;
+        if (!coalesce_max_bytes_) {
+          Flush();
+        }
+      }
+
+      void Flush() {
+        if (!pending_.empty()) {
+          Write([this]() { connection_.BlockingWrite(pending_, false); });
+          pending_.clear();
+        }
+      }
+
+      template <typename F>
+      void Write(F&& f) {
+        try {
+          f();
+        } catch (const SocketException&) {
+          // For chunked HTTP responses, if the receiving end has closed the connection,
+          // as detected during `Send`, suppress logging about the failure to send the final "zero" chunk.
+          can_no_longer_write_ = true;
+          pending_.clear();
+          throw;
+        }
+      }
+
       // Only support STL containers of chars and bytes, this does not yet cover std::string.
       template <typename T>
       inline ENABLE_IF<std::is_same<typename T::value_type, char>::value ||
@@ -638,6 +998,10 @@ class GenericHTTPServerConnection final : public HTTPResponder {
 
       Connection& connection_;
       bool can_no_longer_write_ = false;
+      size_t coalesce_max_bytes_ = 0u;  // Zero for every chunk to be written right away.
+      std::chrono::microseconds coalesce_max_delay_ = std::chrono::microseconds(0);
+      std::string pending_;
+      std::chrono::steady_clock::time_point pending_since_;
 
       Impl() = delete;
       Impl(const Impl&) = delete;
@@ -672,6 +1036,18 @@ class GenericHTTPServerConnection final : public HTTPResponder {
       return *this;
     }
 
+    // Zero `max_bytes` turns coalescing off, and writes out the chunks kept so far.
+    inline ChunkedResponseSender& Coalesce(size_t max_bytes, std::chrono::microseconds max_delay) {
+      impl_->Coalesce(max_bytes, max_delay);
+      return *this;
+    }
+
+    // Writes out the chunks kept by `Coalesce()` so far. For the streams to call once caught up.
+    inline ChunkedResponseSender& Flush() {
+      impl_->Flush();
+      return *this;
+    }
+
     std::unique_ptr<Impl> impl_;
   };
 
@@ -702,6 +1078,27 @@ class GenericHTTPServerConnection final : public HTTPResponder {
 
   const GenericHTTPRequestData<HTTP_REQUEST_DATA>& HTTPRequest() const { return message_; }
 
+  // The reader of the body of the request, see `stream_body` of `GenericHTTPRequestData`.
+  // Reads from memory if the body has been read in full before the handler was called.
+  HTTPRequestBodyReader& BodyReader() {
+    if (!body_reader_) {
+      StreamedHTTPRequestBody body;
+      if (message_.BodyIsStreamed()) {
+        body = std::move(message_.MutableStreamedBody());
+      } else {
+        body.max_length = body.length = message_.BodyLength();
+        body.received = message_.Body();
+      }
+      body_reader_.reset(new HTTPRequestBodyReader(
+          connection_, std::move(body), [this](const std::string& message, HTTPResponseCodeValue code) {
+            if (!responded_) {
+              SendHTTPResponse(message, code, net::constants::kDefaultHTMLContentType);
+            }
+          }));
+    }
+    return *body_reader_;
+  }
+
   const IPAndPort& LocalIPAndPort() const { return connection_.LocalIPAndPort(); }
   const IPAndPort& RemoteIPAndPort() const { return connection_.RemoteIPAndPort(); }
 
@@ -709,8 +1106,11 @@ class GenericHTTPServerConnection final : public HTTPResponder {
 
  private:
   bool responded_ = false;
+  bool responded_with_keep_alive_ = false;
+  keep_alive_function_t keep_alive_;
   Connection connection_;
   GenericHTTPRequestData<HTTP_REQUEST_DATA> message_;
+  std::unique_ptr<HTTPRequestBodyReader> body_reader_;
 
   // Disable any copy/move support for extra safety.
   GenericHTTPServerConnection(const GenericHTTPServerConnection&) = delete;
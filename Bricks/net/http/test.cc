@@ -26,6 +26,7 @@ SOFTWARE.
 
 #include "headers/test.cc"
 
+#include <random>
 #include <thread>
 
 #define CURRENT_BRICKS_DEBUG_HTTP
@@ -35,6 +36,7 @@ SOFTWARE.
 
 #include "../../../3rdparty/gtest/gtest-main-with-dflags.h"
 
+#include "../../strings/escape.h"
 #include "../../strings/printf.h"
 
 DEFINE_int32(net_http_test_port, PickPortForUnitTest(), "Local port to use for the test HTTP server.");
@@ -892,6 +894,43 @@ TEST(HTTPMimeTypeTest, SmokeTest) {
   EXPECT_EQ("image/x-icon", GetFileMimeType("favicon.ico"));
 }
 
+TEST(HTTPLineScanTest, SmokeTest) {
+  using current::net::HTTPLineScan;
+  using current::net::ScanHTTPLine;
+  const auto Scan = [](const std::string& s) {
+    const HTTPLineScan scan = ScanHTTPLine(s.data(), s.data() + s.length());
+    return current::strings::Printf("%d %d", static_cast<int>(scan.colon), static_cast<int>(scan.crlf));
+  };
+  EXPECT_EQ("-1 -1", Scan(""));
+  EXPECT_EQ("-1 0", Scan("\r\n"));
+  EXPECT_EQ("-1 -1", Scan("\r"));
+  EXPECT_EQ("4 10", Scan("Host: test\r\n"));
+  EXPECT_EQ("4 -1", Scan("Host: test\r"));
+  EXPECT_EQ("-1 14", Scan("GET / HTTP/1.1\r\nHost: test\r\n"));
+  EXPECT_EQ("10 30", Scan("Connection:keep-alive\rkeep\r:\n\r\r\n\r\n"));
+  EXPECT_EQ("40 70", Scan(std::string(40, 'X') + ":http://localhost:8080/" + std::string(7, ' ') + "\r\n:"));
+  EXPECT_EQ("-1 64", Scan(std::string(64, 'X') + "\r\nX:\r\n"));
+  EXPECT_EQ("63 -1", Scan(std::string(63, 'X') + ":"));
+}
+
+TEST(HTTPLineScanTest, MatchesScalarScan) {
+  using current::net::HTTPLineScan;
+  std::mt19937 rng(42);
+  const char alphabet[] = "\r\n:ab";
+  for (size_t i = 0; i < 100000; ++i) {
+    std::string line(rng() % 100, ' ');
+    for (char& c : line) {
+      c = alphabet[rng() % (rng() % 2 ? 5 : 3)];
+    }
+    const char* begin = line.data();
+    const char* end = line.data() + line.length();
+    const HTTPLineScan golden = current::net::impl::ScanHTTPLineScalar(begin, end);
+    const HTTPLineScan scan = current::net::ScanHTTPLine(begin, end);
+    ASSERT_EQ(golden.colon, scan.colon) << current::strings::EscapeForCPlusPlus(line);
+    ASSERT_EQ(golden.crlf, scan.crlf) << current::strings::EscapeForCPlusPlus(line);
+  }
+}
+
 // TODO(dkorolev): Figure out a way to test ConnectionResetByPeer exceptions.
 
 #if 0
@@ -34,7 +34,9 @@ SOFTWARE.
 #include "../../../util/singleton.h"
 #include "../../../template/enable_if.h"
 
+#include <algorithm>
 #include <cstring>
+#include <initializer_list>
 #include <string>
 #include <utility>
 #include <vector>
@@ -46,8 +48,13 @@ SOFTWARE.
 #include <netdb.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#ifndef CURRENT_APPLE
+#include <sys/sendfile.h>
+#endif
+
 // Bricks uses `SOCKET` for socket handles in *nix.
 // Makes it easier to have the code run on both Windows and *nix.
 typedef int SOCKET;
@@ -238,6 +245,16 @@ inline std::string InetAddrToString(const struct in_addr* in) {
   }
 }
 
+// A piece of the data for `Connection::BlockingWriteV()` to write.
+struct WriteBuffer final {
+  const void* data;
+  size_t length;
+
+  WriteBuffer(const void* data, size_t length) : data(data), length(length) {}
+  WriteBuffer(const char* s) : data(s), length(strlen(s)) {}
+  WriteBuffer(const std::string& s) : data(s.data()), length(s.length()) {}
+};
+
 class Connection : public SocketHandle {
  public:
   Connection(SocketHandle&& rhs, IPAndPort&& local_ip_and_port, IPAndPort&& remote_ip_and_port)
@@ -269,6 +286,16 @@ class Connection : public SocketHandle {
       const uint8_t* end = (buffer + max_length);
       const int flags = ((policy == BlockingReadPolicy::ReturnASAP) ? 0 : MSG_WAITALL);
 
+      if (prefetched_offset_ < prefetched_.length()) {
+        const size_t prefetched_length = std::min(max_length, prefetched_.length() - prefetched_offset_);
+        std::memcpy(ptr, prefetched_.data() + prefetched_offset_, prefetched_length);
+        prefetched_offset_ += prefetched_length;
+        ptr += prefetched_length;
+        if ((policy == BlockingReadPolicy::ReturnASAP) || (ptr == end)) {
+          return prefetched_length;
+        }
+      }
+
 #ifdef CURRENT_WINDOWS
       int wsa_last_error = 0;
 #endif
@@ -393,6 +420,52 @@ class Connection : public SocketHandle {
     return *this;
   }
 
+  // Writes several buffers as one, with a single `sendmsg(2)` on Linux, instead of a system call per buffer.
+  // Used to send the HTTP header together with the body, and the size, the data and the CRLF of an HTTP chunk.
+  inline Connection& BlockingWriteV(std::initializer_list<WriteBuffer> buffers, bool more) {
+    size_t write_length = 0u;
+    for (const WriteBuffer& buffer : buffers) {
+      write_length += buffer.length;
+    }
+    CURRENT_BRICKS_NET_LOG("S%05d BlockingWriteV(%d buffers, %d bytes) ...\n",
+                           static_cast<SOCKET>(socket),
+                           static_cast<int>(buffers.size()),
+                           static_cast<int>(write_length));
+#if !defined(CURRENT_WINDOWS) && !defined(CURRENT_APPLE)
+    struct iovec iov[16];
+    CURRENT_ASSERT(buffers.size() <= sizeof(iov) / sizeof(iov[0]));
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = iov;
+    for (const WriteBuffer& buffer : buffers) {
+      if (buffer.length) {
+        CURRENT_ASSERT(buffer.data);
+        iov[message.msg_iovlen].iov_base = const_cast<void*>(buffer.data);
+        iov[message.msg_iovlen].iov_len = buffer.length;
+        ++message.msg_iovlen;
+      }
+    }
+    if (message.msg_iovlen) {
+      const ssize_t result = ::sendmsg(socket, &message, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      if (result < 0) {
+        CURRENT_THROW(SocketWriteException());  // LCOV_EXCL_LINE -- Not covered by the unit tests.
+      } else if (static_cast<size_t>(result) != write_length) {
+        CURRENT_THROW(SocketCouldNotWriteEverythingException());  // LCOV_EXCL_LINE
+      }
+    }
+#else
+    // No `MSG_MORE` to keep the buffers in one packet anyway, so just write them one by one.
+    for (const WriteBuffer& buffer : buffers) {
+      if (buffer.length) {
+        BlockingWrite(buffer.data, buffer.length, more);
+      }
+    }
+#endif
+    CURRENT_BRICKS_NET_LOG(
+        "S%05d BlockingWriteV(%d bytes) : OK\n", static_cast<SOCKET>(socket), static_cast<int>(write_length));
+    return *this;
+  }
+
   inline Connection& BlockingWrite(const char* s, bool more) {
     CURRENT_ASSERT(s);
     return BlockingWrite(s, strlen(s), more);
@@ -407,6 +480,63 @@ class Connection : public SocketHandle {
     }
   }
 
+#ifndef CURRENT_WINDOWS
+  // Writes `length` bytes of the open file `fd`, starting from `offset`. On Linux, via `sendfile(2)`, so that
+  // the bytes are not copied through the user space.
+  inline Connection& BlockingSendFile(int fd, uint64_t offset, uint64_t length) {
+    CURRENT_BRICKS_NET_LOG(
+        "S%05d BlockingSendFile(%d bytes) ...\n", static_cast<SOCKET>(socket), static_cast<int>(length));
+#ifndef CURRENT_APPLE
+    off_t position = static_cast<off_t>(offset);
+    while (length) {
+      const ssize_t result =
+          ::sendfile(socket, fd, &position, static_cast<size_t>(std::min(length, static_cast<uint64_t>(1u << 30))));
+      if (result < 0) {
+        if (errno != EINTR) {
+          CURRENT_THROW(SocketWriteException());
+        }
+      } else if (result == 0) {
+        CURRENT_THROW(SocketCouldNotWriteEverythingException());  // LCOV_EXCL_LINE -- The file has shrunk.
+      } else {
+        length -= static_cast<uint64_t>(result);
+      }
+    }
+#else
+    char buffer[64 * 1024];
+    while (length) {
+      const ssize_t result =
+          ::pread(fd, buffer, static_cast<size_t>(std::min(length, static_cast<uint64_t>(sizeof(buffer)))), offset);
+      if (result <= 0) {
+        CURRENT_THROW(SocketCouldNotWriteEverythingException());
+      }
+      BlockingWrite(buffer, static_cast<size_t>(result), false);
+      offset += static_cast<uint64_t>(result);
+      length -= static_cast<uint64_t>(result);
+    }
+#endif
+    CURRENT_BRICKS_NET_LOG("S%05d BlockingSendFile() : OK\n", static_cast<SOCKET>(socket));
+    return *this;
+  }
+#endif  // CURRENT_WINDOWS
+
+  // The bytes already received from this connection by the caller, to be returned by `BlockingRead()` first.
+  // Used by the event-driven HTTP server, which receives the request before it hands the connection over.
+  void SetPrefetchedData(std::string data) {
+    prefetched_ = std::move(data);
+    prefetched_offset_ = 0u;
+  }
+
+  // Whether `BlockingRead()` would return the prefetched bytes without waiting for the peer.
+  bool HasPrefetchedData() const { return prefetched_offset_ < prefetched_.length(); }
+
+  // Returns the prefetched bytes not read yet, if any. Used when the same connection is to receive one more request.
+  std::string TakePrefetchedData() {
+    std::string result = prefetched_offset_ ? prefetched_.substr(prefetched_offset_) : std::move(prefetched_);
+    prefetched_.clear();
+    prefetched_offset_ = 0u;
+    return result;
+  }
+
   // Specialization for STL containers to allow calling BlockingWrite() on std::string, std::vector, etc.
   // The `std::enable_if<>` clause is required, otherwise `BlockingWrite(char[N])` becomes ambiguous.
   template <typename T>
@@ -417,6 +547,8 @@ class Connection : public SocketHandle {
  private:
   const IPAndPort local_ip_and_port_;
   const IPAndPort remote_ip_and_port_;
+  std::string prefetched_;
+  size_t prefetched_offset_ = 0u;
 
   Connection() = delete;
   Connection(const Connection&) = delete;
@@ -243,6 +243,8 @@ class PubSubHTTPEndpointImpl : public AbstractSubscriberObject {
                 {kSherlockHeaderCurrentSubscriptionId, subscription_id},
                 {kSherlockHeaderCurrentStreamSize, current::ToString(data_->persistence.Size())},
             }))) {
+    // Write the entries in batches while catching up, and right away once caught up, see `FlushIfCaughtUp()`.
+    http_response_.Coalesce(kCoalesceMaxBytes, CoalesceMaxDelay());
     if (params_.recent.count() > 0) {
       serving_ = false;  // Start in 'non-serving' mode when `recent` is set.
       from_timestamp_ = r.timestamp - params_.recent;
@@ -304,6 +306,7 @@ class PubSubHTTPEndpointImpl : public AbstractSubscriberObject {
             }
           }
           http_response_(std::move(entry_json));
+          FlushIfCaughtUp(current, last);
         } catch (const current::net::NetworkException&) {  // LCOV_EXCL_LINE
           return ss::EntryResponse::Done;                  // LCOV_EXCL_LINE
         }
@@ -345,7 +348,7 @@ class PubSubHTTPEndpointImpl : public AbstractSubscriberObject {
         return ss::EntryResponse::Done;
       }
       if (!params_.array && !params_.entries_only) {
-        http_response_(JSON<J>(ts_optidx_t(us)) + '\n');
+        http_response_(JSON<J>(ts_optidx_t(us)) + '\n').Flush();
       }
     }
     return ss::EntryResponse::More;
@@ -353,7 +356,13 @@ class PubSubHTTPEndpointImpl : public AbstractSubscriberObject {
 
   // TODO(dkorolev): This is a long shot, but looks right: For type-filtered HTTP subscriptions,
   // whether we should terminate or no depends on `nowait`.
-  ss::EntryResponse EntryResponseIfNoMorePassTypeFilter() const {
+  // Called when the last entry of the stream is not of the type subscribed to, so, the caught up point as well.
+  ss::EntryResponse EntryResponseIfNoMorePassTypeFilter() {
+    try {
+      http_response_.Flush();
+    } catch (const current::net::NetworkException&) {  // LCOV_EXCL_LINE
+      return ss::EntryResponse::Done;                  // LCOV_EXCL_LINE
+    }
     return (time_to_terminate_ || params_.no_wait) ? ss::EntryResponse::Done : ss::EntryResponse::More;
   }
 
@@ -370,6 +379,15 @@ class PubSubHTTPEndpointImpl : public AbstractSubscriberObject {
   // LCOV_EXCL_STOP
 
  private:
+  constexpr static size_t kCoalesceMaxBytes = 64 * 1024;
+  static std::chrono::microseconds CoalesceMaxDelay() { return std::chrono::milliseconds(10); }
+
+  void FlushIfCaughtUp(idxts_t current, idxts_t last) {
+    if (current.index == last.index) {
+      http_response_.Flush();
+    }
+  }
+
   // The HTTP listener must register itself as a user of stream data to ensure the lifetime of stream data.
   ScopeOwnedBySomeoneElse<stream_data_t> data_;
   std::atomic_bool time_to_terminate_{false};
@@ -282,7 +282,8 @@ class StreamImpl {
     return authority_;
   }
 
-  template <typename TYPE_SUBSCRIBED_TO, typename F>
+  // With `RAW`, the subscriber is passed the entries as they are persisted, as JSON strings, without parsing them.
+  template <typename TYPE_SUBSCRIBED_TO, typename F, bool RAW = false>
   class SubscriberThreadInstance final : public current::sherlock::SubscriberScope::SubscriberThread {
    private:
     bool this_is_valid_;
@@ -367,21 +368,9 @@ class StreamImpl {
         size = Exists(head_idx.idxts) ? Value(head_idx.idxts).index + 1 : 0;
         if (head_idx.head > head) {
           if (size > index) {
-            for (const auto& e : bare_data.persistence.Iterate(index, size)) {
-              if (!terminate_sent && terminate_signal_) {
-                terminate_sent = true;
-                if (subscriber_.Terminate() != ss::TerminationResponse::Wait) {
-                  return;
-                }
-              }
-              if (current::ss::PassEntryToSubscriberIfTypeMatches<TYPE_SUBSCRIBED_TO, entry_t>(
-                      subscriber_,
-                      [this]() -> ss::EntryResponse { return subscriber_.EntryResponseIfNoMorePassTypeFilter(); },
-                      e.entry,
-                      e.idx_ts,
-                      bare_data.persistence.LastPublishedIndexAndTimestamp()) == ss::EntryResponse::Done) {
-                return;
-              }
+            if (PassEntries(bare_data, index, size, terminate_sent, std::integral_constant<bool, RAW>()) ==
+                ss::EntryResponse::Done) {
+              return;
             }
             index = size;
             head = Value(head_idx.idxts).us;
@@ -405,17 +394,65 @@ class StreamImpl {
         }
       }
     }
+
+    // Returns `Done` if the subscriber is done, or has agreed to terminate.
+    ss::EntryResponse PassEntries(
+        stream_data_t& bare_data, uint64_t index, uint64_t size, bool& terminate_sent, std::false_type) {
+      for (const auto& e : bare_data.persistence.Iterate(index, size)) {
+        if (TerminateAccepted(terminate_sent)) {
+          return ss::EntryResponse::Done;
+        }
+        if (current::ss::PassEntryToSubscriberIfTypeMatches<TYPE_SUBSCRIBED_TO, entry_t>(
+                subscriber_,
+                [this]() -> ss::EntryResponse { return subscriber_.EntryResponseIfNoMorePassTypeFilter(); },
+                e.entry,
+                e.idx_ts,
+                bare_data.persistence.LastPublishedIndexAndTimestamp()) == ss::EntryResponse::Done) {
+          return ss::EntryResponse::Done;
+        }
+      }
+      return ss::EntryResponse::More;
+    }
+
+    // The persisted entries are `"{idxts}\t{entry}"` lines, of which only the short `idxts` part is parsed.
+    ss::EntryResponse PassEntries(
+        stream_data_t& bare_data, uint64_t index, uint64_t size, bool& terminate_sent, std::true_type) {
+      for (const std::string& line :
+           bare_data.persistence.template Iterate<current::ss::IterationMode::Unsafe>(index, size)) {
+        if (TerminateAccepted(terminate_sent)) {
+          return ss::EntryResponse::Done;
+        }
+        const size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+          CURRENT_THROW(current::persistence::MalformedEntryException(line));  // LCOV_EXCL_LINE
+        }
+        if (subscriber_(line.substr(tab + 1u),
+                        ParseJSON<idxts_t>(line.substr(0u, tab)),
+                        bare_data.persistence.LastPublishedIndexAndTimestamp()) == ss::EntryResponse::Done) {
+          return ss::EntryResponse::Done;
+        }
+      }
+      return ss::EntryResponse::More;
+    }
+
+    bool TerminateAccepted(bool& terminate_sent) {
+      if (!terminate_sent && terminate_signal_) {
+        terminate_sent = true;
+        return subscriber_.Terminate() != ss::TerminationResponse::Wait;
+      }
+      return false;
+    }
   };
 
   // Expose the means to control the scope of the subscriber.
-  template <typename F, typename TYPE_SUBSCRIBED_TO = entry_t>
+  template <typename F, typename TYPE_SUBSCRIBED_TO = entry_t, bool RAW = false>
   class SubscriberScope final : public current::sherlock::SubscriberScope {
    private:
     static_assert(current::ss::IsStreamSubscriber<F, TYPE_SUBSCRIBED_TO>::value, "");
     using base_t = current::sherlock::SubscriberScope;
 
    public:
-    using subscriber_thread_t = SubscriberThreadInstance<TYPE_SUBSCRIBED_TO, F>;
+    using subscriber_thread_t = SubscriberThreadInstance<TYPE_SUBSCRIBED_TO, F, RAW>;
 
     SubscriberScope(ScopeOwned<stream_data_t>& data,
                     F& subscriber,
@@ -436,6 +473,20 @@ class StreamImpl {
     }
   }
 
+  // Same as `Subscribe()`, with the subscriber passed the JSON of each entry instead of the entry itself, so that
+  // it can parse the entries itself, for instance, in parallel. The `idxts_t`-s are passed as usual.
+  template <typename F>
+  SubscriberScope<F, std::string, true> SubscribeToRawEntries(F& subscriber,
+                                                              uint64_t begin_idx = 0u,
+                                                              std::function<void()> done_callback = nullptr) {
+    static_assert(current::ss::IsStreamSubscriber<F, std::string>::value, "");
+    try {
+      return SubscriberScope<F, std::string, true>(own_data_, subscriber, begin_idx, done_callback);
+    } catch (const current::sync::InDestructingModeException&) {
+      CURRENT_THROW(StreamInGracefulShutdownException());
+    }
+  }
+
   // Sherlock handler for serving stream data via HTTP (see `pubsub.h` for details).
   template <class J>
   void ServeDataViaHTTP(Request r) {
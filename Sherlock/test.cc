@@ -257,6 +257,45 @@ TEST(Sherlock, SubscribeSynchronously) {
       << Join(expected_values, ',') << " != " << d.results_;
 }
 
+namespace sherlock_unittest {
+
+struct SherlockRawTestProcessorImpl {
+  std::vector<std::string> results_;
+
+  EntryResponse operator()(const std::string& raw_entry, idxts_t current, idxts_t last) {
+    results_.push_back(Printf("[%llu:%llu,%llu:%llu] ",
+                              static_cast<unsigned long long>(current.index),
+                              static_cast<unsigned long long>(current.us.count()),
+                              static_cast<unsigned long long>(last.index),
+                              static_cast<unsigned long long>(last.us.count())) +
+                       raw_entry);
+    return current.index < last.index ? EntryResponse::More : EntryResponse::Done;
+  }
+
+  EntryResponse operator()(std::chrono::microseconds) { return EntryResponse::More; }
+  static EntryResponse EntryResponseIfNoMorePassTypeFilter() { return EntryResponse::More; }
+  static TerminationResponse Terminate() { return TerminationResponse::Wait; }
+};
+
+using SherlockRawTestProcessor = current::ss::StreamSubscriber<SherlockRawTestProcessorImpl, std::string>;
+
+}  // namespace sherlock_unittest
+
+TEST(Sherlock, SubscribeToRawEntries) {
+  current::time::ResetToZero();
+
+  using namespace sherlock_unittest;
+
+  auto stream = current::sherlock::Stream<Record>();
+  stream.Publish(1, std::chrono::microseconds(10));
+  stream.Publish(2, std::chrono::microseconds(20));
+  stream.Publish(3, std::chrono::microseconds(30));
+
+  SherlockRawTestProcessor p;
+  stream.SubscribeToRawEntries(p, 1u);  // With no return value collection to capture the scope, it's a blocking call.
+  EXPECT_EQ("[1:20,2:30] {\"x\":2}\n[2:30,2:30] {\"x\":3}", Join(p.results_, '\n'));
+}
+
 TEST(Sherlock, SubscribeHandleGoesOutOfScopeBeforeAnyProcessing) {
   current::time::ResetToZero();
 
@@ -156,6 +156,12 @@ struct PerFieldRESTfulHandlerGenerator {
                 Request request,
                 const Optional<typename field_type_dependent_t<specific_field_t>::url_key_t>& url_key) {
               const specific_field_t& field = generic_input.storage(::current::storage::ImmutableFieldByIndex<INDEX>());
+              if (handler.StreamsCollection(url_key, requested_export_params)) {
+                // The whole field is sent as a chunked response, in batches, without holding the storage lock.
+                handler.StreamCollection(
+                    generic_input.storage, field, std::move(request), url_key, requested_export_params);
+                return;
+              }
               generic_input.storage
                   .ReadOnlyTransaction(
                        // Capture local variables by value for safe async transactions.
@@ -290,6 +296,10 @@ struct PerFieldRESTfulHandlerGenerator {
     RegisterAdditionalFieldDataHandlers<FIELD_TYPE, ENTRY_TYPE_WRAPPER>(
         field_name, field_rest_endpoints_schema_t(), generic_data_handler);
 
+    RegisterSecondaryIndexHandlers(field_name, container::field_indexes_t<specific_field_t>());
+
+    RegisterBatchHandlers<entry_t, key_t>(field_name);
+
     // Schema handlers.
 
     SchemaHandlerImpl<entry_t>().RegisterRoutes(
@@ -334,6 +344,11 @@ struct PerFieldRESTfulHandlerGenerator {
             // Capture by reference since this lambda is run synchronously.
             [&storage, &handler, &generic_input, &field_name](Request request, const Optional<std::string>& url_key) {
               const specific_field_t& field = generic_input.storage(::current::storage::ImmutableFieldByIndex<INDEX>());
+              if (handler.StreamsCollection(url_key, Optional<FieldExportParams>())) {
+                handler.StreamCollection(
+                    generic_input.storage, field, std::move(request), url_key, Optional<FieldExportParams>());
+                return;
+              }
               generic_input.storage.ReadOnlyTransaction(
                                         // Capture local variables by value for safe async transactions.
                                         [&storage, handler, generic_input, &field, url_key, field_name](
@@ -383,6 +398,138 @@ struct PerFieldRESTfulHandlerGenerator {
                                                            col_handler)));
     }
   }
+
+  template <typename... SECONDARY_INDEXES>
+  void RegisterSecondaryIndexHandlers(const std::string& field_name, container::Indexes<SECONDARY_INDEXES...>) {
+    const int unused[] = {0, (RegisterSecondaryIndexHandler<SECONDARY_INDEXES>(field_name), 0)...};
+    static_cast<void>(unused);
+  }
+
+  // `GET /data/$FIELD.by_$INDEXED_FIELD/$VALUE` returns the JSON array of the entries having this value.
+  template <typename SECONDARY_INDEX>
+  void RegisterSecondaryIndexHandler(const std::string& field_name) {
+    auto& storage = this->storage;
+    registerer(storage_handlers_map_entry_t(
+        field_name,
+        RESTfulRoute(kRESTfulDataURLComponent,
+                     std::string(".by_") + SECONDARY_INDEX::FieldName(),
+                     URLPathArgs::CountMask::One,
+                     [&storage](Request request) {
+                       if (request.method != "GET") {
+                         request(REST_IMPL::ErrorMethodNotAllowed(request.method,
+                                                                  "Only GET method is allowed for index lookups."));
+                         return;
+                       }
+                       using entry_t = typename specific_field_t::entry_t;
+                       using index_key_t = typename SECONDARY_INDEX::key_t;
+                       const auto index_key = current::FromString<index_key_t>(request.url_path_args[0]);
+                       const specific_field_t& field = storage(::current::storage::ImmutableFieldByIndex<INDEX>());
+                       storage.ReadOnlyTransaction(
+                                   [&field, index_key](immutable_fields_t) -> Response {
+                                     std::vector<entry_t> result;
+                                     field.template Index<SECONDARY_INDEX>().ForEachEntry(
+                                         index_key, [&result](const entry_t& entry) { result.push_back(entry); });
+                                     return result;
+                                   },
+                                   std::move(request)).Detach();
+                     })));
+  }
+
+  // `POST /data/$FIELD.multiget` with the JSON array of keys returns the JSON array of the entries found,
+  // in the order of the keys, all read in one transaction.
+  // `PUT /data/$FIELD.bulk` with the JSON array of entries creates or overwrites them all in one transaction.
+  template <typename ENTRY, typename KEY>
+  void RegisterBatchHandlers(const std::string& field_name) {
+    auto& storage = this->storage;
+    using PUTHandler = DataHandlerImpl<PUT,
+                                       semantics::rest::operation::top_level_operation_for_field_t<specific_field_t>,
+                                       specific_field_t,
+                                       ENTRY,
+                                       KEY>;
+    registerer(storage_handlers_map_entry_t(
+        field_name,
+        RESTfulRoute(kRESTfulDataURLComponent,
+                     kRESTfulMultiGetURLSuffix,
+                     URLPathArgs::CountMask::None,
+                     [&storage](Request request) {
+                       if (request.method != "POST") {
+                         request(REST_IMPL::ErrorMethodNotAllowed(request.method,
+                                                                  "Only POST method is allowed for multi-get."));
+                         return;
+                       }
+                       std::vector<KEY> keys;
+                       try {
+                         keys = ParseJSON<std::vector<KEY>>(request.body);
+                       } catch (const TypeSystemParseJSONException& e) {
+                         request(PUTHandler::ErrorBadJSON(e.DetailedDescription()));
+                         return;
+                       }
+                       if (keys.size() > kRESTfulBatchMaxSize) {
+                         request(Response("Too many keys.\n", HTTPResponseCode.RequestEntityTooLarge));
+                         return;
+                       }
+                       const specific_field_t& field = storage(::current::storage::ImmutableFieldByIndex<INDEX>());
+                       storage.ReadOnlyTransaction(
+                                   [&field, keys](immutable_fields_t) -> Response {
+                                     std::vector<ENTRY> result;
+                                     result.reserve(keys.size());
+                                     for (const auto& key : keys) {
+                                       const ImmutableOptional<ENTRY> entry = field[key];
+                                       if (Exists(entry)) {
+                                         result.push_back(Value(entry));
+                                       }
+                                     }
+                                     return result;
+                                   },
+                                   std::move(request)).Detach();
+                     })));
+    registerer(storage_handlers_map_entry_t(
+        field_name,
+        RESTfulRoute(
+            kRESTfulDataURLComponent,
+            kRESTfulBulkUpsertURLSuffix,
+            URLPathArgs::CountMask::None,
+            [&storage](Request request) {
+              if (request.method != "PUT" || storage.GetRole() != StorageRole::Master) {
+                request(REST_IMPL::ErrorMethodNotAllowed(
+                    request.method, "Only PUT method is allowed for bulk upserts, on the master."));
+                return;
+              }
+              std::vector<ENTRY> entries;
+              try {
+                entries = ParseJSON<std::vector<ENTRY>>(request.body);
+              } catch (const TypeSystemParseJSONException& e) {
+                request(PUTHandler::ErrorBadJSON(e.DetailedDescription()));
+                return;
+              }
+              if (entries.size() > kRESTfulBatchMaxSize) {
+                request(Response("Too many entries.\n", HTTPResponseCode.RequestEntityTooLarge));
+                return;
+              }
+              specific_field_t& field = storage(::current::storage::MutableFieldByIndex<INDEX>());
+              storage.ReadWriteTransaction(
+                          [&field, entries](mutable_fields_t) -> Response {
+                            RESTfulBulkUpsertResponse result;
+                            try {
+                              for (const auto& entry : entries) {
+                                const auto key = field_type_dependent_t<specific_field_t>::ExtractOrComposeKey(entry);
+                                if (Exists(field[key])) {
+                                  ++result.updated;
+                                } else {
+                                  ++result.created;
+                                }
+                                field.Add(entry);
+                              }
+                            } catch (const StorageUniqueIndexViolationException& e) {
+                              // All or nothing: roll back the entries added so far.
+                              CURRENT_STORAGE_THROW_ROLLBACK_WITH_VALUE(
+                                  Response, Response(e.OriginalDescription() + '\n', HTTPResponseCode.Conflict));
+                            }
+                            return result;
+                          },
+                          std::move(request)).Detach();
+            })));
+  }
 };
 
 template <class REST_IMPL, int INDEX, typename STORAGE>
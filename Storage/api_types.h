@@ -56,6 +56,77 @@ struct FieldExportParams {
   uint32_t shard = 0u;
 };
 
+// Batch `.multiget` and `.bulk` routes, see `api.h`.
+const std::string kRESTfulMultiGetURLSuffix = ".multiget";
+const std::string kRESTfulBulkUpsertURLSuffix = ".bulk";
+constexpr size_t kRESTfulBatchMaxSize = 10000u;
+
+CURRENT_STRUCT(RESTfulBulkUpsertResponse) {
+  CURRENT_FIELD(created, uint32_t, 0u);
+  CURRENT_FIELD(updated, uint32_t, 0u);
+};
+
+// Conditional GET-s of entries and collections, RFC 7232.
+const std::string kLastModifiedHeader = "Last-Modified";
+const std::string kETagHeader = "ETag";
+const std::string kIfNoneMatchHeader = "If-None-Match";
+const std::string kIfModifiedSinceHeader = "If-Modified-Since";
+
+// The `ETag` of an entry is its last modified timestamp, the one of a collection is the most recent one of its entries.
+inline std::string FormatETag(std::chrono::microseconds last_modified) {
+  return '"' + current::ToString(last_modified.count()) + '"';
+}
+
+// The validators sent by the client, extracted from the request before the read transaction is started.
+struct ConditionalGETParams {
+  Optional<std::string> if_none_match;
+  Optional<std::chrono::microseconds> if_modified_since;
+
+  static ConditionalGETParams FromRequest(const Request& request) {
+    ConditionalGETParams params;
+    if (request.headers.Has(kIfNoneMatchHeader)) {
+      params.if_none_match = request.headers.Get(kIfNoneMatchHeader);
+    } else if (request.headers.Has(kIfModifiedSinceHeader)) {
+      // An invalid `If-Modified-Since` is ignored, as per the RFC.
+      try {
+        params.if_modified_since = net::http::ParseHTTPDate(request.headers.Get(kIfModifiedSinceHeader));
+      } catch (const current::net::http::InvalidHTTPDateException&) {
+      }
+    }
+    return params;
+  }
+
+  // Whether the representation last modified at `last_modified` is the one the client already has.
+  // `If-None-Match` takes precedence; `If-Modified-Since` has the precision of one second.
+  bool NotModified(std::chrono::microseconds last_modified) const {
+    if (Exists(if_none_match)) {
+      const std::string etag = FormatETag(last_modified);
+      for (const auto& candidate : strings::Split(Value(if_none_match), ", ")) {
+        if (candidate == "*" || candidate == etag || candidate == "W/" + etag) {
+          return true;
+        }
+      }
+      return false;
+    } else if (Exists(if_modified_since)) {
+      return last_modified.count() / 1000000 <= Value(if_modified_since).count() / 1000000;
+    } else {
+      return false;
+    }
+  }
+};
+
+// Returns `304 Not Modified` if the client has the up-to-date representation, and the result of `build()` otherwise.
+// Either way, the `ETag` and `Last-Modified` headers are set.
+template <typename F>
+Response ConditionalGETResponse(const ConditionalGETParams& params,
+                                std::chrono::microseconds last_modified,
+                                F&& build) {
+  Response response = params.NotModified(last_modified) ? Response("", HTTPResponseCode.NotModified) : build();
+  response.SetHeader(kETagHeader, FormatETag(last_modified));
+  response.SetHeader(kLastModifiedHeader, FormatDateTimeAsIMFFix(last_modified));
+  return response;
+}
+
 // TODO(dkorolev): The whole `FieldTypeDependentImpl` section below to be moved to `semantics.h`.
 template <typename>
 struct FieldTypeDependentImpl {};
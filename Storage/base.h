@@ -28,8 +28,11 @@ SOFTWARE.
 
 #include "../port.h"
 
-#include <functional>
+#include <cstddef>
+#include <memory>
+#include <vector>
 
+#include "instrumentation.h"
 #include "semantics.h"
 #include "transaction.h"
 
@@ -155,16 +158,104 @@ struct TypeListMapperImpl<FIELDS, current::variadic_indexes::indexes<NS...>> {
 template <typename FIELDS, int COUNT>
 using FieldsTypeList = typename TypeListMapperImpl<FIELDS, current::variadic_indexes::generate_indexes<COUNT>>::result;
 
+// `UndoLog` keeps the type-erased undo records of one transaction.
+// The records are constructed in place in memory blocks which are kept between the transactions, so that logging
+// a mutation does not allocate once the journal has warmed up. Containers log their own small typed records, which
+// take ownership of the previous values instead of copying them into closures.
+class UndoLog final {
+ public:
+  enum : size_t { kBlockSize = 64u * 1024u };
+
+  UndoLog() = default;
+  UndoLog(const UndoLog&) = delete;
+  UndoLog& operator=(const UndoLog&) = delete;
+  ~UndoLog() { Clear(); }
+
+  template <typename F>
+  void Push(F&& undo) {
+    using record_t = Record<current::decay<F>>;
+    static_assert(alignof(record_t) <= alignof(std::max_align_t), "Over-aligned undo records are not supported.");
+    void* place = Allocate(sizeof(record_t), alignof(record_t));
+    records_.push_back(new (place) record_t(std::forward<F>(undo)));
+  }
+
+  bool Empty() const { return records_.empty(); }
+  size_t Size() const { return records_.size(); }
+
+  // Runs the undo records in reverse order, and clears the log.
+  void Undo() {
+    for (auto rit = records_.rbegin(); rit != records_.rend(); ++rit) {
+      (*rit)->Undo();
+    }
+    Clear();
+  }
+
+  // Destroys the records, keeping the memory for the next transaction.
+  void Clear() {
+    for (RecordBase* record : records_) {
+      record->~RecordBase();
+    }
+    records_.clear();
+    block_ = 0u;
+    offset_ = 0u;
+  }
+
+ private:
+  struct RecordBase {
+    virtual ~RecordBase() = default;
+    virtual void Undo() = 0;
+  };
+
+  template <typename F>
+  struct Record final : RecordBase {
+    F f;
+    template <typename G>
+    explicit Record(G&& f) : f(std::forward<G>(f)) {}
+    void Undo() override { f(); }
+  };
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  void* Allocate(size_t size, size_t alignment) {
+    while (true) {
+      if (block_ < blocks_.size()) {
+        const size_t begin = (offset_ + alignment - 1u) / alignment * alignment;
+        if (begin + size <= blocks_[block_].size) {
+          offset_ = begin + size;
+          return blocks_[block_].data.get() + begin;
+        }
+        ++block_;
+        offset_ = 0u;
+      } else {
+        const size_t block_size = std::max(static_cast<size_t>(kBlockSize), size);
+        blocks_.push_back(Block{std::unique_ptr<char[]>(new char[block_size]), block_size});
+      }
+    }
+  }
+
+  std::vector<Block> blocks_;
+  size_t block_ = 0u;
+  size_t offset_ = 0u;
+  std::vector<RecordBase*> records_;
+};
+
 // `MutationJournal` keeps all the changes made during one transaction, as well as the way to rollback them.
 struct MutationJournal {
   TransactionMeta transaction_meta;
   std::vector<std::unique_ptr<current::CurrentStruct>> commit_log;
-  std::vector<std::function<void()>> rollback_log;
+  UndoLog rollback_log;
+  // Whether the containers should maintain their `FieldAccessCounters`, see `instrumentation.h`.
+  bool instrumented = false;
 
-  template <typename T>
-  void LogMutation(T&& entry, std::function<void()> rollback) {
+  // Returns the logged entry, for the caller to be able to use it as the source of the update.
+  template <typename T, typename F>
+  const T& LogMutation(T&& entry, F&& rollback) {
     commit_log.push_back(std::make_unique<T>(std::move(entry)));
-    rollback_log.push_back(rollback);
+    rollback_log.Push(std::forward<F>(rollback));
+    return static_cast<const T&>(*commit_log.back());
   }
 
   void BeforeTransaction() { transaction_meta.begin_us = current::time::Now(); }
@@ -172,9 +263,7 @@ struct MutationJournal {
   void AfterTransaction() { transaction_meta.end_us = current::time::Now(); }
 
   void Rollback() {
-    for (auto rit = rollback_log.rbegin(); rit != rollback_log.rend(); ++rit) {
-      (*rit)();
-    }
+    rollback_log.Undo();
     Clear();
   }
 
@@ -183,7 +272,7 @@ struct MutationJournal {
     transaction_meta.end_us = std::chrono::microseconds(0);
     transaction_meta.fields.clear();
     commit_log.clear();
-    rollback_log.clear();
+    rollback_log.Clear();
   }
 
   void AssertEmpty() const {
@@ -191,7 +280,7 @@ struct MutationJournal {
     CURRENT_ASSERT(transaction_meta.end_us.count() == 0);
     CURRENT_ASSERT(transaction_meta.fields.empty());
     CURRENT_ASSERT(commit_log.empty());
-    CURRENT_ASSERT(rollback_log.empty());
+    CURRENT_ASSERT(rollback_log.Empty());
   }
 };
 
@@ -0,0 +1,236 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `StorageStreamCompactor<STORAGE>` rewrites the persisted stream of a storage as the minimal log of its state.
+// The stream should be made of `STORAGE::transaction_t`-s, i.e. the storage should use no custom persister param.
+//
+// In the compacted stream, each entry that is present in the storage at the end of the input stream appears once,
+// as an `Updated` event, in the order of the last update of each entry. The entries are published in transactions
+// of up to `CompactionParams::transaction_size` mutations, or in a single transaction if it is zero. Replaying the
+// compacted stream results in the same storage state as replaying the original one, except for the timestamps
+// of the erased entries, which are dropped along with the erased entries themselves.
+//
+// Optionally, every mutation that did not make it into the compacted stream, i.e. the superseded updates
+// and all the deletions, is written into the archive stream, in the transactions it was originally part of.
+//
+// The input is never held in memory. The first pass records, for each key of each field, the index of the last
+// mutation of it; the second pass emits the mutations that are the last ones for their keys. To hold no more than
+// `CompactionParams::max_keys_in_memory` keys at once, the keys are split into partitions by their hashes, and the
+// first pass is made once per partition, with the number of partitions doubled until each of them fits. The memory
+// used is therefore bounded by that many keys, plus the index of each entry present at the end of the input.
+// The input can be a file (offline), or the stream of a live storage (online), in which case the entries
+// published before the compaction has started are compacted.
+
+#ifndef CURRENT_STORAGE_COMPACTION_H
+#define CURRENT_STORAGE_COMPACTION_H
+
+#include "../port.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "transaction.h"
+
+#include "../Sherlock/sherlock.h"
+#include "../TypeSystem/struct.h"
+#include "../TypeSystem/Serialization/json.h"
+
+namespace current {
+namespace storage {
+
+CURRENT_STRUCT(CompactionParams) {
+  CURRENT_FIELD(transaction_size, uint64_t, 10000u);
+  CURRENT_FIELD(archive_file_name, Optional<std::string>);
+  CURRENT_FIELD(max_keys_in_memory, uint64_t, 1000000u);  // Zero means no limit.
+};
+
+CURRENT_STRUCT(CompactionStats) {
+  CURRENT_FIELD(transactions_read, uint64_t, 0u);
+  CURRENT_FIELD(mutations_read, uint64_t, 0u);
+  CURRENT_FIELD(transactions_written, uint64_t, 0u);
+  CURRENT_FIELD(entries_written, uint64_t, 0u);
+  CURRENT_FIELD(mutations_archived, uint64_t, 0u);
+  CURRENT_FIELD(key_partitions, uint64_t, 0u);
+};
+
+template <typename STORAGE>
+class StorageStreamCompactor final {
+ public:
+  using transaction_t = typename STORAGE::transaction_t;
+  using variant_t = typename transaction_t::variant_t;
+  using stream_t = sherlock::Stream<transaction_t, current::persistence::File>;
+
+  // Offline, the input is the file of a stream with no one else writing into it.
+  static CompactionStats Compact(const std::string& input_file_name,
+                                 const std::string& output_file_name,
+                                 const CompactionParams& params = CompactionParams()) {
+    stream_t input(input_file_name);
+    return Compact(input, output_file_name, params);
+  }
+
+  // Online, the input is the stream of a running storage, for instance `storage.InternalExposeStream()`.
+  template <typename STREAM>
+  static CompactionStats Compact(STREAM& input,
+                                 const std::string& output_file_name,
+                                 const CompactionParams& params = CompactionParams()) {
+    const auto& persister = input.Persister();
+    const uint64_t end_index = persister.Size();
+
+    // Pass one: the indexes of the mutations which are the last ones for their keys and are not deletions.
+    CompactionStats stats;
+    std::vector<uint64_t> surviving;
+    stats.key_partitions = 1u;
+    while (!CollectSurvivingMutations(
+        persister, end_index, params.max_keys_in_memory, stats.key_partitions, surviving)) {
+      stats.key_partitions *= 2u;
+    }
+    std::sort(surviving.begin(), surviving.end());
+
+    // Pass two: publish the surviving mutations.
+    stream_t output(output_file_name);
+    std::unique_ptr<stream_t> archive;
+    if (Exists(params.archive_file_name)) {
+      archive = std::make_unique<stream_t>(Value(params.archive_file_name));
+    }
+    transaction_t chunk;
+    auto last_published_us = std::chrono::microseconds(-1);
+    const auto publish_chunk = [&output, &chunk, &stats, &last_published_us](std::chrono::microseconds us) {
+      if (!chunk.mutations.empty()) {
+        // The compacted transactions are timestamped with the input transaction of their last entry.
+        last_published_us = std::max(us, last_published_us + std::chrono::microseconds(1));
+        chunk.meta.begin_us = chunk.meta.end_us = last_published_us;
+        output.Publish(chunk, last_published_us);
+        ++stats.transactions_written;
+        chunk.mutations.clear();
+      }
+    };
+    uint64_t mutation_index = 0u;
+    auto next_surviving = surviving.begin();
+    auto last_input_us = std::chrono::microseconds(-1);
+    for (const auto& stream_record : persister.Iterate(0u, end_index)) {
+      const transaction_t& transaction = stream_record.entry;
+      transaction_t archived;
+      for (const auto& mutation : transaction.mutations) {
+        if (next_surviving != surviving.end() && *next_surviving == mutation_index) {
+          ++next_surviving;
+          chunk.mutations.push_back(mutation);
+          ++stats.entries_written;
+          if (params.transaction_size && chunk.mutations.size() >= params.transaction_size) {
+            publish_chunk(stream_record.idx_ts.us);
+          }
+        } else if (archive) {
+          archived.mutations.push_back(mutation);
+        }
+        ++mutation_index;
+      }
+      if (!archived.mutations.empty()) {
+        stats.mutations_archived += archived.mutations.size();
+        archived.meta = transaction.meta;
+        archive->Publish(std::move(archived), stream_record.idx_ts.us);
+      }
+      ++stats.transactions_read;
+      stats.mutations_read += transaction.mutations.size();
+      last_input_us = stream_record.idx_ts.us;
+    }
+    publish_chunk(last_input_us);
+    return stats;
+  }
+
+ private:
+  struct LastMutation {
+    uint64_t index;
+    bool is_deletion;
+  };
+
+  // Appends the indexes of the surviving mutations for the keys in each of the `partitions` partitions, one pass
+  // over the input per partition. Returns false, with `surviving` cleared, if some partition has too many keys.
+  template <typename PERSISTER>
+  static bool CollectSurvivingMutations(const PERSISTER& persister,
+                                        uint64_t end_index,
+                                        uint64_t max_keys,
+                                        uint64_t partitions,
+                                        std::vector<uint64_t>& surviving) {
+    surviving.clear();
+    for (uint64_t partition = 0u; partition < partitions; ++partition) {
+      std::unordered_map<std::string, LastMutation> last_mutation;
+      uint64_t mutation_index = 0u;
+      for (const auto& stream_record : persister.Iterate(0u, end_index)) {
+        for (const auto& mutation : stream_record.entry.mutations) {
+          MutationKeyExtractor extractor;
+          mutation.Call(extractor);
+          if (std::hash<std::string>()(extractor.key) % partitions == partition) {
+            last_mutation[extractor.key] = LastMutation{mutation_index, extractor.is_deletion};
+            if (max_keys && last_mutation.size() > max_keys) {
+              surviving.clear();
+              return false;
+            }
+          }
+          ++mutation_index;
+        }
+      }
+      for (const auto& key_and_last_mutation : last_mutation) {
+        if (!key_and_last_mutation.second.is_deletion) {
+          surviving.push_back(key_and_last_mutation.second.index);
+        }
+      }
+    }
+    return true;
+  }
+
+  // The key of the entry the mutation is applied to, along with the field it belongs to, as a string.
+  struct MutationKeyExtractor {
+    std::string key;
+    bool is_deletion = false;
+
+    template <typename EVENT>
+    void operator()(const EVENT& event) {
+      using update_event_t = typename EVENT::storage_field_t::update_event_t;
+      Extract(event, std::is_same<EVENT, update_event_t>());
+      key = std::string(reflection::CurrentTypeNameAsConstCharPtr<update_event_t>()) + ' ' + key;
+    }
+
+    // The key of an `Updated` event is the one of its `Deleted` counterpart, for dictionaries and matrices alike.
+    template <typename EVENT>
+    void Extract(const EVENT& event, std::true_type) {
+      key = JSON(typename EVENT::storage_field_t::delete_event_t(event.us, event.data).key);
+    }
+
+    template <typename EVENT>
+    void Extract(const EVENT& event, std::false_type) {
+      key = JSON(event.key);
+      is_deletion = true;
+    }
+  };
+};
+
+}  // namespace storage
+}  // namespace current
+
+using current::storage::StorageStreamCompactor;
+
+#endif  // CURRENT_STORAGE_COMPACTION_H
@@ -27,23 +27,194 @@ SOFTWARE.
 #define CURRENT_STORAGE_CONTAINER_DICTIONARY_H
 
 #include "common.h"
+#include "flat.h"
+#include "index.h"
+#include "memory.h"
+#include "persistent.h"
 #include "sfinae.h"
 
 #include "../base.h"
+#include "../exceptions.h"
 
 #include "../../TypeSystem/optional.h"
+#include "../../TypeSystem/Serialization/json.h"
 
 namespace current {
 namespace storage {
 namespace container {
 
-template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, template <typename...> class MAP>
+// The timestamps of the last modification, including the ones of the erased entries, are kept in a separate map.
+// It is unordered unless the dictionary itself is flat, in which case it is flat too.
+template <template <typename...> class MAP>
+struct LastModifiedMapSelector {
+  template <typename KEY>
+  using type = Unordered<KEY, std::chrono::microseconds>;
+};
+
+template <>
+struct LastModifiedMapSelector<Flat> {
+  template <typename KEY>
+  using type = Flat<KEY, std::chrono::microseconds>;
+};
+
+// Overwrites or takes out the value of the entry `it` points to. The persistent maps never modify the entries in
+// place, as they may be shared with the snapshots, so the former is a `set()`, and the latter is a copy.
+template <typename MAP>
+struct MapEntryMutator {
+  using value_t = typename MAP::mapped_type;
+  template <typename VALUE>
+  static const value_t& Assign(MAP&, typename MAP::iterator it, VALUE&& value) {
+    it->second = std::forward<VALUE>(value);
+    return it->second;
+  }
+  static value_t Take(MAP&, typename MAP::iterator it) { return std::move(it->second); }
+};
+
+template <typename K, typename V, typename H, typename E>
+struct MapEntryMutator<Persistent<K, V, H, E>> {
+  using map_t = Persistent<K, V, H, E>;
+  template <typename VALUE>
+  static const V& Assign(map_t& map, typename map_t::iterator it, VALUE&& value) {
+    return map.set(it->first, std::forward<VALUE>(value));
+  }
+  static V Take(map_t&, typename map_t::iterator it) { return it->second; }
+};
+
+// The order in which the dictionary is iterated over. It is the order of the map itself, except for the unordered
+// maps, which are walked bucket by bucket, so that the position of any entry is its bucket, see `KeysetCursor` below.
+template <typename MAP>
+struct MapWalker {
+  using iterator_t = typename MAP::const_iterator;
+  static iterator_t Begin(const MAP& map) { return map.cbegin(); }
+  static iterator_t End(const MAP& map) { return map.cend(); }
+};
+
+template <typename K, typename V, typename H, typename E>
+struct MapWalker<std::unordered_map<K, V, H, E>> {
+  using map_t = std::unordered_map<K, V, H, E>;
+  struct iterator_t final {
+    const map_t* map;
+    size_t bucket;
+    typename map_t::const_local_iterator it;
+    iterator_t(const map_t& map, size_t bucket) : map(&map), bucket(bucket) {
+      if (bucket < map.bucket_count()) {
+        it = map.cbegin(bucket);
+        SkipEmptyBuckets();
+      }
+    }
+    iterator_t(const map_t& map, size_t bucket, typename map_t::const_local_iterator it)
+        : map(&map), bucket(bucket), it(it) {}
+    void SkipEmptyBuckets() {
+      while (it == map->cend(bucket)) {
+        if (++bucket == map->bucket_count()) {
+          return;
+        }
+        it = map->cbegin(bucket);
+      }
+    }
+    void operator++() {
+      ++it;
+      SkipEmptyBuckets();
+    }
+    bool operator==(const iterator_t& rhs) const {
+      return bucket == rhs.bucket && (bucket == map->bucket_count() || it == rhs.it);
+    }
+    bool operator!=(const iterator_t& rhs) const { return !operator==(rhs); }
+    const typename map_t::value_type& operator*() const { return *it; }
+    const typename map_t::value_type* operator->() const { return &*it; }
+  };
+  static iterator_t Begin(const map_t& map) { return iterator_t(map, 0u); }
+  static iterator_t End(const map_t& map) { return iterator_t(map, map.bucket_count()); }
+};
+
+// Keyset pagination cursors: `Cursor(map, it)` is the position of the entry `it` points to, and `Seek(map, cursor)`
+// returns the iterator to that position in O(1) or O(log N), so that the N-th page costs the same as the first one.
+// * For the ordered maps it is the key, and the page starts at its `lower_bound()`, even if the key was erased.
+// * For the flat maps it is the slot of the entry, and the page starts at that slot, or past it if it was vacated.
+// * For the unordered maps it is the bucket count and the key, and the page starts at the key, or at the beginning
+//   of its bucket if it was erased. Once the map is rehashed the buckets are reshuffled, so the cursor is rejected.
+// The persistent maps have no stable position to resume from once the entry at the page boundary is erased, so they
+// are paginated by offset instead.
+template <typename MAP>
+struct KeysetCursor {};
+
+template <typename KEY>
+KEY ParseKeysetCursorKey(const std::string& cursor) {
+  try {
+    return ParseJSON<KEY>(cursor);
+  } catch (const TypeSystemParseJSONException&) {
+    CURRENT_THROW(StorageInvalidCursorException("Malformed cursor."));
+  }
+}
+
+inline size_t ParseKeysetCursorPosition(const std::string& cursor) {
+  if (cursor.empty() || cursor.find_first_not_of("0123456789") != std::string::npos) {
+    CURRENT_THROW(StorageInvalidCursorException("Malformed cursor."));
+  }
+  return current::FromString<size_t>(cursor);
+}
+
+template <typename K, typename V, typename C>
+struct KeysetCursor<std::map<K, V, C>> {
+  using map_t = std::map<K, V, C>;
+  static std::string Cursor(const map_t&, typename map_t::const_iterator it) { return JSON(it->first); }
+  static typename map_t::const_iterator Seek(const map_t& map, const std::string& cursor) {
+    return map.lower_bound(ParseKeysetCursorKey<K>(cursor));
+  }
+};
+
+template <typename K, typename V, typename H, typename E>
+struct KeysetCursor<Flat<K, V, H, E>> {
+  using map_t = Flat<K, V, H, E>;
+  static std::string Cursor(const map_t& map, typename map_t::const_iterator it) {
+    return current::ToString(map.position(it));
+  }
+  static typename map_t::const_iterator Seek(const map_t& map, const std::string& cursor) {
+    return map.from_position(ParseKeysetCursorPosition(cursor));
+  }
+};
+
+template <typename K, typename V, typename H, typename E>
+struct KeysetCursor<std::unordered_map<K, V, H, E>> {
+  using map_t = std::unordered_map<K, V, H, E>;
+  using iterator_t = typename MapWalker<map_t>::iterator_t;
+  static std::string Cursor(const map_t& map, const iterator_t& it) {
+    return current::ToString(map.bucket_count()) + ':' + JSON(it->first);
+  }
+  static iterator_t Seek(const map_t& map, const std::string& cursor) {
+    const size_t colon = cursor.find(':');
+    if (colon == std::string::npos) {
+      CURRENT_THROW(StorageInvalidCursorException("Malformed cursor."));
+    }
+    if (ParseKeysetCursorPosition(cursor.substr(0, colon)) != map.bucket_count()) {
+      CURRENT_THROW(StorageInvalidCursorException(
+          "The collection has been rehashed since the cursor was issued, start from the first page."));
+    }
+    const K key = ParseKeysetCursorKey<K>(cursor.substr(colon + 1));
+    const size_t bucket = map.bucket(key);
+    for (auto it = map.cbegin(bucket); it != map.cend(bucket); ++it) {
+      if (map.key_eq()(it->first, key)) {
+        return iterator_t(map, bucket, it);
+      }
+    }
+    return iterator_t(map, bucket);
+  }
+};
+
+template <typename T,
+          typename UPDATE_EVENT,
+          typename DELETE_EVENT,
+          template <typename...> class MAP,
+          typename INDEXES = NoIndexes>
 class GenericDictionary {
  public:
   using entry_t = T;
   using key_t = sfinae::entry_key_t<T>;
   using map_t = MAP<key_t, T>;
+  using last_modified_map_t = typename LastModifiedMapSelector<MAP>::template type<key_t>;
+  using indexes_t = INDEXES;
   using semantics_t = storage::semantics::Dictionary;
+  using mutator_t = MapEntryMutator<map_t>;
 
   GenericDictionary(MutationJournal& journal) : journal_(journal) {}
 
@@ -51,6 +222,9 @@ class GenericDictionary {
   size_t Size() const { return map_.size(); }
 
   ImmutableOptional<T> operator[](sfinae::CF<key_t> key) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto iterator = map_.find(key);
     if (iterator != map_.end()) {
       return ImmutableOptional<T>(FromBarePointer(), &iterator->second);
@@ -59,6 +233,9 @@ class GenericDictionary {
     }
   }
 
+  // The most recent modification time of any entry, zero if none. Used for the collection-level `ETag`-s.
+  std::chrono::microseconds FieldLastModified() const { return field_last_modified_; }
+
   ImmutableOptional<std::chrono::microseconds> LastModified(sfinae::CF<key_t> key) const {
     const auto iterator = last_modified_.find(key);
     if (iterator != last_modified_.end()) {
@@ -68,70 +245,81 @@ class GenericDictionary {
     }
   }
 
+  // The entries are stored in the nodes of the map, see `container/memory.h`.
+  StorageFieldStats FieldStats() const {
+    StorageFieldStats stats;
+    stats.entries = map_.size();
+    stats.approximate_bytes =
+        ApproximateHeapBytes(map_) + ApproximateHeapBytes(last_modified_) + indexes_.ApproximateHeapBytes();
+    access_counters_.FillStats(stats);
+    return stats;
+  }
+
+  // Secondary index accessor, `fields.d.Index<RecordByRhs>()[42]`.
+  template <typename INDEX>
+  const SecondaryIndex<T, INDEX>& Index() const {
+    return indexes_.template Get<INDEX>();
+  }
+
   void Add(const T& object) {
+    if (journal_.instrumented) {
+      ++access_counters_.adds;
+    }
     const auto now = current::time::Now();
     const auto key = sfinae::GetKey(object);
     const auto map_iterator = map_.find(key);
     const auto lm_iterator = last_modified_.find(key);
+    // Check the unique indexes before any mutation, so that the exception leaves the container intact.
+    indexes_.AssertNoConflicts(object, map_iterator != map_.end() ? &map_iterator->second : nullptr);
     if (map_iterator != map_.end()) {
-      const T& previous_object = map_iterator->second;
       CURRENT_ASSERT(lm_iterator != last_modified_.end());
-      const auto previous_timestamp = lm_iterator->second;
-      journal_.LogMutation(UPDATE_EVENT(now, object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             last_modified_[key] = previous_timestamp;
-                             map_[key] = previous_object;
-                           });
+      // Copy `object` into the event first, as it may refer to the very entry being replaced.
+      UPDATE_EVENT event(now, object);
+      indexes_.Remove(map_iterator->second);
+      const T& data =
+          journal_.LogMutation(std::move(event),
+                               UndoRemoval{this,
+                                           lm_iterator->second,
+                                           mutator_t::Take(map_, map_iterator),
+                                           field_last_modified_}).data;
+      SetLastModified(key, now);
+      indexes_.Insert(mutator_t::Assign(map_, map_iterator, data));
     } else {
       if (lm_iterator != last_modified_.end()) {
-        const auto previous_timestamp = lm_iterator->second;
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key, previous_timestamp]() {
-                               last_modified_[key] = previous_timestamp;
-                               map_.erase(key);
-                             });
+                             UndoInsertion{this, key, true, lm_iterator->second, field_last_modified_});
       } else {
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key]() {
-                               last_modified_.erase(key);
-                               map_.erase(key);
-                             });
+                             UndoInsertion{this, key, false, std::chrono::microseconds(0), field_last_modified_});
       }
+      DoUpdateWithLastModified(now, key, object);
     }
-    last_modified_[key] = now;
-    map_[key] = object;
   }
 
   void Erase(sfinae::CF<key_t> key) {
+    if (journal_.instrumented) {
+      ++access_counters_.erases;
+    }
     const auto now = current::time::Now();
     const auto map_iterator = map_.find(key);
     if (map_iterator != map_.end()) {
-      const T& previous_object = map_iterator->second;
       const auto lm_iterator = last_modified_.find(key);
       CURRENT_ASSERT(lm_iterator != last_modified_.end());
-      const auto previous_timestamp = lm_iterator->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             last_modified_[key] = previous_timestamp;
-                             map_[key] = previous_object;
-                           });
-      last_modified_[key] = now;
-      map_.erase(key);
+      DELETE_EVENT event(now, map_iterator->second);
+      indexes_.Remove(map_iterator->second);
+      journal_.LogMutation(
+          std::move(event),
+          UndoRemoval{this, lm_iterator->second, mutator_t::Take(map_, map_iterator), field_last_modified_});
+      SetLastModified(key, now);
+      map_.erase(map_iterator);
     }
   }
 
-  void operator()(const UPDATE_EVENT& e) {
-    const auto key = sfinae::GetKey(e.data);
-    last_modified_[key] = e.us;
-    map_[key] = e.data;
-  }
-  void operator()(const DELETE_EVENT& e) {
-    last_modified_[e.key] = e.us;
-    map_.erase(e.key);
-  }
+  void operator()(const UPDATE_EVENT& e) { DoUpdateWithLastModified(e.us, sfinae::GetKey(e.data), e.data); }
+  void operator()(const DELETE_EVENT& e) { DoEraseWithLastModified(e.us, e.key); }
 
   struct Iterator final {
-    using iterator_t = typename map_t::const_iterator;
+    using iterator_t = typename MapWalker<map_t>::iterator_t;
     using value_t = sfinae::CF<T>;
     iterator_t iterator;
     explicit Iterator(iterator_t iterator) : iterator(std::move(iterator)) {}
@@ -145,37 +333,137 @@ class GenericDictionary {
     const T* operator->() const { return &iterator->second; }
   };
 
-  Iterator begin() const { return Iterator(map_.cbegin()); }
-  Iterator end() const { return Iterator(map_.cend()); }
+  Iterator begin() const { return Iterator(MapWalker<map_t>::Begin(map_)); }
+  Iterator end() const { return Iterator(MapWalker<map_t>::End(map_)); }
+
+  // The copy of the entries, to be read outside the transaction it was taken in. For the persistent dictionaries
+  // it is O(1), and the copy shares the unchanged parts of the map with the dictionary; otherwise, it is a full copy.
+  map_t Snapshot() const { return map_; }
+
+  // Keyset pagination, see `KeysetCursor` above, only for the maps that support it. `Seek()` throws
+  // `StorageInvalidCursorException`.
+  template <typename M = map_t>
+  auto Cursor(const Iterator& it) const -> decltype(KeysetCursor<M>::Cursor(std::declval<const M&>(), it.iterator)) {
+    return KeysetCursor<M>::Cursor(map_, it.iterator);
+  }
+  template <typename M = map_t>
+  auto Seek(const std::string& cursor) const
+      -> decltype(Iterator(KeysetCursor<M>::Seek(std::declval<const M&>(), cursor))) {
+    return Iterator(KeysetCursor<M>::Seek(map_, cursor));
+  }
 
  private:
+  void SetLastModified(sfinae::CF<key_t> key, std::chrono::microseconds us) {
+    last_modified_[key] = us;
+    field_last_modified_ = std::max(field_last_modified_, us);
+  }
+
+  template <typename OBJECT>
+  void DoUpdateWithLastModified(std::chrono::microseconds us, sfinae::CF<key_t> key, OBJECT&& object) {
+    SetLastModified(key, us);
+    const auto map_iterator = map_.find(key);
+    if (map_iterator != map_.end()) {
+      indexes_.Remove(map_iterator->second);
+      indexes_.Insert(mutator_t::Assign(map_, map_iterator, std::forward<OBJECT>(object)));
+    } else {
+      indexes_.Insert(map_.emplace(key, std::forward<OBJECT>(object)).first->second);
+    }
+  }
+
+  void DoEraseWithoutTouchingLastModified(sfinae::CF<key_t> key) {
+    const auto map_iterator = map_.find(key);
+    if (map_iterator != map_.end()) {
+      indexes_.Remove(map_iterator->second);
+      map_.erase(map_iterator);
+    }
+  }
+
+  void DoEraseWithLastModified(std::chrono::microseconds us, sfinae::CF<key_t> key) {
+    SetLastModified(key, us);
+    DoEraseWithoutTouchingLastModified(key);
+  }
+
+  // Undo records for `MutationJournal`. Each of them also restores `FieldLastModified()` as of before the mutation,
+  // so that, as they are run in reverse order, a rolled back transaction leaves it intact.
+  // Puts back the entry which the transaction has overwritten or erased. It owns the previous value, moved into it.
+  struct UndoRemoval {
+    GenericDictionary* self;
+    std::chrono::microseconds previous_timestamp;
+    T previous_object;
+    std::chrono::microseconds previous_field_last_modified;
+    void operator()() {
+      const auto key = sfinae::GetKey(previous_object);
+      self->DoUpdateWithLastModified(previous_timestamp, key, std::move(previous_object));
+      self->field_last_modified_ = previous_field_last_modified;
+    }
+  };
+
+  // Erases the entry which the transaction has added, restoring the last modified timestamp of the key, if any.
+  struct UndoInsertion {
+    GenericDictionary* self;
+    key_t key;
+    bool had_timestamp;
+    std::chrono::microseconds previous_timestamp;
+    std::chrono::microseconds previous_field_last_modified;
+    void operator()() {
+      if (had_timestamp) {
+        self->DoEraseWithLastModified(previous_timestamp, key);
+      } else {
+        self->last_modified_.erase(key);
+        self->DoEraseWithoutTouchingLastModified(key);
+      }
+      self->field_last_modified_ = previous_field_last_modified;
+    }
+  };
+
   map_t map_;
-  std::unordered_map<key_t, std::chrono::microseconds, CurrentHashFunction<key_t>> last_modified_;
+  last_modified_map_t last_modified_;
+  std::chrono::microseconds field_last_modified_ = std::chrono::microseconds(0);
+  SecondaryIndexes<T, INDEXES> indexes_;
+  mutable FieldAccessCounters access_counters_;
   MutationJournal& journal_;
 };
 
-template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT>
-using UnorderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Unordered>;
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = NoIndexes>
+using UnorderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Unordered, INDEXES>;
+
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = NoIndexes>
+using OrderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Ordered, INDEXES>;
 
-template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT>
-using OrderedDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Ordered>;
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = NoIndexes>
+using FlatDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Flat, INDEXES>;
+
+template <typename T, typename UPDATE_EVENT, typename DELETE_EVENT, typename INDEXES = NoIndexes>
+using PersistentDictionary = GenericDictionary<T, UPDATE_EVENT, DELETE_EVENT, Persistent, INDEXES>;
 
 }  // namespace container
 
-template <typename T, typename E1, typename E2>  // Entry, update event, delete event.
-struct StorageFieldTypeSelector<container::UnorderedDictionary<T, E1, E2>> {
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::UnorderedDictionary<T, E1, E2, I>> {
   static const char* HumanReadableName() { return "UnorderedDictionary"; }
 };
 
-template <typename T, typename E1, typename E2>  // Entry, update event, delete event.
-struct StorageFieldTypeSelector<container::OrderedDictionary<T, E1, E2>> {
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::OrderedDictionary<T, E1, E2, I>> {
   static const char* HumanReadableName() { return "OrderedDictionary"; }
 };
 
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::FlatDictionary<T, E1, E2, I>> {
+  static const char* HumanReadableName() { return "FlatDictionary"; }
+};
+
+template <typename T, typename E1, typename E2, typename I>  // Entry, update event, delete event, indexes.
+struct StorageFieldTypeSelector<container::PersistentDictionary<T, E1, E2, I>> {
+  static const char* HumanReadableName() { return "PersistentDictionary"; }
+};
+
 }  // namespace storage
 }  // namespace current
 
 using current::storage::container::UnorderedDictionary;
 using current::storage::container::OrderedDictionary;
+using current::storage::container::FlatDictionary;
+using current::storage::container::PersistentDictionary;
 
 #endif  // CURRENT_STORAGE_CONTAINER_DICTIONARY_H
@@ -0,0 +1,377 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `Flat<KEY, VALUE>` is an open-addressing hash map, a drop-in for `Unordered<KEY, VALUE>` in Storage containers.
+//
+// The `{ key, value }` pairs live in a `std::deque<>` of slots, which is allocated in large chunks and never moves
+// its elements, so that pointers to the values stay valid for as long as the entry exists, same as with node-based
+// maps. Erased slots are reused. The hash table itself is a flat power-of-two array of `{ hash, slot index }` buckets
+// with linear probing and backward-shift deletion: no per-entry heap allocation, no tombstones, and a lookup is one
+// contiguous probe sequence which compares the keys only when the cached full hashes match. The hashes are passed
+// through a 64-bit finalizer before masking, as `CurrentHashFunction` is the identity for integers and enums, and
+// strided keys would otherwise land in the same few buckets and form long probe runs.
+//
+// Iteration order is the slot order, which is unspecified, same as for `std::unordered_map`.
+
+#ifndef CURRENT_STORAGE_CONTAINER_FLAT_H
+#define CURRENT_STORAGE_CONTAINER_FLAT_H
+
+#include "../../port.h"
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <tuple>
+#include <vector>
+
+#include "../../Bricks/util/comparators.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+template <typename KEY, typename VALUE, typename HASH = CurrentHashFunction<KEY>, typename EQUAL = std::equal_to<KEY>>
+class Flat final {
+ public:
+  using key_type = KEY;
+  using mapped_type = VALUE;
+  using value_type = std::pair<const KEY, VALUE>;
+  using hasher = HASH;
+  using key_equal = EQUAL;
+  using size_type = size_t;
+
+ private:
+  struct Slot {
+    typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type data;
+    bool occupied = false;
+    value_type& value() { return *reinterpret_cast<value_type*>(&data); }
+    const value_type& value() const { return *reinterpret_cast<const value_type*>(&data); }
+  };
+
+  // An empty bucket has `slot == kNoSlot`.
+  struct Bucket {
+    size_t hash;
+    size_t slot;
+  };
+
+  static constexpr size_t kNoSlot = static_cast<size_t>(-1);
+  static constexpr size_t kMinBuckets = 8u;
+
+ public:
+  template <typename SELF, typename V>
+  class IteratorImpl final {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = V;
+    using difference_type = std::ptrdiff_t;
+    using pointer = V*;
+    using reference = V&;
+
+    IteratorImpl() = default;
+    IteratorImpl(SELF* self, size_t index) : self_(self), index_(index) { SkipVacantSlots(); }
+
+    // Allow `iterator` -> `const_iterator`, but not the other way around.
+    template <typename S, typename W, class = typename std::enable_if<std::is_convertible<W*, V*>::value>::type>
+    IteratorImpl(const IteratorImpl<S, W>& rhs) : self_(rhs.self_), index_(rhs.index_) {}
+
+    IteratorImpl& operator++() {
+      ++index_;
+      SkipVacantSlots();
+      return *this;
+    }
+    IteratorImpl operator++(int) {
+      IteratorImpl result = *this;
+      operator++();
+      return result;
+    }
+
+    template <typename S, typename W>
+    bool operator==(const IteratorImpl<S, W>& rhs) const {
+      return index_ == rhs.index_;
+    }
+    template <typename S, typename W>
+    bool operator!=(const IteratorImpl<S, W>& rhs) const {
+      return index_ != rhs.index_;
+    }
+
+    V& operator*() const { return self_->slots_[index_].value(); }
+    V* operator->() const { return &self_->slots_[index_].value(); }
+
+   private:
+    template <typename, typename>
+    friend class IteratorImpl;
+    friend class Flat;
+
+    void SkipVacantSlots() {
+      while (index_ < self_->slots_.size() && !self_->slots_[index_].occupied) {
+        ++index_;
+      }
+    }
+
+    SELF* self_ = nullptr;
+    size_t index_ = 0u;
+  };
+
+  using iterator = IteratorImpl<Flat, value_type>;
+  using const_iterator = IteratorImpl<const Flat, const value_type>;
+
+  Flat() = default;
+  Flat(const Flat& rhs) {
+    reserve(rhs.size_);
+    for (const auto& e : rhs) {
+      emplace(e);
+    }
+  }
+  Flat(Flat&& rhs) { Swap(rhs); }
+  Flat& operator=(Flat rhs) {
+    Swap(rhs);
+    return *this;
+  }
+  ~Flat() { clear(); }
+
+  bool empty() const { return size_ == 0u; }
+  size_t size() const { return size_; }
+
+  iterator begin() { return iterator(this, 0u); }
+  iterator end() { return iterator(this, slots_.size()); }
+  const_iterator begin() const { return const_iterator(this, 0u); }
+  const_iterator end() const { return const_iterator(this, slots_.size()); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  // The slot of the entry is its stable position: it does not change until the entry is erased, rehashing included.
+  // `from_position(i)` is the first entry at or past slot `i`, or `end()`, which makes it a keyset pagination cursor.
+  size_t position(const_iterator it) const { return it.index_; }
+  const_iterator from_position(size_t index) const { return const_iterator(this, std::min(index, slots_.size())); }
+
+  // The memory held by the slots, including the vacated ones, and by the bucket array.
+  size_t allocated_bytes() const {
+    return slots_.size() * sizeof(Slot) + free_slots_.capacity() * sizeof(size_t) +
+           buckets_.capacity() * sizeof(Bucket);
+  }
+
+  iterator find(const KEY& key) {
+    const size_t bucket = FindBucket(key, Hash(key));
+    return bucket != kNoSlot ? iterator(this, buckets_[bucket].slot) : end();
+  }
+  const_iterator find(const KEY& key) const {
+    const size_t bucket = FindBucket(key, Hash(key));
+    return bucket != kNoSlot ? const_iterator(this, buckets_[bucket].slot) : end();
+  }
+  size_t count(const KEY& key) const { return FindBucket(key, Hash(key)) != kNoSlot ? 1u : 0u; }
+
+  VALUE& operator[](const KEY& key) {
+    const auto it = find(key);
+    if (it != end()) {
+      return it->second;
+    } else {
+      return emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first->second;
+    }
+  }
+
+  // Same as `std::unordered_map::emplace()`: the pair is constructed first, and destroyed if the key is present.
+  template <typename... ARGS>
+  std::pair<iterator, bool> emplace(ARGS&&... args) {
+    reserve(size_ + 1u);
+    const size_t slot = AllocateSlot();
+    try {
+      new (&slots_[slot].data) value_type(std::forward<ARGS>(args)...);
+    } catch (...) {
+      free_slots_.push_back(slot);
+      throw;
+    }
+    slots_[slot].occupied = true;
+    const KEY& key = slots_[slot].value().first;
+    const size_t hash = Hash(key);
+    const size_t bucket = FindBucket(key, hash);
+    if (bucket != kNoSlot) {
+      ReleaseSlot(slot);
+      return std::make_pair(iterator(this, buckets_[bucket].slot), false);
+    }
+    PlaceBucket(Bucket{hash, slot});
+    ++size_;
+    return std::make_pair(iterator(this, slot), true);
+  }
+
+  size_t erase(const KEY& key) {
+    const size_t bucket = FindBucket(key, Hash(key));
+    if (bucket != kNoSlot) {
+      EraseBucket(bucket);
+      return 1u;
+    } else {
+      return 0u;
+    }
+  }
+
+  iterator erase(const_iterator it) {
+    const size_t index = it.index_;
+    const KEY& key = slots_[index].value().first;
+    EraseBucket(FindBucket(key, Hash(key)));
+    return iterator(this, index + 1u);
+  }
+
+  void clear() {
+    for (auto& slot : slots_) {
+      if (slot.occupied) {
+        slot.value().~value_type();
+        slot.occupied = false;
+      }
+    }
+    slots_.clear();
+    free_slots_.clear();
+    buckets_.clear();
+    size_ = 0u;
+  }
+
+  // Keeps the load factor at or below 7/8.
+  void reserve(size_t n) {
+    if (n * 8u <= buckets_.size() * 7u) {
+      return;
+    }
+    size_t buckets = std::max(kMinBuckets, buckets_.size());
+    while (n * 8u > buckets * 7u) {
+      buckets *= 2u;
+    }
+    Rehash(buckets);
+  }
+
+  // The number of probed buckets on average per successful lookup, for tests and for tuning the hash function.
+  double AverageProbeLength() const {
+    if (!size_) {
+      return 0.0;
+    }
+    const size_t mask = buckets_.size() - 1u;
+    size_t total = 0u;
+    for (size_t i = 0u; i < buckets_.size(); ++i) {
+      if (buckets_[i].slot != kNoSlot) {
+        total += ((i - buckets_[i].hash) & mask) + 1u;
+      }
+    }
+    return static_cast<double>(total) / size_;
+  }
+
+ private:
+  void Swap(Flat& rhs) {
+    slots_.swap(rhs.slots_);
+    free_slots_.swap(rhs.free_slots_);
+    buckets_.swap(rhs.buckets_);
+    std::swap(size_, rhs.size_);
+  }
+
+  // The `fmix64` finalizer of MurmurHash3: every input bit affects the low bits, which are the ones masked.
+  static size_t Hash(const KEY& key) {
+    uint64_t h = static_cast<uint64_t>(HASH()(key));
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
+
+  size_t FindBucket(const KEY& key, size_t hash) const {
+    if (buckets_.empty()) {
+      return kNoSlot;
+    }
+    const size_t mask = buckets_.size() - 1u;
+    for (size_t i = hash & mask;; i = (i + 1u) & mask) {
+      const Bucket& bucket = buckets_[i];
+      if (bucket.slot == kNoSlot) {
+        return kNoSlot;
+      }
+      if (bucket.hash == hash && EQUAL()(slots_[bucket.slot].value().first, key)) {
+        return i;
+      }
+    }
+  }
+
+  void PlaceBucket(const Bucket& bucket) {
+    const size_t mask = buckets_.size() - 1u;
+    size_t i = bucket.hash & mask;
+    while (buckets_[i].slot != kNoSlot) {
+      i = (i + 1u) & mask;
+    }
+    buckets_[i] = bucket;
+  }
+
+  void Rehash(size_t new_bucket_count) {
+    std::vector<Bucket> old_buckets(new_bucket_count, Bucket{0u, kNoSlot});
+    buckets_.swap(old_buckets);  // Now `old_buckets` are indeed the old ones.
+    for (const Bucket& bucket : old_buckets) {
+      if (bucket.slot != kNoSlot) {
+        PlaceBucket(bucket);
+      }
+    }
+  }
+
+  // Backward-shift deletion: pull the subsequent entries of the probe sequence into the hole, so that no tombstones
+  // are needed and the probe sequences stay as short as they were before the entry was inserted.
+  void EraseBucket(size_t hole) {
+    ReleaseSlot(buckets_[hole].slot);
+    const size_t mask = buckets_.size() - 1u;
+    for (size_t i = (hole + 1u) & mask; buckets_[i].slot != kNoSlot; i = (i + 1u) & mask) {
+      const size_t home = buckets_[i].hash & mask;
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        buckets_[hole] = buckets_[i];
+        hole = i;
+      }
+    }
+    buckets_[hole].slot = kNoSlot;
+    --size_;
+  }
+
+  size_t AllocateSlot() {
+    if (!free_slots_.empty()) {
+      const size_t slot = free_slots_.back();
+      free_slots_.pop_back();
+      return slot;
+    } else {
+      slots_.emplace_back();
+      return slots_.size() - 1u;
+    }
+  }
+
+  void ReleaseSlot(size_t slot) {
+    slots_[slot].value().~value_type();
+    slots_[slot].occupied = false;
+    free_slots_.push_back(slot);
+  }
+
+  std::deque<Slot> slots_;
+  std::vector<size_t> free_slots_;
+  std::vector<Bucket> buckets_;
+  size_t size_ = 0u;
+};
+
+template <typename KEY, typename VALUE, typename HASH, typename EQUAL>
+constexpr size_t Flat<KEY, VALUE, HASH, EQUAL>::kNoSlot;
+
+template <typename KEY, typename VALUE, typename HASH, typename EQUAL>
+constexpr size_t Flat<KEY, VALUE, HASH, EQUAL>::kMinBuckets;
+
+}  // namespace container
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_CONTAINER_FLAT_H
@@ -0,0 +1,237 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Secondary indexes for Storage dictionaries.
+//
+// An index is declared with `CURRENT_STORAGE_INDEX(kind, entry_type, field_name, index_name)`, where `kind` is one of
+// `OrderedUnique`, `UnorderedUnique`, `OrderedMulti`, `UnorderedMulti`, and is then listed in the field entry
+// declaration: `CURRENT_STORAGE_INDEXED_FIELD_ENTRY(OrderedDictionary, Record, RecordDictionary, RecordByRhs, ...)`.
+//
+// Indexes hold bare pointers into the dictionary, and are kept in sync with it on `Add()`, `Erase()`, rollbacks,
+// and on the replayed `Updated` / `Deleted` events. Adding an entry which violates a unique index throws
+// `StorageUniqueIndexViolationException`, which rolls back the transaction.
+
+#ifndef CURRENT_STORAGE_CONTAINER_INDEX_H
+#define CURRENT_STORAGE_CONTAINER_INDEX_H
+
+#include "common.h"
+#include "memory.h"
+#include "sfinae.h"
+
+#include "../exceptions.h"
+
+#include "../../TypeSystem/optional.h"
+#include "../../Bricks/strings/util.h"
+#include "../../Bricks/util/iterator.h"  // For `GenericMapAccessor`.
+#include "../../Bricks/util/singleton.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+namespace index {
+struct Unique {};
+struct Multi {};
+}  // namespace current::storage::container::index
+
+template <typename... INDEXES>
+struct Indexes {};
+
+using NoIndexes = Indexes<>;
+
+template <typename T, typename INDEX, typename UNIQUENESS = typename INDEX::uniqueness_t>
+class SecondaryIndex;
+
+// Unique index: index key -> the only entry having it.
+template <typename T, typename INDEX>
+class SecondaryIndex<T, INDEX, index::Unique> {
+ public:
+  using index_key_t = typename INDEX::key_t;
+  using map_t = typename INDEX::template map_t<index_key_t, const T*>;
+
+  bool Empty() const { return map_.empty(); }
+  size_t Size() const { return map_.size(); }
+
+  bool Has(sfinae::CF<index_key_t> key) const { return map_.find(key) != map_.end(); }
+
+  ImmutableOptional<T> operator[](sfinae::CF<index_key_t> key) const {
+    const auto cit = map_.find(key);
+    if (cit != map_.end()) {
+      return ImmutableOptional<T>(FromBarePointer(), cit->second);
+    } else {
+      return nullptr;
+    }
+  }
+
+  template <typename F>
+  void ForEachEntry(sfinae::CF<index_key_t> key, F&& f) const {
+    const auto cit = map_.find(key);
+    if (cit != map_.end()) {
+      f(*cit->second);
+    }
+  }
+
+  // `existing` is the entry being overwritten by `object`, if any; it is fine for `object` to take its place.
+  void AssertNoConflict(const T& object, const T* existing) const {
+    const auto cit = map_.find(INDEX::Extract(object));
+    if (cit != map_.end() && cit->second != existing) {
+      CURRENT_THROW(StorageUniqueIndexViolationException(
+          std::string("Unique index on `") + INDEX::FieldName() + "` violated by `" +
+          current::ToString(INDEX::Extract(object)) + "`."));
+    }
+  }
+
+  void Insert(const T& object) { map_[INDEX::Extract(object)] = &object; }
+
+  uint64_t ApproximateHeapBytes() const { return container::ApproximateHeapBytes(map_); }
+
+  void Remove(const T& object) {
+    const auto it = map_.find(INDEX::Extract(object));
+    // Only erase the index entry if it points to this very object, for the replayed stream to be forgiving.
+    if (it != map_.end() && it->second == &object) {
+      map_.erase(it);
+    }
+  }
+
+ private:
+  map_t map_;
+};
+
+// Multi index: index key -> the map of primary keys of the entries having it.
+template <typename T, typename INDEX>
+class SecondaryIndex<T, INDEX, index::Multi> {
+ public:
+  using index_key_t = typename INDEX::key_t;
+  using entries_map_t = Ordered<sfinae::entry_key_t<T>, const T*>;
+  using map_t = typename INDEX::template map_t<index_key_t, entries_map_t>;
+
+  bool Empty() const { return map_.empty(); }
+  size_t Size() const { return map_.size(); }
+
+  bool Has(sfinae::CF<index_key_t> key) const { return map_.find(key) != map_.end(); }
+
+  GenericMapAccessor<entries_map_t> operator[](sfinae::CF<index_key_t> key) const {
+    const auto cit = map_.find(key);
+    return GenericMapAccessor<entries_map_t>(cit != map_.end() ? cit->second
+                                                               : current::ThreadLocalSingleton<entries_map_t>());
+  }
+
+  template <typename F>
+  void ForEachEntry(sfinae::CF<index_key_t> key, F&& f) const {
+    const auto cit = map_.find(key);
+    if (cit != map_.end()) {
+      for (const auto& e : cit->second) {
+        f(*e.second);
+      }
+    }
+  }
+
+  void AssertNoConflict(const T&, const T*) const {}
+
+  void Insert(const T& object) { map_[INDEX::Extract(object)][sfinae::GetKey(object)] = &object; }
+
+  uint64_t ApproximateHeapBytes() const { return container::ApproximateHeapBytes(map_); }
+
+  void Remove(const T& object) {
+    const auto it = map_.find(INDEX::Extract(object));
+    if (it != map_.end()) {
+      it->second.erase(sfinae::GetKey(object));
+      if (it->second.empty()) {
+        map_.erase(it);
+      }
+    }
+  }
+
+ private:
+  map_t map_;
+};
+
+template <typename T, typename INDEX>
+struct SecondaryIndexHolder {
+  SecondaryIndex<T, INDEX> index;
+};
+
+template <typename T, typename INDEXES>
+class SecondaryIndexes;
+
+template <typename T, typename... INDEXES>
+class SecondaryIndexes<T, Indexes<INDEXES...>> : SecondaryIndexHolder<T, INDEXES>... {
+ public:
+  template <typename INDEX>
+  const SecondaryIndex<T, INDEX>& Get() const {
+    return static_cast<const SecondaryIndexHolder<T, INDEX>&>(*this).index;
+  }
+
+  void AssertNoConflicts(const T& object, const T* existing) const {
+    const int unused[] = {0, (Get<INDEXES>().AssertNoConflict(object, existing), 0)...};
+    static_cast<void>(unused);
+    static_cast<void>(object);  // Unused with no indexes.
+    static_cast<void>(existing);
+  }
+
+  void Insert(const T& object) {
+    const int unused[] = {0, (Mutable<INDEXES>().Insert(object), 0)...};
+    static_cast<void>(unused);
+  }
+
+  void Remove(const T& object) {
+    const int unused[] = {0, (Mutable<INDEXES>().Remove(object), 0)...};
+    static_cast<void>(unused);
+  }
+
+  uint64_t ApproximateHeapBytes() const {
+    uint64_t bytes = 0u;
+    const int unused[] = {0, (bytes += Get<INDEXES>().ApproximateHeapBytes(), 0)...};
+    static_cast<void>(unused);
+    return bytes;
+  }
+
+ private:
+  template <typename INDEX>
+  SecondaryIndex<T, INDEX>& Mutable() {
+    return static_cast<SecondaryIndexHolder<T, INDEX>&>(*this).index;
+  }
+};
+
+// Extracts the indexes of a storage field, `Indexes<>` for the containers which do not support them.
+template <typename FIELD>
+struct FieldIndexesExtractor {
+ private:
+  template <typename F>
+  static typename F::indexes_t Check(int);
+  template <typename>
+  static NoIndexes Check(...);
+
+ public:
+  using type = decltype(Check<FIELD>(0));
+};
+
+template <typename FIELD>
+using field_indexes_t = typename FieldIndexesExtractor<FIELD>::type;
+
+}  // namespace container
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_CONTAINER_INDEX_H
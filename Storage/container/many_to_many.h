@@ -27,7 +27,9 @@ SOFTWARE.
 #define CURRENT_STORAGE_CONTAINER_MANY_TO_MANY_H
 
 #include "common.h"
+#include "memory.h"
 #include "sfinae.h"
+#include "slab.h"
 
 #include "../base.h"
 
@@ -51,7 +53,10 @@ class GenericManyToMany {
   using row_t = sfinae::entry_row_t<T>;
   using col_t = sfinae::entry_col_t<T>;
   using key_t = std::pair<row_t, col_t>;
-  using whole_matrix_map_t = std::unordered_map<key_t, std::unique_ptr<T>, CurrentHashFunction<key_t>>;
+  using entry_allocator_t = SlabAllocator<T>;
+  using entry_ptr_t = typename entry_allocator_t::unique_ptr_t;
+  using whole_matrix_map_t =
+      std::unordered_map<key_t, entry_ptr_t, CurrentHashFunction<key_t>>;
   using row_elements_map_t = COL_MAP<col_t, const T*>;
   using col_elements_map_t = ROW_MAP<row_t, const T*>;
   using forward_map_t = ROW_MAP<row_t, row_elements_map_t>;
@@ -64,6 +69,9 @@ class GenericManyToMany {
   size_t Size() const { return map_.size(); }
 
   void Add(const T& object) {
+    if (journal_.instrumented) {
+      ++access_counters_.adds;
+    }
     const auto now = current::time::Now();
     const auto row = sfinae::GetRow(object);
     const auto col = sfinae::GetCol(object);
@@ -71,24 +79,17 @@ class GenericManyToMany {
     const auto map_cit = map_.find(key);
     const auto lm_cit = last_modified_.find(key);
     if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
       CURRENT_ASSERT(lm_cit != last_modified_.end());
-      const auto previous_timestamp = lm_cit->second;
+      // The previous entry itself moves into the undo log, so `object` stays valid even if it refers to it.
       journal_.LogMutation(UPDATE_EVENT(now, object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
-                           });
+                           UndoRemoval{this, lm_cit->second, std::move(map_cit->second), field_last_modified_});
     } else {
       if (lm_cit != last_modified_.end()) {
-        const auto previous_timestamp = lm_cit->second;
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key, previous_timestamp]() { DoEraseWithLastModified(previous_timestamp, key); });
+                             UndoInsertion{this, key, true, lm_cit->second, field_last_modified_});
       } else {
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key]() {
-                               last_modified_.erase(key);
-                               DoEraseWithoutTouchingLastModified(key);
-                             });
+                             UndoInsertion{this, key, false, std::chrono::microseconds(0), field_last_modified_});
       }
     }
     DoUpdateWithLastModified(now, key, object);
@@ -96,23 +97,19 @@ class GenericManyToMany {
 
   // Here and below pass the key by a const reference, as `key_t` is an `std::pair<row_t, col_t>`.
   void Erase(const key_t& key) {
-    const auto now = current::time::Now();
-    const auto map_cit = map_.find(key);
-    if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
-      const auto lm_cit = last_modified_.find(key);
-      CURRENT_ASSERT(lm_cit != last_modified_.end());
-      const auto previous_timestamp = lm_cit->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
-                           });
-      DoEraseWithLastModified(now, key);
+    if (journal_.instrumented) {
+      ++access_counters_.erases;
+    }
+    if (map_.find(key) != map_.end()) {
+      EraseAndLogUndo(current::time::Now(), key);
     }
   }
   void Erase(sfinae::CF<row_t> row, sfinae::CF<col_t> col) { Erase(std::make_pair(row, col)); }
 
   ImmutableOptional<T> operator[](const key_t& key) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto cit = map_.find(key);
     if (cit != map_.end()) {
       return ImmutableOptional<T>(FromBarePointer(), cit->second.get());
@@ -124,6 +121,22 @@ class GenericManyToMany {
     return operator[](std::make_pair(row, col));
   }
 
+  SlabAllocatorStats EntryAllocatorStats() const { return entry_allocator_.Stats(); }
+
+  // The entries themselves are stored in the slabs, the maps only hold the pointers to them.
+  StorageFieldStats FieldStats() const {
+    StorageFieldStats stats;
+    stats.entries = map_.size();
+    stats.approximate_bytes = entry_allocator_.Stats().bytes + ApproximateHeapBytes(map_) +
+                              ApproximateHeapBytes(forward_) + ApproximateHeapBytes(transposed_) +
+                              ApproximateHeapBytes(last_modified_);
+    access_counters_.FillStats(stats);
+    return stats;
+  }
+
+  // The most recent modification time of any entry, zero if none. Used for the collection-level `ETag`-s.
+  std::chrono::microseconds FieldLastModified() const { return field_last_modified_; }
+
   ImmutableOptional<std::chrono::microseconds> LastModified(const key_t& key) const {
     const auto cit = last_modified_.find(key);
     if (cit != last_modified_.end()) {
@@ -192,12 +205,18 @@ class GenericManyToMany {
   cols_outer_accessor_t Cols() const { return OuterAccessor<transposed_map_t>(transposed_); }
 
   GenericMapAccessor<row_elements_map_t> Row(sfinae::CF<row_t> row) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto cit = forward_.find(row);
     return GenericMapAccessor<row_elements_map_t>(
         cit != forward_.end() ? cit->second : current::ThreadLocalSingleton<row_elements_map_t>());
   }
 
   GenericMapAccessor<col_elements_map_t> Col(sfinae::CF<col_t> col) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto cit = transposed_.find(col);
     return GenericMapAccessor<col_elements_map_t>(
         cit != transposed_.end() ? cit->second : current::ThreadLocalSingleton<col_elements_map_t>());
@@ -210,10 +229,41 @@ class GenericManyToMany {
   iterator_t end() const { return iterator_t(map_.end()); }
 
  private:
-  void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, const T& object) {
+  // Erases the existing entry, moving it into the undo log of the transaction.
+  void EraseAndLogUndo(std::chrono::microseconds now, const key_t& key) {
+    const auto map_it = map_.find(key);
+    const auto lm_cit = last_modified_.find(key);
+    CURRENT_ASSERT(map_it != map_.end());
+    CURRENT_ASSERT(lm_cit != last_modified_.end());
+    DELETE_EVENT event(now, *(map_it->second));
+    journal_.LogMutation(std::move(event),
+                         UndoRemoval{this, lm_cit->second, std::move(map_it->second), field_last_modified_});
+    DoEraseWithLastModified(now, key);
+  }
+
+  void SetLastModified(const key_t& key, std::chrono::microseconds us) {
     last_modified_[key] = us;
+    field_last_modified_ = std::max(field_last_modified_, us);
+  }
+
+  void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, const T& object) {
+    SetLastModified(key, us);
     auto& placeholder = map_[key];
-    placeholder = std::make_unique<T>(object);
+    if (placeholder) {
+      // Overwrite in place, the pointers in the forward and transposed maps stay valid.
+      *placeholder = object;
+    } else {
+      placeholder = entry_allocator_.New(object);
+    }
+    forward_[key.first][key.second] = placeholder.get();
+    transposed_[key.second][key.first] = placeholder.get();
+  }
+
+  void DoRestoreWithLastModified(std::chrono::microseconds us, entry_ptr_t entry) {
+    const auto key = std::make_pair(sfinae::GetRow(*entry), sfinae::GetCol(*entry));
+    SetLastModified(key, us);
+    auto& placeholder = map_[key];
+    placeholder = std::move(entry);
     forward_[key.first][key.second] = placeholder.get();
     transposed_[key.second][key.first] = placeholder.get();
   }
@@ -233,14 +283,49 @@ class GenericManyToMany {
   }
 
   void DoEraseWithLastModified(std::chrono::microseconds us, const key_t& key) {
-    last_modified_[key] = us;
+    SetLastModified(key, us);
     DoEraseWithoutTouchingLastModified(key);
   }
 
+  // Undo records for `MutationJournal`. Both also put back `field_last_modified_`, see `container/dictionary.h`.
+  // Puts back the entry which the transaction has overwritten or erased. The entry itself is kept, not a copy of it.
+  struct UndoRemoval {
+    GenericManyToMany* self;
+    std::chrono::microseconds previous_timestamp;
+    entry_ptr_t previous_entry;
+    std::chrono::microseconds previous_field_last_modified;
+    void operator()() {
+      self->DoRestoreWithLastModified(previous_timestamp, std::move(previous_entry));
+      self->field_last_modified_ = previous_field_last_modified;
+    }
+  };
+
+  // Erases the entry which the transaction has added, restoring the last modified timestamp of the key, if any.
+  struct UndoInsertion {
+    GenericManyToMany* self;
+    key_t key;
+    bool had_timestamp;
+    std::chrono::microseconds previous_timestamp;
+    std::chrono::microseconds previous_field_last_modified;
+    void operator()() {
+      if (had_timestamp) {
+        self->DoEraseWithLastModified(previous_timestamp, key);
+      } else {
+        self->last_modified_.erase(key);
+        self->DoEraseWithoutTouchingLastModified(key);
+      }
+      self->field_last_modified_ = previous_field_last_modified;
+    }
+  };
+
+  // Must be declared before `map_`, which returns the entries to it on destruction.
+  entry_allocator_t entry_allocator_;
   whole_matrix_map_t map_;
   forward_map_t forward_;
   transposed_map_t transposed_;
   std::unordered_map<key_t, std::chrono::microseconds, CurrentHashFunction<key_t>> last_modified_;
+  std::chrono::microseconds field_last_modified_ = std::chrono::microseconds(0);
+  mutable FieldAccessCounters access_counters_;
   MutationJournal& journal_;
 };
 
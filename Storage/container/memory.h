@@ -0,0 +1,120 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `ApproximateHeapBytes(map)` is the memory a map holds on top of `sizeof(map)`, for the storage instrumentation.
+//
+// The nodes are assumed to be laid out as in the common standard library implementations: a tree node carries three
+// pointers and the color, a hash table node carries the next pointer and the cached hash. The values nested maps
+// hold are counted recursively. Other than that, the memory owned by the values is not counted.
+
+#ifndef CURRENT_STORAGE_CONTAINER_MEMORY_H
+#define CURRENT_STORAGE_CONTAINER_MEMORY_H
+
+#include "../../port.h"
+
+#include <map>
+#include <type_traits>
+#include <unordered_map>
+
+#include "flat.h"
+#include "persistent.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+constexpr size_t kApproximateTreeNodeOverhead = 4u * sizeof(void*);
+constexpr size_t kApproximateHashNodeOverhead = 2u * sizeof(void*);
+
+template <typename T>
+struct ApproximateMemory {
+  constexpr static bool is_map = false;
+  static uint64_t HeapBytes(const T&) { return 0u; }
+};
+
+template <typename MAP>
+uint64_t ApproximateNestedHeapBytes(const MAP&, std::false_type) {
+  return 0u;
+}
+
+template <typename MAP>
+uint64_t ApproximateNestedHeapBytes(const MAP& map, std::true_type) {
+  uint64_t bytes = 0u;
+  for (const auto& element : map) {
+    bytes += ApproximateMemory<typename MAP::mapped_type>::HeapBytes(element.second);
+  }
+  return bytes;
+}
+
+template <typename MAP>
+uint64_t ApproximateNestedHeapBytes(const MAP& map) {
+  return ApproximateNestedHeapBytes(
+      map, std::integral_constant<bool, ApproximateMemory<typename MAP::mapped_type>::is_map>());
+}
+
+template <typename K, typename V, typename C, typename A>
+struct ApproximateMemory<std::map<K, V, C, A>> {
+  constexpr static bool is_map = true;
+  static uint64_t HeapBytes(const std::map<K, V, C, A>& map) {
+    using value_t = typename std::map<K, V, C, A>::value_type;
+    return map.size() * (sizeof(value_t) + kApproximateTreeNodeOverhead) + ApproximateNestedHeapBytes(map);
+  }
+};
+
+template <typename K, typename V, typename H, typename E, typename A>
+struct ApproximateMemory<std::unordered_map<K, V, H, E, A>> {
+  constexpr static bool is_map = true;
+  static uint64_t HeapBytes(const std::unordered_map<K, V, H, E, A>& map) {
+    using value_t = typename std::unordered_map<K, V, H, E, A>::value_type;
+    return map.size() * (sizeof(value_t) + kApproximateHashNodeOverhead) + map.bucket_count() * sizeof(void*) +
+           ApproximateNestedHeapBytes(map);
+  }
+};
+
+template <typename K, typename V, typename H, typename E>
+struct ApproximateMemory<Flat<K, V, H, E>> {
+  constexpr static bool is_map = true;
+  static uint64_t HeapBytes(const Flat<K, V, H, E>& map) {
+    return map.allocated_bytes() + ApproximateNestedHeapBytes(map);
+  }
+};
+
+template <typename K, typename V, typename H, typename E>
+struct ApproximateMemory<Persistent<K, V, H, E>> {
+  constexpr static bool is_map = true;
+  static uint64_t HeapBytes(const Persistent<K, V, H, E>& map) {
+    return map.allocated_bytes() + ApproximateNestedHeapBytes(map);
+  }
+};
+
+template <typename T>
+uint64_t ApproximateHeapBytes(const T& x) {
+  return ApproximateMemory<T>::HeapBytes(x);
+}
+
+}  // namespace current::storage::container
+}  // namespace current::storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_CONTAINER_MEMORY_H
@@ -27,7 +27,9 @@ SOFTWARE.
 #define CURRENT_STORAGE_CONTAINER_ONE_TO_ONE_H
 
 #include "common.h"
+#include "memory.h"
 #include "sfinae.h"
+#include "slab.h"
 
 #include "../base.h"
 
@@ -50,7 +52,10 @@ class GenericOneToOne {
   using row_t = sfinae::entry_row_t<T>;
   using col_t = sfinae::entry_col_t<T>;
   using key_t = std::pair<row_t, col_t>;
-  using elements_map_t = std::unordered_map<key_t, std::unique_ptr<T>, CurrentHashFunction<key_t>>;
+  using entry_allocator_t = SlabAllocator<T>;
+  using entry_ptr_t = typename entry_allocator_t::unique_ptr_t;
+  using elements_map_t =
+      std::unordered_map<key_t, entry_ptr_t, CurrentHashFunction<key_t>>;
   using forward_map_t = ROW_MAP<row_t, const T*>;
   using transposed_map_t = COL_MAP<col_t, const T*>;
   using semantics_t = storage::semantics::OneToOne;
@@ -63,6 +68,9 @@ class GenericOneToOne {
   // Adds specified object and overwrites existing one if it has the same row and col.
   // Removes all other existing objects with the same row or col.
   void Add(const T& object) {
+    if (journal_.instrumented) {
+      ++access_counters_.adds;
+    }
     // `now` can be updated to minimize the number of `Now()` calls and keep the order of the timestamps.
     auto now = current::time::Now();
     const auto row = sfinae::GetRow(object);
@@ -71,67 +79,36 @@ class GenericOneToOne {
     const auto map_cit = map_.find(key);
     const auto lm_cit = last_modified_.find(key);
     if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
       CURRENT_ASSERT(lm_cit != last_modified_.end());
-      const auto previous_timestamp = lm_cit->second;
+      // The previous entry itself moves into the undo log, so `object` stays valid even if it refers to it.
       journal_.LogMutation(UPDATE_EVENT(now, object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
-                           });
+                           UndoRemoval{this, lm_cit->second, std::move(map_cit->second), field_last_modified_});
     } else {
       const auto cit_row = forward_.find(row);
       const auto cit_col = transposed_.find(col);
       const bool row_occupied = (cit_row != forward_.end());
       const bool col_occupied = (cit_col != transposed_.end());
       if (row_occupied && col_occupied) {
-        const T& conflicting_object_same_row = *(cit_row->second);
-        const T& conflicting_object_same_col = *(cit_col->second);
-        const auto key_same_row = std::make_pair(row, sfinae::GetCol(conflicting_object_same_row));
-        const auto lm_same_row_cit = last_modified_.find(key_same_row);
-        CURRENT_ASSERT(lm_same_row_cit != last_modified_.end());
-        const auto timestamp_same_row = lm_same_row_cit->second;
-        const auto key_same_col = std::make_pair(sfinae::GetRow(conflicting_object_same_col), col);
-        const auto lm_same_col_cit = last_modified_.find(key_same_col);
-        CURRENT_ASSERT(lm_same_col_cit != last_modified_.end());
-        const auto timestamp_same_col = lm_same_col_cit->second;
-        journal_.LogMutation(DELETE_EVENT(now, conflicting_object_same_row),
-                             [this, key_same_row, conflicting_object_same_row, timestamp_same_row]() {
-                               DoUpdateWithLastModified(timestamp_same_row, key_same_row, conflicting_object_same_row);
-                             });
-        DoEraseWithLastModified(now, key_same_row);
+        const auto key_same_row = std::make_pair(row, sfinae::GetCol(*(cit_row->second)));
+        const auto key_same_col = std::make_pair(sfinae::GetRow(*(cit_col->second)), col);
+        EraseAndLogUndo(now, key_same_row);
         now = current::time::Now();
-        journal_.LogMutation(DELETE_EVENT(now, conflicting_object_same_col),
-                             [this, key_same_col, conflicting_object_same_col, timestamp_same_col]() {
-                               DoUpdateWithLastModified(timestamp_same_col, key_same_col, conflicting_object_same_col);
-                             });
-        DoEraseWithLastModified(now, key_same_col);
+        EraseAndLogUndo(now, key_same_col);
         now = current::time::Now();
       } else if (row_occupied || col_occupied) {
         const T& conflicting_object = row_occupied ? *(cit_row->second) : *(cit_col->second);
         const auto conflicting_object_key =
             std::make_pair(sfinae::GetRow(conflicting_object), sfinae::GetCol(conflicting_object));
-        const auto conflicting_object_lm_cit = last_modified_.find(conflicting_object_key);
-        CURRENT_ASSERT(conflicting_object_lm_cit != last_modified_.end());
-        const auto conflicting_object_timestamp = conflicting_object_lm_cit->second;
-        journal_.LogMutation(DELETE_EVENT(now, conflicting_object),
-                             [this, conflicting_object_key, conflicting_object, conflicting_object_timestamp]() {
-                               DoUpdateWithLastModified(
-                                   conflicting_object_timestamp, conflicting_object_key, conflicting_object);
-                             });
-        DoEraseWithLastModified(now, conflicting_object_key);
+        EraseAndLogUndo(now, conflicting_object_key);
         now = current::time::Now();
       }
 
       if (lm_cit != last_modified_.end()) {
-        const auto previous_timestamp = lm_cit->second;
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key, previous_timestamp]() { DoEraseWithLastModified(previous_timestamp, key); });
+                             UndoInsertion{this, key, true, lm_cit->second, field_last_modified_});
       } else {
         journal_.LogMutation(UPDATE_EVENT(now, object),
-                             [this, key]() {
-                               last_modified_.erase(key);
-                               DoEraseWithoutTouchingLastModified(key);
-                             });
+                             UndoInsertion{this, key, false, std::chrono::microseconds(0), field_last_modified_});
       }
     }
     DoUpdateWithLastModified(now, key, object);
@@ -139,57 +116,39 @@ class GenericOneToOne {
 
   // Here and below pass the key by a const reference, as `key_t` is an `std::pair<row_t, col_t>`.
   void Erase(const key_t& key) {
-    const auto now = current::time::Now();
-    const auto map_cit = map_.find(key);
-    if (map_cit != map_.end()) {
-      const T& previous_object = *(map_cit->second);
-      const auto lm_cit = last_modified_.find(key);
-      CURRENT_ASSERT(lm_cit != last_modified_.end());
-      const auto previous_timestamp = lm_cit->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
-                           });
-      DoEraseWithLastModified(now, key);
+    if (journal_.instrumented) {
+      ++access_counters_.erases;
+    }
+    if (map_.find(key) != map_.end()) {
+      EraseAndLogUndo(current::time::Now(), key);
     }
   }
   void Erase(sfinae::CF<row_t> row, sfinae::CF<col_t> col) { Erase(std::make_pair(row, col)); }
 
   void EraseRow(sfinae::CF<row_t> row) {
-    const auto now = current::time::Now();
+    if (journal_.instrumented) {
+      ++access_counters_.erases;
+    }
     const auto forward_cit = forward_.find(row);
     if (forward_cit != forward_.end()) {
-      const T& previous_object = *(forward_cit->second);
-      const auto key = std::make_pair(row, sfinae::GetCol(previous_object));
-      const auto lm_cit = last_modified_.find(key);
-      CURRENT_ASSERT(lm_cit != last_modified_.end());
-      const auto previous_timestamp = lm_cit->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
-                           });
-      DoEraseWithLastModified(now, key);
+      EraseAndLogUndo(current::time::Now(), std::make_pair(row, sfinae::GetCol(*(forward_cit->second))));
     }
   }
 
   void EraseCol(sfinae::CF<col_t> col) {
-    const auto now = current::time::Now();
+    if (journal_.instrumented) {
+      ++access_counters_.erases;
+    }
     const auto transposed_cit = transposed_.find(col);
     if (transposed_cit != transposed_.end()) {
-      const T& previous_object = *(transposed_cit->second);
-      const auto key = std::make_pair(sfinae::GetRow(previous_object), col);
-      const auto lm_cit = last_modified_.find(key);
-      CURRENT_ASSERT(lm_cit != last_modified_.end());
-      const auto previous_timestamp = lm_cit->second;
-      journal_.LogMutation(DELETE_EVENT(now, previous_object),
-                           [this, key, previous_object, previous_timestamp]() {
-                             DoUpdateWithLastModified(previous_timestamp, key, previous_object);
-                           });
-      DoEraseWithLastModified(now, key);
+      EraseAndLogUndo(current::time::Now(), std::make_pair(sfinae::GetRow(*(transposed_cit->second)), col));
     }
   }
 
   ImmutableOptional<T> operator[](const key_t& key) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto cit = map_.find(key);
     if (cit != map_.end()) {
       return ImmutableOptional<T>(FromBarePointer(), cit->second.get());
@@ -201,6 +160,9 @@ class GenericOneToOne {
     return operator[](std::make_pair(row, col));
   }
   ImmutableOptional<T> GetEntryFromRow(sfinae::CF<row_t> row) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto cit = forward_.find(row);
     if (cit != forward_.end()) {
       return ImmutableOptional<T>(FromBarePointer(), cit->second);
@@ -209,6 +171,9 @@ class GenericOneToOne {
     }
   }
   ImmutableOptional<T> GetEntryFromCol(sfinae::CF<col_t> col) const {
+    if (journal_.instrumented) {
+      ++access_counters_.lookups;
+    }
     const auto cit = transposed_.find(col);
     if (cit != transposed_.end()) {
       return ImmutableOptional<T>(FromBarePointer(), cit->second);
@@ -217,6 +182,22 @@ class GenericOneToOne {
     }
   }
 
+  SlabAllocatorStats EntryAllocatorStats() const { return entry_allocator_.Stats(); }
+
+  // The entries themselves are stored in the slabs, the maps only hold the pointers to them.
+  StorageFieldStats FieldStats() const {
+    StorageFieldStats stats;
+    stats.entries = map_.size();
+    stats.approximate_bytes = entry_allocator_.Stats().bytes + ApproximateHeapBytes(map_) +
+                              ApproximateHeapBytes(forward_) + ApproximateHeapBytes(transposed_) +
+                              ApproximateHeapBytes(last_modified_);
+    access_counters_.FillStats(stats);
+    return stats;
+  }
+
+  // The most recent modification time of any entry, zero if none. Used for the collection-level `ETag`-s.
+  std::chrono::microseconds FieldLastModified() const { return field_last_modified_; }
+
   ImmutableOptional<std::chrono::microseconds> LastModified(const key_t& key) const {
     const auto cit = last_modified_.find(key);
     if (cit != last_modified_.end()) {
@@ -256,10 +237,41 @@ class GenericOneToOne {
   iterator_t end() const { return iterator_t(map_.end()); }
 
  private:
-  void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, const T& object) {
+  // Erases the existing entry, moving it into the undo log of the transaction.
+  void EraseAndLogUndo(std::chrono::microseconds now, const key_t& key) {
+    const auto map_it = map_.find(key);
+    const auto lm_cit = last_modified_.find(key);
+    CURRENT_ASSERT(map_it != map_.end());
+    CURRENT_ASSERT(lm_cit != last_modified_.end());
+    DELETE_EVENT event(now, *(map_it->second));
+    journal_.LogMutation(std::move(event),
+                         UndoRemoval{this, lm_cit->second, std::move(map_it->second), field_last_modified_});
+    DoEraseWithLastModified(now, key);
+  }
+
+  void SetLastModified(const key_t& key, std::chrono::microseconds us) {
     last_modified_[key] = us;
+    field_last_modified_ = std::max(field_last_modified_, us);
+  }
+
+  void DoUpdateWithLastModified(std::chrono::microseconds us, const key_t& key, const T& object) {
+    SetLastModified(key, us);
     auto& placeholder = map_[key];
-    placeholder = std::make_unique<T>(object);
+    if (placeholder) {
+      // Overwrite in place, the pointers in the forward and transposed maps stay valid.
+      *placeholder = object;
+    } else {
+      placeholder = entry_allocator_.New(object);
+    }
+    forward_[key.first] = placeholder.get();
+    transposed_[key.second] = placeholder.get();
+  }
+
+  void DoRestoreWithLastModified(std::chrono::microseconds us, entry_ptr_t entry) {
+    const auto key = std::make_pair(sfinae::GetRow(*entry), sfinae::GetCol(*entry));
+    SetLastModified(key, us);
+    auto& placeholder = map_[key];
+    placeholder = std::move(entry);
     forward_[key.first] = placeholder.get();
     transposed_[key.second] = placeholder.get();
   }
@@ -271,14 +283,49 @@ class GenericOneToOne {
   }
 
   void DoEraseWithLastModified(std::chrono::microseconds us, const key_t& key) {
-    last_modified_[key] = us;
+    SetLastModified(key, us);
     DoEraseWithoutTouchingLastModified(key);
   }
 
+  // Undo records for `MutationJournal`. Both also put back `field_last_modified_`, see `container/dictionary.h`.
+  // Puts back the entry which the transaction has overwritten or erased. The entry itself is kept, not a copy of it.
+  struct UndoRemoval {
+    GenericOneToOne* self;
+    std::chrono::microseconds previous_timestamp;
+    entry_ptr_t previous_entry;
+    std::chrono::microseconds previous_field_last_modified;
+    void operator()() {
+      self->DoRestoreWithLastModified(previous_timestamp, std::move(previous_entry));
+      self->field_last_modified_ = previous_field_last_modified;
+    }
+  };
+
+  // Erases the entry which the transaction has added, restoring the last modified timestamp of the key, if any.
+  struct UndoInsertion {
+    GenericOneToOne* self;
+    key_t key;
+    bool had_timestamp;
+    std::chrono::microseconds previous_timestamp;
+    std::chrono::microseconds previous_field_last_modified;
+    void operator()() {
+      if (had_timestamp) {
+        self->DoEraseWithLastModified(previous_timestamp, key);
+      } else {
+        self->last_modified_.erase(key);
+        self->DoEraseWithoutTouchingLastModified(key);
+      }
+      self->field_last_modified_ = previous_field_last_modified;
+    }
+  };
+
+  // Must be declared before `map_`, which returns the entries to it on destruction.
+  entry_allocator_t entry_allocator_;
   elements_map_t map_;
   forward_map_t forward_;
   transposed_map_t transposed_;
   std::unordered_map<key_t, std::chrono::microseconds, CurrentHashFunction<key_t>> last_modified_;
+  std::chrono::microseconds field_last_modified_ = std::chrono::microseconds(0);
+  mutable FieldAccessCounters access_counters_;
   MutationJournal& journal_;
 };
 
@@ -0,0 +1,442 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `Persistent<KEY, VALUE>` is a persistent hash map, a hash array mapped trie with structural sharing.
+//
+// Copying the map is O(1): the copy shares the whole trie with the original. The nodes and the `{ key, value }` pairs
+// are immutable once created, and a mutation copies the O(log32 N) nodes on the path from the root to the entry,
+// leaving the rest shared. Hence a copy stays intact no matter how the original is mutated, and it can be read on
+// another thread while the original is being modified, as long as the copy itself was made under the same lock the
+// mutations are made under. This is what `GenericDictionary::Snapshot()` relies on.
+//
+// Each level of the trie takes five bits of the hash, and keeps only its present children, indexed by a bitmap.
+// The entries with fully equal hashes end up in the same collision node. The pairs are held by `std::shared_ptr<>`-s,
+// so that their addresses are stable for as long as the entry is not overwritten or erased, same as with node-based
+// maps, which the secondary indexes rely on. The entries are never modified in place: the `iterator` is const, and
+// the values are changed with `set()`.
+//
+// Iteration order is the order of the hashes, from the lowest bits up, and does not depend on the order of insertions.
+// Any mutation invalidates all the iterators of the map, but not of its copies.
+
+#ifndef CURRENT_STORAGE_CONTAINER_PERSISTENT_H
+#define CURRENT_STORAGE_CONTAINER_PERSISTENT_H
+
+#include "../../port.h"
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "../../Bricks/util/comparators.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+template <typename KEY, typename VALUE, typename HASH = CurrentHashFunction<KEY>, typename EQUAL = std::equal_to<KEY>>
+class Persistent final {
+ public:
+  using key_type = KEY;
+  using mapped_type = VALUE;
+  using value_type = std::pair<const KEY, VALUE>;
+  using hasher = HASH;
+  using key_equal = EQUAL;
+  using size_type = size_t;
+
+ private:
+  enum : size_t { kBitsPerLevel = 5u, kHashBits = sizeof(size_t) * 8u };
+  // The number of levels the bits of the hash last for, plus the collision nodes.
+  enum : size_t { kMaxDepth = (kHashBits + kBitsPerLevel - 1u) / kBitsPerLevel + 1u };
+
+  struct Node;
+  using leaf_ptr_t = std::shared_ptr<const value_type>;
+  using node_ptr_t = std::shared_ptr<const Node>;
+
+  // Either a leaf, with the hash of its key, or a subtrie.
+  struct Child {
+    size_t hash;
+    leaf_ptr_t leaf;
+    node_ptr_t node;
+  };
+
+  // In the collision nodes `bitmap` is unused, and all the children are the leaves with the same hash.
+  struct Node {
+    uint32_t bitmap = 0u;
+    bool collision = false;
+    std::vector<Child> children;
+  };
+
+ public:
+  class const_iterator final {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = const typename Persistent::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type*;
+    using reference = value_type&;
+
+    const_iterator() = default;
+
+    const_iterator& operator++() {
+      ++frames_[depth_ - 1u].index;
+      Settle();
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator result = *this;
+      operator++();
+      return result;
+    }
+
+    bool operator==(const const_iterator& rhs) const {
+      return depth_ == rhs.depth_ &&
+             (!depth_ || (frames_[depth_ - 1u].node == rhs.frames_[depth_ - 1u].node &&
+                          frames_[depth_ - 1u].index == rhs.frames_[depth_ - 1u].index));
+    }
+    bool operator!=(const const_iterator& rhs) const { return !operator==(rhs); }
+
+    reference operator*() const { return *Current().leaf; }
+    pointer operator->() const { return Current().leaf.get(); }
+
+   private:
+    friend class Persistent;
+
+    struct Frame {
+      const Node* node;
+      size_t index;
+    };
+
+    const Child& Current() const { return frames_[depth_ - 1u].node->children[frames_[depth_ - 1u].index]; }
+
+    void Push(const Node* node, size_t index) { frames_[depth_++] = Frame{node, index}; }
+
+    // Moves on to the first leaf at or past the current position, or to the end.
+    void Settle() {
+      while (depth_) {
+        Frame& top = frames_[depth_ - 1u];
+        if (top.index >= top.node->children.size()) {
+          if (--depth_) {
+            ++frames_[depth_ - 1u].index;
+          }
+        } else if (top.node->children[top.index].node) {
+          Push(top.node->children[top.index].node.get(), 0u);
+        } else {
+          return;
+        }
+      }
+    }
+
+    Frame frames_[kMaxDepth];
+    size_t depth_ = 0u;
+  };
+
+  // The entries can not be modified in place.
+  using iterator = const_iterator;
+
+  Persistent() = default;
+
+  bool empty() const { return size_ == 0u; }
+  size_t size() const { return size_; }
+
+  const_iterator begin() const {
+    const_iterator result;
+    if (root_) {
+      result.Push(root_.get(), 0u);
+      result.Settle();
+    }
+    return result;
+  }
+  const_iterator end() const { return const_iterator(); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  const_iterator find(const KEY& key) const {
+    const_iterator result;
+    const size_t hash = HASH()(key);
+    const Node* node = root_.get();
+    size_t shift = 0u;
+    while (node) {
+      size_t index;
+      if (node->collision) {
+        for (index = 0u; index < node->children.size(); ++index) {
+          if (EQUAL()(node->children[index].leaf->first, key)) {
+            break;
+          }
+        }
+        if (index == node->children.size()) {
+          return end();
+        }
+      } else {
+        const uint32_t mask = Mask(hash, shift);
+        if (!(node->bitmap & mask)) {
+          return end();
+        }
+        index = Position(node->bitmap, mask);
+      }
+      result.Push(node, index);
+      const Child& child = node->children[index];
+      if (child.node) {
+        node = child.node.get();
+        shift += kBitsPerLevel;
+      } else {
+        return (child.hash == hash && EQUAL()(child.leaf->first, key)) ? result : end();
+      }
+    }
+    return end();
+  }
+  size_t count(const KEY& key) const { return find(key) != end() ? 1u : 0u; }
+
+  // Inserts or overwrites the entry, and returns the reference to its value, valid until it is overwritten or erased.
+  template <typename V>
+  const VALUE& set(const KEY& key, V&& value) {
+    // The new pair is constructed first, as `key` or `value` may refer to the entry being overwritten.
+    leaf_ptr_t leaf = std::make_shared<const value_type>(key, std::forward<V>(value));
+    const VALUE& result = leaf->second;
+    bool inserted = false;
+    root_ = Insert(root_, 0u, HASH()(key), std::move(leaf), true, inserted);
+    if (inserted) {
+      ++size_;
+    }
+    return result;
+  }
+
+  // Same as `std::unordered_map::emplace()`: the pair is constructed first, and is dropped if the key is present.
+  template <typename... ARGS>
+  std::pair<const_iterator, bool> emplace(ARGS&&... args) {
+    leaf_ptr_t leaf = std::make_shared<const value_type>(std::forward<ARGS>(args)...);
+    const KEY& key = leaf->first;
+    const size_t hash = HASH()(key);
+    bool inserted = false;
+    root_ = Insert(root_, 0u, hash, leaf, false, inserted);
+    if (inserted) {
+      ++size_;
+    }
+    return std::make_pair(find(key), inserted);
+  }
+
+  size_t erase(const KEY& key) {
+    if (!root_) {
+      return 0u;
+    }
+    Child replacement;
+    if (!Erase(root_.get(), 0u, HASH()(key), key, replacement)) {
+      return 0u;
+    }
+    if (replacement.node) {
+      root_ = std::move(replacement.node);
+    } else if (replacement.leaf) {
+      // The root is always a node, even if only one entry is left.
+      bool unused_inserted;
+      root_ = Insert(nullptr, 0u, replacement.hash, std::move(replacement.leaf), false, unused_inserted);
+    } else {
+      root_ = nullptr;
+    }
+    --size_;
+    return 1u;
+  }
+
+  void erase(const_iterator it) { erase(KEY(it->first)); }
+
+  void clear() {
+    root_ = nullptr;
+    size_ = 0u;
+  }
+
+  // The memory held by the nodes and the pairs, including the ones shared with the copies of this map.
+  size_t allocated_bytes() const { return root_ ? AllocatedBytes(*root_) : 0u; }
+
+ private:
+  static uint32_t Mask(size_t hash, size_t shift) {
+    return static_cast<uint32_t>(1u) << ((hash >> shift) & ((static_cast<size_t>(1u) << kBitsPerLevel) - 1u));
+  }
+
+  static size_t Position(uint32_t bitmap, uint32_t mask) {
+    uint32_t x = bitmap & (mask - 1u);
+    x = x - ((x >> 1u) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2u) & 0x33333333u);
+    return static_cast<size_t>((((x + (x >> 4u)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24u);
+  }
+
+  // A node holding the two leaves with different keys, splitting them further down if their hashes collide so far.
+  static node_ptr_t Split(size_t shift, Child lhs, Child rhs) {
+    auto node = std::make_shared<Node>();
+    if (shift >= kHashBits) {
+      node->collision = true;
+      node->children.push_back(std::move(lhs));
+      node->children.push_back(std::move(rhs));
+    } else {
+      const uint32_t lhs_mask = Mask(lhs.hash, shift);
+      const uint32_t rhs_mask = Mask(rhs.hash, shift);
+      if (lhs_mask == rhs_mask) {
+        node->bitmap = lhs_mask;
+        const size_t hash = lhs.hash;
+        node->children.push_back(Child{hash, nullptr, Split(shift + kBitsPerLevel, std::move(lhs), std::move(rhs))});
+      } else {
+        node->bitmap = lhs_mask | rhs_mask;
+        if (lhs_mask < rhs_mask) {
+          node->children.push_back(std::move(lhs));
+          node->children.push_back(std::move(rhs));
+        } else {
+          node->children.push_back(std::move(rhs));
+          node->children.push_back(std::move(lhs));
+        }
+      }
+    }
+    return node;
+  }
+
+  // Returns the copy of `node` with the leaf inserted. If the key is present, the leaf replaces it if `overwrite`
+  // is set, and `node` itself is returned otherwise.
+  static node_ptr_t Insert(
+      const node_ptr_t& node, size_t shift, size_t hash, leaf_ptr_t leaf, bool overwrite, bool& inserted) {
+    if (!node) {
+      auto result = std::make_shared<Node>();
+      result->bitmap = Mask(hash, shift);
+      result->children.push_back(Child{hash, std::move(leaf), nullptr});
+      inserted = true;
+      return result;
+    }
+    if (node->collision) {
+      for (size_t i = 0u; i < node->children.size(); ++i) {
+        if (EQUAL()(node->children[i].leaf->first, leaf->first)) {
+          if (!overwrite) {
+            return node;
+          }
+          auto result = std::make_shared<Node>(*node);
+          result->children[i].leaf = std::move(leaf);
+          return result;
+        }
+      }
+      auto result = std::make_shared<Node>(*node);
+      result->children.push_back(Child{hash, std::move(leaf), nullptr});
+      inserted = true;
+      return result;
+    }
+    const uint32_t mask = Mask(hash, shift);
+    const size_t index = Position(node->bitmap, mask);
+    if (!(node->bitmap & mask)) {
+      auto result = std::make_shared<Node>(*node);
+      result->bitmap |= mask;
+      result->children.insert(result->children.begin() + index, Child{hash, std::move(leaf), nullptr});
+      inserted = true;
+      return result;
+    }
+    const Child& child = node->children[index];
+    if (child.node) {
+      node_ptr_t subtrie = Insert(child.node, shift + kBitsPerLevel, hash, std::move(leaf), overwrite, inserted);
+      if (subtrie == child.node) {
+        return node;
+      }
+      auto result = std::make_shared<Node>(*node);
+      result->children[index].node = std::move(subtrie);
+      return result;
+    }
+    if (child.hash == hash && EQUAL()(child.leaf->first, leaf->first)) {
+      if (!overwrite) {
+        return node;
+      }
+      auto result = std::make_shared<Node>(*node);
+      result->children[index].leaf = std::move(leaf);
+      return result;
+    }
+    auto result = std::make_shared<Node>(*node);
+    result->children[index] =
+        Child{hash, nullptr, Split(shift + kBitsPerLevel, child, Child{hash, std::move(leaf), nullptr})};
+    inserted = true;
+    return result;
+  }
+
+  // Returns whether the key was found. If it was, `replacement` is set to what should take the place of `node`:
+  // the updated node, the only leaf left in it, or nothing if it is now empty.
+  static bool Erase(const Node* node, size_t shift, size_t hash, const KEY& key, Child& replacement) {
+    size_t index;
+    if (node->collision) {
+      for (index = 0u; index < node->children.size(); ++index) {
+        if (EQUAL()(node->children[index].leaf->first, key)) {
+          break;
+        }
+      }
+      if (index == node->children.size()) {
+        return false;
+      }
+    } else {
+      const uint32_t mask = Mask(hash, shift);
+      if (!(node->bitmap & mask)) {
+        return false;
+      }
+      index = Position(node->bitmap, mask);
+      const Child& child = node->children[index];
+      if (child.node) {
+        Child subtrie;
+        if (!Erase(child.node.get(), shift + kBitsPerLevel, hash, key, subtrie)) {
+          return false;
+        }
+        if (subtrie.leaf || subtrie.node) {
+          auto result = std::make_shared<Node>(*node);
+          result->children[index] = std::move(subtrie);
+          return Collapse(std::move(result), replacement);
+        }
+      } else if (child.hash != hash || !EQUAL()(child.leaf->first, key)) {
+        return false;
+      }
+    }
+    auto result = std::make_shared<Node>(*node);
+    if (!result->collision) {
+      result->bitmap &= ~Mask(hash, shift);
+    }
+    result->children.erase(result->children.begin() + index);
+    return Collapse(std::move(result), replacement);
+  }
+
+  // A node with no children is dropped, and a node with a single leaf is replaced by this leaf.
+  static bool Collapse(std::shared_ptr<Node> node, Child& replacement) {
+    if (node->children.empty()) {
+      replacement = Child{0u, nullptr, nullptr};
+    } else if (node->children.size() == 1u && node->children.front().leaf) {
+      replacement = std::move(node->children.front());
+    } else {
+      replacement = Child{0u, nullptr, std::move(node)};
+    }
+    return true;
+  }
+
+  static size_t AllocatedBytes(const Node& node) {
+    size_t bytes = sizeof(Node) + node.children.capacity() * sizeof(Child);
+    for (const Child& child : node.children) {
+      bytes += child.node ? AllocatedBytes(*child.node) : sizeof(value_type);
+    }
+    return bytes;
+  }
+
+  node_ptr_t root_;
+  size_t size_ = 0u;
+};
+
+}  // namespace current::storage::container
+}  // namespace current::storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_CONTAINER_PERSISTENT_H
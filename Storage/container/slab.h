@@ -0,0 +1,135 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `SlabAllocator<T>` is the per-field allocator of the entries of the matrix containers.
+//
+// Entries are carved out of slabs which double in size up to `kMaxSlabSize` cells, so that replaying a stream of
+// N entries takes O(log N) calls to the system allocator. Freed cells go to an intrusive free list and are reused
+// first. The memory is only returned to the system when the container is destroyed.
+
+#ifndef CURRENT_STORAGE_CONTAINER_SLAB_H
+#define CURRENT_STORAGE_CONTAINER_SLAB_H
+
+#include "../../port.h"
+
+#include <memory>
+#include <vector>
+
+#include "../../TypeSystem/struct.h"
+
+namespace current {
+namespace storage {
+namespace container {
+
+CURRENT_STRUCT(SlabAllocatorStats) {
+  CURRENT_FIELD(entries, uint64_t, 0u);
+  CURRENT_FIELD(capacity, uint64_t, 0u);
+  CURRENT_FIELD(slabs, uint64_t, 0u);
+  CURRENT_FIELD(bytes, uint64_t, 0u);
+};
+
+template <typename T>
+class SlabAllocator final {
+ public:
+  enum : size_t { kMinSlabSize = 64u, kMaxSlabSize = 65536u };
+
+  class Deleter final {
+   public:
+    Deleter() = default;
+    explicit Deleter(SlabAllocator* allocator) : allocator_(allocator) {}
+    void operator()(T* object) const { allocator_->Delete(object); }
+
+   private:
+    SlabAllocator* allocator_ = nullptr;
+  };
+
+  using unique_ptr_t = std::unique_ptr<T, Deleter>;
+
+  SlabAllocator() = default;
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+  // All the objects must have been deleted by now, which is the case if the allocator is declared before the
+  // container holding the `unique_ptr_t`-s.
+  ~SlabAllocator() { CURRENT_ASSERT(!entries_); }
+
+  template <typename... ARGS>
+  unique_ptr_t New(ARGS&&... args) {
+    if (!free_list_) {
+      // Double the capacity with each new slab, within the `[kMinSlabSize, kMaxSlabSize]` range.
+      AllocateSlab(std::min(std::max(capacity_, static_cast<size_t>(kMinSlabSize)), static_cast<size_t>(kMaxSlabSize)));
+    }
+    Cell* cell = free_list_;
+    Cell* next = cell->next;
+    T* object = new (&cell->storage) T(std::forward<ARGS>(args)...);
+    free_list_ = next;
+    ++entries_;
+    return unique_ptr_t(object, Deleter(this));
+  }
+
+  SlabAllocatorStats Stats() const {
+    SlabAllocatorStats stats;
+    stats.entries = entries_;
+    stats.capacity = capacity_;
+    stats.slabs = slabs_.size();
+    stats.bytes = capacity_ * sizeof(Cell) + slabs_.capacity() * sizeof(slab_t);
+    return stats;
+  }
+
+ private:
+  union Cell {
+    Cell* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+  using slab_t = std::unique_ptr<Cell[]>;
+
+  void Delete(T* object) {
+    object->~T();
+    Cell* cell = reinterpret_cast<Cell*>(object);
+    cell->next = free_list_;
+    free_list_ = cell;
+    --entries_;
+  }
+
+  void AllocateSlab(size_t size) {
+    slabs_.emplace_back(new Cell[size]);
+    Cell* slab = slabs_.back().get();
+    for (size_t i = size; i > 0u; --i) {
+      slab[i - 1u].next = free_list_;
+      free_list_ = &slab[i - 1u];
+    }
+    capacity_ += size;
+  }
+
+  std::vector<slab_t> slabs_;
+  Cell* free_list_ = nullptr;
+  size_t entries_ = 0u;
+  size_t capacity_ = 0u;
+};
+
+}  // namespace container
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_CONTAINER_SLAB_H
@@ -76,6 +76,22 @@ struct ReadWriteTransactionInFollowerStorageException : StorageException {
   using StorageException::StorageException;
 };
 
+struct StorageUniqueIndexViolationException : StorageException {
+  using StorageException::StorageException;
+};
+
+struct StorageShardsCountException : StorageException {
+  using StorageException::StorageException;
+};
+
+struct StorageInvalidCursorException : StorageException {
+  using StorageException::StorageException;
+};
+
+struct StorageStalenessTimeoutException : StorageException {
+  using StorageException::StorageException;
+};
+
 struct StorageInGracefulShutdownException : InGracefulShutdownException {
   using InGracefulShutdownException::InGracefulShutdownException;
 };
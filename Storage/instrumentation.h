@@ -0,0 +1,181 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// Storage instrumentation, `storage.EnableInstrumentation()`, `storage.Stats()`, `storage.ExposeStatsViaHTTP()`.
+//
+// The number of entries and the approximate memory footprint of each field are computed on demand, and are always
+// available. The per-field `Add` / `Erase` / lookup counters and the transaction latency histograms are only
+// maintained while the instrumentation is enabled, which costs one branch per operation when it is not.
+//
+// Both the counters and the histograms are only ever updated and read under the storage mutex, hence no atomics.
+
+#ifndef CURRENT_STORAGE_INSTRUMENTATION_H
+#define CURRENT_STORAGE_INSTRUMENTATION_H
+
+#include "../port.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../TypeSystem/struct.h"
+
+namespace current {
+namespace storage {
+
+CURRENT_STRUCT(StorageFieldStats) {
+  CURRENT_FIELD(name, std::string);
+  CURRENT_FIELD(container, std::string);
+  CURRENT_FIELD(entries, uint64_t, 0u);
+  // The entries themselves plus the nodes, buckets and indexes of the container. The memory owned by the entries,
+  // such as the contents of their strings, is not counted.
+  CURRENT_FIELD(approximate_bytes, uint64_t, 0u);
+  CURRENT_FIELD(adds, uint64_t, 0u);
+  CURRENT_FIELD(erases, uint64_t, 0u);
+  CURRENT_FIELD(lookups, uint64_t, 0u);
+};
+
+// `buckets[0]` counts the latencies under one microsecond, and `buckets[i]` the ones in `[2^(i-1), 2^i)` microseconds.
+CURRENT_STRUCT(StorageLatencyHistogram) {
+  CURRENT_FIELD(count, uint64_t, 0u);
+  CURRENT_FIELD(total_us, uint64_t, 0u);
+  CURRENT_FIELD(max_us, uint64_t, 0u);
+  CURRENT_FIELD(buckets, std::vector<uint64_t>);
+};
+
+// Lock wait is the time to acquire the storage mutex, body is the time spent in the user code of the transaction,
+// persist is the time to publish the mutations of a read-write transaction.
+CURRENT_STRUCT(StorageTransactionStats) {
+  CURRENT_FIELD(lock_wait, StorageLatencyHistogram);
+  CURRENT_FIELD(body, StorageLatencyHistogram);
+  CURRENT_FIELD(persist, StorageLatencyHistogram);
+};
+
+CURRENT_STRUCT(StorageStats) {
+  CURRENT_FIELD(instrumented, bool, false);
+  CURRENT_FIELD(replayed_transactions_count, uint64_t, 0u);  // Same as `storage.TransactionsCount()`.
+  CURRENT_FIELD(fields, std::vector<StorageFieldStats>);
+  CURRENT_FIELD(transactions, StorageTransactionStats);
+};
+
+// Kept by each container. Only the calls made from within the transactions are counted, not the replayed mutations.
+struct FieldAccessCounters {
+  uint64_t adds = 0u;
+  uint64_t erases = 0u;
+  uint64_t lookups = 0u;
+
+  void FillStats(StorageFieldStats& stats) const {
+    stats.adds = adds;
+    stats.erases = erases;
+    stats.lookups = lookups;
+  }
+};
+
+class LatencyHistogram final {
+ public:
+  enum : size_t { kBuckets = 40u };
+
+  void Add(std::chrono::microseconds latency) {
+    const uint64_t us = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0u;
+    size_t bucket = 0u;
+    while (bucket + 1u < kBuckets && (us >> bucket)) {
+      ++bucket;
+    }
+    ++buckets_[bucket];
+    ++count_;
+    total_us_ += us;
+    max_us_ = std::max(max_us_, us);
+  }
+
+  // The trailing empty buckets are omitted.
+  StorageLatencyHistogram Stats() const {
+    StorageLatencyHistogram stats;
+    stats.count = count_;
+    stats.total_us = total_us_;
+    stats.max_us = max_us_;
+    size_t size = kBuckets;
+    while (size && !buckets_[size - 1u]) {
+      --size;
+    }
+    stats.buckets.assign(buckets_, buckets_ + size);
+    return stats;
+  }
+
+ private:
+  uint64_t buckets_[kBuckets] = {};
+  uint64_t count_ = 0u;
+  uint64_t total_us_ = 0u;
+  uint64_t max_us_ = 0u;
+};
+
+// Kept by the transaction policy. The flag is atomic, as it is checked before the storage mutex is acquired.
+struct TransactionInstrumentation {
+  std::atomic_bool enabled{false};
+  LatencyHistogram lock_wait;
+  LatencyHistogram body;
+  LatencyHistogram persist;
+
+  StorageTransactionStats Stats() const {
+    StorageTransactionStats stats;
+    stats.lock_wait = lock_wait.Stats();
+    stats.body = body.Stats();
+    stats.persist = persist.Stats();
+    return stats;
+  }
+};
+
+// Measures the consecutive phases of one transaction, if the instrumentation was enabled when it has started.
+class TransactionPhaseTimer final {
+ public:
+  using timer_clock_t = std::chrono::steady_clock;
+
+  explicit TransactionPhaseTimer(TransactionInstrumentation& instrumentation)
+      : instrumentation_(instrumentation),
+        enabled_(instrumentation.enabled.load(std::memory_order_relaxed)),
+        phase_begin_(enabled_ ? timer_clock_t::now() : timer_clock_t::time_point()) {}
+
+  void LockAcquired() { EndPhase(instrumentation_.lock_wait); }
+  void BodyDone() { EndPhase(instrumentation_.body); }
+  void Persisted() { EndPhase(instrumentation_.persist); }
+
+ private:
+  void EndPhase(LatencyHistogram& histogram) {
+    if (enabled_) {
+      const auto now = timer_clock_t::now();
+      histogram.Add(std::chrono::duration_cast<std::chrono::microseconds>(now - phase_begin_));
+      phase_begin_ = now;
+    }
+  }
+
+  TransactionInstrumentation& instrumentation_;
+  const bool enabled_;
+  timer_clock_t::time_point phase_begin_;
+};
+
+}  // namespace current::storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_INSTRUMENTATION_H
@@ -25,12 +25,23 @@ SOFTWARE.
 #ifndef CURRENT_STORAGE_PERSISTER_COMMON_H
 #define CURRENT_STORAGE_PERSISTER_COMMON_H
 
+#include <chrono>
+#include <cstdint>
+
 namespace current {
 namespace storage {
 namespace persister {
 
 enum class PersisterDataAuthority : bool { Own = true, External = false };
 
+// How far the storage is in its stream: the index of the first entry it has not applied yet, which is the number
+// of entries it has applied, and the timestamp of the last applied one, or -1 if none.
+// On the master, the entries are "applied" as the transactions are published.
+struct StreamPosition {
+  uint64_t next_index = 0u;
+  std::chrono::microseconds last_us = std::chrono::microseconds(-1);
+};
+
 }  // namespace persister
 }  // namespace storage
 }  // namespace current
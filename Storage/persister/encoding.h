@@ -0,0 +1,154 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// How the Sherlock stream persister keeps the transactions in its stream.
+//
+// * `TransactionEncoding::JSON`, the default, publishes the `Transaction<>`-s as they are. The file-backed stream
+//   keeps them as JSON, with the name and the type ID of each mutation, and the names of all the fields of its entry.
+// * `TransactionEncoding::Binary` publishes each transaction as a `BinaryTransaction`, the base64 of its binary form,
+//   see `TypeSystem/Serialization/binary.h`. A mutation is then the index of its case in the mutations variant,
+//   which stands for the storage field and for whether it is an update or a deletion, followed by the values of the
+//   fields of its entry. Base64 keeps each entry on its own line of the stream file. The transactions are replayed
+//   without parsing any JSON, and `DecodeBinaryTransaction<>()` turns an entry back into a transaction to view it.
+//
+// The binary form depends on the order of the fields in the storage and in the entries, so the storage must only
+// ever be extended by adding new fields at the end. The custom stream record types are only supported by JSON.
+
+#ifndef CURRENT_STORAGE_PERSISTER_ENCODING_H
+#define CURRENT_STORAGE_PERSISTER_ENCODING_H
+
+#include "../../port.h"
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#include "../base.h"
+
+#include "../../Bricks/util/base64.h"
+#include "../../TypeSystem/struct.h"
+#include "../../TypeSystem/Serialization/binary.h"
+#include "../../TypeSystem/Serialization/json.h"
+
+namespace current {
+namespace storage {
+
+CURRENT_STRUCT(BinaryTransaction) { CURRENT_FIELD(data, std::string); };
+
+template <typename TRANSACTION>
+BinaryTransaction EncodeBinaryTransaction(const TRANSACTION& transaction) {
+  std::ostringstream os;
+  SaveIntoBinary(os, transaction);
+  BinaryTransaction result;
+  result.data = Base64Encode(os.str());
+  return result;
+}
+
+template <typename TRANSACTION>
+TRANSACTION DecodeBinaryTransaction(const char* base64, size_t length) {
+  std::istringstream is(Base64Decode(base64, length));
+  return LoadFromBinary<TRANSACTION>(is);
+}
+
+template <typename TRANSACTION>
+TRANSACTION DecodeBinaryTransaction(const BinaryTransaction& entry) {
+  return DecodeBinaryTransaction<TRANSACTION>(entry.data.c_str(), entry.data.length());
+}
+
+namespace persister {
+
+struct TransactionEncoding {
+  struct JSON {};
+  struct Binary {};
+};
+
+// `entry_t` is what is published into the stream, `subscribed_t` is what the followers subscribe to, and
+// `decoded_t` is what the raw entries are decoded into when the stream is replayed in parallel.
+// `Apply(entry, f)` calls `f(transaction)` and returns `true` if the entry, or the decoded entry, is a transaction.
+template <typename ENCODING, typename TRANSACTION, typename STREAM_RECORD_TYPE>
+struct TransactionEncoder;
+
+template <typename TRANSACTION, typename STREAM_RECORD_TYPE>
+struct TransactionEncoder<TransactionEncoding::JSON, TRANSACTION, STREAM_RECORD_TYPE> {
+  using entry_t = typename std::conditional<std::is_same<STREAM_RECORD_TYPE, NoCustomPersisterParam>::value,
+                                            TRANSACTION,
+                                            STREAM_RECORD_TYPE>::type;
+  using subscribed_t = TRANSACTION;
+  using decoded_t = entry_t;
+
+  static TRANSACTION&& Encode(TRANSACTION& transaction) { return std::move(transaction); }
+
+  static decoded_t Decode(const char* json) { return ParseJSON<entry_t>(json); }
+
+  template <typename ENTRY, typename F>
+  static bool Apply(const ENTRY& entry, F&& f) {
+    if (Exists<TRANSACTION>(entry)) {
+      f(Value<TRANSACTION>(entry));
+      return true;
+    } else {
+      return false;
+    }
+  }
+};
+
+template <typename TRANSACTION>
+struct TransactionEncoder<TransactionEncoding::Binary, TRANSACTION, NoCustomPersisterParam> {
+  using entry_t = BinaryTransaction;
+  using subscribed_t = BinaryTransaction;
+  using decoded_t = TRANSACTION;
+
+  static BinaryTransaction Encode(TRANSACTION& transaction) { return EncodeBinaryTransaction(transaction); }
+
+  // The entry is `{"data":"..."}`, and base64 needs no escaping, so the data is taken as is, with no JSON parsing.
+  static decoded_t Decode(const char* json) {
+    static const char prefix[] = "{\"data\":\"";
+    const size_t prefix_length = sizeof(prefix) - 1u;
+    const size_t length = std::strlen(json);
+    if (length >= prefix_length + 2u && !std::memcmp(json, prefix, prefix_length) && json[length - 2u] == '"' &&
+        json[length - 1u] == '}') {
+      return DecodeBinaryTransaction<TRANSACTION>(json + prefix_length, length - prefix_length - 2u);
+    } else {
+      return DecodeBinaryTransaction<TRANSACTION>(ParseJSON<BinaryTransaction>(json));
+    }
+  }
+
+  template <typename F>
+  static bool Apply(const BinaryTransaction& entry, F&& f) {
+    f(DecodeBinaryTransaction<TRANSACTION>(entry));
+    return true;
+  }
+
+  template <typename F>
+  static bool Apply(const TRANSACTION& transaction, F&& f) {
+    f(transaction);
+    return true;
+  }
+};
+
+}  // namespace current::storage::persister
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_PERSISTER_ENCODING_H
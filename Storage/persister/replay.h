@@ -0,0 +1,213 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `ReplayDecodingInParallel<ENTRY>(raw_entries, decode, apply)` replays the entries of a stream persisted as JSON.
+//
+// Parsing JSON takes considerably longer than applying the mutations it contains, so the entries are decoded on
+// several threads ahead of the calling thread, which applies them strictly in order. The raw entries are read in
+// batches of `kReplayDecodeBatchSize`, each batch is split evenly between the threads of a decoding pool, which is
+// started once per replay, and the next batch is being decoded while the previous one is being applied.
+//
+// This is what the storage does when it starts from its stream, when a follower catches up with the stream before
+// subscribing to it, and when a follower becomes the master. Once subscribed, the follower receives the raw entries
+// from the subscriber thread of the stream, and decodes each burst of them on the pool of its own in the same way.
+
+#ifndef CURRENT_STORAGE_PERSISTER_REPLAY_H
+#define CURRENT_STORAGE_PERSISTER_REPLAY_H
+
+#include "../../port.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace current {
+namespace storage {
+namespace persister {
+
+constexpr size_t kReplayDecodeBatchSize = 512u;
+
+// One core is left to the thread applying the decoded entries.
+inline size_t DefaultReplayDecodeThreads() {
+  const size_t cores = std::thread::hardware_concurrency();
+  return cores > 1u ? cores - 1u : 1u;
+}
+
+// A fixed set of threads running the posted tasks. The tasks must not throw. The destructor runs the tasks
+// already posted to completion before joining the threads.
+class ReplayDecodeThreadPool final {
+ public:
+  explicit ReplayDecodeThreadPool(size_t threads) {
+    for (size_t i = 0u; i < threads; ++i) {
+      threads_.emplace_back(&ReplayDecodeThreadPool::Thread, this);
+    }
+  }
+
+  ~ReplayDecodeThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    condition_variable_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  size_t ThreadsCount() const { return threads_.size(); }
+
+  void Post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(task));
+    }
+    condition_variable_.notify_one();
+  }
+
+ private:
+  void Thread() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_variable_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        task = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+  std::deque<std::function<void()>> queue_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+// The batch of raw entries being decoded by the slices posted to the pool.
+template <typename ENTRY>
+class ReplayDecodeBatch final {
+ public:
+  template <typename DECODE>
+  ReplayDecodeBatch(std::vector<std::string>&& raw_entries, DECODE& decode, ReplayDecodeThreadPool& pool)
+      : raw_entries_(std::move(raw_entries)), decoded_(raw_entries_.size()) {
+    const size_t slices = std::max(std::min(pool.ThreadsCount(), raw_entries_.size()), static_cast<size_t>(1u));
+    const size_t slice = (raw_entries_.size() + slices - 1u) / slices;
+    pending_slices_ = (raw_entries_.size() + slice - 1u) / slice;
+    for (size_t begin = 0u; begin < raw_entries_.size(); begin += slice) {
+      const size_t end = std::min(begin + slice, raw_entries_.size());
+      pool.Post([this, &decode, begin, end]() { DecodeSlice(decode, begin, end); });
+    }
+  }
+
+  // Waits until all the slices are decoded, and rethrows the first exception thrown by `decode`, if any.
+  std::vector<ENTRY>& Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_variable_.wait(lock, [this]() { return !pending_slices_; });
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+    return decoded_;
+  }
+
+ private:
+  template <typename DECODE>
+  void DecodeSlice(DECODE& decode, size_t begin, size_t end) {
+    std::exception_ptr exception;
+    try {
+      for (size_t i = begin; i < end; ++i) {
+        decoded_[i] = decode(raw_entries_[i]);
+      }
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (exception && !exception_) {
+      exception_ = exception;
+    }
+    if (!--pending_slices_) {
+      condition_variable_.notify_all();
+    }
+  }
+
+  const std::vector<std::string> raw_entries_;
+  std::vector<ENTRY> decoded_;
+  std::mutex mutex_;
+  std::condition_variable condition_variable_;
+  size_t pending_slices_ = 0u;
+  std::exception_ptr exception_;
+};
+
+// `decode(const std::string&)` returns an `ENTRY`, and must be safe to call concurrently.
+// `apply(ENTRY&)` is only called from the calling thread, in the order of the entries in `raw_entries`.
+template <typename ENTRY, typename RANGE, typename DECODE, typename APPLY>
+void ReplayDecodingInParallel(RANGE&& raw_entries,
+                              DECODE&& decode,
+                              APPLY&& apply,
+                              size_t threads = DefaultReplayDecodeThreads()) {
+  std::unique_ptr<ReplayDecodeBatch<ENTRY>> decoding;
+  std::unique_ptr<ReplayDecodeBatch<ENTRY>> next;
+  // Declared after the batches, so that, should `decode` or `apply` throw, the slices still being decoded
+  // are done with by the time the batches they are decoding into are destroyed.
+  ReplayDecodeThreadPool pool(std::max(threads, static_cast<size_t>(1u)));
+  auto iterator = raw_entries.begin();
+  const auto end = raw_entries.end();
+  while (true) {
+    std::vector<std::string> batch;
+    batch.reserve(kReplayDecodeBatchSize);
+    while (batch.size() < kReplayDecodeBatchSize && iterator != end) {
+      batch.push_back(*iterator);
+      ++iterator;
+    }
+    if (!batch.empty()) {
+      next = std::make_unique<ReplayDecodeBatch<ENTRY>>(std::move(batch), decode, pool);
+    }
+    if (decoding) {
+      for (auto& entry : decoding->Wait()) {
+        apply(entry);
+      }
+    }
+    if (!next) {
+      return;
+    }
+    decoding = std::move(next);
+  }
+}
+
+}  // namespace persister
+}  // namespace storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_PERSISTER_REPLAY_H
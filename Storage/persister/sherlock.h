@@ -27,39 +27,57 @@ SOFTWARE.
 #define CURRENT_STORAGE_PERSISTER_SHERLOCK_H
 
 #include "common.h"
+#include "encoding.h"
+#include "replay.h"
 #include "../base.h"
 #include "../exceptions.h"
 #include "../transaction.h"
 #include "../../Sherlock/sherlock.h"
 
 #include "../../Bricks/sync/locks.h"
+#include "../../Bricks/sync/waitable_atomic.h"
 
 namespace current {
 namespace storage {
 namespace persister {
 
-template <typename MUTATIONS_VARIANT, template <typename> class UNDERLYING_PERSISTER, typename STREAM_RECORD_TYPE>
+// Whether the entries of the stream are kept as JSON, and thus are worth decoding in parallel when replayed.
+template <template <typename> class UNDERLYING_PERSISTER>
+struct PersisterKeepsEntriesAsJSON {
+  constexpr static bool value = false;
+};
+
+template <>
+struct PersisterKeepsEntriesAsJSON<current::persistence::File> {
+  constexpr static bool value = true;
+};
+
+template <typename MUTATIONS_VARIANT,
+          template <typename> class UNDERLYING_PERSISTER,
+          typename STREAM_RECORD_TYPE,
+          typename ENCODING = TransactionEncoding::JSON>
 class SherlockStreamPersisterImpl {
  public:
   using variant_t = MUTATIONS_VARIANT;
   using transaction_t = Transaction<variant_t>;
-  using sherlock_entry_t = typename std::conditional<std::is_same<STREAM_RECORD_TYPE, NoCustomPersisterParam>::value,
-                                                     transaction_t,
-                                                     STREAM_RECORD_TYPE>::type;
+  using encoder_t = TransactionEncoder<ENCODING, transaction_t, STREAM_RECORD_TYPE>;
+  using sherlock_entry_t = typename encoder_t::entry_t;
   using sherlock_t = sherlock::Stream<sherlock_entry_t, UNDERLYING_PERSISTER>;
   using fields_update_function_t = std::function<void(const variant_t&)>;
 
   struct SherlockSubscriberImpl {
     using EntryResponse = current::ss::EntryResponse;
     using TerminationResponse = current::ss::TerminationResponse;
-    using replay_function_t = std::function<void(const transaction_t&)>;
+    using replay_function_t = std::function<void(const transaction_t&, idxts_t)>;
     replay_function_t replay_f_;
     uint64_t next_replay_index_ = 0u;
 
     SherlockSubscriberImpl(replay_function_t f) : replay_f_(f) {}
 
-    EntryResponse operator()(const transaction_t& transaction, idxts_t current, idxts_t) {
-      replay_f_(transaction);
+    EntryResponse operator()(const typename encoder_t::subscribed_t& entry, idxts_t current, idxts_t) {
+      const replay_function_t& replay_f = replay_f_;
+      encoder_t::Apply(entry,
+                       [&replay_f, current](const transaction_t& transaction) { replay_f(transaction, current); });
       next_replay_index_ = current.index + 1u;
       return EntryResponse::More;
     }
@@ -69,14 +87,64 @@ class SherlockStreamPersisterImpl {
     EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return EntryResponse::More; }
     TerminationResponse Terminate() const { return TerminationResponse::Terminate; }
   };
-  using SherlockSubscriber = current::ss::StreamSubscriber<SherlockSubscriberImpl, transaction_t>;
+
+  // Follows the stream kept as JSON. The entries received in a burst are decoded in parallel, in batches of up to
+  // `kReplayDecodeBatchSize`, and applied in order, in the same way the stream is replayed, see `replay.h`.
+  struct SherlockRawSubscriberImpl {
+    using EntryResponse = current::ss::EntryResponse;
+    using TerminationResponse = current::ss::TerminationResponse;
+    using replay_function_t = std::function<void(const transaction_t&, idxts_t)>;
+    replay_function_t replay_f_;
+    uint64_t next_replay_index_ = 0u;
+    std::vector<std::string> raw_entries_;
+    std::vector<idxts_t> raw_entries_idxts_;
+    std::unique_ptr<ReplayDecodeThreadPool> pool_;  // Started with the first entry received.
+
+    SherlockRawSubscriberImpl(replay_function_t f) : replay_f_(f) {}
+
+    EntryResponse operator()(const std::string& raw_entry, idxts_t current, idxts_t last) {
+      raw_entries_.push_back(raw_entry);
+      raw_entries_idxts_.push_back(current);
+      if (current.index >= last.index || raw_entries_.size() >= kReplayDecodeBatchSize) {
+        ApplyRawEntries();
+      }
+      return EntryResponse::More;
+    }
+
+    EntryResponse operator()(std::chrono::microseconds) const { return EntryResponse::More; }
+
+    EntryResponse EntryResponseIfNoMorePassTypeFilter() const { return EntryResponse::More; }
+    TerminationResponse Terminate() const { return TerminationResponse::Terminate; }
+
+    void ApplyRawEntries() {
+      if (!pool_) {
+        pool_ = std::make_unique<ReplayDecodeThreadPool>(DefaultReplayDecodeThreads());
+      }
+      const auto decode = [](const std::string& raw_entry) { return encoder_t::Decode(raw_entry.c_str()); };
+      ReplayDecodeBatch<typename encoder_t::decoded_t> batch(std::move(raw_entries_), decode, *pool_);
+      raw_entries_.clear();
+      const replay_function_t& replay_f = replay_f_;
+      const auto& decoded = batch.Wait();
+      for (size_t i = 0u; i < decoded.size(); ++i) {
+        const idxts_t current = raw_entries_idxts_[i];
+        encoder_t::Apply(decoded[i],
+                         [&replay_f, current](const transaction_t& transaction) { replay_f(transaction, current); });
+        next_replay_index_ = current.index + 1u;
+      }
+      raw_entries_idxts_.clear();
+    }
+  };
+
+  using SherlockSubscriber = typename std::conditional<
+      PersisterKeepsEntriesAsJSON<UNDERLYING_PERSISTER>::value,
+      current::ss::StreamSubscriber<SherlockRawSubscriberImpl, std::string>,
+      current::ss::StreamSubscriber<SherlockSubscriberImpl, typename encoder_t::subscribed_t>>::type;
 
   template <typename... ARGS>
   explicit SherlockStreamPersisterImpl(std::mutex& storage_mutex, fields_update_function_t f, ARGS&&... args)
       : storage_mutex_ref_(storage_mutex),
         fields_update_f_(f),
-        stream_owned_if_any_(
-            std::make_unique<sherlock::Stream<sherlock_entry_t, UNDERLYING_PERSISTER>>(std::forward<ARGS>(args)...)),
+        stream_owned_if_any_(std::make_unique<sherlock_t>(std::forward<ARGS>(args)...)),
         stream_used_(*stream_owned_if_any_.get()),
         authority_(PersisterDataAuthority::Own) {
     // Do not use lock since we are in ctor.
@@ -91,12 +159,13 @@ class SherlockStreamPersisterImpl {
     authority_ = (stream_used_.DataAuthority() == current::sherlock::StreamDataAuthority::Own)
                      ? PersisterDataAuthority::Own
                      : PersisterDataAuthority::External;
-    subscriber_ =
-        std::make_unique<SherlockSubscriber>([this](const transaction_t& transaction) { ApplyMutations(transaction); });
-    if (authority_ == PersisterDataAuthority::Own) {
-      // Do not use lock since we are in ctor.
-      SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>();
-    } else {
+    subscriber_ = std::make_unique<SherlockSubscriber>(
+        [this](const transaction_t& transaction, idxts_t idxts) { ApplyMutations(transaction, idxts); });
+    // Do not use lock since we are in ctor.
+    // The follower catches up with what is already in the stream in the same way, and only then subscribes to it.
+    const uint64_t next_index = SyncReplayStream<current::locks::MutexLockStatus::AlreadyLocked>();
+    if (authority_ == PersisterDataAuthority::External) {
+      subscriber_->next_replay_index_ = next_index;
       SubscribeToStream();
     }
   }
@@ -120,18 +189,25 @@ class SherlockStreamPersisterImpl {
         transaction.mutations.emplace_back(BypassVariantTypeCheck(), std::move(entry));
       }
       std::swap(transaction.meta, journal.transaction_meta);
-      stream_used_.Publish(std::move(transaction));
+      AdvancePosition(stream_used_.Publish(encoder_t::Encode(transaction)));
     }
     journal.Clear();
   }
 
   void ExposeRawLogViaHTTP(uint16_t port, const std::string& route) {
-    handlers_scope_ +=
-        HTTP(port).Register(route, URLPathArgs::CountMask::None | URLPathArgs::CountMask::One, stream_used_);
+    ExposeRawLogViaHTTP(port, route, std::is_same<ENCODING, TransactionEncoding::Binary>());
   }
 
   sherlock_t& InternalExposeStream() { return stream_used_; }
 
+  StreamPosition Position() const { return position_.GetValue(); }
+
+  // Returns whether `predicate(position)` holds, having waited for up to `timeout` for it to.
+  bool WaitForPosition(std::function<bool(const StreamPosition&)> predicate, std::chrono::microseconds timeout) const {
+    position_.WaitFor(predicate, timeout);
+    return position_.ImmutableUse(predicate);
+  }
+
   template <current::locks::MutexLockStatus MLS>
   void AcquireDataAuthority() {
     current::locks::SmartMutexLockGuard<MLS> lock(storage_mutex_ref_);
@@ -145,28 +221,117 @@ class SherlockStreamPersisterImpl {
   }
 
  private:
+  // Returns the index of the first entry not replayed.
+  template <current::locks::MutexLockStatus MLS>
+  uint64_t SyncReplayStream(uint64_t from_idx = 0u) {
+    const uint64_t end_idx = stream_used_.Persister().Size();
+    if (end_idx > from_idx) {
+      SyncReplayStreamRange<MLS>(
+          from_idx, end_idx, std::integral_constant<bool, PersisterKeepsEntriesAsJSON<UNDERLYING_PERSISTER>::value>());
+    }
+    return std::max(from_idx, end_idx);
+  }
+
   template <current::locks::MutexLockStatus MLS>
-  void SyncReplayStream(uint64_t from_idx = 0u) {
-    for (const auto& stream_record : stream_used_.Persister().Iterate(from_idx)) {
-      if (Exists<transaction_t>(stream_record.entry)) {
-        const transaction_t& transaction = Value<transaction_t>(stream_record.entry);
-        ApplyMutations<MLS>(transaction);
+  void SyncReplayStreamRange(uint64_t from_idx, uint64_t end_idx, std::false_type) {
+    for (const auto& stream_record : stream_used_.Persister().Iterate(from_idx, end_idx)) {
+      const idxts_t idxts = stream_record.idx_ts;
+      if (!encoder_t::Apply(stream_record.entry, [this, idxts](const transaction_t& transaction) {
+            ApplyMutations<MLS>(transaction, idxts);
+          })) {
+        AdvancePosition(idxts);
       }
     }
   }
 
+  // The entries are read as raw `"{idxts}\t{entry}"` lines, and decoded in parallel, see `replay.h`.
+  template <current::locks::MutexLockStatus MLS>
+  void SyncReplayStreamRange(uint64_t from_idx, uint64_t end_idx, std::true_type) {
+    using decoded_t = std::pair<idxts_t, typename encoder_t::decoded_t>;
+    ReplayDecodingInParallel<decoded_t>(
+        stream_used_.Persister().template Iterate<current::ss::IterationMode::Unsafe>(from_idx, end_idx),
+        [](const std::string& line) {
+          const size_t tab = line.find('\t');
+          if (tab == std::string::npos) {
+            CURRENT_THROW(current::persistence::MalformedEntryException(line));  // LCOV_EXCL_LINE
+          }
+          return decoded_t(ParseJSON<idxts_t>(line.substr(0u, tab)), encoder_t::Decode(line.c_str() + tab + 1u));
+        },
+        [this](const decoded_t& entry) {
+          const idxts_t idxts = entry.first;
+          if (!encoder_t::Apply(entry.second, [this, idxts](const transaction_t& transaction) {
+                ApplyMutations<MLS>(transaction, idxts);
+              })) {
+            AdvancePosition(idxts);
+          }
+        });
+  }
+
   template <current::locks::MutexLockStatus MLS = current::locks::MutexLockStatus::NeedToLock>
-  void ApplyMutations(const transaction_t& transaction) {
+  void ApplyMutations(const transaction_t& transaction, idxts_t idxts) {
     current::locks::SmartMutexLockGuard<MLS> lock(storage_mutex_ref_);
     for (const auto& mutation : transaction.mutations) {
       fields_update_f_(mutation);
     }
+    AdvancePosition(idxts);
+  }
+
+  // Called under the storage mutex, after the entry has been applied, so that the waiters see its mutations.
+  void AdvancePosition(idxts_t idxts) {
+    position_.MutableUse([idxts](StreamPosition& position) {
+      position.next_index = idxts.index + 1u;
+      position.last_us = idxts.us;
+    });
+  }
+
+  // The JSON-encoded stream serves its own raw log.
+  void ExposeRawLogViaHTTP(uint16_t port, const std::string& route, std::false_type) {
+    handlers_scope_ +=
+        HTTP(port).Register(route, URLPathArgs::CountMask::None | URLPathArgs::CountMask::One, stream_used_);
+  }
+
+  // The binary-encoded entries are served decoded, as JSON. Unlike the stream itself, the decoded raw log only serves
+  // the entries present at the time of the request, and only respects the `i`, `n`, `sizeonly` and `entries_only`
+  // URL parameters.
+  void ExposeRawLogViaHTTP(uint16_t port, const std::string& route, std::true_type) {
+    handlers_scope_ += HTTP(port).Register(route, [this](Request r) { ServeDecodedRawLog(std::move(r)); });
+  }
+
+  void ServeDecodedRawLog(Request r) {
+    const auto params = current::sherlock::ParsePubSubHTTPRequest(r);
+    auto& persister = stream_used_.Persister();
+    const uint64_t size = persister.Size();
+    if (params.size_only) {
+      const std::string size_str = current::ToString(size);
+      r(r.method == "GET" ? size_str + '\n' : "",
+        HTTPResponseCode.OK,
+        current::net::constants::kDefaultContentType,
+        current::net::http::Headers({{current::sherlock::kSherlockHeaderCurrentStreamSize, size_str}}));
+      return;
+    }
+    const uint64_t begin = std::min(params.i, size);
+    const uint64_t end = params.n ? std::min(begin + params.n, size) : size;
+    auto response = r.SendChunkedResponse();
+    for (const auto& stream_record : persister.Iterate(begin, end)) {
+      const std::string json = JSON(DecodeBinaryTransaction<transaction_t>(stream_record.entry));
+      response(params.entries_only ? json + '\n' : JSON(stream_record.idx_ts) + '\t' + json + '\n');
+    }
   }
 
+  // The subscription starts from the first entry not replayed yet.
   void SubscribeToStream() {
     CURRENT_ASSERT(!subscriber_scope_);
     CURRENT_ASSERT(subscriber_);
-    subscriber_scope_ = std::move(stream_used_.template Subscribe<transaction_t>(*subscriber_));
+    SubscribeToStream(std::integral_constant<bool, PersisterKeepsEntriesAsJSON<UNDERLYING_PERSISTER>::value>());
+  }
+
+  void SubscribeToStream(std::false_type) {
+    subscriber_scope_ = std::move(stream_used_.template Subscribe<typename encoder_t::subscribed_t>(
+        *subscriber_, subscriber_->next_replay_index_));
+  }
+
+  void SubscribeToStream(std::true_type) {
+    subscriber_scope_ = std::move(stream_used_.SubscribeToRawEntries(*subscriber_, subscriber_->next_replay_index_));
   }
 
   void TerminateStreamSubscription() { subscriber_scope_ = nullptr; }
@@ -175,11 +340,12 @@ class SherlockStreamPersisterImpl {
   std::mutex& storage_mutex_ref_;
   fields_update_function_t fields_update_f_;
   // `stream_{used/owned}_` are two variables to support both owning and non-owning Storage usage patterns.
-  std::unique_ptr<sherlock::Stream<transaction_t, UNDERLYING_PERSISTER>> stream_owned_if_any_;
+  std::unique_ptr<sherlock_t> stream_owned_if_any_;
   sherlock_t& stream_used_;
   std::unique_ptr<SherlockSubscriber> subscriber_;
   current::sherlock::SubscriberScope subscriber_scope_;
   PersisterDataAuthority authority_;
+  current::WaitableAtomic<StreamPosition> position_;
   HTTPRoutesScope handlers_scope_;
 };
 
@@ -190,11 +356,19 @@ using SherlockInMemoryStreamPersister =
 template <typename TYPELIST, typename STREAM_RECORD_TYPE = NoCustomPersisterParam>
 using SherlockStreamPersister = SherlockStreamPersisterImpl<TYPELIST, current::persistence::File, STREAM_RECORD_TYPE>;
 
+// Same as `SherlockStreamPersister`, with the transactions binary-encoded, see `encoding.h`.
+template <typename TYPELIST, typename STREAM_RECORD_TYPE = NoCustomPersisterParam>
+using SherlockBinaryStreamPersister = SherlockStreamPersisterImpl<TYPELIST,
+                                                                  current::persistence::File,
+                                                                  STREAM_RECORD_TYPE,
+                                                                  TransactionEncoding::Binary>;
+
 }  // namespace persister
 }  // namespace storage
 }  // namespace current
 
 using current::storage::persister::SherlockInMemoryStreamPersister;
 using current::storage::persister::SherlockStreamPersister;
+using current::storage::persister::SherlockBinaryStreamPersister;
 
 #endif  // CURRENT_STORAGE_PERSISTER_SHERLOCK_H
@@ -26,6 +26,7 @@ SOFTWARE.
 // Hypermedia: A rather hacky solution for Hypermedia REST API supporting:
 // * Rich JSON format (top-level `url_*` fields, and actual data in `data`.)
 // * Poor man's stateless "pagination" through collections and collection "slices" (rows/cols of matrices).
+// * Keyset pagination through dictionaries, via the opaque `?cursor=...` tokens of the `url_next_page` links.
 // * Full and brief fields sets.
 
 #ifndef CURRENT_STORAGE_REST_HYPERMEDIA_H
@@ -33,6 +34,8 @@ SOFTWARE.
 
 #include "simple.h"
 
+#include "../../Bricks/util/base64.h"
+
 namespace current {
 namespace storage {
 namespace rest {
@@ -77,6 +80,70 @@ struct PopulateCollectionRecord<ENTRY, current::GenericMapAccessor<MAP>> {
   }
 };
 
+// The containers that support `Cursor()` and `Seek()` are paginated by keyset, the others, matrix views, by offset.
+template <typename ITERABLE>
+class HasKeysetCursors {
+  template <typename T>
+  static constexpr auto Test(int) -> decltype(std::declval<const T&>().Seek(std::string()), bool()) {
+    return true;
+  }
+  template <typename>
+  static constexpr bool Test(...) {
+    return false;
+  }
+
+ public:
+  constexpr static bool value = Test<current::decay<ITERABLE>>(0);
+};
+
+// The pagination token is the offset of the page followed by the container cursor of its first element. The offset is
+// only used to populate `"i"` and the previous page link, it is the cursor that tells where the page starts.
+template <bool HAS_KEYSET_CURSORS>
+struct KeysetPagination {
+  template <typename ITERABLE>
+  static auto Seek(const ITERABLE& span, const std::string&) -> decltype(span.begin()) {
+    CURRENT_THROW(StorageInvalidCursorException("This collection is paginated with `?i=...&n=...`."));
+  }
+  template <typename ITERABLE, typename ITERATOR>
+  static std::string Cursor(const ITERABLE&, const ITERATOR&) {
+    return "";
+  }
+};
+
+template <>
+struct KeysetPagination<true> {
+  template <typename ITERABLE>
+  static auto Seek(const ITERABLE& span, const std::string& cursor) -> decltype(span.begin()) {
+    return span.Seek(cursor);
+  }
+  template <typename ITERABLE, typename ITERATOR>
+  static std::string Cursor(const ITERABLE& span, const ITERATOR& iterator) {
+    return span.Cursor(iterator);
+  }
+};
+
+inline std::string EncodePaginationToken(uint64_t i, const std::string& cursor) {
+  std::string token = Base64URLEncode(current::ToString(i) + ':' + cursor);
+  token.erase(token.find_last_not_of('=') + 1u);  // No need to URL-encode the padding, the decoder is fine without it.
+  return token;
+}
+
+// Returns the offset, and sets `cursor`. Throws `StorageInvalidCursorException`.
+inline uint64_t DecodePaginationToken(const std::string& token, std::string& cursor) {
+  std::string decoded;
+  try {
+    decoded = Base64URLDecode(token);
+  } catch (const Base64DecodeException&) {
+    CURRENT_THROW(StorageInvalidCursorException("Malformed cursor."));
+  }
+  const size_t colon = decoded.find(':');
+  if (colon == 0u || colon == std::string::npos || decoded.find_first_not_of("0123456789") != colon) {
+    CURRENT_THROW(StorageInvalidCursorException("Malformed cursor."));
+  }
+  cursor = decoded.substr(colon + 1u);
+  return current::FromString<uint64_t>(decoded.substr(0u, colon));
+}
+
 struct HypermediaResponseFormatter {
   // TODO(dkorolev): We could move to per-HTTP-VERB context type as it's high performance time.
   struct Context {
@@ -86,6 +153,9 @@ struct HypermediaResponseFormatter {
     // For poor man's pagination when viewing the collection.
     mutable uint64_t query_i = 0u;
     mutable uint64_t query_n = 10u;  // Default page size.
+
+    // For keyset pagination, the `?cursor=...` token, which takes precedence over `query_i`.
+    std::string query_cursor;
   };
 
   template <typename ENTRY>
@@ -111,6 +181,20 @@ struct HypermediaResponseFormatter {
                                               const std::string& pagination_url,
                                               const std::string& collection_url,
                                               ITERABLE&& span) {
+    try {
+      return BuildCollectionPage<PARTICULAR_FIELD, ENTRY, INNER_HYPERMEDIA_TYPE>(
+          context, pagination_url, collection_url, std::forward<ITERABLE>(span));
+    } catch (const StorageInvalidCursorException& e) {
+      return helpers::ErrorResponse(HypermediaRESTError("InvalidCursor", e.OriginalDescription()),
+                                    HTTPResponseCode.BadRequest);
+    }
+  }
+
+  template <typename PARTICULAR_FIELD, typename ENTRY, typename INNER_HYPERMEDIA_TYPE, typename ITERABLE>
+  static Response BuildCollectionPage(const Context& context,
+                                      const std::string& pagination_url,
+                                      const std::string& collection_url,
+                                      ITERABLE&& span) {
     using inner_element_t = sfinae::brief_of_t<INNER_HYPERMEDIA_TYPE>;
     using collection_element_t = typename std::conditional<std::is_same<INNER_HYPERMEDIA_TYPE, inner_element_t>::value,
                                                            HypermediaRESTFullCollectionRecord<inner_element_t>,
@@ -119,13 +203,24 @@ struct HypermediaResponseFormatter {
     HypermediaRESTCollectionResponse<collection_element_t> response;
     response.url_directory = collection_url;
 
-    // Poor man's pagination.
+    // Poor man's pagination, unless the page is requested by a cursor, in which case it starts right where it should.
+    constexpr bool has_keyset_cursors = HasKeysetCursors<ITERABLE>::value;
     const size_t total = span.Size();
     bool has_previous_page = false;
     bool has_next_page = false;
     uint64_t current_index = 0;
+    std::string next_page_cursor;
+    std::string cursor;
+    if (!context.query_cursor.empty()) {
+      context.query_i = DecodePaginationToken(context.query_cursor, cursor);
+      current_index = context.query_i;
+      has_previous_page = (context.query_i > 0u);
+    }
     response.data.reserve(context.query_n);
-    for (auto iterator = span.begin(); iterator != span.end(); ++iterator) {
+    for (auto iterator = context.query_cursor.empty() ? span.begin()
+                                                      : KeysetPagination<has_keyset_cursors>::Seek(span, cursor);
+         iterator != span.end();
+         ++iterator) {
       using iterator_t = decltype(iterator);
       // NOTE(dkorolev): This `iterator` can be of more than three different kinds, among which are:
       // 1) container/many_to_many.h. ManyToMany::OuterAccessor::OuterIterator
@@ -145,6 +240,7 @@ struct HypermediaResponseFormatter {
         has_previous_page = true;
       } else if (current_index >= context.query_i + context.query_n) {
         has_next_page = true;
+        next_page_cursor = KeysetPagination<has_keyset_cursors>::Cursor(span, iterator);
         break;
       }
       ++current_index;
@@ -154,21 +250,32 @@ struct HypermediaResponseFormatter {
       return pagination_url + "?i=" + current::ToString(url_i) + "&n=" + current::ToString(url_n);
     };
 
+    const auto gen_cursor_page_url = [&pagination_url](const std::string& token, uint64_t url_n) {
+      return pagination_url + "?cursor=" + token + "&n=" + current::ToString(url_n);
+    };
+
+    // With cursors, the offset is only as accurate as the collection was stable while being browsed, so clamp it.
     if (context.query_i > total) {
       context.query_i = total;
     }
-    response.url = gen_page_url(context.query_i, context.query_n);
+    response.url = context.query_cursor.empty() ? gen_page_url(context.query_i, context.query_n)
+                                                : gen_cursor_page_url(context.query_cursor, context.query_n);
     response.i = context.query_i;
-    response.n = std::min(context.query_n, total - context.query_i);
+    response.n = response.data.size();
     response.total = total;
     if (has_previous_page) {
       response.url_previous_page =
           gen_page_url(context.query_i >= context.query_n ? context.query_i - context.query_n : 0, context.query_n);
     }
     if (has_next_page) {
-      response.url_next_page = gen_page_url(
-          context.query_i + context.query_n * 2 > total ? total - context.query_n : context.query_i + context.query_n,
-          context.query_n);
+      if (has_keyset_cursors) {
+        response.url_next_page = gen_cursor_page_url(
+            EncodePaginationToken(context.query_i + context.query_n, next_page_cursor), context.query_n);
+      } else {
+        response.url_next_page = gen_page_url(
+            context.query_i + context.query_n * 2 > total ? total - context.query_n : context.query_i + context.query_n,
+            context.query_n);
+      }
     }
 
     return Response(response, HTTPResponseCode.OK);
@@ -199,6 +306,7 @@ struct Hypermedia : generic::Structured<hypermedia::HypermediaResponseFormatter>
       context.brief = ((q["fields"] == "brief") || q.has("brief")) && !q.has("full");
       context.query_i = current::FromString<uint64_t>(q.get("i", current::ToString(context.query_i)));
       context.query_n = current::FromString<uint64_t>(q.get("n", current::ToString(context.query_n)));
+      context.query_cursor = q.get("cursor", "");
 
       SUPER_GET_HANDLER_GENERATOR::Enter(std::move(request), std::forward<F>(next));
     }
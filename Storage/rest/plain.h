@@ -30,6 +30,7 @@ SOFTWARE.
 #define CURRENT_STORAGE_REST_PLAIN_H
 
 #include "sfinae.h"
+#include "streaming.h"
 
 #include "../api_types.h"
 #include "../storage.h"
@@ -51,6 +52,8 @@ struct Plain {
 
   template <typename OPERATION, typename PARTICULAR_FIELD, typename ENTRY, typename KEY>
   struct RESTfulDataHandler<GET, OPERATION, PARTICULAR_FIELD, ENTRY, KEY> {
+    ConditionalGETParams conditional_get;
+
     template <typename F>
     void EnterByKeyCompletenessFamily(Request request,
                                       semantics::key_completeness::FullKey,
@@ -70,31 +73,153 @@ struct Plain {
 
     template <typename F>
     void Enter(Request request, F&& next) {
+      conditional_get = ConditionalGETParams::FromRequest(request);
       EnterByKeyCompletenessFamily(std::move(request),
                                    typename OPERATION::key_completeness_t(),
                                    typename OPERATION::key_completeness_t::completeness_family_t(),
                                    std::forward<F>(next));
     }
 
-    template <class FIELD>
-    std::string RunIterate(const FIELD& field, semantics::primary_key::Key) const {
-      std::ostringstream result;
-      for (const auto& element : field) {
-        // In plain "REST", which is mostly here for unit testing purposes, no URL-ifying is performed.
-        result << current::ToString(current::storage::sfinae::GetKey(element)) << '\t' << JSON(element) << '\n';
+    // In plain "REST", which is mostly here for unit testing purposes, no URL-ifying is performed.
+    struct FormatEntryWithKey {
+      template <typename RECORD>
+      void operator()(std::string& output, const RECORD& record) const {
+        output += current::ToString(current::storage::sfinae::GetKey(record.entry));
+        output += '\t';
+        output += JSON(record.entry);
+        output += '\n';
+      }
+    };
+
+    struct FormatEntryWithRowCol {
+      template <typename RECORD>
+      void operator()(std::string& output, const RECORD& record) const {
+        output += current::ToString(current::storage::sfinae::GetRow(record.entry));
+        output += '\t';
+        output += current::ToString(current::storage::sfinae::GetCol(record.entry));
+        output += '\t';
+        output += JSON(record.entry);
+        output += '\n';
       }
-      return result.str();
+    };
+
+    static FormatEntryWithKey EntryFormatter(semantics::primary_key::Key) { return FormatEntryWithKey(); }
+    static FormatEntryWithRowCol EntryFormatter(semantics::primary_key::RowCol) { return FormatEntryWithRowCol(); }
+
+    // The whole field, as well as the matrix rows and cols, is always streamed, see `rest/streaming.h`.
+    template <typename URL_KEY>
+    bool StreamsCollection(const Optional<URL_KEY>& url_key, const Optional<FieldExportParams>&) const {
+      return StreamsCollectionByKeyCompletenessFamily(url_key,
+                                                      typename OPERATION::key_completeness_t::completeness_family_t());
+    }
+
+    template <typename URL_KEY>
+    static bool StreamsCollectionByKeyCompletenessFamily(const Optional<URL_KEY>& url_key,
+                                                         semantics::key_completeness::DictionaryOrMatrixCompleteKey) {
+      return !Exists(url_key);
+    }
+
+    template <typename URL_KEY>
+    static bool StreamsCollectionByKeyCompletenessFamily(const Optional<URL_KEY>&,
+                                                         semantics::key_completeness::MatrixHalfKey) {
+      return true;
+    }
+
+    template <class STORAGE, class FIELD, typename URL_KEY>
+    void StreamCollection(const STORAGE& storage,
+                          const FIELD& field,
+                          Request request,
+                          const Optional<URL_KEY>& url_key,
+                          const Optional<FieldExportParams>&) const {
+      StreamCollectionByKeyCompletenessFamily(storage,
+                                              field,
+                                              std::move(request),
+                                              url_key,
+                                              typename OPERATION::key_completeness_t(),
+                                              typename OPERATION::key_completeness_t::completeness_family_t());
     }
 
-    template <class FIELD>
-    std::string RunIterate(const FIELD& field, semantics::primary_key::RowCol) const {
-      std::ostringstream result;
-      for (const auto& element : field) {
-        // Basic REST, mostly for unit testing purposes. No need to URL-ify plain text output.
-        result << current::ToString(current::storage::sfinae::GetRow(element)) << '\t'
-               << current::ToString(current::storage::sfinae::GetCol(element)) << '\t' << JSON(element) << '\n';
+    template <class STORAGE, class FIELD, typename URL_KEY>
+    void StreamCollectionByKeyCompletenessFamily(const STORAGE& storage,
+                                                 const FIELD& field,
+                                                 Request request,
+                                                 const Optional<URL_KEY>&,
+                                                 semantics::key_completeness::FullKey,
+                                                 semantics::key_completeness::DictionaryOrMatrixCompleteKey) const {
+      StreamFieldCollection<KEY, ENTRY>(storage,
+                                        field,
+                                        std::move(request),
+                                        conditional_get,
+                                        [](const KEY&) { return true; },
+                                        EntryFormatter(typename OPERATION::top_level_iterating_key_t()));
+    }
+
+    // A matrix row or col is its entries, and the list of rows or cols is their keys and sizes.
+    template <class STORAGE, class FIELD, typename KEY_COMPLETENESS>
+    void StreamCollectionByKeyCompletenessFamily(const STORAGE& storage,
+                                                 const FIELD& field,
+                                                 Request request,
+                                                 const Optional<std::string>& rowcol_url_key,
+                                                 KEY_COMPLETENESS,
+                                                 semantics::key_completeness::MatrixHalfKey) const {
+      using matrix_iterator_t = GenericMatrixIterator<KEY_COMPLETENESS, typename FIELD::semantics_t>;
+      using outer_key_t = typename MatrixContainerProxy<KEY_COMPLETENESS>::template entry_outer_key_t<ENTRY>;
+      if (Exists(rowcol_url_key)) {
+        using record_t = StreamedCollectionRecord<KEY, ENTRY>;
+        const auto row_or_col_key = current::FromString<outer_key_t>(Value(rowcol_url_key));
+        StreamCollectionInBatches<KEY, record_t>(
+            storage,
+            field,
+            std::move(request),
+            conditional_get,
+            [&field, &row_or_col_key](std::vector<KEY>& keys) {
+              for (const auto& e : matrix_iterator_t::RowOrCol(field, row_or_col_key)) {
+                keys.push_back(KEY(current::storage::sfinae::GetRow(e), current::storage::sfinae::GetCol(e)));
+              }
+              return !keys.empty();
+            },
+            [&field](const KEY& key, std::vector<record_t>& batch) {
+              const ImmutableOptional<ENTRY> entry = field[key];
+              if (Exists(entry)) {
+                batch.push_back(record_t{key, Value(entry), std::chrono::microseconds(0)});
+              }
+            },
+            Response("Nope.\n", HTTPResponseCode.NotFound),
+            [](std::string& output, const record_t& record) {
+              output += JSON(record.entry);
+              output += '\n';
+            });
+      } else {
+        using record_t = std::pair<outer_key_t, size_t>;
+        StreamCollectionInBatches<outer_key_t, record_t>(
+            storage,
+            field,
+            std::move(request),
+            conditional_get,
+            [&field](std::vector<outer_key_t>& keys) {
+              const auto iterable = matrix_iterator_t::RowsOrCols(field);
+              // Must use `begin()/end()` here, can not use a range-based for-loop, as
+              // `OuterKeyForPartialHypermediaCollectionView` (or .key() FWIW -- D.K.) if only available
+              // on the top-level iterator, not on its deferenced type.
+              for (auto iterator = iterable.begin(); iterator != iterable.end(); ++iterator) {
+                keys.push_back(iterator.OuterKeyForPartialHypermediaCollectionView());
+              }
+              return true;
+            },
+            [&field](const outer_key_t& key, std::vector<record_t>& batch) {
+              const size_t size = matrix_iterator_t::RowOrCol(field, key).Size();
+              if (size) {
+                batch.emplace_back(key, size);
+              }
+            },
+            Response(),
+            [](std::string& output, const record_t& record) {
+              output += current::ToString(record.first);
+              output += '\t';
+              output += current::ToString(record.second);
+              output += '\n';
+            });
       }
-      return result.str();
     }
 
     // TODO(dkorolev): Or can `FIELD_SEMANTICS` be hardcoded here?
@@ -103,51 +228,27 @@ struct Plain {
                                     semantics::key_completeness::FullKey,
                                     FIELD_SEMANTICS,
                                     semantics::key_completeness::DictionaryOrMatrixCompleteKey) const {
-      if (Exists(input.get_url_key)) {
-        const auto key = field_type_dependent_t<PARTICULAR_FIELD>::template ParseURLKey<KEY>(Value(input.get_url_key));
-        const ImmutableOptional<ENTRY> result = input.field[key];
-        if (Exists(result)) {
-          return Value(result);
-        } else {
-          return Response("Nope.\n", HTTPResponseCode.NotFound);
-        }
+      // The whole field is sent by `StreamCollection()`, so the key is always there.
+      CURRENT_ASSERT(Exists(input.get_url_key));
+      const auto key = field_type_dependent_t<PARTICULAR_FIELD>::template ParseURLKey<KEY>(Value(input.get_url_key));
+      const ImmutableOptional<ENTRY> result = input.field[key];
+      if (Exists(result)) {
+        return ConditionalGETResponse(conditional_get,
+                                      Value(input.field.LastModified(key)),
+                                      [&result]() -> Response { return Value(result); });
       } else {
-        return RunIterate(input.field, typename OPERATION::top_level_iterating_key_t());
+        return Response("Nope.\n", HTTPResponseCode.NotFound);
       }
     }
 
     template <class INPUT, typename FIELD_SEMANTICS, typename KEY_COMPLETENESS>
-    Response RunForFullOrPartialKey(const INPUT& input,
+    Response RunForFullOrPartialKey(const INPUT&,
                                     KEY_COMPLETENESS,
                                     FIELD_SEMANTICS,
                                     semantics::key_completeness::MatrixHalfKey) const {
-      if (Exists(input.rowcol_get_url_key)) {
-        const auto row_or_col_key =
-            current::FromString<typename MatrixContainerProxy<KEY_COMPLETENESS>::template entry_outer_key_t<ENTRY>>(
-                Value(input.rowcol_get_url_key));
-        const auto iterable =
-            GenericMatrixIterator<KEY_COMPLETENESS, FIELD_SEMANTICS>::RowOrCol(input.field, row_or_col_key);
-        if (!iterable.Empty()) {
-          std::ostringstream result;
-          for (const auto& e : iterable) {
-            result << JSON(e) << '\n';
-          }
-          return result.str();
-        } else {
-          return Response("Nope.\n", HTTPResponseCode.NotFound);
-        }
-      } else {
-        std::ostringstream result;
-        const auto iterable = GenericMatrixIterator<KEY_COMPLETENESS, FIELD_SEMANTICS>::RowsOrCols(input.field);
-        // Must use `begin()/end()` here, can not use a range-based for-loop, as
-        // `OuterKeyForPartialHypermediaCollectionView` (or .key() FWIW -- D.K.) if only available
-        // on the top-level iterator, not on its deferenced type.
-        for (auto iterator = iterable.begin(); iterator != iterable.end(); ++iterator) {
-          result << current::ToString(iterator.OuterKeyForPartialHypermediaCollectionView()) << '\t'
-                 << (*iterator).TotalElementsForHypermediaCollectionView() << '\n';
-        }
-        return result.str();
-      }
+      // The matrix rows and cols are sent by `StreamCollection()`, so they never get here.
+      CURRENT_ASSERT(false);
+      return Response();  // LCOV_EXCL_LINE
     }
 
     template <class INPUT>
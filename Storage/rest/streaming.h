@@ -0,0 +1,175 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `StreamFieldCollection()` sends the whole field as a chunked HTTP response, without holding the storage lock
+// for the time it takes to serialize and send it. `StreamCollectionInBatches()` does the same for any collection
+// of records that can be looked up by key, such as a matrix row or col.
+//
+// The keys of the entries to send are collected in one read-only transaction, which fixes the set of entries.
+// The entries themselves are then copied out in batches of `kRESTfulStreamedCollectionBatchSize`, one short read-only
+// transaction per batch, and each batch is serialized and sent as an HTTP chunk after its transaction is over.
+// The entries deleted after the keys were collected are skipped, and the updated ones are sent in their latest state.
+// The `ETag` of the response is the one of the field as of the time the keys were collected.
+
+#ifndef CURRENT_STORAGE_REST_STREAMING_H
+#define CURRENT_STORAGE_REST_STREAMING_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../api_types.h"
+
+#include "../../Blocks/HTTP/api.h"
+
+namespace current {
+namespace storage {
+namespace rest {
+
+constexpr size_t kRESTfulStreamedCollectionBatchSize = 1000u;
+
+template <typename KEY, typename ENTRY>
+struct StreamedCollectionRecord {
+  KEY key;
+  ENTRY entry;
+  std::chrono::microseconds last_modified;
+};
+
+// The output is `prefix`, then the records formatted by `format(std::string& output, const RECORD& record)`,
+// separated by `separator`, then `suffix`. The keys are collected by `collect(std::vector<KEY>& keys)`, which returns
+// false if there is no such collection, in which case `not_found` is sent instead. The records are then looked up by
+// `fetch(const KEY& key, std::vector<RECORD>& batch)`, which appends nothing if the record is gone by then.
+template <typename KEY, typename RECORD, class STORAGE, class FIELD, typename COLLECT, typename FETCH, typename FORMAT>
+void StreamCollectionInBatches(const STORAGE& storage,
+                               const FIELD& field,
+                               Request request,
+                               const ConditionalGETParams& conditional_get,
+                               COLLECT&& collect,
+                               FETCH&& fetch,
+                               Response not_found,
+                               FORMAT&& format,
+                               const std::string& prefix = "",
+                               const std::string& separator = "",
+                               const std::string& suffix = "") {
+  using immutable_fields_t = typename STORAGE::fields_by_cref_t;
+
+  std::vector<KEY> keys;
+  std::chrono::microseconds last_modified;
+  bool found = true;
+  storage.ReadOnlyTransaction([&field, &collect, &keys, &last_modified, &found, &conditional_get](immutable_fields_t) {
+    last_modified = field.FieldLastModified();
+    if (conditional_get.NotModified(last_modified)) {
+      return;
+    }
+    found = collect(keys);
+  }).Go();
+
+  if (!found) {
+    request(std::move(not_found));
+    return;
+  }
+  net::http::Headers headers;
+  headers.Set(kETagHeader, FormatETag(last_modified));
+  headers.Set(kLastModifiedHeader, FormatDateTimeAsIMFFix(last_modified));
+  if (conditional_get.NotModified(last_modified)) {
+    request("", HTTPResponseCode.NotModified, net::constants::kDefaultContentType, headers);
+    return;
+  }
+  auto sender = request.SendChunkedResponse(HTTPResponseCode.OK, net::constants::kDefaultContentType, headers);
+  try {
+    bool first = true;
+    std::string chunk = prefix;
+    std::vector<RECORD> batch;
+    for (size_t begin = 0u; begin < keys.size(); begin += kRESTfulStreamedCollectionBatchSize) {
+      const size_t end = std::min(begin + kRESTfulStreamedCollectionBatchSize, keys.size());
+      batch.clear();
+      storage.ReadOnlyTransaction([&fetch, &keys, &batch, begin, end](immutable_fields_t) {
+        for (size_t i = begin; i < end; ++i) {
+          fetch(keys[i], batch);
+        }
+      }).Go();
+      for (const auto& record : batch) {
+        if (!first) {
+          chunk += separator;
+        }
+        first = false;
+        format(chunk, record);
+      }
+      sender.Send(chunk);
+      chunk.clear();
+    }
+    chunk += suffix;
+    sender.Send(chunk);
+  } catch (const current::Exception&) {
+    // The response header is out, so there is no way to report the error, other than to cut the response short.
+    // Normally it's the client that has closed the connection.
+  }
+}
+
+// The whole field, as `StreamedCollectionRecord`-s. Only the keys for which `filter(key)` is true are sent.
+template <typename KEY, typename ENTRY, class STORAGE, class FIELD, typename FILTER, typename FORMAT>
+void StreamFieldCollection(const STORAGE& storage,
+                           const FIELD& field,
+                           Request request,
+                           const ConditionalGETParams& conditional_get,
+                           FILTER&& filter,
+                           FORMAT&& format,
+                           const std::string& prefix = "",
+                           const std::string& separator = "",
+                           const std::string& suffix = "") {
+  using record_t = StreamedCollectionRecord<KEY, ENTRY>;
+  StreamCollectionInBatches<KEY, record_t>(
+      storage,
+      field,
+      std::move(request),
+      conditional_get,
+      [&field, &filter](std::vector<KEY>& keys) {
+        keys.reserve(field.Size());
+        for (auto cit = field.begin(); cit != field.end(); ++cit) {
+          if (filter(cit.key())) {
+            keys.push_back(cit.key());
+          }
+        }
+        return true;
+      },
+      [&field](const KEY& key, std::vector<record_t>& batch) {
+        const ImmutableOptional<ENTRY> entry = field[key];
+        if (Exists(entry)) {
+          const auto last_modified = field.LastModified(key);
+          batch.push_back(
+              record_t{key, Value(entry), Exists(last_modified) ? Value(last_modified) : std::chrono::microseconds(0)});
+        }
+      },
+      Response(),
+      std::forward<FORMAT>(format),
+      prefix,
+      separator,
+      suffix);
+}
+
+}  // namespace current::storage::rest
+}  // namespace current::storage
+}  // namespace current
+
+#endif  // CURRENT_STORAGE_REST_STREAMING_H
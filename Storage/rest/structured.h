@@ -29,6 +29,7 @@ SOFTWARE.
 #include "types.h"
 #include "plain.h"
 #include "sfinae.h"
+#include "streaming.h"
 
 #include "../api_types.h"
 #include "../storage.h"
@@ -41,7 +42,6 @@ namespace storage {
 namespace rest {
 namespace generic {
 
-const std::string kLastModifiedHeader = "Last-Modified";
 const std::string kCurrentLastModifiedHeader = "X-Current-Last-Modified";
 const std::string kIfUnmodifiedSinceHeader = "If-Unmodified-Since";
 const std::string kCurrentIfUnmodifiedSinceHeader = "X-Current-If-Unmodified-Since";
@@ -109,6 +109,7 @@ struct Structured {
   template <typename OPERATION, typename PARTICULAR_FIELD, typename ENTRY, typename KEY>
   struct RESTfulDataHandler<GET, OPERATION, PARTICULAR_FIELD, ENTRY, KEY> {
     context_t context;
+    ConditionalGETParams conditional_get;
 
     template <typename F>
     void EnterByKeyCompletenessFamily(Request request,
@@ -129,12 +130,73 @@ struct Structured {
 
     template <typename F>
     void Enter(Request request, F&& next) {
+      conditional_get = ConditionalGETParams::FromRequest(request);
       EnterByKeyCompletenessFamily(std::move(request),
                                    typename OPERATION::key_completeness_t(),
                                    typename OPERATION::key_completeness_t::completeness_family_t(),
                                    std::forward<F>(next));
     }
 
+    // The export of the whole field via `?export` is streamed, see `rest/streaming.h`.
+    template <typename URL_KEY>
+    bool StreamsCollection(const Optional<URL_KEY>& url_key,
+                           const Optional<FieldExportParams>& requested_export_params) const {
+      return !Exists(url_key) && Exists(requested_export_params);
+    }
+
+    template <class STORAGE, class FIELD, typename URL_KEY>
+    void StreamCollection(const STORAGE& storage,
+                          const FIELD& field,
+                          Request request,
+                          const Optional<URL_KEY>&,
+                          const Optional<FieldExportParams>& requested_export_params) const {
+#ifndef CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
+      // Only available off the followers.
+      if (storage.GetRole() != StorageRole::Follower) {
+        request(ErrorResponse(RESTError("NotFollowerMode", "Can only request full export from a Follower storage."),
+                              HTTPResponseCode.Forbidden));
+        return;
+      }
+#endif  // CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
+      const FieldExportParams export_params = Value(requested_export_params);
+      const auto hasher = CurrentHashFunction<KEY>();
+      const auto filter = [export_params, hasher](const KEY& key) {
+        return export_params.nshards <= 1u || (hasher(key) % export_params.nshards) == export_params.shard;
+      };
+      if (export_params.format == FieldExportFormat::Detailed) {
+        StreamFieldCollection<KEY, ENTRY>(storage,
+                                          field,
+                                          std::move(request),
+                                          conditional_get,
+                                          filter,
+                                          FormatDetailedExportEntry(),
+                                          "[",
+                                          ",",
+                                          "]\n");
+      } else {
+        StreamFieldCollection<KEY, ENTRY>(
+            storage, field, std::move(request), conditional_get, filter, FormatSimpleExportEntry());
+      }
+    }
+
+    struct FormatSimpleExportEntry {
+      template <typename RECORD>
+      void operator()(std::string& output, const RECORD& record) const {
+        output += JSON<JSONFormat::Minimalistic>(record.entry);
+        output += '\n';
+      }
+    };
+
+    struct FormatDetailedExportEntry {
+      template <typename RECORD>
+      void operator()(std::string& output, const RECORD& record) const {
+        using detailed_export_helper_t = hypermedia::DetailedExportEntryHelper<KEY, ENTRY>;
+        using detailed_export_entry_t = hypermedia::HypermediaRESTDetailedExportEntry<detailed_export_helper_t>;
+        output += JSON<JSONFormat::Minimalistic>(
+            detailed_export_entry_t(record.last_modified, detailed_export_helper_t(record.key, record.entry)));
+      }
+    };
+
     template <class INPUT, typename FIELD_SEMANTICS>
     Response RunForFullOrPartialKey(const INPUT& input,
                                     semantics::key_completeness::FullKey,
@@ -149,27 +211,25 @@ struct Structured {
         const ImmutableOptional<ENTRY> result = input.field[key];
         if (Exists(result)) {
           const auto& value = Value(result);
-          const auto last_modified = input.field.LastModified(key);
-          if (!Exists(input.requested_export_params)) {
-            const std::string url_collection =
-                input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name;
-            const std::string url =
-                url_collection + '/' + field_type_dependent_t<PARTICULAR_FIELD>::FormatURLKey(url_key_value);
-            Response response = RESPONSE_FORMATTER::BuildResponseForResource(context, url, url_collection, value);
-            if (Exists(last_modified)) {
-              const auto last_modified_value = Value(last_modified);
-              response.SetHeader(kLastModifiedHeader, FormatDateTimeAsIMFFix(last_modified_value));
-              response.SetHeader(kCurrentLastModifiedHeader, current::ToString(last_modified_value));
-            }
-            return response;
-          } else {
-            // Export requested via `?export`, dump the record using the appropriate format.
-            if (Value(input.requested_export_params).format == FieldExportFormat::Detailed) {
-              return detailed_export_entry_t(Value(last_modified), detailed_export_helper_t(key, value));
+          const auto last_modified = Value(input.field.LastModified(key));
+          Response response = ConditionalGETResponse(conditional_get, last_modified, [&]() -> Response {
+            if (!Exists(input.requested_export_params)) {
+              const std::string url_collection =
+                  input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name;
+              const std::string url =
+                  url_collection + '/' + field_type_dependent_t<PARTICULAR_FIELD>::FormatURLKey(url_key_value);
+              return RESPONSE_FORMATTER::BuildResponseForResource(context, url, url_collection, value);
             } else {
-              return value;
+              // Export requested via `?export`, dump the record using the appropriate format.
+              if (Value(input.requested_export_params).format == FieldExportFormat::Detailed) {
+                return detailed_export_entry_t(last_modified, detailed_export_helper_t(key, value));
+              } else {
+                return value;
+              }
             }
-          }
+          });
+          response.SetHeader(kCurrentLastModifiedHeader, current::ToString(last_modified));
+          return response;
         } else {
           return ErrorResponse(
               ResourceNotFoundError("The requested resource was not found.",
@@ -177,54 +237,15 @@ struct Structured {
               HTTPResponseCode.NotFound);
         }
       } else {
-        if (!Exists(input.requested_export_params)) {
-          // Top-level field view, identical for dictionaries and matrices.
-          // Pass `url` twice, as `pagination_url` and `collection_url` are the same for this format.
-          const std::string url = input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name;
+        // Top-level field view, identical for dictionaries and matrices. The export of the whole field is sent by
+        // `StreamCollection()`, so it never gets here.
+        CURRENT_ASSERT(!Exists(input.requested_export_params));
+        // Pass `url` twice, as `pagination_url` and `collection_url` are the same for this format.
+        const std::string url = input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name;
+        return ConditionalGETResponse(conditional_get, input.field.FieldLastModified(), [&]() -> Response {
           return RESPONSE_FORMATTER::template BuildResponseWithCollection<PARTICULAR_FIELD, ENTRY, ENTRY>(
               context, url, url, input.field);
-        } else {
-#ifndef CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
-          // Export requested via `?export`, dump all the records.
-          // Slow. Only available off the followers.
-          if (input.role != StorageRole::Follower) {
-            return ErrorResponse(RESTError("NotFollowerMode", "Can only request full export from a Follower storage."),
-                                 HTTPResponseCode.Forbidden);
-          } else
-#endif  // CURRENT_ALLOW_STORAGE_EXPORT_FROM_MASTER
-          {
-            // Sadly, the `Response` must be returned.
-            // Have to create it in memory for now. -- D.K.
-            // TODO(dkorolev): Migrate to a better way.
-            const auto& export_params = Value(input.requested_export_params);
-            const auto hasher = CurrentHashFunction<KEY>();
-            std::ostringstream result;
-            if (export_params.format == FieldExportFormat::Detailed) {
-              result << '[';
-            }
-            for (auto cit = input.field.begin(); cit != input.field.end(); ++cit) {
-              if (export_params.nshards > 1u && (hasher(cit.key()) % export_params.nshards) != export_params.shard) {
-                continue;
-              }
-              if (export_params.format == FieldExportFormat::Detailed) {
-                const auto last_modified = input.field.LastModified(cit.key());
-                CURRENT_ASSERT(Exists(last_modified));
-                const auto detailed_entry =
-                    detailed_export_entry_t(Value(last_modified), detailed_export_helper_t(cit.key(), *cit));
-                result << JSON<JSONFormat::Minimalistic>(detailed_entry) << ',';
-              } else {
-                result << JSON<JSONFormat::Minimalistic>(*cit) << '\n';
-              }
-            }
-            if (export_params.format == FieldExportFormat::Detailed) {
-              if (result.tellp() > 1) {
-                result.seekp(-1, std::ios_base::cur);
-              }
-              result << "]\n";
-            }
-            return result.str();
-          }
-        }
+        });
       }
     }
 
@@ -242,12 +263,14 @@ struct Structured {
             GenericMatrixIterator<KEY_COMPLETENESS, FIELD_SEMANTICS>::RowOrCol(input.field, row_or_col_key);
         if (!iterable.Empty()) {
           // Outer-level matrix collection view, browse the list of rows of cols.
-          return RESPONSE_FORMATTER::template BuildResponseWithCollection<PARTICULAR_FIELD, ENTRY, ENTRY>(
-              context,
-              input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name + '.' +
-                  MatrixContainerProxy<KEY_COMPLETENESS>::PartialKeySuffix() + '/' + row_or_col_key_string,
-              input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name,
-              iterable);
+          return ConditionalGETResponse(conditional_get, input.field.FieldLastModified(), [&]() -> Response {
+            return RESPONSE_FORMATTER::template BuildResponseWithCollection<PARTICULAR_FIELD, ENTRY, ENTRY>(
+                context,
+                input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name + '.' +
+                    MatrixContainerProxy<KEY_COMPLETENESS>::PartialKeySuffix() + '/' + row_or_col_key_string,
+                input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name,
+                iterable);
+          });
         } else {
           return ErrorResponse(
               ResourceNotFoundError("The requested key has was not found.", {{"key", Value(input.rowcol_get_url_key)}}),
@@ -258,10 +281,12 @@ struct Structured {
         // Pass the same `url` twice, as the collection ("specific row/col") and pagination have the same base URL.
         const std::string url = input.restful_url_prefix + '/' + kRESTfulDataURLComponent + '/' + input.field_name +
                                 '.' + MatrixContainerProxy<KEY_COMPLETENESS>::PartialKeySuffix();
-        return RESPONSE_FORMATTER::template BuildResponseWithCollection<PARTICULAR_FIELD,
-                                                                        ENTRY,
-                                                                        RESTSubCollection<ENTRY>>(
-            context, url, url, GenericMatrixIterator<KEY_COMPLETENESS, FIELD_SEMANTICS>::RowsOrCols(input.field));
+        return ConditionalGETResponse(conditional_get, input.field.FieldLastModified(), [&]() -> Response {
+          return RESPONSE_FORMATTER::template BuildResponseWithCollection<PARTICULAR_FIELD,
+                                                                          ENTRY,
+                                                                          RESTSubCollection<ENTRY>>(
+              context, url, url, GenericMatrixIterator<KEY_COMPLETENESS, FIELD_SEMANTICS>::RowsOrCols(input.field));
+        });
       }
     }
 
@@ -0,0 +1,229 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// `ShardedStorage<STORAGE>` partitions the data among N independent storages of the same type.
+//
+// Each shard has its own mutex and its own persisted stream, so the transactions on different shards run in parallel.
+// Each transaction is routed by the partition key passed along with it, for example, the user ID, and is confined
+// to a single shard. There are no cross-shard read-write transactions.
+//
+// The key goes to shard `ROUTER()(key) % N`. The default router, `StableHashShardRouter`, hashes the key with FNV-1a,
+// which, unlike `std::hash<>`, does not change with the standard library, so that the persisted shards are still
+// routed to after a toolchain upgrade. A custom router, such as a function of the key, can be passed in instead.
+//
+// `ReadOnlyFanOut()` runs a read-only transaction on all the shards concurrently, and either returns the per-shard
+// results in the order of the shards, or folds them with a user-provided merge function. The transaction body is
+// invoked from several threads at once, and should not mutate any state shared between the invocations.
+
+#ifndef CURRENT_STORAGE_SHARDED_H
+#define CURRENT_STORAGE_SHARDED_H
+
+#include "../port.h"
+
+#include <future>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "exceptions.h"
+#include "storage.h"
+
+#include "../TypeSystem/Serialization/json.h"
+
+#include "../Bricks/strings/printf.h"
+
+namespace current {
+namespace storage {
+
+// The strings are hashed as their bytes, the integers and the enums as their eight little-endian bytes,
+// and the rest of the keys, for example, the `CURRENT_STRUCT`-s, as their JSON.
+struct StableHashShardRouter {
+  enum : uint64_t { kFNVOffsetBasis = 0xcbf29ce484222325ull, kFNVPrime = 0x100000001b3ull };
+
+  uint64_t operator()(const std::string& key) const { return Hash(key.data(), key.length()); }
+
+  template <typename KEY>
+  std::enable_if_t<std::is_integral<KEY>::value || std::is_enum<KEY>::value, uint64_t> operator()(KEY key) const {
+    uint64_t value = static_cast<uint64_t>(key);
+    char bytes[8];
+    for (char& byte : bytes) {
+      byte = static_cast<char>(value & 0xffu);
+      value >>= 8u;
+    }
+    return Hash(bytes, sizeof(bytes));
+  }
+
+  template <typename KEY>
+  std::enable_if_t<!std::is_integral<KEY>::value && !std::is_enum<KEY>::value, uint64_t> operator()(
+      const KEY& key) const {
+    return operator()(JSON(key));
+  }
+
+  static uint64_t Hash(const char* data, size_t size) {
+    uint64_t hash = kFNVOffsetBasis;
+    for (size_t i = 0u; i < size; ++i) {
+      hash ^= static_cast<uint8_t>(data[i]);
+      hash *= kFNVPrime;
+    }
+    return hash;
+  }
+};
+
+template <typename STORAGE, typename ROUTER = StableHashShardRouter>
+class ShardedStorage final {
+ public:
+  using storage_t = STORAGE;
+  using router_t = ROUTER;
+
+  template <typename F>
+  using f_result_t = typename std::result_of<F(typename STORAGE::fields_by_cref_t)>::type;
+
+  ShardedStorage(const ShardedStorage&) = delete;
+  ShardedStorage(ShardedStorage&&) = delete;
+  ShardedStorage& operator=(const ShardedStorage&) = delete;
+  ShardedStorage& operator=(ShardedStorage&&) = delete;
+
+  // In-memory shards.
+  explicit ShardedStorage(size_t shards_count, ROUTER router = ROUTER()) : router_(router) {
+    AssertNonZero(shards_count);
+    for (size_t i = 0u; i < shards_count; ++i) {
+      shards_.emplace_back(std::make_unique<STORAGE>());
+    }
+  }
+
+  // Persisted shards, shard `i` of `N` is stored in `base_file_name + ".i-of-N"`.
+  ShardedStorage(size_t shards_count, const std::string& base_file_name, ROUTER router = ROUTER())
+      : router_(router) {
+    AssertNonZero(shards_count);
+    for (size_t i = 0u; i < shards_count; ++i) {
+      shards_.emplace_back(std::make_unique<STORAGE>(ShardFileName(base_file_name, i, shards_count)));
+    }
+  }
+
+  // Externally constructed shards, for custom persister parameters.
+  explicit ShardedStorage(std::vector<std::unique_ptr<STORAGE>>&& shards, ROUTER router = ROUTER())
+      : router_(router), shards_(std::move(shards)) {
+    AssertNonZero(shards_.size());
+  }
+
+  static std::string ShardFileName(const std::string& base_file_name, size_t index, size_t shards_count) {
+    return base_file_name + strings::Printf(".%d-of-%d", static_cast<int>(index), static_cast<int>(shards_count));
+  }
+
+  size_t ShardsCount() const { return shards_.size(); }
+
+  template <typename KEY>
+  size_t ShardIndex(const KEY& key) const {
+    return static_cast<size_t>(static_cast<uint64_t>(router_(key)) % shards_.size());
+  }
+
+  STORAGE& Shard(size_t index) { return *shards_.at(index); }
+  const STORAGE& Shard(size_t index) const { return *shards_.at(index); }
+
+  template <typename KEY>
+  STORAGE& ShardFor(const KEY& key) {
+    return *shards_[ShardIndex(key)];
+  }
+  template <typename KEY>
+  const STORAGE& ShardFor(const KEY& key) const {
+    return *shards_[ShardIndex(key)];
+  }
+
+  // Single-shard transactions, same signatures as the ones of the storage itself, prefixed by the partition key.
+  template <typename KEY, typename... FS>
+  auto ReadWriteTransaction(const KEY& key, FS&&... fs)
+      -> decltype(std::declval<STORAGE&>().ReadWriteTransaction(std::forward<FS>(fs)...)) {
+    return ShardFor(key).ReadWriteTransaction(std::forward<FS>(fs)...);
+  }
+
+  template <typename KEY, typename... FS>
+  auto ReadOnlyTransaction(const KEY& key, FS&&... fs) const
+      -> decltype(std::declval<const STORAGE&>().ReadOnlyTransaction(std::forward<FS>(fs)...)) {
+    return ShardFor(key).ReadOnlyTransaction(std::forward<FS>(fs)...);
+  }
+
+  // Runs `f` as a read-only transaction on each shard concurrently, returns the results in the order of the shards.
+  // If the transaction on any shard throws, the exception is rethrown once all the shards are done.
+  template <typename F>
+  std::vector<TransactionResult<f_result_t<F>>> ReadOnlyFanOut(F&& f) const {
+    static_assert(!std::is_void<f_result_t<F>>::value, "`ReadOnlyFanOut()` requires a non-void transaction.");
+    using shard_result_t = TransactionResult<f_result_t<F>>;
+    std::vector<std::future<shard_result_t>> futures;
+    futures.reserve(shards_.size() - 1u);
+    for (size_t i = 1u; i < shards_.size(); ++i) {
+      const STORAGE& shard = *shards_[i];
+      futures.push_back(
+          std::async(std::launch::async, [&shard, &f]() { return shard.ReadOnlyTransaction(f).Go(); }));
+    }
+    std::vector<shard_result_t> results;
+    results.reserve(shards_.size());
+    std::exception_ptr exception;
+    try {
+      results.push_back(shards_.front()->ReadOnlyTransaction(f).Go());
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    for (auto& future : futures) {
+      try {
+        results.push_back(future.get());
+      } catch (...) {
+        if (!exception) {
+          exception = std::current_exception();
+        }
+      }
+    }
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+    return results;
+  }
+
+  // Same as above, folding the per-shard results with `merge(accumulator, shard_result)` in the order of the shards.
+  // Throws if the transaction on any shard did not return a value.
+  template <typename F, typename R, typename MERGE>
+  R ReadOnlyFanOut(F&& f, R accumulator, MERGE&& merge) const {
+    for (auto& result : ReadOnlyFanOut(std::forward<F>(f))) {
+      merge(accumulator, std::move(Value(result)));
+    }
+    return accumulator;
+  }
+
+ private:
+  static void AssertNonZero(size_t shards_count) {
+    if (!shards_count) {
+      CURRENT_THROW(StorageShardsCountException("`ShardedStorage` requires at least one shard."));
+    }
+  }
+
+  const ROUTER router_;
+  std::vector<std::unique_ptr<STORAGE>> shards_;
+};
+
+}  // namespace storage
+}  // namespace current
+
+using current::storage::ShardedStorage;
+
+#endif  // CURRENT_STORAGE_SHARDED_H
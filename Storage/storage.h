@@ -28,6 +28,13 @@ SOFTWARE.
 // * (Ordered/Unordered)Dictionary<T> <=> std::(map/unordered_map)<key_t, T>
 //   Empty(), Size(), operator[](key), Erase(key) [, iteration, {lower/upper}_bound].
 //   `key_t` is either the type of `T.key` or of `T.get_key()`.
+//   Optional secondary indexes on other fields of `T`, `Index<INDEX>()[value]`, see `container/index.h`.
+//
+// * FlatDictionary<T> <=> UnorderedDictionary<T> atop an open-addressing hash table, see `container/flat.h`.
+//   Same interface, no per-entry allocation, lower memory footprint and fewer cache misses on large dictionaries.
+//
+// * PersistentDictionary<T> <=> UnorderedDictionary<T> atop a persistent hash map, see `container/persistent.h`.
+//   Same interface, plus `Snapshot()`, the O(1) copy of the entries to be read outside the transaction.
 //
 // * (Ordered/Unordered)(One/Many)To(One/Many)<T> <=> { row_t, col_t } -> T, two `std::(map/unordered_map)<>`-s.
 //   Entries are stored in third `std::unordered_map<std::pair<row_t, col_t>, std::unique_ptr<T>>`.
@@ -46,6 +53,7 @@ SOFTWARE.
 #include <atomic>
 
 #include "base.h"
+#include "instrumentation.h"
 #include "transaction.h"
 #include "transaction_policy.h"
 #include "transaction_result.h"
@@ -57,6 +65,8 @@ SOFTWARE.
 
 #include "persister/file.h"
 
+#include "../Blocks/HTTP/api.h"
+
 #include "../TypeSystem/struct.h"
 #include "../TypeSystem/Serialization/json.h"
 #include "../TypeSystem/optional.h"
@@ -69,7 +79,8 @@ SOFTWARE.
 namespace current {
 namespace storage {
 
-#define CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(dictionary_type, entry_type, entry_name)        \
+// The variadic part is the secondary indexes type, `NoIndexes` or `Indexes<...>`.
+#define CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(dictionary_type, entry_type, entry_name, ...)   \
   struct entry_name;                                                                                \
   CURRENT_STRUCT(entry_name##Updated) {                                                             \
     CURRENT_FIELD(us, std::chrono::microseconds);                                                   \
@@ -89,7 +100,7 @@ namespace storage {
   };                                                                                                \
   struct entry_name {                                                                               \
     template <typename T, typename E1, typename E2>                                                 \
-    using field_t = dictionary_type<T, E1, E2>;                                                     \
+    using field_t = dictionary_type<T, E1, E2, __VA_ARGS__>;                                        \
     using entry_t = entry_type;                                                                     \
     using key_t = ::current::storage::sfinae::entry_key_t<entry_type>;                              \
     using update_event_t = entry_name##Updated;                                                     \
@@ -99,10 +110,63 @@ namespace storage {
   }
 
 #define CURRENT_STORAGE_FIELD_ENTRY_UnorderedDictionary(entry_type, entry_name) \
-  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(UnorderedDictionary, entry_type, entry_name)
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                  \
+      UnorderedDictionary, entry_type, entry_name, ::current::storage::container::NoIndexes)
 
 #define CURRENT_STORAGE_FIELD_ENTRY_OrderedDictionary(entry_type, entry_name) \
-  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(OrderedDictionary, entry_type, entry_name)
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                \
+      OrderedDictionary, entry_type, entry_name, ::current::storage::container::NoIndexes)
+
+#define CURRENT_STORAGE_FIELD_ENTRY_FlatDictionary(entry_type, entry_name) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                             \
+      FlatDictionary, entry_type, entry_name, ::current::storage::container::NoIndexes)
+
+#define CURRENT_STORAGE_FIELD_ENTRY_PersistentDictionary(entry_type, entry_name) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                   \
+      PersistentDictionary, entry_type, entry_name, ::current::storage::container::NoIndexes)
+
+#define CURRENT_STORAGE_INDEXED_FIELD_ENTRY_UnorderedDictionary(entry_type, entry_name, ...) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                              \
+      UnorderedDictionary, entry_type, entry_name, ::current::storage::container::Indexes<__VA_ARGS__>)
+
+#define CURRENT_STORAGE_INDEXED_FIELD_ENTRY_OrderedDictionary(entry_type, entry_name, ...) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                            \
+      OrderedDictionary, entry_type, entry_name, ::current::storage::container::Indexes<__VA_ARGS__>)
+
+#define CURRENT_STORAGE_INDEXED_FIELD_ENTRY_FlatDictionary(entry_type, entry_name, ...) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                         \
+      FlatDictionary, entry_type, entry_name, ::current::storage::container::Indexes<__VA_ARGS__>)
+
+#define CURRENT_STORAGE_INDEXED_FIELD_ENTRY_PersistentDictionary(entry_type, entry_name, ...) \
+  CURRENT_STORAGE_FIELD_ENTRY_Dictionary_IMPL(                                               \
+      PersistentDictionary, entry_type, entry_name, ::current::storage::container::Indexes<__VA_ARGS__>)
+
+// Secondary index on the `field_name` field of `entry_type`, to be listed in `CURRENT_STORAGE_INDEXED_FIELD_ENTRY`.
+#define CURRENT_STORAGE_INDEX_IMPL(map_type, uniqueness, entry_type, field_name, index_name)          \
+  struct index_name {                                                                                 \
+    using entry_t = entry_type;                                                                       \
+    using key_t = ::current::decay<decltype(entry_type::field_name)>;                                 \
+    template <typename K, typename V>                                                                 \
+    using map_t = ::current::storage::container::map_type<K, V>;                                      \
+    using uniqueness_t = ::current::storage::container::index::uniqueness;                            \
+    static const char* FieldName() { return #field_name; }                                            \
+    static ::current::copy_free<key_t> Extract(const entry_type& entry) { return entry.field_name; } \
+  }
+
+#define CURRENT_STORAGE_INDEX_OrderedUnique(entry_type, field_name, index_name) \
+  CURRENT_STORAGE_INDEX_IMPL(Ordered, Unique, entry_type, field_name, index_name)
+
+#define CURRENT_STORAGE_INDEX_UnorderedUnique(entry_type, field_name, index_name) \
+  CURRENT_STORAGE_INDEX_IMPL(Unordered, Unique, entry_type, field_name, index_name)
+
+#define CURRENT_STORAGE_INDEX_OrderedMulti(entry_type, field_name, index_name) \
+  CURRENT_STORAGE_INDEX_IMPL(Ordered, Multi, entry_type, field_name, index_name)
+
+#define CURRENT_STORAGE_INDEX_UnorderedMulti(entry_type, field_name, index_name) \
+  CURRENT_STORAGE_INDEX_IMPL(Unordered, Multi, entry_type, field_name, index_name)
+
+#define CURRENT_STORAGE_INDEX(kind, entry_type, field_name, index_name) \
+  CURRENT_STORAGE_INDEX_##kind(entry_type, field_name, index_name)
 
 #define CURRENT_STORAGE_FIELD_ENTRY_Matrix_IMPL(matrix_type, entry_type, entry_name)                                   \
   struct entry_name;                                                                                                   \
@@ -177,6 +241,10 @@ namespace storage {
 #define CURRENT_STORAGE_FIELD_ENTRY(container, entry_type, entry_name) \
   CURRENT_STORAGE_FIELD_ENTRY_##container(entry_type, entry_name)
 
+// Dictionaries only: `CURRENT_STORAGE_INDEXED_FIELD_ENTRY(OrderedDictionary, Record, RecordDictionary, RecordByRhs)`.
+#define CURRENT_STORAGE_INDEXED_FIELD_ENTRY(container, entry_type, entry_name, ...) \
+  CURRENT_STORAGE_INDEXED_FIELD_ENTRY_##container(entry_type, entry_name, __VA_ARGS__)
+
 #define CURRENT_STORAGE_FIELDS_HELPERS(name)                                                                   \
   template <typename T>                                                                                        \
   struct CURRENT_STORAGE_FIELDS_HELPER;                                                                        \
@@ -212,6 +280,8 @@ class GenericStorageImpl {
   persister_t persister_;
   TRANSACTION_POLICY<persister_t> transaction_policy_;
   std::atomic<StorageRole> role_;
+  // Declared last, for the route to be unregistered before the fields it reports on are destroyed.
+  HTTPRoutesScope stats_http_route_;
 
  public:
   using fields_by_ref_t = FIELDS&;
@@ -280,6 +350,44 @@ class GenericStorageImpl {
                                            std::forward<F2>(f2));
   }
 
+  // Where the storage is in its stream. On the master, the position after a read-write transaction is what its
+  // client would pass, unchanged, to `ReadOnlyTransactionAtIndex()` of a follower to read its own writes.
+  persister::StreamPosition CurrentStreamPosition() const { return persister_.Position(); }
+
+  // Read-only transactions which first wait, for up to `timeout`, until the storage has applied the stream entry
+  // with the given index, or everything before the given stream position, or an entry with the timestamp at or past
+  // the given one. Meant for the followers. Throw `StorageStalenessTimeoutException` if the storage is still behind.
+  template <typename F>
+  ::current::Future<::current::storage::TransactionResult<f_result_t<F>>, ::current::StrictFuture::Strict>
+  ReadOnlyTransactionAtIndex(uint64_t index, std::chrono::microseconds timeout, F&& f) const {
+    WaitForStreamPosition([index](const persister::StreamPosition& position) { return position.next_index > index; },
+                          timeout,
+                          "index " + current::ToString(index));
+    return ReadOnlyTransaction(std::forward<F>(f));
+  }
+
+  template <typename F>
+  ::current::Future<::current::storage::TransactionResult<f_result_t<F>>, ::current::StrictFuture::Strict>
+  ReadOnlyTransactionAtIndex(const persister::StreamPosition& master_position,
+                             std::chrono::microseconds timeout,
+                             F&& f) const {
+    const uint64_t next_index = master_position.next_index;
+    WaitForStreamPosition(
+        [next_index](const persister::StreamPosition& position) { return position.next_index >= next_index; },
+        timeout,
+        "position " + current::ToString(next_index));
+    return ReadOnlyTransaction(std::forward<F>(f));
+  }
+
+  template <typename F>
+  ::current::Future<::current::storage::TransactionResult<f_result_t<F>>, ::current::StrictFuture::Strict>
+  ReadOnlyTransactionAtTimestamp(std::chrono::microseconds us, std::chrono::microseconds timeout, F&& f) const {
+    WaitForStreamPosition([us](const persister::StreamPosition& position) { return position.last_us >= us; },
+                          timeout,
+                          "timestamp " + current::ToString(us.count()));
+    return ReadOnlyTransaction(std::forward<F>(f));
+  }
+
   void ExposeRawLogViaHTTP(int port, const std::string& route) { persister_.ExposeRawLogViaHTTP(port, route); }
 
   typename std::result_of<decltype(&persister_t::InternalExposeStream)(persister_t)>::type InternalExposeStream() {
@@ -288,6 +396,30 @@ class GenericStorageImpl {
 
   persister_t& Persister() { return persister_; }
 
+  // Turns the per-field operation counters and the transaction latency histograms on or off, see `instrumentation.h`.
+  // The values collected so far are kept.
+  void EnableInstrumentation(bool enabled = true) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fields_.current_storage_mutation_journal_.instrumented = enabled;
+    transaction_policy_.Instrumentation().enabled = enabled;
+  }
+
+  // Takes the storage mutex, so must not be called from within a transaction.
+  StorageStats Stats() {
+    StorageStats stats;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats.instrumented = fields_.current_storage_mutation_journal_.instrumented;
+    stats.replayed_transactions_count = transactions_count_.GetValue();
+    stats.fields.reserve(FIELDS_COUNT);
+    CollectFieldStats(stats.fields, current::variadic_indexes::generate_indexes<FIELDS_COUNT>());
+    stats.transactions = transaction_policy_.Instrumentation().Stats();
+    return stats;
+  }
+
+  void ExposeStatsViaHTTP(int port, const std::string& route) {
+    stats_http_route_ += HTTP(port).Register(route, [this](Request r) { r(Stats()); });
+  }
+
   uint64_t TransactionsCount() const { return transactions_count_.GetValue(); }
 
   void WaitForTransactionsCount(uint64_t count) const {
@@ -305,6 +437,37 @@ class GenericStorageImpl {
   }
 
   void GracefulShutdown() { transaction_policy_.GracefulShutdown(); }
+
+ private:
+  void WaitForStreamPosition(std::function<bool(const persister::StreamPosition&)> predicate,
+                             std::chrono::microseconds timeout,
+                             const std::string& description) const {
+    if (!persister_.WaitForPosition(predicate, timeout)) {
+      CURRENT_THROW(StorageStalenessTimeoutException("The storage has not reached " + description + " in time."));
+    }
+  }
+
+  struct FieldContainerNameExtractor {
+    template <typename FIELD, typename ENTRY_TYPE_WRAPPER>
+    std::string operator()(const char*, ::current::storage::StorageFieldTypeSelector<FIELD>, ENTRY_TYPE_WRAPPER) const {
+      return ::current::storage::StorageFieldTypeSelector<FIELD>::HumanReadableName();
+    }
+  };
+
+  template <int I>
+  StorageFieldStats FieldStatsByIndex() const {
+    StorageFieldStats stats = fields_(::current::storage::ImmutableFieldByIndex<I>()).FieldStats();
+    stats.name = fields_(::current::storage::FieldNameByIndex<I>());
+    stats.container = fields_(::current::storage::FieldNameAndTypeByIndexAndReturn<I, std::string>(),
+                              FieldContainerNameExtractor());
+    return stats;
+  }
+
+  template <int... NS>
+  void CollectFieldStats(std::vector<StorageFieldStats>& output, current::variadic_indexes::indexes<NS...>) const {
+    const int unused[] = {0, (output.push_back(FieldStatsByIndex<NS>()), 0)...};
+    static_cast<void>(unused);
+  }
 };
 
 #define CURRENT_STORAGE_IMPLEMENTATION(name)                                                                   \
@@ -28,6 +28,7 @@ SOFTWARE.
 
 #define CURRENT_MOCK_TIME
 
+#include <random>
 #include <set>
 #include <type_traits>
 
@@ -38,6 +39,8 @@ SOFTWARE.
 
 #include "storage.h"
 #include "api.h"
+#include "compaction.h"
+#include "sharded.h"
 #include "persister/sherlock.h"
 
 #include "rest/plain.h"
@@ -1586,6 +1589,266 @@ TEST(TransactionalStorage, LastModifiedInMatrixContainers) {
   }
 }
 
+TEST(TransactionalStorage, MatrixContainersSlabAllocator) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      EXPECT_EQ(0u, fields.umany_to_umany.EntryAllocatorStats().entries);
+      EXPECT_EQ(0u, fields.umany_to_umany.EntryAllocatorStats().slabs);
+      for (int i = 0; i < 1000; ++i) {
+        fields.umany_to_umany.Add(Cell{i, "x", i});
+        fields.uone_to_umany.Add(Cell{i % 10, current::ToString(i), i});
+      }
+      // The overwritten entry is kept by the undo log until the end of the transaction.
+      fields.umany_to_umany.Add(Cell{0, "x", 42});
+      EXPECT_EQ(1001u, fields.umany_to_umany.EntryAllocatorStats().entries);
+      EXPECT_EQ(42, Value(fields.umany_to_umany.Get(0, "x")).phew);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      const auto stats = fields.umany_to_umany.EntryAllocatorStats();
+      EXPECT_EQ(1000u, stats.entries);
+      EXPECT_LE(1000u, stats.capacity);
+      EXPECT_GE(5u, stats.slabs);  // 64 + 64 + 128 + 256 + 512.
+      EXPECT_EQ(1000u, fields.uone_to_umany.EntryAllocatorStats().entries);
+      for (int i = 0; i < 500; ++i) {
+        fields.umany_to_umany.Erase(i, "x");
+      }
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      const auto before = fields.umany_to_umany.EntryAllocatorStats();
+      EXPECT_EQ(500u, before.entries);
+      for (int i = 0; i < 500; ++i) {
+        fields.umany_to_umany.Add(Cell{i, "y", i});
+      }
+      // The freed cells are reused.
+      const auto after = fields.umany_to_umany.EntryAllocatorStats();
+      EXPECT_EQ(1000u, after.entries);
+      EXPECT_EQ(before.capacity, after.capacity);
+      EXPECT_EQ(before.slabs, after.slabs);
+      CURRENT_STORAGE_THROW_ROLLBACK();
+    }).Go();
+    EXPECT_FALSE(WasCommitted(result));
+  }
+  {
+    const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(500u, fields.umany_to_umany.Size());
+      EXPECT_EQ(500u, fields.umany_to_umany.EntryAllocatorStats().entries);
+      EXPECT_TRUE(Exists(fields.umany_to_umany.Get(500, "x")));
+      EXPECT_FALSE(Exists(fields.umany_to_umany.Get(499, "x")));
+      EXPECT_FALSE(Exists(fields.umany_to_umany.Get(499, "y")));
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+
+  // Replaying the log overwrites entries in place, as there is no undo log to keep the previous ones.
+  using PersistedStorage = TestStorage<SherlockStreamPersister>;
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "slab_replay_data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+  {
+    PersistedStorage master_storage(persistence_file_name);
+    const auto result = master_storage.ReadWriteTransaction([](MutableFields<PersistedStorage> fields) {
+      for (int i = 0; i < 200; ++i) {
+        fields.umany_to_umany.Add(Cell{0, "x", i});
+      }
+      EXPECT_EQ(200u, fields.umany_to_umany.EntryAllocatorStats().entries);
+      EXPECT_LT(1u, fields.umany_to_umany.EntryAllocatorStats().slabs);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+  {
+    PersistedStorage replayed_storage(persistence_file_name);
+    const auto result = replayed_storage.ReadOnlyTransaction([](ImmutableFields<PersistedStorage> fields) {
+      EXPECT_EQ(1u, fields.umany_to_umany.Size());
+      EXPECT_EQ(199, Value(fields.umany_to_umany.Get(0, "x")).phew);
+      // Overwriting an entry reuses its memory.
+      const auto stats = fields.umany_to_umany.EntryAllocatorStats();
+      EXPECT_EQ(1u, stats.entries);
+      EXPECT_EQ(64u, stats.capacity);
+      EXPECT_EQ(1u, stats.slabs);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+}
+
+TEST(TransactionalStorage, UndoLogRestoresEntries) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  current::time::SetNow(std::chrono::microseconds(100));
+  {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Add(Record{"one", 1});
+      fields.d.Add(Record{"two", 2});
+      fields.umany_to_umany.Add(Cell{1, "one", 1});
+      fields.uone_to_uone.Add(Cell{1, "one", 1});
+      fields.uone_to_umany.Add(Cell{1, "one", 1});
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+
+  current::time::SetNow(std::chrono::microseconds(200));
+  for (int i = 0; i < 3; ++i) {
+    const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      // Re-adding an entry passed by a reference to itself.
+      fields.d.Add(Value(fields.d["one"]));
+      fields.umany_to_umany.Add(Value(fields.umany_to_umany.Get(1, "one")));
+      EXPECT_EQ(1, Value(fields.d["one"]).rhs);
+      EXPECT_EQ(1, Value(fields.umany_to_umany.Get(1, "one")).phew);
+      fields.d.Add(Record{"one", 100});
+      fields.d.Erase("two");
+      fields.d.Add(Record{"three", 3});
+      fields.umany_to_umany.Add(Cell{1, "one", 100});
+      fields.umany_to_umany.Erase(1, "one");
+      fields.uone_to_uone.Add(Cell{2, "one", 2});  // Evicts `{1, "one"}`.
+      fields.uone_to_umany.Add(Cell{2, "one", 2});  // Evicts `{1, "one"}`.
+      EXPECT_FALSE(Exists(fields.uone_to_uone.Get(1, "one")));
+      EXPECT_FALSE(Exists(fields.uone_to_umany.Get(1, "one")));
+      CURRENT_STORAGE_THROW_ROLLBACK();
+    }).Go();
+    EXPECT_FALSE(WasCommitted(result));
+  }
+
+  {
+    const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(2u, fields.d.Size());
+      EXPECT_EQ(1, Value(fields.d["one"]).rhs);
+      EXPECT_EQ(2, Value(fields.d["two"]).rhs);
+      EXPECT_FALSE(Exists(fields.d["three"]));
+      EXPECT_FALSE(Exists(fields.d.LastModified("three")));
+      EXPECT_EQ(100, Value(fields.d.LastModified("one")).count());
+      EXPECT_EQ(1, Value(fields.umany_to_umany.Get(1, "one")).phew);
+      EXPECT_EQ(1u, fields.umany_to_umany.Row(1).Size());
+      EXPECT_EQ(1, Value(fields.uone_to_uone.GetEntryFromCol("one")).phew);
+      EXPECT_FALSE(Exists(fields.uone_to_uone.Get(2, "one")));
+      EXPECT_EQ(1, Value(fields.uone_to_umany.GetEntryFromCol("one")).phew);
+      EXPECT_EQ(1u, fields.uone_to_umany.EntryAllocatorStats().entries);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+}
+
+TEST(TransactionalStorage, ShardedStorage) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockStreamPersister>;
+  using sharded_t = current::storage::ShardedStorage<Storage>;
+
+  const std::string base_file_name = current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "data");
+  EXPECT_THROW(sharded_t(0u, base_file_name), current::storage::StorageShardsCountException);
+  std::vector<current::FileSystem::ScopedRmFile> persistence_file_removers;
+  persistence_file_removers.reserve(4u);
+  for (size_t i = 0u; i < 4u; ++i) {
+    persistence_file_removers.emplace_back(sharded_t::ShardFileName(base_file_name, i, 4u));
+  }
+
+  const auto sum_sizes = [](size_t& total, size_t shard_size) { total += shard_size; };
+
+  {
+    sharded_t sharded(4u, base_file_name);
+    EXPECT_EQ(4u, sharded.ShardsCount());
+
+    for (int i = 0; i < 100; ++i) {
+      const std::string key = current::ToString(i);
+      const auto result = sharded.ReadWriteTransaction(key, [&key, i](MutableFields<Storage> fields) {
+        fields.d.Add(Record{key, i});
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+
+    // Each record lives in its own shard only.
+    for (size_t shard = 0u; shard < sharded.ShardsCount(); ++shard) {
+      const auto result = sharded.Shard(shard).ReadOnlyTransaction([&sharded, shard](ImmutableFields<Storage> fields) {
+        EXPECT_FALSE(fields.d.Empty());
+        for (const auto& record : fields.d) {
+          EXPECT_EQ(shard, sharded.ShardIndex(record.lhs));
+        }
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+
+    const auto sizes = sharded.ReadOnlyFanOut([](ImmutableFields<Storage> fields) { return fields.d.Size(); });
+    ASSERT_EQ(4u, sizes.size());
+    EXPECT_EQ(100u, sharded.ReadOnlyFanOut([](ImmutableFields<Storage> fields) { return fields.d.Size(); },
+                                           size_t(0u),
+                                           sum_sizes));
+
+    // The exception from any shard is propagated.
+    EXPECT_THROW(sharded.ReadOnlyFanOut([](ImmutableFields<Storage>) -> int { CURRENT_THROW(current::Exception()); }),
+                 current::Exception);
+
+    // Transactions on different shards run in parallel: the one on shard A waits for the one on shard B to complete.
+    std::string key_a = "0";
+    std::string key_b;
+    for (int i = 1; key_b.empty(); ++i) {
+      if (sharded.ShardIndex(current::ToString(i)) != sharded.ShardIndex(key_a)) {
+        key_b = current::ToString(i);
+      }
+    }
+    std::atomic_bool b_done(false);
+    std::thread thread_a([&sharded, &key_a, &b_done]() {
+      const auto result = sharded.ReadWriteTransaction(key_a, [&b_done](MutableFields<Storage> fields) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!b_done && std::chrono::steady_clock::now() < deadline) {
+          std::this_thread::yield();
+        }
+        EXPECT_TRUE(b_done);
+        fields.d.Add(Record{"a", 1});
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    });
+    {
+      const auto result = sharded.ReadWriteTransaction(key_b, [&key_b](MutableFields<Storage> fields) {
+        fields.d.Erase(key_b);
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+      b_done = true;
+    }
+    thread_a.join();
+  }
+
+  // Each shard replays its own stream.
+  {
+    sharded_t sharded(4u, base_file_name);
+    EXPECT_EQ(100u, sharded.ReadOnlyFanOut([](ImmutableFields<Storage> fields) { return fields.d.Size(); },
+                                           size_t(0u),
+                                           sum_sizes));
+    const auto result = sharded.ReadOnlyTransaction(std::string("42"), [](ImmutableFields<Storage> fields) {
+      return Value(fields.d["42"]).rhs;
+    }).Go();
+    EXPECT_EQ(42, Value(result));
+  }
+
+  // The default routing does not depend on the standard library.
+  EXPECT_EQ(0x07ee7e07b4b19223ull, current::storage::StableHashShardRouter()(std::string("42")));
+  EXPECT_EQ(0xff3add6b3789daefull, current::storage::StableHashShardRouter()(42));
+
+  // The keys can be routed by a function of them instead.
+  {
+    struct RouteByFirstDigit {
+      uint64_t operator()(const std::string& key) const { return static_cast<uint64_t>(key[0] - '0'); }
+    };
+    current::storage::ShardedStorage<TestStorage<SherlockInMemoryStreamPersister>, RouteByFirstDigit> by_digit(4u);
+    EXPECT_EQ(1u, by_digit.ShardIndex(std::string("1x")));
+    EXPECT_EQ(3u, by_digit.ShardIndex(std::string("7")));
+  }
+}
+
 TEST(TransactionalStorage, WaitUntilLocalLogIsReplayed) {
   current::time::ResetToZero();
 
@@ -3242,4 +3505,1419 @@ TEST(TransactionalStorage, FollowingStorageFlipsToMaster) {
   }
 }
 
+namespace transactional_storage_test {
+
+CURRENT_STRUCT(Employee) {
+  CURRENT_FIELD(key, std::string);
+  CURRENT_FIELD(team, std::string);
+  CURRENT_FIELD(badge, int32_t);
+  CURRENT_CONSTRUCTOR(Employee)(const std::string& key = "", const std::string& team = "", int32_t badge = 0)
+      : key(key), team(team), badge(badge) {}
+};
+
+CURRENT_STORAGE_INDEX(OrderedMulti, Employee, team, EmployeeByTeam);
+CURRENT_STORAGE_INDEX(UnorderedUnique, Employee, badge, EmployeeByBadge);
+CURRENT_STORAGE_INDEXED_FIELD_ENTRY(UnorderedDictionary, Employee, EmployeeDictionary, EmployeeByTeam, EmployeeByBadge);
+
+CURRENT_STORAGE(IndexedStorage) { CURRENT_STORAGE_FIELD(employee, EmployeeDictionary); };
+
+template <typename INDEX>
+std::string EmployeeKeysByIndex(const INDEX& index, const typename INDEX::index_key_t& value) {
+  std::vector<std::string> keys;
+  index.ForEachEntry(value, [&keys](const Employee& e) { keys.push_back(e.key); });
+  return current::strings::Join(keys, ',');
+}
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, SecondaryIndexes) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = IndexedStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  {
+    Storage storage(persistence_file_name);
+
+    current::time::SetNow(std::chrono::microseconds(100));
+    {
+      const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        fields.employee.Add(Employee("alice", "eng", 1));
+        fields.employee.Add(Employee("bob", "eng", 2));
+        fields.employee.Add(Employee("carol", "ops", 3));
+        // Overwriting an entry keeps its own unique index value available to it.
+        fields.employee.Add(Employee("carol", "sales", 3));
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+
+    // A unique index violation throws and rolls back the whole transaction.
+    current::time::SetNow(std::chrono::microseconds(200));
+    {
+      auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        fields.employee.Add(Employee("dave", "eng", 4));
+        fields.employee.Add(Employee("eve", "eng", 1));
+      });
+      EXPECT_THROW(result.Go(), current::storage::StorageUniqueIndexViolationException);
+    }
+
+    // A user-initiated rollback restores the indexes as well.
+    current::time::SetNow(std::chrono::microseconds(300));
+    {
+      const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        fields.employee.Erase("alice");
+        fields.employee.Add(Employee("bob", "ops", 5));
+        CURRENT_STORAGE_THROW_ROLLBACK();
+      }).Go();
+      EXPECT_FALSE(WasCommitted(result));
+    }
+
+    current::time::SetNow(std::chrono::microseconds(400));
+    {
+      const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+        const auto& by_team = fields.employee.Index<EmployeeByTeam>();
+        const auto& by_badge = fields.employee.Index<EmployeeByBadge>();
+        EXPECT_EQ(2u, by_team.Size());
+        EXPECT_EQ(3u, by_badge.Size());
+        EXPECT_EQ("alice,bob", EmployeeKeysByIndex(by_team, "eng"));
+        EXPECT_EQ("carol", EmployeeKeysByIndex(by_team, "sales"));
+        EXPECT_FALSE(by_team.Has("ops"));
+        ASSERT_TRUE(Exists(by_badge[2]));
+        EXPECT_EQ("bob", Value(by_badge[2]).key);
+        EXPECT_FALSE(Exists(by_badge[4]));
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+
+    current::time::SetNow(std::chrono::microseconds(500));
+    {
+      const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        fields.employee.Erase("alice");
+        fields.employee.Add(Employee("bob", "ops", 6));
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+  }
+
+  // The indexes are rebuilt on replay.
+  {
+    Storage replayed(persistence_file_name);
+    const auto result = replayed.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      const auto& by_team = fields.employee.Index<EmployeeByTeam>();
+      const auto& by_badge = fields.employee.Index<EmployeeByBadge>();
+      EXPECT_FALSE(by_team.Has("eng"));
+      EXPECT_EQ("bob", EmployeeKeysByIndex(by_team, "ops"));
+      EXPECT_EQ("carol", EmployeeKeysByIndex(by_team, "sales"));
+      EXPECT_EQ(2u, by_badge.Size());
+      EXPECT_FALSE(Exists(by_badge[1]));
+      EXPECT_FALSE(Exists(by_badge[2]));
+      ASSERT_TRUE(Exists(by_badge[6]));
+      EXPECT_EQ("bob", Value(by_badge[6]).key);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+
+    const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+    auto rest = RESTfulStorage<Storage>(
+        replayed, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+    {
+      const auto response = HTTP(GET(base_url + "/api/data/employee.by_team/ops"));
+      EXPECT_EQ(200, static_cast<int>(response.code));
+      const auto employees = ParseJSON<std::vector<Employee>>(response.body);
+      ASSERT_EQ(1u, employees.size());
+      EXPECT_EQ("bob", employees[0].key);
+    }
+    {
+      const auto response = HTTP(GET(base_url + "/api/data/employee.by_badge/3"));
+      EXPECT_EQ(200, static_cast<int>(response.code));
+      EXPECT_EQ("carol", ParseJSON<std::vector<Employee>>(response.body)[0].key);
+    }
+    {
+      const auto response = HTTP(GET(base_url + "/api/data/employee.by_team/eng"));
+      EXPECT_EQ(200, static_cast<int>(response.code));
+      EXPECT_EQ("[]", response.body.substr(0, 2));
+    }
+  }
+}
+
+TEST(TransactionalStorage, FlatContainer) {
+  using flat_t = current::storage::container::Flat<std::string, int>;
+
+  flat_t flat;
+  std::unordered_map<std::string, int> golden;
+  std::unordered_map<std::string, const int*> addresses;
+
+  std::mt19937 rng(42);
+  for (int i = 0; i < 20000; ++i) {
+    const std::string key = current::ToString(rng() % 1000);
+    if (rng() % 3) {
+      const int value = static_cast<int>(rng() % 100);
+      const auto result = flat.emplace(key, value);
+      if (result.second) {
+        addresses[key] = &result.first->second;
+      } else {
+        result.first->second = value;
+      }
+      golden[key] = value;
+    } else {
+      EXPECT_EQ(golden.erase(key), flat.erase(key));
+      addresses.erase(key);
+    }
+    ASSERT_EQ(golden.size(), flat.size());
+  }
+
+  for (const auto& e : golden) {
+    const auto cit = flat.find(e.first);
+    ASSERT_TRUE(cit != flat.end());
+    EXPECT_EQ(e.second, cit->second);
+    // The values never move as long as they are in the container.
+    EXPECT_EQ(addresses[e.first], &cit->second);
+  }
+  size_t count = 0u;
+  for (const auto& e : flat) {
+    ++count;
+    EXPECT_EQ(golden[e.first], e.second);
+  }
+  EXPECT_EQ(golden.size(), count);
+  EXPECT_TRUE(flat.find("nope") == flat.end());
+  EXPECT_LT(flat.AverageProbeLength(), 4.0);
+
+  // Erase by iterator while iterating.
+  for (auto it = flat.begin(); it != flat.end();) {
+    if (it->second % 2) {
+      it = flat.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (const auto& e : flat) {
+    EXPECT_EQ(0, e.second % 2);
+  }
+
+  flat_t copy(flat);
+  EXPECT_EQ(flat.size(), copy.size());
+  flat.clear();
+  EXPECT_TRUE(flat.empty());
+  EXPECT_FALSE(copy.empty());
+  flat["x"] = 1;
+  ++flat["x"];
+  EXPECT_EQ(2, flat["x"]);
+}
+
+TEST(TransactionalStorage, FlatContainerStridedIntegerKeys) {
+  // `CurrentHashFunction` is the identity for integers, so the keys below would all share their low bits unmixed.
+  current::storage::container::Flat<uint64_t, uint64_t> flat;
+  for (uint64_t i = 0u; i < 100000u; ++i) {
+    flat.emplace(i * 1024u, i);
+  }
+  EXPECT_EQ(100000u, flat.size());
+  EXPECT_LT(flat.AverageProbeLength(), 4.0);
+  for (uint64_t i = 0u; i < 100000u; i += 997u) {
+    const auto cit = flat.find(i * 1024u);
+    ASSERT_TRUE(cit != flat.end());
+    EXPECT_EQ(i, cit->second);
+  }
+  EXPECT_TRUE(flat.find(1u) == flat.end());
+  for (uint64_t i = 0u; i < 100000u; i += 2u) {
+    EXPECT_EQ(1u, flat.erase(i * 1024u));
+  }
+  EXPECT_EQ(50000u, flat.size());
+  EXPECT_LT(flat.AverageProbeLength(), 4.0);
+  EXPECT_EQ(1u, flat.count(1023u * 1024u));
+  EXPECT_EQ(0u, flat.count(1022u * 1024u));
+}
+
+namespace transactional_storage_test {
+
+CURRENT_STORAGE_FIELD_ENTRY(FlatDictionary, Record, FlatRecordDictionary);
+CURRENT_STORAGE(FlatStorage) { CURRENT_STORAGE_FIELD(d, FlatRecordDictionary); };
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, FlatDictionary) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = FlatStorage<SherlockStreamPersister>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  {
+    Storage storage(persistence_file_name);
+    {
+      std::string s;
+      storage(::current::storage::FieldNameAndTypeByIndex<0>(), CurrentStorageTestMagicTypesExtractor(s));
+      EXPECT_EQ("d, FlatDictionary, Record", s);
+    }
+
+    current::time::SetNow(std::chrono::microseconds(100));
+    {
+      const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        for (int i = 0; i < 100; ++i) {
+          fields.d.Add(Record{current::ToString(i), i});
+        }
+        fields.d.Erase("42");
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+
+    current::time::SetNow(std::chrono::microseconds(200));
+    {
+      const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        fields.d.Erase("1");
+        fields.d.Add(Record{"2", 200});
+        CURRENT_STORAGE_THROW_ROLLBACK();
+      }).Go();
+      EXPECT_FALSE(WasCommitted(result));
+    }
+
+    current::time::SetNow(std::chrono::microseconds(300));
+    {
+      const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+        EXPECT_EQ(99u, fields.d.Size());
+        EXPECT_FALSE(Exists(fields.d["42"]));
+        ASSERT_TRUE(Exists(fields.d.LastModified("42")));
+        EXPECT_EQ(100, Value(fields.d.LastModified("42")).count());
+        ASSERT_TRUE(Exists(fields.d["1"]));
+        EXPECT_EQ(2, Value(fields.d["2"]).rhs);
+        int sum = 0;
+        for (const auto& record : fields.d) {
+          sum += record.rhs;
+        }
+        EXPECT_EQ(99 * 100 / 2 - 42, sum);
+      }).Go();
+      EXPECT_TRUE(WasCommitted(result));
+    }
+  }
+
+  {
+    Storage replayed(persistence_file_name);
+    const auto result = replayed.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(99u, fields.d.Size());
+      EXPECT_FALSE(Exists(fields.d["42"]));
+      EXPECT_EQ(99, Value(fields.d["99"]).rhs);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+}
+
+TEST(TransactionalStorage, StreamedCollectionExport) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockStreamPersister>;
+  using transaction_t = typename Storage::transaction_t;
+  using sherlock_t = current::sherlock::Stream<transaction_t, current::persistence::File>;
+  using StreamReplicator = current::sherlock::StreamReplicator<sherlock_t>;
+
+  const std::string master_file_name = current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "master");
+  const auto master_file_remover = current::FileSystem::ScopedRmFile(master_file_name);
+  const std::string follower_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "follower");
+  const auto follower_file_remover = current::FileSystem::ScopedRmFile(follower_file_name);
+
+  sherlock_t follower_stream(follower_file_name);
+  auto replicator = std::make_unique<StreamReplicator>(follower_stream);
+  Storage master_storage(master_file_name);
+  Storage follower_storage(follower_stream);
+
+  // More than two batches of `kRESTfulStreamedCollectionBatchSize` entries.
+  const size_t n = 2500u;
+  current::time::SetNow(std::chrono::microseconds(100));
+  EXPECT_TRUE(WasCommitted(master_storage.ReadWriteTransaction([n](MutableFields<Storage> fields) {
+    for (size_t i = 0u; i < n; ++i) {
+      fields.user.Add(SimpleUser(current::strings::Printf("%05d", static_cast<int>(i)), "User"));
+      fields.like.Add(SimpleLike(current::strings::Printf("%05d", static_cast<int>(i)), "beer"));
+    }
+  }).Go()));
+
+  const auto replicator_scope = master_storage.InternalExposeStream().template Subscribe<transaction_t>(*replicator);
+  while (Value(follower_storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+    return fields.user.Size();
+  }).Go()) != n) {
+    std::this_thread::yield();
+  }
+
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  const auto master_rest = RESTfulStorage<Storage>(master_storage, FLAGS_transactional_storage_test_port, "/plain", "");
+  const auto master_simple_rest = RESTfulStorage<Storage, current::storage::rest::Simple>(
+      master_storage, FLAGS_transactional_storage_test_port, "/master", "");
+  const auto follower_simple_rest = RESTfulStorage<Storage, current::storage::rest::Simple>(
+      follower_storage, FLAGS_transactional_storage_test_port, "/follower", "");
+
+  const auto split_lines = [](const std::string& body) {
+    return current::strings::Split(body, '\n', current::strings::EmptyFields::Keep);
+  };
+
+  // The plain full field view is streamed in chunks.
+  {
+    const auto result = HTTP(GET(base_url + "/plain/data/user"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    const auto lines = split_lines(result.body);
+    ASSERT_EQ(n + 1u, lines.size());
+    EXPECT_EQ("00000\t{\"key\":\"00000\",\"name\":\"User\"}", lines.front());
+    EXPECT_EQ("02499\t{\"key\":\"02499\",\"name\":\"User\"}", lines[n - 1u]);
+    EXPECT_EQ("", lines.back());
+  }
+
+  // So are the plain matrix rows and cols, and the lists of them.
+  {
+    const auto result = HTTP(GET(base_url + "/plain/data/like.col/beer"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    const auto lines = split_lines(result.body);
+    ASSERT_EQ(n + 1u, lines.size());
+    std::set<std::string> keys;
+    for (size_t i = 0u; i < n; ++i) {
+      keys.insert(ParseJSON<SimpleLike>(lines[i]).row);
+    }
+    EXPECT_EQ(n, keys.size());
+    EXPECT_EQ("", lines.back());
+  }
+  EXPECT_EQ("beer\t2500\n", HTTP(GET(base_url + "/plain/data/like.col")).body);
+  {
+    const auto result = HTTP(GET(base_url + "/plain/data/like.row"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    const auto lines = split_lines(result.body);
+    ASSERT_EQ(n + 1u, lines.size());
+    EXPECT_EQ("", lines.back());
+  }
+  EXPECT_EQ(404, static_cast<int>(HTTP(GET(base_url + "/plain/data/like.row/nobody")).code));
+
+  // Export is only available off the follower.
+  EXPECT_EQ(403, static_cast<int>(HTTP(GET(base_url + "/master/data/user?export")).code));
+
+  {
+    const auto result = HTTP(GET(base_url + "/follower/data/user?export"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    const auto lines = split_lines(result.body);
+    ASSERT_EQ(n + 1u, lines.size());
+    std::set<std::string> keys;
+    for (size_t i = 0u; i < n; ++i) {
+      keys.insert(ParseJSON<SimpleUser>(lines[i]).key);
+    }
+    EXPECT_EQ(n, keys.size());
+  }
+
+  {
+    std::set<std::string> keys;
+    size_t total = 0u;
+    for (int shard = 0; shard < 3; ++shard) {
+      const auto result =
+          HTTP(GET(base_url + current::strings::Printf("/follower/data/user?export&nshards=3&shard=%d", shard)));
+      EXPECT_EQ(200, static_cast<int>(result.code));
+      for (const auto& line : current::strings::Split(result.body, '\n')) {
+        keys.insert(ParseJSON<SimpleUser>(line).key);
+        ++total;
+      }
+    }
+    EXPECT_EQ(n, total);
+    EXPECT_EQ(n, keys.size());
+  }
+
+  {
+    const auto result = HTTP(GET(base_url + "/follower/data/user?export=detailed"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    ASSERT_GE(result.body.length(), 4u);
+    EXPECT_EQ("[{", result.body.substr(0u, 2u));
+    EXPECT_EQ("}]\n", result.body.substr(result.body.length() - 3u));
+    size_t separators = 0u;
+    for (size_t i = result.body.find("},{"); i != std::string::npos; i = result.body.find("},{", i + 1u)) {
+      ++separators;
+    }
+    EXPECT_EQ(n - 1u, separators);
+  }
+}
+
+TEST(TransactionalStorage, RESTfulBatchEndpoints) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  const auto& persister = storage.InternalExposeStream().Persister();
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  const auto rest = RESTfulStorage<Storage, current::storage::rest::Hypermedia>(
+      storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+
+  // Bulk upsert, as a single transaction.
+  current::time::SetNow(std::chrono::microseconds(100));
+  {
+    std::vector<SimpleUser> users;
+    for (int i = 0; i < 500; ++i) {
+      users.emplace_back(current::strings::Printf("u%03d", i), "User");
+    }
+    const auto result = HTTP(PUT(base_url + "/api/data/user.bulk", JSON(users)));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    EXPECT_EQ("{\"created\":500,\"updated\":0}\n", result.body);
+  }
+  EXPECT_EQ(1u, persister.Size());
+  {
+    current::time::SetNow(std::chrono::microseconds(200));
+    const auto result =
+        HTTP(PUT(base_url + "/api/data/user.bulk",
+                 JSON(std::vector<SimpleUser>({SimpleUser("u000", "Updated"), SimpleUser("u999", "New")}))));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    EXPECT_EQ("{\"created\":1,\"updated\":1}\n", result.body);
+  }
+  EXPECT_EQ(2u, persister.Size());
+
+  EXPECT_EQ(405, static_cast<int>(HTTP(POST(base_url + "/api/data/user.bulk", "[]")).code));
+  EXPECT_EQ(400, static_cast<int>(HTTP(PUT(base_url + "/api/data/user.bulk", "[{\"bad\":")).code));
+
+  // Multi-get, only the entries found are returned, in the order of the keys.
+  {
+    const auto result = HTTP(POST(base_url + "/api/data/user.multiget", "[\"u999\",\"nope\",\"u000\",\"u123\"]"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    const auto users = ParseJSON<std::vector<SimpleUser>>(result.body);
+    ASSERT_EQ(3u, users.size());
+    EXPECT_EQ("New", users[0].name);
+    EXPECT_EQ("Updated", users[1].name);
+    EXPECT_EQ("u123", users[2].key);
+    EXPECT_EQ("User", users[2].name);
+  }
+  EXPECT_EQ(405, static_cast<int>(HTTP(GET(base_url + "/api/data/user.multiget")).code));
+  EXPECT_EQ(400, static_cast<int>(HTTP(POST(base_url + "/api/data/user.multiget", "{}")).code));
+
+  // Matrix keys are `[row, col]` pairs.
+  {
+    current::time::SetNow(std::chrono::microseconds(300));
+    const auto result = HTTP(PUT(base_url + "/api/data/like.bulk",
+                                 JSON(std::vector<SimpleLike>({SimpleLike("u000", "p1"), SimpleLike("u001", "p2")}))));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    EXPECT_EQ("{\"created\":2,\"updated\":0}\n", result.body);
+  }
+  {
+    const auto result = HTTP(POST(base_url + "/api/data/like.multiget", "[[\"u001\",\"p2\"],[\"u001\",\"p1\"]]"));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    const auto likes = ParseJSON<std::vector<SimpleLike>>(result.body);
+    ASSERT_EQ(1u, likes.size());
+    EXPECT_EQ("u001", likes[0].row);
+    EXPECT_EQ("p2", likes[0].col);
+  }
+}
+
+TEST(TransactionalStorage, RESTfulConditionalGET) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  const auto plain_rest = RESTfulStorage<Storage>(storage, FLAGS_transactional_storage_test_port, "/plain", "");
+  const auto rest = RESTfulStorage<Storage, current::storage::rest::Hypermedia>(
+      storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+
+  const auto conditional_get_code =
+      [&base_url](const std::string& path, const std::string& header, const std::string& value) {
+        return static_cast<int>(HTTP(GET(base_url + path).SetHeader(header, value)).code);
+      };
+
+  current::time::SetNow(std::chrono::microseconds(1000000));
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.user.Add(SimpleUser("max", "MZ"));
+  }).Go()));
+  current::time::SetNow(std::chrono::microseconds(5000000));
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.user.Add(SimpleUser("dima", "DK"));
+  }).Go()));
+
+  for (const std::string prefix : {"/plain", "/api"}) {
+    // The `ETag` of an entry is its last modified timestamp.
+    {
+      const auto result = HTTP(GET(base_url + prefix + "/data/user/max"));
+      EXPECT_EQ(200, static_cast<int>(result.code));
+      ASSERT_TRUE(result.headers.Has("ETag"));
+      EXPECT_EQ("\"1000000\"", result.headers.Get("ETag"));
+      ASSERT_TRUE(result.headers.Has("Last-Modified"));
+      EXPECT_EQ("Thu, 01 Jan 1970 00:00:01 GMT", result.headers.Get("Last-Modified"));
+    }
+    {
+      const auto result = HTTP(GET(base_url + prefix + "/data/user/max").SetHeader("If-None-Match", "\"1000000\""));
+      EXPECT_EQ(304, static_cast<int>(result.code));
+      EXPECT_EQ("", result.body);
+      EXPECT_EQ("\"1000000\"", result.headers.Get("ETag"));
+    }
+    EXPECT_EQ(304, conditional_get_code(prefix + "/data/user/max", "If-None-Match", "\"1\", W/\"1000000\""));
+    EXPECT_EQ(200, conditional_get_code(prefix + "/data/user/max", "If-None-Match", "\"1\""));
+    EXPECT_EQ(304,
+              conditional_get_code(prefix + "/data/user/max", "If-Modified-Since", "Thu, 01 Jan 1970 00:00:01 GMT"));
+    EXPECT_EQ(200,
+              conditional_get_code(prefix + "/data/user/dima", "If-Modified-Since", "Thu, 01 Jan 1970 00:00:01 GMT"));
+    // No `304` for the resources which do not exist.
+    EXPECT_EQ(404, conditional_get_code(prefix + "/data/user/nope", "If-None-Match", "*"));
+
+    // The `ETag` of a collection is the most recent modification timestamp of its entries.
+    {
+      const auto result = HTTP(GET(base_url + prefix + "/data/user"));
+      EXPECT_EQ(200, static_cast<int>(result.code));
+      EXPECT_EQ("\"5000000\"", result.headers.Get("ETag"));
+    }
+    EXPECT_EQ(304, conditional_get_code(prefix + "/data/user", "If-None-Match", "\"5000000\""));
+  }
+
+  // Deleting an entry changes the `ETag` of the collection.
+  current::time::SetNow(std::chrono::microseconds(7000000));
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.user.Erase("dima");
+  }).Go()));
+  {
+    const auto result = HTTP(GET(base_url + "/api/data/user").SetHeader("If-None-Match", "\"5000000\""));
+    EXPECT_EQ(200, static_cast<int>(result.code));
+    EXPECT_EQ("\"7000000\"", result.headers.Get("ETag"));
+  }
+  // The entry that was not touched is still not modified.
+  EXPECT_EQ(304, conditional_get_code("/api/data/user/max", "If-None-Match", "\"1000000\""));
+
+  // A rolled back transaction leaves the `ETag`-s of the collections as they were, for matrices too.
+  current::time::SetNow(std::chrono::microseconds(8000000));
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.like.Add(SimpleLike("max", "beer"));
+  }).Go()));
+  current::time::SetNow(std::chrono::microseconds(9000000));
+  EXPECT_FALSE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.user.Add(SimpleUser("dima", "DK"));
+    fields.user.Add(SimpleUser("max", "MZ"));
+    fields.user.Erase("max");
+    fields.like.Add(SimpleLike("max", "wine"));
+    fields.like.Add(SimpleLike("max", "beer", "Updated."));
+    fields.like.Erase("max", "beer");
+    fields.composite_o2o.Add(SimpleComposite("x", std::chrono::microseconds(1)));
+    fields.composite_o2m.Add(SimpleComposite("x", std::chrono::microseconds(1)));
+    fields.composite_m2m.Add(SimpleComposite("x", std::chrono::microseconds(1)));
+    CURRENT_STORAGE_THROW_ROLLBACK();
+  }).Go()));
+  EXPECT_EQ(304, conditional_get_code("/api/data/user", "If-None-Match", "\"7000000\""));
+  EXPECT_EQ(304, conditional_get_code("/api/data/like", "If-None-Match", "\"8000000\""));
+  EXPECT_EQ("0,0,0",
+            Value(storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+              return current::strings::Join(
+                  std::vector<std::string>{current::ToString(fields.composite_o2o.FieldLastModified().count()),
+                                           current::ToString(fields.composite_o2m.FieldLastModified().count()),
+                                           current::ToString(fields.composite_m2m.FieldLastModified().count())},
+                  ',');
+            }).Go()));
+}
+
+TEST(TransactionalStorage, RESTfulKeysetPagination) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockInMemoryStreamPersister>;
+  using collection_t = current::storage::rest::hypermedia::HypermediaRESTCollectionResponse<
+      current::storage::rest::hypermedia::HypermediaRESTFullCollectionRecord<SimpleUser>>;
+
+  Storage storage;
+  const auto base_url = current::strings::Printf("http://localhost:%d", FLAGS_transactional_storage_test_port);
+  const auto rest = RESTfulStorage<Storage, current::storage::rest::Hypermedia>(
+      storage, FLAGS_transactional_storage_test_port, "/api", "http://unittest.current.ai");
+
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    for (int i = 0; i < 25; ++i) {
+      fields.user.Add(SimpleUser(current::strings::Printf("u%02d", i), "User"));
+    }
+  }).Go()));
+
+  const auto get_page = [&base_url](const std::string& url) {
+    const std::string prefix = "http://unittest.current.ai";
+    EXPECT_EQ(prefix, url.substr(0u, prefix.length()));
+    const auto response = HTTP(GET(base_url + "/api" + url.substr(prefix.length())));
+    EXPECT_EQ(200, static_cast<int>(response.code)) << response.body;
+    return ParseJSON<collection_t>(response.body);
+  };
+  const auto keys = [](const collection_t& page) {
+    std::vector<std::string> result;
+    for (const auto& record : page.data) {
+      result.push_back(record.data.key);
+    }
+    return current::strings::Join(result, ',');
+  };
+
+  // The first page, requested by offset, links to the next one by cursor.
+  const auto page1 = get_page("http://unittest.current.ai/data/user?n=10");
+  EXPECT_EQ(0u, page1.i);
+  EXPECT_EQ(10u, page1.n);
+  EXPECT_EQ(25u, page1.total);
+  EXPECT_EQ("u00,u01,u02,u03,u04,u05,u06,u07,u08,u09", keys(page1));
+  EXPECT_FALSE(Exists(page1.url_previous_page));
+  ASSERT_TRUE(Exists(page1.url_next_page));
+  EXPECT_NE(std::string::npos, Value(page1.url_next_page).find("?cursor="));
+
+  const auto page2 = get_page(Value(page1.url_next_page));
+  EXPECT_EQ(10u, page2.i);
+  EXPECT_EQ(10u, page2.n);
+  EXPECT_EQ("u10,u11,u12,u13,u14,u15,u16,u17,u18,u19", keys(page2));
+  EXPECT_EQ(Value(page1.url_next_page), page2.url);
+  ASSERT_TRUE(Exists(page2.url_previous_page));
+  EXPECT_EQ("http://unittest.current.ai/data/user?i=0&n=10", Value(page2.url_previous_page));
+  ASSERT_TRUE(Exists(page2.url_next_page));
+
+  // The cursor is the key, so the entries removed or added before it do not shift the next page.
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    fields.user.Erase("u00");
+    fields.user.Erase("u20");
+    fields.user.Add(SimpleUser("a", "Added"));
+  }).Go()));
+  const auto page3 = get_page(Value(page2.url_next_page));
+  EXPECT_EQ(20u, page3.i);
+  EXPECT_EQ(4u, page3.n);
+  EXPECT_EQ(24u, page3.total);
+  EXPECT_EQ("u21,u22,u23,u24", keys(page3));
+  EXPECT_FALSE(Exists(page3.url_next_page));
+
+  // Invalid cursors.
+  const auto cursor_code = [&base_url](const std::string& cursor) {
+    return static_cast<int>(HTTP(GET(base_url + "/api/data/user?cursor=" + cursor)).code);
+  };
+  EXPECT_EQ(400, cursor_code("!"));
+  EXPECT_EQ(400, cursor_code(current::Base64URLEncode("x:\"u10\"")));
+  EXPECT_EQ(400, cursor_code(current::Base64URLEncode("10:u10")));
+  EXPECT_EQ(200, cursor_code(current::Base64URLEncode("10:\"u10\"")));
+
+  // The container cursors themselves.
+  EXPECT_EQ("u22",
+            Value(storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+              return fields.user.Seek(fields.user.Cursor(fields.user.Seek("\"u22\""))).key();
+            }).Go()));
+  EXPECT_EQ("u21",
+            Value(storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+              return fields.user.Seek("\"u20\"").key();
+            }).Go()));
+
+  // The unordered dictionaries are paginated bucket by bucket, until they are rehashed.
+  EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+    for (int i = 0; i < 15; ++i) {
+      fields.post.Add(SimplePost(current::strings::Printf("p%02d", i), "Post"));
+    }
+  }).Go()));
+  {
+    using post_collection_t = current::storage::rest::hypermedia::HypermediaRESTCollectionResponse<
+        current::storage::rest::hypermedia::HypermediaRESTFullCollectionRecord<SimplePost>>;
+    const std::string prefix = "http://unittest.current.ai";
+    const auto get_post_page = [&](const std::string& url) {
+      const auto response = HTTP(GET(base_url + "/api" + url.substr(prefix.length())));
+      EXPECT_EQ(200, static_cast<int>(response.code)) << response.body;
+      return ParseJSON<post_collection_t>(response.body);
+    };
+    const auto page1 = get_post_page(prefix + "/data/post?n=6");
+    ASSERT_EQ(6u, page1.data.size());
+    ASSERT_TRUE(Exists(page1.url_next_page));
+    EXPECT_NE(std::string::npos, Value(page1.url_next_page).find("?cursor="));
+    const auto page2 = get_post_page(Value(page1.url_next_page));
+    ASSERT_EQ(6u, page2.data.size());
+    EXPECT_EQ(6u, page2.i);
+    ASSERT_TRUE(Exists(page2.url_next_page));
+
+    // Erasing the entry the cursor points to resumes from its bucket; every surviving entry is seen exactly once.
+    const std::string boundary = page2.data.back().data.key;
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([&boundary](MutableFields<Storage> fields) {
+      fields.post.Erase(boundary);
+    }).Go()));
+    const auto page3 = get_post_page(Value(page2.url_next_page));
+    EXPECT_FALSE(Exists(page3.url_next_page));
+    std::set<std::string> seen;
+    for (const auto* page : {&page1, &page2, &page3}) {
+      for (const auto& record : page->data) {
+        EXPECT_TRUE(seen.insert(record.data.key).second) << record.data.key;
+      }
+    }
+    EXPECT_EQ(15u, seen.size());
+    EXPECT_EQ(3u, page3.data.size());
+
+    // Once the map is rehashed, the cursors issued before are rejected.
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      for (int i = 0; i < 1000; ++i) {
+        fields.post.Add(SimplePost(current::strings::Printf("q%03d", i), "Post"));
+      }
+    }).Go()));
+    const auto next = Value(page1.url_next_page);
+    EXPECT_EQ(400, static_cast<int>(HTTP(GET(base_url + "/api" + next.substr(prefix.length()))).code));
+  }
+  EXPECT_EQ(400,
+            static_cast<int>(
+                HTTP(GET(base_url + "/api/data/post?cursor=" + current::Base64URLEncode("10:\"p10\""))).code));
+}
+
+TEST(TransactionalStorage, ParallelReplay) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockStreamPersister>;
+  using stream_t = typename Storage::persister_t::sherlock_t;
+
+  // The entries are applied in order, regardless of the number of decoding threads.
+  {
+    std::vector<std::string> raw_entries;
+    for (int i = 0; i < 2000; ++i) {
+      raw_entries.push_back(current::ToString(i));
+    }
+    for (size_t threads : {1u, 3u, 8u}) {
+      std::vector<int> applied;
+      current::storage::persister::ReplayDecodingInParallel<int>(
+          raw_entries,
+          [](const std::string& s) { return current::FromString<int>(s); },
+          [&applied](int value) { applied.push_back(value); },
+          threads);
+      ASSERT_EQ(2000u, applied.size());
+      for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(i, applied[i]);
+      }
+    }
+
+    // The exception thrown while decoding is rethrown by the applying thread, past the entries applied before it.
+    size_t applied_count = 0u;
+    ASSERT_THROW(current::storage::persister::ReplayDecodingInParallel<int>(
+                     raw_entries,
+                     [](const std::string& s) {
+                       if (s == "1500") {
+                         CURRENT_THROW(current::Exception("Malformed."));
+                       }
+                       return current::FromString<int>(s);
+                     },
+                     [&applied_count](int) { ++applied_count; },
+                     4u),
+                 current::Exception);
+    EXPECT_EQ(1024u, applied_count);
+  }
+
+  const std::string storage_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "storage_data");
+  const auto storage_file_remover = current::FileSystem::ScopedRmFile(storage_file_name);
+  {
+    Storage master_storage(storage_file_name);
+    for (int i = 0; i < 1500; ++i) {
+      current::time::SetNow(std::chrono::microseconds(100 + i));
+      master_storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+        fields.d.Add(Record{current::ToString(i % 1000), i});
+      }).Go();
+    }
+  }
+
+  const auto check = [](const Storage& storage) {
+    const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(1000u, fields.d.Size());
+      ASSERT_TRUE(Exists(fields.d["0"]));
+      EXPECT_EQ(1000, Value(fields.d["0"]).rhs);
+      ASSERT_TRUE(Exists(fields.d["999"]));
+      EXPECT_EQ(999, Value(fields.d["999"]).rhs);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  };
+
+  // The master storage replays its own log.
+  {
+    Storage storage(storage_file_name);
+    EXPECT_EQ(1500u, storage.TransactionsCount());
+    check(storage);
+  }
+
+  // The following storage catches up with the existing log before it returns from the constructor.
+  {
+    stream_t stream(storage_file_name);
+    struct StreamPublisherOwner {
+      void AcceptPublisher(std::unique_ptr<stream_t::publisher_t>) {}
+    } stream_publisher_owner;
+    stream.MovePublisherTo(stream_publisher_owner);
+    Storage storage(stream);
+    EXPECT_EQ(1500u, storage.TransactionsCount());
+    check(storage);
+  }
+}
+
+TEST(TransactionalStorage, StreamCompaction) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = SimpleStorage<SherlockStreamPersister>;
+
+  const std::string storage_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "compaction_input");
+  const auto storage_file_remover = current::FileSystem::ScopedRmFile(storage_file_name);
+  const std::string compacted_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "compaction_output");
+  const auto compacted_file_remover = current::FileSystem::ScopedRmFile(compacted_file_name);
+  const std::string archive_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "compaction_archive");
+  const auto archive_file_remover = current::FileSystem::ScopedRmFile(archive_file_name);
+  const std::string online_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "compaction_online");
+  const auto online_file_remover = current::FileSystem::ScopedRmFile(online_file_name);
+
+  const auto check = [](const Storage& storage) {
+    const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(3u, fields.user.Size());
+      ASSERT_TRUE(Exists(fields.user["max"]));
+      EXPECT_EQ("MZ99", Value(fields.user["max"]).name);
+      EXPECT_TRUE(Exists(fields.user["dima"]));
+      EXPECT_TRUE(Exists(fields.user["grisha"]));
+      EXPECT_FALSE(Exists(fields.user["alice"]));
+      EXPECT_EQ(1u, fields.like.Size());
+      ASSERT_TRUE(Exists(fields.like.Get("dima", "beer")));
+      EXPECT_EQ("cold", Value(Value(fields.like.Get("dima", "beer")).details));
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  };
+
+  {
+    Storage storage(storage_file_name);
+    for (int i = 0; i < 100; ++i) {
+      current::time::SetNow(std::chrono::microseconds(100 + i));
+      EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+        fields.user.Add(SimpleUser("max", "MZ" + current::ToString(i)));
+      }).Go()));
+    }
+    current::time::SetNow(std::chrono::microseconds(1000));
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.user.Add(SimpleUser("dima", "DK"));
+      fields.user.Add(SimpleUser("alice", "A"));
+      fields.user.Add(SimpleUser("grisha", "GK"));
+      fields.like.Add(SimpleLike("dima", "beer", "warm"));
+      fields.like.Add(SimpleLike("max", "beer"));
+    }).Go()));
+    current::time::SetNow(std::chrono::microseconds(2000));
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.user.Erase("alice");
+      fields.like.Add(SimpleLike("dima", "beer", "cold"));
+      fields.like.Erase("max", "beer");
+    }).Go()));
+    check(storage);
+
+    // Online, from the stream of a running storage.
+    const auto stats = StorageStreamCompactor<Storage>::Compact(storage.InternalExposeStream(), online_file_name);
+    EXPECT_EQ(102u, stats.transactions_read);
+    EXPECT_EQ(108u, stats.mutations_read);
+    EXPECT_EQ(4u, stats.entries_written);
+    EXPECT_EQ(1u, stats.transactions_written);
+    EXPECT_EQ(0u, stats.mutations_archived);
+    EXPECT_EQ(1u, stats.key_partitions);
+  }
+
+  // Offline, from a file, in transactions of up to three entries, with the history archived.
+  // With at most two keys in memory, the six keys are split into at least four partitions.
+  current::storage::CompactionParams params;
+  params.transaction_size = 3u;
+  params.archive_file_name = archive_file_name;
+  params.max_keys_in_memory = 2u;
+  const auto stats = StorageStreamCompactor<Storage>::Compact(storage_file_name, compacted_file_name, params);
+  EXPECT_EQ(102u, stats.transactions_read);
+  EXPECT_EQ(108u, stats.mutations_read);
+  EXPECT_EQ(4u, stats.entries_written);
+  EXPECT_EQ(2u, stats.transactions_written);
+  EXPECT_EQ(104u, stats.mutations_archived);
+  EXPECT_LE(4u, stats.key_partitions);
+
+  {
+    Storage storage(compacted_file_name);
+    EXPECT_EQ(2u, storage.InternalExposeStream().Persister().Size());
+    check(storage);
+  }
+  {
+    Storage storage(online_file_name);
+    EXPECT_EQ(1u, storage.InternalExposeStream().Persister().Size());
+    check(storage);
+  }
+  {
+    Storage storage(archive_file_name);
+    EXPECT_EQ(101u, storage.InternalExposeStream().Persister().Size());
+  }
+}
+
+
+TEST(TransactionalStorage, Instrumentation) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+
+  Storage storage;
+  const auto add_and_look_up = [&storage]() {
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      for (int i = 0; i < 100; ++i) {
+        fields.d.Add(Record{current::ToString(i), i});
+        fields.umany_to_umany.Add(Cell{i, "x", i});
+      }
+      fields.d.Erase("0");
+    }).Go()));
+    EXPECT_TRUE(WasCommitted(storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_TRUE(Exists(fields.d["1"]));
+      EXPECT_FALSE(Exists(fields.d["0"]));
+      EXPECT_TRUE(Exists(fields.umany_to_umany.Get(1, "x")));
+    }).Go()));
+  };
+
+  // The sizes are always reported, the counters and the latencies only once the instrumentation is enabled.
+  add_and_look_up();
+  {
+    const auto stats = storage.Stats();
+    EXPECT_FALSE(stats.instrumented);
+    EXPECT_EQ(0u, stats.replayed_transactions_count);
+    ASSERT_EQ(static_cast<size_t>(Storage::FIELDS_COUNT), stats.fields.size());
+    EXPECT_EQ("d", stats.fields[0].name);
+    EXPECT_EQ("OrderedDictionary", stats.fields[0].container);
+    EXPECT_EQ(99u, stats.fields[0].entries);
+    EXPECT_LT(99u * sizeof(Record), stats.fields[0].approximate_bytes);
+    EXPECT_EQ(0u, stats.fields[0].adds);
+    EXPECT_EQ("umany_to_umany", stats.fields[1].name);
+    EXPECT_EQ("UnorderedManyToUnorderedMany", stats.fields[1].container);
+    EXPECT_EQ(100u, stats.fields[1].entries);
+    EXPECT_LT(100u * sizeof(Cell), stats.fields[1].approximate_bytes);
+    EXPECT_EQ(0u, stats.fields[2].entries);
+    EXPECT_EQ(0u, stats.transactions.body.count);
+  }
+
+  storage.EnableInstrumentation();
+  add_and_look_up();
+  {
+    const auto stats = storage.Stats();
+    EXPECT_TRUE(stats.instrumented);
+    EXPECT_EQ(100u, stats.fields[0].adds);
+    EXPECT_EQ(1u, stats.fields[0].erases);
+    EXPECT_EQ(2u, stats.fields[0].lookups);
+    EXPECT_EQ(100u, stats.fields[1].adds);
+    EXPECT_EQ(0u, stats.fields[1].erases);
+    EXPECT_EQ(1u, stats.fields[1].lookups);
+    EXPECT_EQ(0u, stats.fields[2].adds);
+    EXPECT_EQ(2u, stats.transactions.lock_wait.count);
+    EXPECT_EQ(2u, stats.transactions.body.count);
+    EXPECT_EQ(1u, stats.transactions.persist.count);
+    uint64_t total = 0u;
+    for (uint64_t bucket : stats.transactions.body.buckets) {
+      total += bucket;
+    }
+    EXPECT_EQ(2u, total);
+    EXPECT_GE(stats.transactions.body.total_us, stats.transactions.body.max_us);
+  }
+
+  // The collected values are kept, but no longer updated, once the instrumentation is disabled.
+  storage.EnableInstrumentation(false);
+  add_and_look_up();
+  storage.ExposeStatsViaHTTP(FLAGS_transactional_storage_test_port, "/stats");
+  {
+    const auto response =
+        HTTP(GET(current::strings::Printf("http://localhost:%d/stats", FLAGS_transactional_storage_test_port)));
+    EXPECT_EQ(200, static_cast<int>(response.code));
+    const auto stats = ParseJSON<current::storage::StorageStats>(response.body);
+    EXPECT_FALSE(stats.instrumented);
+    EXPECT_EQ(99u, stats.fields[0].entries);
+    EXPECT_EQ(100u, stats.fields[0].adds);
+    EXPECT_EQ(2u, stats.transactions.body.count);
+  }
+}
+
+
+TEST(TransactionalStorage, FollowerReadAtIndex) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockInMemoryStreamPersister>;
+  using transaction_t = typename Storage::transaction_t;
+  using stream_t = typename Storage::persister_t::sherlock_t;
+
+  Storage master_storage;
+  EXPECT_EQ(0u, master_storage.CurrentStreamPosition().next_index);
+  EXPECT_EQ(-1, master_storage.CurrentStreamPosition().last_us.count());
+  for (int i = 1; i <= 3; ++i) {
+    current::time::SetNow(std::chrono::microseconds(i * 100));
+    master_storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+      fields.d.Add(Record{current::ToString(i), i});
+    }).Go();
+  }
+  const auto master_position = master_storage.CurrentStreamPosition();
+  EXPECT_EQ(3u, master_position.next_index);
+  EXPECT_LT(200, master_position.last_us.count());
+
+  // The master has applied what it has published.
+  EXPECT_TRUE(WasCommitted(master_storage.ReadOnlyTransactionAtIndex(master_position,
+                                                                     std::chrono::microseconds(0),
+                                                                     [](ImmutableFields<Storage> fields) {
+                                                                       EXPECT_TRUE(Exists(fields.d["3"]));
+                                                                     }).Go()));
+
+  // The follower is fed the same transactions by hand.
+  stream_t follower_stream;
+  struct StreamPublisherOwner {
+    std::unique_ptr<stream_t::publisher_t> publisher;
+    void AcceptPublisher(std::unique_ptr<stream_t::publisher_t> value) { publisher = std::move(value); }
+  } stream_publisher_owner;
+  follower_stream.MovePublisherTo(stream_publisher_owner);
+  Storage follower_storage(follower_stream);
+  EXPECT_EQ(0u, follower_storage.CurrentStreamPosition().next_index);
+
+  std::vector<std::pair<transaction_t, std::chrono::microseconds>> transactions;
+  for (const auto& e : master_storage.InternalExposeStream().Persister().Iterate()) {
+    transactions.emplace_back(e.entry, e.idx_ts.us);
+  }
+  ASSERT_EQ(3u, transactions.size());
+
+  ASSERT_THROW(follower_storage.ReadOnlyTransactionAtIndex(0u,
+                                                           std::chrono::microseconds(1000),
+                                                           [](ImmutableFields<Storage>) { ADD_FAILURE(); }),
+               current::storage::StorageStalenessTimeoutException);
+
+  stream_publisher_owner.publisher->Publish(transactions[0].first, transactions[0].second);
+  EXPECT_TRUE(WasCommitted(follower_storage.ReadOnlyTransactionAtIndex(0u,
+                                                                       std::chrono::seconds(10),
+                                                                       [](ImmutableFields<Storage> fields) {
+                                                                         EXPECT_TRUE(Exists(fields.d["1"]));
+                                                                       }).Go()));
+
+  // Waits until the entry with the requested index or timestamp has been applied, and not longer.
+  std::thread publisher([&stream_publisher_owner, &transactions]() {
+    for (size_t i = 1u; i < transactions.size(); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      stream_publisher_owner.publisher->Publish(transactions[i].first, transactions[i].second);
+    }
+  });
+  EXPECT_TRUE(WasCommitted(follower_storage.ReadOnlyTransactionAtIndex(1u,
+                                                                       std::chrono::seconds(10),
+                                                                       [](ImmutableFields<Storage> fields) {
+                                                                         EXPECT_TRUE(Exists(fields.d["2"]));
+                                                                       }).Go()));
+  EXPECT_TRUE(WasCommitted(follower_storage.ReadOnlyTransactionAtTimestamp(master_position.last_us,
+                                                                           std::chrono::seconds(10),
+                                                                           [](ImmutableFields<Storage> fields) {
+                                                                             EXPECT_TRUE(Exists(fields.d["3"]));
+                                                                           }).Go()));
+  publisher.join();
+  // The master's position after its last write is enough for the follower, with no entries past it published.
+  EXPECT_TRUE(WasCommitted(follower_storage.ReadOnlyTransactionAtIndex(master_position,
+                                                                       std::chrono::microseconds(0),
+                                                                       [](ImmutableFields<Storage> fields) {
+                                                                         EXPECT_TRUE(Exists(fields.d["3"]));
+                                                                       }).Go()));
+  EXPECT_EQ(3u, follower_storage.CurrentStreamPosition().next_index);
+  EXPECT_EQ(master_position.last_us, follower_storage.CurrentStreamPosition().last_us);
+}
+
+TEST(TransactionalStorage, FollowerDecodesBurstsInParallel) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = TestStorage<SherlockStreamPersister>;
+  using transaction_t = typename Storage::transaction_t;
+  using stream_t = typename Storage::persister_t::sherlock_t;
+
+  const std::string master_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "burst_master");
+  const auto master_file_remover = current::FileSystem::ScopedRmFile(master_file_name);
+  const std::string follower_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "burst_follower");
+  const auto follower_file_remover = current::FileSystem::ScopedRmFile(follower_file_name);
+
+  std::vector<std::pair<transaction_t, std::chrono::microseconds>> transactions;
+  {
+    Storage master_storage(master_file_name);
+    for (int i = 0; i < 2000; ++i) {
+      current::time::SetNow(std::chrono::microseconds(100 + i));
+      master_storage.ReadWriteTransaction([i](MutableFields<Storage> fields) {
+        fields.d.Add(Record{current::ToString(i % 10), i});
+        if (i % 7 == 0) {
+          fields.d.Erase(current::ToString((i + 5) % 10));
+        }
+      }).Go();
+    }
+    for (const auto& e : master_storage.InternalExposeStream().Persister().Iterate()) {
+      transactions.emplace_back(e.entry, e.idx_ts.us);
+    }
+  }
+  ASSERT_EQ(2000u, transactions.size());
+
+  stream_t follower_stream(follower_file_name);
+  struct StreamPublisherOwner {
+    std::unique_ptr<stream_t::publisher_t> publisher;
+    void AcceptPublisher(std::unique_ptr<stream_t::publisher_t> value) { publisher = std::move(value); }
+  } stream_publisher_owner;
+  follower_stream.MovePublisherTo(stream_publisher_owner);
+
+  // The follower catches up with the first entries, and then receives the rest of them in one burst.
+  for (size_t i = 0u; i < 10u; ++i) {
+    stream_publisher_owner.publisher->Publish(transactions[i].first, transactions[i].second);
+  }
+  Storage follower_storage(follower_stream);
+  EXPECT_EQ(10u, follower_storage.CurrentStreamPosition().next_index);
+  for (size_t i = 10u; i < transactions.size(); ++i) {
+    stream_publisher_owner.publisher->Publish(transactions[i].first, transactions[i].second);
+  }
+
+  EXPECT_TRUE(WasCommitted(follower_storage.ReadOnlyTransactionAtIndex(1999u,
+                                                                       std::chrono::seconds(10),
+                                                                       [](ImmutableFields<Storage> fields) {
+                                                                         // The key "0" is erased by the 1995-th one.
+                                                                         EXPECT_EQ(9u, fields.d.Size());
+                                                                         EXPECT_FALSE(Exists(fields.d["0"]));
+                                                                         EXPECT_EQ(1995, Value(fields.d["5"]).rhs);
+                                                                         EXPECT_EQ(1999, Value(fields.d["9"]).rhs);
+                                                                       }).Go()));
+  EXPECT_EQ(2000u, follower_storage.CurrentStreamPosition().next_index);
+}
+
+namespace transactional_storage_test {
+
+CURRENT_STORAGE_INDEXED_FIELD_ENTRY(PersistentDictionary, Employee, PersistentEmployeeDictionary, EmployeeByBadge);
+CURRENT_STORAGE(PersistentStorage) { CURRENT_STORAGE_FIELD(employee, PersistentEmployeeDictionary); };
+
+}  // namespace transactional_storage_test
+
+TEST(TransactionalStorage, PersistentDictionary) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using Storage = PersistentStorage<SherlockStreamPersister>;
+  using snapshot_t = current::storage::container::Persistent<std::string, Employee>;
+
+  const std::string persistence_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "data");
+  const auto persistence_file_remover = current::FileSystem::ScopedRmFile(persistence_file_name);
+
+  const int n = 10000;
+  {
+    Storage storage(persistence_file_name);
+    {
+      std::string s;
+      storage(::current::storage::FieldNameAndTypeByIndex<0>(), CurrentStorageTestMagicTypesExtractor(s));
+      EXPECT_EQ("employee, PersistentDictionary, Employee", s);
+    }
+
+    current::time::SetNow(std::chrono::microseconds(100));
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([n](MutableFields<Storage> fields) {
+      for (int i = 0; i < n; ++i) {
+        fields.employee.Add(Employee(current::ToString(i), "eng", i));
+      }
+      fields.employee.Add(Employee("42", "ops", -42));
+      fields.employee.Erase("0");
+    }).Go()));
+
+    // The snapshot is taken in a transaction, and stays intact as the storage is modified further.
+    const snapshot_t snapshot = Value(storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      return fields.employee.Snapshot();
+    }).Go());
+
+    current::time::SetNow(std::chrono::microseconds(200));
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([n](MutableFields<Storage> fields) {
+      for (int i = 0; i < n; i += 2) {
+        fields.employee.Erase(current::ToString(i));
+      }
+      fields.employee.Add(Employee("3", "sales", 3));
+    }).Go()));
+
+    current::time::SetNow(std::chrono::microseconds(300));
+    {
+      const auto result = storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+        fields.employee.Erase("3");
+        fields.employee.Add(Employee("5", "ops", 5));
+        fields.employee.Add(Employee("42", "ops", 42));
+        CURRENT_STORAGE_THROW_ROLLBACK();
+      }).Go();
+      EXPECT_FALSE(WasCommitted(result));
+    }
+
+    // The snapshot is read on another thread, while the storage keeps being modified.
+    int64_t snapshot_sum = 0;
+    size_t snapshot_size = 0u;
+    std::thread reader([&snapshot, &snapshot_sum, &snapshot_size]() {
+      for (const auto& element : snapshot) {
+        snapshot_sum += element.second.badge;
+        ++snapshot_size;
+      }
+    });
+    current::time::SetNow(std::chrono::microseconds(400));
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([n](MutableFields<Storage> fields) {
+      for (int i = 1; i < n; i += 4) {
+        fields.employee.Add(Employee(current::ToString(i), "ops", n + i));
+      }
+    }).Go()));
+    reader.join();
+    EXPECT_EQ(static_cast<size_t>(n - 1), snapshot_size);
+    EXPECT_EQ(static_cast<int64_t>(n) * (n - 1) / 2 - 42 - 42, snapshot_sum);
+    ASSERT_TRUE(snapshot.find("42") != snapshot.end());
+    EXPECT_EQ("ops", snapshot.find("42")->second.team);
+    EXPECT_TRUE(snapshot.find("0") == snapshot.end());
+
+    current::time::SetNow(std::chrono::microseconds(500));
+    EXPECT_TRUE(WasCommitted(storage.ReadOnlyTransaction([n](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(static_cast<size_t>(n / 2), fields.employee.Size());
+      EXPECT_FALSE(Exists(fields.employee["42"]));
+      ASSERT_TRUE(Exists(fields.employee["3"]));
+      EXPECT_EQ("sales", Value(fields.employee["3"]).team);
+      EXPECT_EQ("eng", Value(fields.employee["7"]).team);
+      EXPECT_EQ("ops", Value(fields.employee["5"]).team);
+      const auto& by_badge = fields.employee.Index<EmployeeByBadge>();
+      EXPECT_EQ(static_cast<size_t>(n / 2), by_badge.Size());
+      ASSERT_TRUE(Exists(by_badge[n + 5]));
+      EXPECT_EQ("5", Value(by_badge[n + 5]).key);
+      EXPECT_FALSE(Exists(by_badge[5]));
+      ASSERT_TRUE(Exists(by_badge[3]));
+      EXPECT_EQ("3", Value(by_badge[3]).key);
+      EXPECT_FALSE(Exists(by_badge[-42]));
+      int64_t sum = 0;
+      for (const auto& employee : fields.employee) {
+        sum += employee.badge;
+      }
+      EXPECT_EQ(static_cast<int64_t>(n / 2) * (n / 2) + static_cast<int64_t>(n) * (n / 4), sum);
+    }).Go()));
+
+    current::time::SetNow(std::chrono::microseconds(600));
+    EXPECT_TRUE(WasCommitted(storage.ReadWriteTransaction([n](MutableFields<Storage> fields) {
+      for (int i = 0; i < n; ++i) {
+        fields.employee.Erase(current::ToString(i));
+      }
+      fields.employee.Add(Employee("last", "eng", 0));
+    }).Go()));
+  }
+
+  {
+    Storage replayed(persistence_file_name);
+    EXPECT_TRUE(WasCommitted(replayed.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(1u, fields.employee.Size());
+      ASSERT_TRUE(Exists(fields.employee["last"]));
+      ASSERT_TRUE(Exists(fields.employee.Index<EmployeeByBadge>()[0]));
+      EXPECT_EQ("last", Value(fields.employee.Index<EmployeeByBadge>()[0]).key);
+      size_t count = 0u;
+      for (const auto& employee : fields.employee) {
+        EXPECT_EQ("last", employee.key);
+        ++count;
+      }
+      EXPECT_EQ(1u, count);
+    }).Go()));
+  }
+}
+
+TEST(TransactionalStorage, BinaryTransactionEncoding) {
+  current::time::ResetToZero();
+
+  using namespace transactional_storage_test;
+  using JSONStorage = TestStorage<SherlockStreamPersister>;
+  using Storage = TestStorage<SherlockBinaryStreamPersister>;
+  using stream_t = typename Storage::persister_t::sherlock_t;
+
+  static_assert(std::is_same<typename stream_t::entry_t, current::storage::BinaryTransaction>::value, "");
+
+  const std::string json_storage_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "storage_data_json");
+  const auto json_storage_file_remover = current::FileSystem::ScopedRmFile(json_storage_file_name);
+  const std::string storage_file_name =
+      current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "storage_data_binary");
+  const auto storage_file_remover = current::FileSystem::ScopedRmFile(storage_file_name);
+
+  // The same transactions, persisted both ways.
+  {
+    JSONStorage json_storage(json_storage_file_name);
+    Storage master_storage(storage_file_name);
+    for (int i = 0; i < 1500; ++i) {
+      current::time::SetNow(std::chrono::microseconds(100 + i));
+      const auto f = [i](MutableFields<Storage> fields) {
+        fields.d.Add(Record{current::ToString(i % 1000), i});
+        if (i % 10 == 9) {
+          fields.d.Erase(current::ToString((i - 1) % 1000));
+        }
+      };
+      json_storage.ReadWriteTransaction(f).Go();
+      master_storage.ReadWriteTransaction(f).Go();
+    }
+  }
+
+  // Each transaction is a single `{"data":"..."}` line, with no field or type names in it.
+  {
+    const std::string contents = current::FileSystem::ReadFileAsString(storage_file_name);
+    EXPECT_EQ(std::string::npos, contents.find("RecordDictionary"));
+    EXPECT_NE(std::string::npos, contents.find("\t{\"data\":\""));
+    EXPECT_LT(contents.length() * 2u,
+              current::FileSystem::ReadFileAsString(json_storage_file_name).length());
+  }
+
+  const auto check = [](const Storage& storage) {
+    const auto result = storage.ReadOnlyTransaction([](ImmutableFields<Storage> fields) {
+      EXPECT_EQ(900u, fields.d.Size());
+      ASSERT_TRUE(Exists(fields.d["0"]));
+      EXPECT_EQ(1000, Value(fields.d["0"]).rhs);
+      EXPECT_FALSE(Exists(fields.d["8"]));
+      EXPECT_FALSE(Exists(fields.d["508"]));
+      ASSERT_TRUE(Exists(fields.d["9"]));
+      EXPECT_EQ(1009, Value(fields.d["9"]).rhs);
+      ASSERT_TRUE(Exists(fields.d["999"]));
+      EXPECT_EQ(999, Value(fields.d["999"]).rhs);
+    }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  };
+
+  // The master storage replays its own log.
+  {
+    Storage storage(storage_file_name);
+    EXPECT_EQ(1650u, storage.TransactionsCount());
+    check(storage);
+
+    // The raw log is served decoded, as JSON.
+    storage.ExposeRawLogViaHTTP(FLAGS_transactional_storage_test_port, "/raw_log");
+    const std::string base_url = Printf("http://localhost:%d/raw_log", FLAGS_transactional_storage_test_port);
+    {
+      const auto result = HTTP(GET(base_url + "?sizeonly"));
+      EXPECT_EQ(200, static_cast<int>(result.code));
+      EXPECT_EQ("1500\n", result.body);
+    }
+    {
+      const auto result = HTTP(GET(base_url + "?i=9&n=1"));
+      EXPECT_EQ(200, static_cast<int>(result.code));
+      EXPECT_EQ(
+          "{\"index\":9,\"us\":109}\t{\"meta\":{\"begin_us\":109,\"end_us\":109,\"fields\":{}},\"mutations\":[{"
+          "\"RecordDictionaryUpdated\":{\"us\":109,\"data\":{\"lhs\":\"9\",\"rhs\":9}},"
+          "\"\":\"T9200018162904582576\"},{"
+          "\"RecordDictionaryDeleted\":{\"us\":109,\"key\":\"8\"},"
+          "\"\":\"T9200749443989249031\"}]}\n",
+          result.body);
+    }
+    {
+      const auto result = HTTP(GET(base_url + "?i=1498&entries_only"));
+      EXPECT_EQ(200, static_cast<int>(result.code));
+      EXPECT_EQ(
+          "{\"meta\":{\"begin_us\":1598,\"end_us\":1598,\"fields\":{}},\"mutations\":[{"
+          "\"RecordDictionaryUpdated\":{\"us\":1598,\"data\":{\"lhs\":\"498\",\"rhs\":1498}},"
+          "\"\":\"T9200018162904582576\"}]}\n"
+          "{\"meta\":{\"begin_us\":1599,\"end_us\":1599,\"fields\":{}},\"mutations\":[{"
+          "\"RecordDictionaryUpdated\":{\"us\":1599,\"data\":{\"lhs\":\"499\",\"rhs\":1499}},"
+          "\"\":\"T9200018162904582576\"},{"
+          "\"RecordDictionaryDeleted\":{\"us\":1599,\"key\":\"498\"},"
+          "\"\":\"T9200749443989249031\"}]}\n",
+          result.body);
+    }
+  }
+
+  // The binary-encoded stream is replicated as is, and the following storage decodes it.
+  {
+    using StreamReplicator = current::sherlock::StreamReplicator<stream_t>;
+
+    const std::string follower_file_name =
+        current::FileSystem::JoinPath(FLAGS_transactional_storage_test_tmpdir, "storage_data_binary_follower");
+    const auto follower_file_remover = current::FileSystem::ScopedRmFile(follower_file_name);
+
+    stream_t follower_stream(follower_file_name);
+    auto replicator = std::make_unique<StreamReplicator>(follower_stream);
+
+    Storage master_storage(storage_file_name);
+    Storage follower_storage(follower_stream);
+
+    const auto replicator_scope =
+        master_storage.InternalExposeStream().template Subscribe<current::storage::BinaryTransaction>(*replicator);
+
+    current::time::SetNow(std::chrono::microseconds(2000));
+    EXPECT_TRUE(WasCommitted(master_storage.ReadWriteTransaction([](MutableFields<Storage> fields) {
+      fields.d.Erase("0");
+    }).Go()));
+
+    const auto result = follower_storage.ReadOnlyTransactionAtIndex(
+        1500u, std::chrono::seconds(10), [](ImmutableFields<Storage> fields) {
+          EXPECT_EQ(899u, fields.d.Size());
+          EXPECT_FALSE(Exists(fields.d["0"]));
+          ASSERT_TRUE(Exists(fields.d["999"]));
+          EXPECT_EQ(999, Value(fields.d["999"]).rhs);
+        }).Go();
+    EXPECT_TRUE(WasCommitted(result));
+  }
+}
+
 #endif  // STORAGE_ONLY_RUN_RESTFUL_TESTS
@@ -60,7 +60,9 @@ class Synchronous final {
   template <typename F, class = std::enable_if_t<!std::is_void<f_result_t<F>>::value>>
   Future<TransactionResult<f_result_t<F>>, StrictFuture::Strict> Transaction(F&& f) {
     using result_t = f_result_t<F>;
+    TransactionPhaseTimer timer(instrumentation_);
     std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+    timer.LockAcquired();
     journal_.AssertEmpty();
     std::promise<TransactionResult<result_t>> promise;
     if (destructing_) {
@@ -71,6 +73,7 @@ class Synchronous final {
       try {
         journal_.BeforeTransaction();
         f_result = f();
+        timer.BodyDone();
         journal_.AfterTransaction();
         successful = true;
       } catch (StorageRollbackExceptionWithValue<result_t> e) {
@@ -92,6 +95,7 @@ class Synchronous final {
       }
       if (successful) {
         PersistJournal();
+        timer.Persisted();
         promise.set_value(TransactionResult<result_t>::Committed(std::move(f_result)));
       }
     }
@@ -102,7 +106,9 @@ class Synchronous final {
   template <typename F, class = std::enable_if_t<!std::is_void<f_result_t<F>>::value>>
   Future<TransactionResult<f_result_t<F>>, StrictFuture::Strict> Transaction(F&& f) const {
     using result_t = f_result_t<F>;
+    TransactionPhaseTimer timer(instrumentation_);
     std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+    timer.LockAcquired();
     journal_.AssertEmpty();
     std::promise<TransactionResult<result_t>> promise;
     if (destructing_) {
@@ -112,6 +118,7 @@ class Synchronous final {
       result_t f_result;
       try {
         f_result = f();
+        timer.BodyDone();
         successful = true;
       } catch (StorageRollbackExceptionWithValue<result_t> e) {
         promise.set_value(TransactionResult<result_t>::RolledBack(std::move(e.value)));
@@ -137,7 +144,9 @@ class Synchronous final {
   // Read-write transaction returning void type.
   template <typename F, class = std::enable_if_t<std::is_void<f_result_t<F>>::value>>
   Future<TransactionResult<void>, StrictFuture::Strict> Transaction(F&& f) {
+    TransactionPhaseTimer timer(instrumentation_);
     std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+    timer.LockAcquired();
     journal_.AssertEmpty();
     std::promise<TransactionResult<void>> promise;
     if (destructing_) {
@@ -149,6 +158,7 @@ class Synchronous final {
       try {
         journal_.BeforeTransaction();
         f();
+        timer.BodyDone();
         journal_.AfterTransaction();
         successful = true;
       } catch (StorageRollbackExceptionWithNoValue) {
@@ -167,6 +177,7 @@ class Synchronous final {
       }
       if (successful) {
         PersistJournal();
+        timer.Persisted();
         promise.set_value(TransactionResult<void>::Committed(OptionalResultExists()));
       }
     }
@@ -176,7 +187,9 @@ class Synchronous final {
   // Read-only transaction returning void type.
   template <typename F, class = std::enable_if_t<std::is_void<f_result_t<F>>::value>>
   Future<TransactionResult<void>, StrictFuture::Strict> Transaction(F&& f) const {
+    TransactionPhaseTimer timer(instrumentation_);
     std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+    timer.LockAcquired();
     journal_.AssertEmpty();
     std::promise<TransactionResult<void>> promise;
     if (destructing_) {
@@ -185,6 +198,7 @@ class Synchronous final {
       bool successful = false;
       try {
         f();
+        timer.BodyDone();
         successful = true;
       } catch (StorageRollbackExceptionWithNoValue) {
         promise.set_value(TransactionResult<void>::RolledBack(OptionalResultExists()));
@@ -210,7 +224,9 @@ class Synchronous final {
   template <typename F1, typename F2, class = std::enable_if_t<!std::is_void<f_result_t<F1>>::value>>
   Future<TransactionResult<void>, StrictFuture::Strict> Transaction(F1&& f1, F2&& f2) {
     using result_t = f_result_t<F1>;
+    TransactionPhaseTimer timer(instrumentation_);
     std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+    timer.LockAcquired();
     journal_.AssertEmpty();
     std::promise<TransactionResult<void>> promise;
     if (destructing_) {
@@ -220,8 +236,10 @@ class Synchronous final {
       try {
         journal_.BeforeTransaction();
         f1_result = f1();
+        timer.BodyDone();
         journal_.AfterTransaction();
         PersistJournal();
+        timer.Persisted();
         f2(std::move(f1_result));
         promise.set_value(TransactionResult<void>::Committed(OptionalResultExists()));
       } catch (StorageRollbackExceptionWithValue<result_t> e) {
@@ -252,14 +270,18 @@ class Synchronous final {
   template <typename F1, typename F2, class = std::enable_if_t<!std::is_void<f_result_t<F1>>::value>>
   Future<TransactionResult<void>, StrictFuture::Strict> Transaction(F1&& f1, F2&& f2) const {
     using result_t = f_result_t<F1>;
+    TransactionPhaseTimer timer(instrumentation_);
     std::lock_guard<std::mutex> lock(storage_mutex_ref_);
+    timer.LockAcquired();
     journal_.AssertEmpty();
     std::promise<TransactionResult<void>> promise;
     if (destructing_) {
       promise.set_exception(std::make_exception_ptr(StorageInGracefulShutdownException()));  // LCOV_EXCL_LINE
     } else {
       try {
-        f2(f1());
+        result_t f1_result = f1();
+        timer.BodyDone();
+        f2(std::move(f1_result));
         promise.set_value(TransactionResult<void>::Committed(OptionalResultExists()));
       } catch (StorageRollbackExceptionWithValue<result_t> e) {
         // Transaction was rolled back, but returned a value, which we try to pass again to `f2`.
@@ -287,6 +309,9 @@ class Synchronous final {
     destructing_ = true;
   }
 
+  // Only to be read or reset under the storage mutex, except for the `enabled` flag, see `instrumentation.h`.
+  TransactionInstrumentation& Instrumentation() const { return instrumentation_; }
+
  private:
   void PersistJournal() {
     try {
@@ -309,6 +334,7 @@ class Synchronous final {
   MutationJournal& journal_;
   std::mutex mutex_;
   bool destructing_ = false;
+  mutable TransactionInstrumentation instrumentation_;
 };
 
 }  // namespace transaction_policy
@@ -22,9 +22,524 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 *******************************************************************************/
 
+// Binary format, `SaveIntoBinary(ostream, object)` and `LoadFromBinary<T>(istream)`.
+//
+// * The numbers are stored as is, in the native byte order, `bool` is one byte, and enums are their underlying type.
+// * `std::chrono::{milli/micro}seconds` are their `int64_t` counts.
+// * The sizes of strings and containers are varints, seven bits per byte, lowest bits first.
+// * `CURRENT_STRUCT`-s are their fields in order of declaration, the fields of the base struct first.
+// * `Optional<T>` is a one-byte flag followed by the value, if present.
+// * `Variant<...>` is the varint of the 1-based index of its case in its type list, zero if the variant is empty,
+//   followed by the case itself.
+//
+// Unlike JSON, the format carries no field names nor type IDs, so the reader must use the very same types, in the
+// very same order, as the writer did. It is meant for the data read back by the same binary, such as the journals.
+
 #ifndef CURRENT_TYPE_SYSTEM_SERIALIZATION_BINARY_H
 #define CURRENT_TYPE_SYSTEM_SERIALIZATION_BINARY_H
 
-// TBD.
+#include <algorithm>
+#include <chrono>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "serialization.h"
+
+#include "../struct.h"
+#include "../optional.h"
+#include "../variant.h"
+#include "../Reflection/reflection.h"
+
+#include "../../Bricks/strings/printf.h"
+
+namespace current {
+namespace serialization {
+
+namespace binary {
+
+struct BinarySerializationException : Exception {
+  using Exception::Exception;
+};
+
+struct BinaryLoadFromStreamException : BinarySerializationException {
+  BinaryLoadFromStreamException(size_t requested, size_t read)
+      : BinarySerializationException(strings::Printf(
+            "Failed to read %lld bytes, got %lld.", static_cast<long long>(requested), static_cast<long long>(read))) {}
+};
+
+struct BinaryVariantCaseException : BinarySerializationException {
+  BinaryVariantCaseException(uint64_t index, size_t cases)
+      : BinarySerializationException(strings::Printf(
+            "Variant case %lld out of %lld.", static_cast<long long>(index), static_cast<long long>(cases))) {}
+};
+
+class BinarySerializer final {
+ public:
+  explicit BinarySerializer(std::ostream& os) : os_(os) {}
+
+  void Write(const void* data, size_t size) { os_.write(reinterpret_cast<const char*>(data), size); }
+
+  void WriteSize(uint64_t size) {
+    char buffer[10];
+    size_t length = 0u;
+    while (size >= 0x80u) {
+      buffer[length++] = static_cast<char>((size & 0x7Fu) | 0x80u);
+      size >>= 7u;
+    }
+    buffer[length++] = static_cast<char>(size);
+    os_.write(buffer, length);
+  }
+
+ private:
+  std::ostream& os_;
+};
+
+class BinaryDeserializer final {
+ public:
+  // The sizes read from the stream are not trusted to allocate more than this many bytes ahead of the data.
+  enum : size_t { kMaxPreallocatedBytes = 64 * 1024 };
+
+  explicit BinaryDeserializer(std::istream& is) : is_(is) {}
+
+  void Read(void* data, size_t size) {
+    is_.read(reinterpret_cast<char*>(data), size);
+    const size_t read = static_cast<size_t>(is_.gcount());
+    if (read != size) {
+      CURRENT_THROW(BinaryLoadFromStreamException(size, read));
+    }
+  }
+
+  uint64_t ReadSize() {
+    uint64_t size = 0u;
+    for (size_t shift = 0u; shift < 64u; shift += 7u) {
+      uint8_t byte;
+      Read(&byte, 1u);
+      size |= static_cast<uint64_t>(byte & 0x7Fu) << shift;
+      if (!(byte & 0x80u)) {
+        return size;
+      }
+    }
+    CURRENT_THROW(BinarySerializationException("Malformed size."));
+  }
+
+ private:
+  std::istream& is_;
+};
+
+// The 0-based index of the first occurrence of `T` in `TYPELIST`.
+template <typename TYPELIST, typename T>
+struct TypeListIndex;
+
+template <typename T, typename... TS>
+struct TypeListIndex<TypeListImpl<T, TS...>, T> {
+  constexpr static size_t value = 0u;
+};
+
+template <typename X, typename... TS, typename T>
+struct TypeListIndex<TypeListImpl<X, TS...>, T> {
+  constexpr static size_t value = 1u + TypeListIndex<TypeListImpl<TS...>, T>::value;
+};
+
+template <typename VARIANT>
+struct BinaryVariantCaseSerializer {
+  BinarySerializer& serializer;
+
+  template <typename X>
+  void operator()(const X& object) {
+    serializer.WriteSize(TypeListIndex<typename VARIANT::typelist_t, X>::value + 1u);
+    Serialize(serializer, object);
+  }
+};
+
+template <typename VARIANT, typename X>
+void LoadBinaryVariantCase(BinaryDeserializer& deserializer, VARIANT& destination) {
+  auto result = std::make_unique<X>();
+  Deserialize(deserializer, *result);
+  destination.UncheckedMoveFromUniquePtr(std::move(result));
+}
+
+template <typename VARIANT, typename TYPELIST>
+struct BinaryVariantCaseLoader;
+
+template <typename VARIANT, typename... TS>
+struct BinaryVariantCaseLoader<VARIANT, TypeListImpl<TS...>> {
+  // The case is looked up in the table, not by trying the cases one by one.
+  static void Load(BinaryDeserializer& deserializer, VARIANT& destination, uint64_t index) {
+    using loader_t = void (*)(BinaryDeserializer&, VARIANT&);
+    static const loader_t loaders[] = {&LoadBinaryVariantCase<VARIANT, TS>...};
+    if (index >= sizeof...(TS)) {
+      CURRENT_THROW(BinaryVariantCaseException(index, sizeof...(TS)));
+    }
+    loaders[index](deserializer, destination);
+  }
+};
+
+struct BinaryStructFieldsSerializer {
+  BinarySerializer& serializer;
+
+  template <typename U>
+  void operator()(const char*, const U& value) const {
+    Serialize(serializer, value);
+  }
+};
+
+struct BinaryStructFieldsDeserializer {
+  BinaryDeserializer& deserializer;
+
+  template <typename U>
+  void operator()(const char*, U& value) const {
+    Deserialize(deserializer, value);
+  }
+};
+
+}  // namespace current::serialization::binary
+
+// Numbers, other than `bool`.
+template <typename T>
+struct SerializeImpl<binary::BinarySerializer,
+                     T,
+                     std::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, T value) { serializer.Write(&value, sizeof(T)); }
+};
+
+template <typename T>
+struct DeserializeImpl<binary::BinaryDeserializer,
+                       T,
+                       std::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, T& destination) {
+    deserializer.Read(&destination, sizeof(T));
+  }
+};
+
+// `bool`.
+template <>
+struct SerializeImpl<binary::BinarySerializer, bool> {
+  static void DoSerialize(binary::BinarySerializer& serializer, bool value) {
+    const uint8_t byte = value ? 1u : 0u;
+    serializer.Write(&byte, 1u);
+  }
+};
+
+template <>
+struct DeserializeImpl<binary::BinaryDeserializer, bool> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, bool& destination) {
+    uint8_t byte;
+    deserializer.Read(&byte, 1u);
+    destination = (byte != 0u);
+  }
+};
+
+// Enums.
+template <typename T>
+struct SerializeImpl<binary::BinarySerializer, T, std::enable_if_t<std::is_enum<T>::value>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, T value) {
+    Serialize(serializer, static_cast<typename std::underlying_type<T>::type>(value));
+  }
+};
+
+template <typename T>
+struct DeserializeImpl<binary::BinaryDeserializer, T, std::enable_if_t<std::is_enum<T>::value>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, T& destination) {
+    typename std::underlying_type<T>::type value;
+    Deserialize(deserializer, value);
+    destination = static_cast<T>(value);
+  }
+};
+
+// `std::string`.
+template <>
+struct SerializeImpl<binary::BinarySerializer, std::string> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::string& value) {
+    serializer.WriteSize(value.length());
+    serializer.Write(value.data(), value.length());
+  }
+};
+
+template <>
+struct DeserializeImpl<binary::BinaryDeserializer, std::string> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, std::string& destination) {
+    // Grows the string as the bytes are read, so that a corrupted length fails the read instead of the allocation.
+    uint64_t remaining = deserializer.ReadSize();
+    destination.clear();
+    while (remaining) {
+      const size_t offset = destination.length();
+      const size_t step =
+          static_cast<size_t>(std::min<uint64_t>(remaining, binary::BinaryDeserializer::kMaxPreallocatedBytes));
+      destination.resize(offset + step);
+      deserializer.Read(&destination[offset], step);
+      remaining -= step;
+    }
+  }
+};
+
+// `std::chrono::milliseconds` and `std::chrono::microseconds`.
+template <typename PERIOD>
+struct SerializeImpl<binary::BinarySerializer, std::chrono::duration<int64_t, PERIOD>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, std::chrono::duration<int64_t, PERIOD> value) {
+    Serialize(serializer, static_cast<int64_t>(value.count()));
+  }
+};
+
+template <typename PERIOD>
+struct DeserializeImpl<binary::BinaryDeserializer, std::chrono::duration<int64_t, PERIOD>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer,
+                            std::chrono::duration<int64_t, PERIOD>& destination) {
+    int64_t count;
+    Deserialize(deserializer, count);
+    destination = std::chrono::duration<int64_t, PERIOD>(count);
+  }
+};
+
+// `std::pair<>`.
+template <typename FIRST, typename SECOND>
+struct SerializeImpl<binary::BinarySerializer, std::pair<FIRST, SECOND>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::pair<FIRST, SECOND>& value) {
+    Serialize(serializer, value.first);
+    Serialize(serializer, value.second);
+  }
+};
+
+template <typename FIRST, typename SECOND>
+struct DeserializeImpl<binary::BinaryDeserializer, std::pair<FIRST, SECOND>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, std::pair<FIRST, SECOND>& destination) {
+    Deserialize(deserializer, destination.first);
+    Deserialize(deserializer, destination.second);
+  }
+};
+
+namespace binary {
+
+template <typename CONTAINER>
+void SerializeContainer(BinarySerializer& serializer, const CONTAINER& container) {
+  serializer.WriteSize(container.size());
+  for (const auto& element : container) {
+    Serialize(serializer, element);
+  }
+}
+
+// For the maps the elements are `{ key, value }` pairs, with the key not being `const` in `ELEMENT`.
+template <typename ELEMENT, typename CONTAINER>
+void DeserializeIntoContainer(BinaryDeserializer& deserializer, CONTAINER& destination) {
+  destination.clear();
+  for (uint64_t size = deserializer.ReadSize(); size; --size) {
+    ELEMENT element;
+    Deserialize(deserializer, element);
+    destination.insert(std::move(element));
+  }
+}
+
+}  // namespace current::serialization::binary
+
+// `std::vector<>`.
+template <typename T, typename A>
+struct SerializeImpl<binary::BinarySerializer, std::vector<T, A>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::vector<T, A>& value) {
+    binary::SerializeContainer(serializer, value);
+  }
+};
+
+template <typename T, typename A>
+struct DeserializeImpl<binary::BinaryDeserializer, std::vector<T, A>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, std::vector<T, A>& destination) {
+    const uint64_t size = deserializer.ReadSize();
+    destination.clear();
+    destination.reserve(static_cast<size_t>(
+        std::min<uint64_t>(size, binary::BinaryDeserializer::kMaxPreallocatedBytes / sizeof(T) + 1u)));
+    for (uint64_t i = 0u; i < size; ++i) {
+      destination.emplace_back();
+      Deserialize(deserializer, destination.back());
+    }
+  }
+};
+
+// `std::map<>` and `std::unordered_map<>`.
+template <typename K, typename V, typename C, typename A>
+struct SerializeImpl<binary::BinarySerializer, std::map<K, V, C, A>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::map<K, V, C, A>& value) {
+    binary::SerializeContainer(serializer, value);
+  }
+};
+
+template <typename K, typename V, typename C, typename A>
+struct DeserializeImpl<binary::BinaryDeserializer, std::map<K, V, C, A>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, std::map<K, V, C, A>& destination) {
+    binary::DeserializeIntoContainer<std::pair<K, V>>(deserializer, destination);
+  }
+};
+
+template <typename K, typename V, typename H, typename E, typename A>
+struct SerializeImpl<binary::BinarySerializer, std::unordered_map<K, V, H, E, A>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::unordered_map<K, V, H, E, A>& value) {
+    binary::SerializeContainer(serializer, value);
+  }
+};
+
+template <typename K, typename V, typename H, typename E, typename A>
+struct DeserializeImpl<binary::BinaryDeserializer, std::unordered_map<K, V, H, E, A>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer,
+                            std::unordered_map<K, V, H, E, A>& destination) {
+    binary::DeserializeIntoContainer<std::pair<K, V>>(deserializer, destination);
+  }
+};
+
+// `std::set<>` and `std::unordered_set<>`.
+template <typename T, typename C, typename A>
+struct SerializeImpl<binary::BinarySerializer, std::set<T, C, A>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::set<T, C, A>& value) {
+    binary::SerializeContainer(serializer, value);
+  }
+};
+
+template <typename T, typename C, typename A>
+struct DeserializeImpl<binary::BinaryDeserializer, std::set<T, C, A>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, std::set<T, C, A>& destination) {
+    binary::DeserializeIntoContainer<T>(deserializer, destination);
+  }
+};
+
+template <typename T, typename H, typename E, typename A>
+struct SerializeImpl<binary::BinarySerializer, std::unordered_set<T, H, E, A>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const std::unordered_set<T, H, E, A>& value) {
+    binary::SerializeContainer(serializer, value);
+  }
+};
+
+template <typename T, typename H, typename E, typename A>
+struct DeserializeImpl<binary::BinaryDeserializer, std::unordered_set<T, H, E, A>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, std::unordered_set<T, H, E, A>& destination) {
+    binary::DeserializeIntoContainer<T>(deserializer, destination);
+  }
+};
+
+// `Optional<>`.
+template <typename T>
+struct SerializeImpl<binary::BinarySerializer, Optional<T>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const Optional<T>& value) {
+    Serialize(serializer, Exists(value));
+    if (Exists(value)) {
+      Serialize(serializer, Value(value));
+    }
+  }
+};
+
+template <typename T>
+struct DeserializeImpl<binary::BinaryDeserializer, Optional<T>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, Optional<T>& destination) {
+    bool exists;
+    Deserialize(deserializer, exists);
+    if (exists) {
+      destination = T();
+      Deserialize(deserializer, Value(destination));
+    } else {
+      destination = nullptr;
+    }
+  }
+};
+
+// `CURRENT_STRUCT`-s.
+template <typename T>
+struct SerializeImpl<binary::BinarySerializer,
+                     T,
+                     std::enable_if_t<IS_CURRENT_STRUCT(T) && !std::is_same<T, CurrentStruct>::value>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const T& value) {
+    using super_t = current::reflection::SuperType<T>;
+    if (!std::is_same<super_t, CurrentStruct>::value) {
+      Serialize(serializer, static_cast<const super_t&>(value));
+    }
+    current::reflection::VisitAllFields<T, current::reflection::FieldNameAndImmutableValue>::WithObject(
+        value, binary::BinaryStructFieldsSerializer{serializer});
+  }
+};
+
+template <>
+struct SerializeImpl<binary::BinarySerializer, CurrentStruct> {
+  static void DoSerialize(binary::BinarySerializer&, const CurrentStruct&) {}
+};
+
+template <typename T>
+struct DeserializeImpl<binary::BinaryDeserializer,
+                       T,
+                       std::enable_if_t<IS_CURRENT_STRUCT(T) && !std::is_same<T, CurrentStruct>::value>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, T& destination) {
+    using super_t = current::reflection::SuperType<T>;
+    if (!std::is_same<super_t, CurrentStruct>::value) {
+      Deserialize(deserializer, static_cast<super_t&>(destination));
+    }
+    current::reflection::VisitAllFields<T, current::reflection::FieldNameAndMutableValue>::WithObject(
+        destination, binary::BinaryStructFieldsDeserializer{deserializer});
+  }
+};
+
+template <>
+struct DeserializeImpl<binary::BinaryDeserializer, CurrentStruct> {
+  static void DoDeserialize(binary::BinaryDeserializer&, CurrentStruct&) {}
+};
+
+// `Variant<>`-s.
+template <typename T>
+struct SerializeImpl<binary::BinarySerializer, T, std::enable_if_t<IS_CURRENT_VARIANT(T)>> {
+  static void DoSerialize(binary::BinarySerializer& serializer, const T& value) {
+    if (Exists(value)) {
+      value.Call(binary::BinaryVariantCaseSerializer<T>{serializer});
+    } else {
+      serializer.WriteSize(0u);
+    }
+  }
+};
+
+template <typename T>
+struct DeserializeImpl<binary::BinaryDeserializer, T, std::enable_if_t<IS_CURRENT_VARIANT(T)>> {
+  static void DoDeserialize(binary::BinaryDeserializer& deserializer, T& destination) {
+    const uint64_t index = deserializer.ReadSize();
+    if (index) {
+      binary::BinaryVariantCaseLoader<T, typename T::typelist_t>::Load(deserializer, destination, index - 1u);
+    } else {
+      destination = nullptr;
+    }
+  }
+};
+
+namespace binary {
+
+template <typename T>
+inline void SaveIntoBinary(std::ostream& os, const T& source) {
+  BinarySerializer serializer(os);
+  Serialize(serializer, source);
+}
+
+template <typename T>
+inline void LoadFromBinary(std::istream& is, T& destination) {
+  BinaryDeserializer deserializer(is);
+  Deserialize(deserializer, destination);
+}
+
+template <typename T>
+inline T LoadFromBinary(std::istream& is) {
+  T result;
+  LoadFromBinary(is, result);
+  return result;
+}
+
+}  // namespace current::serialization::binary
+}  // namespace current::serialization
+
+using serialization::binary::SaveIntoBinary;
+using serialization::binary::LoadFromBinary;
+using serialization::binary::BinarySerializationException;
+using serialization::binary::BinaryLoadFromStreamException;
+}  // namespace current
+
+using current::SaveIntoBinary;
+using current::LoadFromBinary;
+using current::BinarySerializationException;
+using current::BinaryLoadFromStreamException;
 
 #endif  // CURRENT_TYPE_SYSTEM_SERIALIZATION_BINARY_H
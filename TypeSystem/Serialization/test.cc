@@ -166,8 +166,6 @@ CURRENT_STRUCT(WithInnerVariant) { CURRENT_FIELD(v, InnerVariant); };
 }  // namespace serialization_test::named_variant
 }  // namespace serialization_test
 
-#if 0
-// TODO(dkorolev): DIMA FIXME binary format.
 TEST(Serialization, Binary) {
   using namespace serialization_test;
 
@@ -237,8 +235,15 @@ TEST(Serialization, Binary) {
     std::istringstream is("Invalid");
     ASSERT_THROW(LoadFromBinary<ComplexSerializable>(is), BinaryLoadFromStreamException);
   }
+  {
+    // The corrupted lengths fail the read, not the allocation.
+    const std::string huge_length = "\xff\xff\xff\xff\xff\xff\xff\xff\x0f";
+    std::istringstream string_is(huge_length + "abc");
+    ASSERT_THROW(LoadFromBinary<std::string>(string_is), BinaryLoadFromStreamException);
+    std::istringstream vector_is(huge_length + "abc");
+    ASSERT_THROW(LoadFromBinary<std::vector<std::string>>(vector_is), BinaryLoadFromStreamException);
+  }
 }
-#endif
 
 TEST(JSONSerialization, CPPTypes) {
   // `bool`.
@@ -316,8 +321,6 @@ TEST(JSONSerialization, CPPTypes) {
   }
 }
 
-#if 0
-// TODO(dkorolev): DIMA FIXME binary format.
 TEST(Serialization, OptionalAsBinary) {
   using namespace serialization_test;
 
@@ -360,7 +363,6 @@ TEST(Serialization, OptionalAsBinary) {
     EXPECT_TRUE(Value(parsed_with_b.b));
   }
 }
-#endif
 
 TEST(JSONSerialization, CurrentStructs) {
   using namespace serialization_test;
@@ -829,8 +831,6 @@ TEST(JSONSerialization, Time) {
   }
 }
 
-#if 0
-// TODO(dkorolev): DIMA FIXME binary format.
 TEST(Serialization, TimeAsBinary) {
   using namespace serialization_test;
 
@@ -853,7 +853,55 @@ TEST(Serialization, TimeAsBinary) {
     EXPECT_EQ(6ll, parsed.micros.count());
   }
 }
-#endif
+
+TEST(Serialization, VariantAsBinary) {
+  using namespace serialization_test;
+
+  std::ostringstream oss;
+  {
+    ContainsVariant empty;
+    SaveIntoBinary(oss, empty);
+    // One byte for the empty variant.
+    EXPECT_EQ(1u, oss.str().length());
+
+    ContainsVariant with_struct;
+    with_struct.variant = Serializable(42, "foo", true, Enum::SET);
+    SaveIntoBinary(oss, with_struct);
+
+    ContainsVariant with_empty_struct;
+    with_empty_struct.variant = AlternativeEmpty();
+    SaveIntoBinary(oss, with_empty_struct);
+
+    std::vector<simple_variant_t> vector_of_variants;
+    vector_of_variants.push_back(ComplexSerializable('a', 'c'));
+    vector_of_variants.push_back(Empty());
+    SaveIntoBinary(oss, vector_of_variants);
+  }
+  {
+    std::istringstream iss(oss.str());
+    EXPECT_FALSE(Exists(LoadFromBinary<ContainsVariant>(iss).variant));
+
+    const auto with_struct = LoadFromBinary<ContainsVariant>(iss);
+    ASSERT_TRUE(Exists<Serializable>(with_struct.variant));
+    EXPECT_EQ(42ull, Value<Serializable>(with_struct.variant).i);
+    EXPECT_EQ("foo", Value<Serializable>(with_struct.variant).s);
+    EXPECT_TRUE(Value<Serializable>(with_struct.variant).b);
+    EXPECT_EQ(Enum::SET, Value<Serializable>(with_struct.variant).e);
+
+    EXPECT_TRUE(Exists<AlternativeEmpty>(LoadFromBinary<ContainsVariant>(iss).variant));
+
+    const auto vector_of_variants = LoadFromBinary<std::vector<simple_variant_t>>(iss);
+    ASSERT_EQ(2u, vector_of_variants.size());
+    ASSERT_TRUE(Exists<ComplexSerializable>(vector_of_variants[0]));
+    EXPECT_EQ("a,b,c", current::strings::Join(Value<ComplexSerializable>(vector_of_variants[0]).v, ','));
+    EXPECT_TRUE(Exists<Empty>(vector_of_variants[1]));
+  }
+  {
+    // The case index past the end of the type list.
+    std::istringstream iss(std::string(1, '\x05'));
+    ASSERT_THROW(LoadFromBinary<ContainsVariant>(iss), current::serialization::binary::BinaryVariantCaseException);
+  }
+}
 
 TEST(JSONSerialization, Optional) {
   using namespace serialization_test;
@@ -0,0 +1,107 @@
+/*******************************************************************************
+The MIT License (MIT)
+
+Copyright (c) 2017 Dmitry "Dima" Korolev <dmitry.korolev@gmail.com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*******************************************************************************/
+
+// The "A+B over HTTP" benchmark with `--concurrency` requests in flight at all times, sent by `AsyncHTTP()` from
+// a single thread instead of from a thread per request as `benchmark.cc` does.
+
+#include "../../../current.h"
+
+#include "server.h"
+
+using namespace current;
+
+DEFINE_double(seconds, 2.5, "Run the load test for this many seconds.");
+DEFINE_int32(port, PickPortForUnitTest(), "The port to run the local server on.");
+DEFINE_int32(concurrency, 1000, "The number of requests to keep in flight.");
+DEFINE_int32(event_loops, 4, "The number of the event loops of the local server, zero for a thread per connection.");
+DEFINE_int32(workers, 4, "The number of the worker threads of the local server, zero for a thread per request.");
+
+class AsyncLoad final {
+ public:
+  AsyncLoad(const std::string& url, double seconds)
+      : url_(url),
+        end_(time::Now() + std::chrono::microseconds(static_cast<int64_t>(seconds * 1e6))),
+        in_flight_(0),
+        queries_(0u),
+        errors_(0u) {}
+
+  // Returns once the last request in flight is done.
+  void Run(int concurrency) {
+    std::future<void> done = all_done_.get_future();
+    in_flight_ = concurrency;
+    for (int i = 0; i < concurrency; ++i) {
+      Next();
+    }
+    done.wait();
+  }
+
+  size_t TotalQueries() const { return queries_; }
+  size_t TotalErrors() const { return errors_; }
+
+ private:
+  void Next() {
+    if (time::Now() >= end_) {
+      if (!--in_flight_) {
+        all_done_.set_value();
+      }
+      return;
+    }
+    const int a = current::random::RandomIntegral(-1000000, +1000000);
+    const int b = current::random::RandomIntegral(-1000000, +1000000);
+    AsyncHTTP(GET(url_ + strings::Printf("?a=%d&b=%d", a, b)),
+              [this, a, b](current::http::HTTPResponseWithBuffer&& r) {
+                CURRENT_ASSERT(r.code == HTTPResponseCode.OK);
+                CURRENT_ASSERT(ParseJSON<AddResult>(r.body).sum == a + b);
+                ++queries_;
+                Next();
+              },
+              [this](std::exception_ptr) {
+                ++errors_;
+                Next();
+              });
+  }
+
+  const std::string url_;
+  const std::chrono::microseconds end_;
+  std::atomic_int in_flight_;
+  std::atomic_size_t queries_;
+  std::atomic_size_t errors_;
+  std::promise<void> all_done_;
+};
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  BenchmarkTestServer server(FLAGS_port, "/add");
+  HTTP(FLAGS_port).ConfigureEventLoops(static_cast<size_t>(FLAGS_event_loops));
+  HTTP(FLAGS_port).ConfigureWorkerPool(static_cast<size_t>(FLAGS_workers));
+
+  AsyncLoad load(strings::Printf("http://localhost:%d/add", FLAGS_port), FLAGS_seconds);
+  load.Run(FLAGS_concurrency);
+
+  std::cout << "QPS: " << std::setw(3) << (load.TotalQueries() / FLAGS_seconds) << std::endl;
+  if (load.TotalErrors()) {
+    std::cout << "Errors: " << load.TotalErrors() << std::endl;
+  }
+}